@@ -0,0 +1,514 @@
+/*
+ *  jit_profile.cpp - Execution profile of JIT translated blocks
+ *
+ *  Basilisk II (C) 1997-2008 Christian Bauer
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+/*
+ *  While profiling is enabled, the JIT compilers emit an increment of a
+ *  64-bit counter at the entry of each translated block. Counters are
+ *  kept per guest address, so they survive retranslation of a block.
+ *  The host code of each translation is listed in /tmp/perf-<pid>.map
+ *  so that "perf report" can show guest names for JIT code, and the
+ *  guest profile can be written in pprof format. Blocks are named after
+ *  the A-Trap they belong to (68k only), or their offset in ROM.
+ */
+
+#include "sysdeps.h"
+#include "cpu_emulation.h"
+#include "prefs.h"
+#include "vm_alloc.h"
+#include "jit_profile.h"
+
+#include <map>
+#include <vector>
+#include <string>
+#include <algorithm>
+
+#ifndef _WIN32
+#include <unistd.h>
+#endif
+
+#if ENABLE_MON
+#include "mon.h"
+#include "mon_atraps.h"
+#endif
+
+#define DEBUG 0
+#include "debug.h"
+
+
+// Number of counters (i.e. distinct guest blocks)
+static const int MAX_COUNTERS = 0x40000;
+
+// Maximum distance of a block from the entry of its A-Trap
+static const uint32 MAX_TRAP_SIZE = 0x2000;
+
+// A-Trap dispatch tables in low memory
+static const uint32 OS_TRAP_TABLE = 0x400;
+static const int OS_TRAP_COUNT = 256;
+static const uint32 TOOLBOX_TRAP_TABLE = 0xe00;
+static const int TOOLBOX_TRAP_COUNT = 1024;
+
+bool jit_profile_enabled = false;
+
+static const char *cpu_name;
+static bool m68k_code;
+static uint32 rom_base, rom_size;
+static void (*flush_cache)(void);
+static const char *profile_path;		// Written on exit if set
+
+struct profile_block {
+	uint64 *counter;
+	uint32 num_insns;
+	uint8 *code;						// Latest translation
+	uint32 code_size;
+};
+
+static std::map<uint32, profile_block> blocks;
+static uint64 *counters = NULL;
+static int num_counters = 0;
+
+static FILE *perf_map = NULL;
+
+struct trap_entry {
+	uint32 addr;
+	uint16 trap;
+	bool operator<(const trap_entry &other) const { return addr < other.addr; }
+};
+
+static std::vector<trap_entry> trap_entries;	// Sorted by address
+static uint32 trap_tables_sum = 0;
+
+#if ENABLE_MON
+static void jit_profile_command(void);
+#endif
+
+
+/*
+ *  Initialization
+ */
+
+void jit_profile_init(const char *name, bool m68k, uint32 rom_start, uint32 rom_length, void (*flush)(void))
+{
+	cpu_name = name;
+	m68k_code = m68k;
+	rom_base = rom_start;
+	rom_size = rom_length;
+	flush_cache = flush;
+
+	counters = (uint64 *)vm_acquire(MAX_COUNTERS * sizeof(uint64), VM_MAP_DEFAULT | VM_MAP_32BIT);
+	if (counters == VM_MAP_FAILED) {
+		printf("WARNING: Cannot allocate JIT profile counters\n");
+		counters = NULL;
+		return;
+	}
+
+#if ENABLE_MON
+	mon_add_command("jitprof", jit_profile_command,
+		"jitprof [on|off|reset]   Show most frequently executed JIT blocks,\n"
+		"                         start, stop or reset counting\n"
+		"jitprof \"file\"           Write JIT block profile in pprof format\n");
+#endif
+
+	profile_path = PrefsFindString("jitprofile");
+	if (profile_path && profile_path[0])
+		jit_profile_start();
+}
+
+
+/*
+ *  Deinitialization
+ */
+
+void jit_profile_exit(void)
+{
+	if (jit_profile_enabled && profile_path && profile_path[0]) {
+		if (jit_profile_write(profile_path))
+			printf("JIT profile written to %s\n", profile_path);
+	}
+	jit_profile_enabled = false;
+	if (perf_map) {
+		fclose(perf_map);
+		perf_map = NULL;
+	}
+	blocks.clear();
+	if (counters) {
+		vm_release(counters, MAX_COUNTERS * sizeof(uint64));
+		counters = NULL;
+	}
+}
+
+
+/*
+ *  Start/stop counting
+ */
+
+void jit_profile_start(void)
+{
+	if (counters == NULL || jit_profile_enabled)
+		return;
+
+#ifndef _WIN32
+	if (perf_map == NULL) {
+		char name[64];
+		sprintf(name, "/tmp/perf-%d.map", (int)getpid());
+		perf_map = fopen(name, "w");
+		if (perf_map == NULL)
+			printf("WARNING: Cannot open %s\n", name);
+	}
+#endif
+
+	D(bug("JIT profile started\n"));
+	jit_profile_enabled = true;
+	flush_cache();
+}
+
+void jit_profile_stop(void)
+{
+	if (!jit_profile_enabled)
+		return;
+
+	D(bug("JIT profile stopped\n"));
+	jit_profile_enabled = false;
+	if (perf_map)
+		fflush(perf_map);
+	flush_cache();
+}
+
+
+/*
+ *  Name guest code
+ */
+
+static bool same_trap_addr(const trap_entry &a, const trap_entry &b)
+{
+	return a.addr == b.addr;
+}
+
+// Rebuild list of A-Trap entry points if the dispatch tables changed
+static void update_trap_entries(void)
+{
+	uint32 sum = 0;
+	for (int i = 0; i < OS_TRAP_COUNT; i++)
+		sum = sum * 31 + ReadMacInt32(OS_TRAP_TABLE + i * 4);
+	for (int i = 0; i < TOOLBOX_TRAP_COUNT; i++)
+		sum = sum * 31 + ReadMacInt32(TOOLBOX_TRAP_TABLE + i * 4);
+	if (sum == trap_tables_sum)
+		return;
+	trap_tables_sum = sum;
+
+	trap_entries.clear();
+	for (int i = 0; i < OS_TRAP_COUNT; i++) {
+		trap_entry e = {ReadMacInt32(OS_TRAP_TABLE + i * 4), (uint16)(0xa000 + i)};
+		if (e.addr)
+			trap_entries.push_back(e);
+	}
+	for (int i = 0; i < TOOLBOX_TRAP_COUNT; i++) {
+		trap_entry e = {ReadMacInt32(TOOLBOX_TRAP_TABLE + i * 4), (uint16)(0xa800 + i)};
+		if (e.addr)
+			trap_entries.push_back(e);
+	}
+
+	// Unimplemented traps share one entry point, keep the first trap
+	std::stable_sort(trap_entries.begin(), trap_entries.end());
+	std::vector<trap_entry>::iterator end = std::unique(trap_entries.begin(), trap_entries.end(), same_trap_addr);
+	trap_entries.erase(end, trap_entries.end());
+}
+
+static std::string trap_name(uint16 trap)
+{
+	char str[16];
+#if ENABLE_MON
+	for (int i = 0; atraps[i].word; i++) {
+		if (atraps[i].word == trap)
+			return std::string("_") + atraps[i].name;
+	}
+#endif
+	sprintf(str, "_A%03X", trap & 0xfff);
+	return str;
+}
+
+// Find symbol for guest address, returns offset of address to the symbol
+static std::string guest_symbol(uint32 pc, uint32 &offset)
+{
+	char str[32];
+
+	if (m68k_code && !trap_entries.empty()) {
+		trap_entry key = {pc, 0};
+		std::vector<trap_entry>::iterator i = std::upper_bound(trap_entries.begin(), trap_entries.end(), key);
+		if (i != trap_entries.begin()) {
+			--i;
+			if (pc - i->addr < MAX_TRAP_SIZE) {
+				offset = pc - i->addr;
+				return trap_name(i->trap);
+			}
+		}
+	}
+
+	offset = 0;
+	if (pc - rom_base < rom_size)
+		sprintf(str, "ROM+0x%x", pc - rom_base);
+	else
+		sprintf(str, "0x%08x", pc);
+	return str;
+}
+
+static std::string guest_name(uint32 pc)
+{
+	uint32 offset;
+	std::string name = guest_symbol(pc, offset);
+	if (offset) {
+		char str[16];
+		sprintf(str, "+0x%x", offset);
+		name += str;
+	}
+	return name;
+}
+
+
+/*
+ *  Hooks for the JIT compilers
+ */
+
+uint64 *jit_profile_counter(uint32 pc)
+{
+	std::map<uint32, profile_block>::iterator i = blocks.find(pc);
+	if (i != blocks.end())
+		return i->second.counter;
+
+	if (num_counters == MAX_COUNTERS) {
+		static bool warned = false;
+		if (!warned) {
+			printf("WARNING: Out of JIT profile counters, new blocks are not counted\n");
+			warned = true;
+		}
+		return NULL;
+	}
+
+	profile_block &b = blocks[pc];
+	b.counter = &counters[num_counters++];
+	b.num_insns = 0;
+	b.code = NULL;
+	b.code_size = 0;
+	return b.counter;
+}
+
+void jit_profile_translated(uint32 pc, uint32 num_insns, uint8 *code, uint32 code_size)
+{
+	std::map<uint32, profile_block>::iterator i = blocks.find(pc);
+	if (i == blocks.end())
+		return;
+	i->second.num_insns = num_insns;
+	i->second.code = code;
+	i->second.code_size = code_size;
+
+	if (perf_map) {
+		if (m68k_code)
+			update_trap_entries();
+		fprintf(perf_map, "%lx %x %s@%08x %s\n", (unsigned long)(uintptr)code, code_size,
+			cpu_name, pc, guest_name(pc).c_str());
+	}
+}
+
+
+/*
+ *  pprof output
+ */
+
+// Protocol buffer encoding
+static void pb_varint(std::string &s, uint64 v)
+{
+	while (v >= 0x80) {
+		s += (char)(v | 0x80);
+		v >>= 7;
+	}
+	s += (char)v;
+}
+
+static void pb_uint(std::string &s, int field, uint64 v)
+{
+	pb_varint(s, field << 3);
+	pb_varint(s, v);
+}
+
+static void pb_bytes(std::string &s, int field, const std::string &v)
+{
+	pb_varint(s, (field << 3) | 2);
+	pb_varint(s, v.size());
+	s += v;
+}
+
+struct string_table {
+	std::vector<std::string> strings;
+	std::map<std::string, int> index;
+
+	string_table() { add(""); }
+
+	int add(const std::string &str) {
+		std::map<std::string, int>::iterator i = index.find(str);
+		if (i != index.end())
+			return i->second;
+		strings.push_back(str);
+		return index[str] = strings.size() - 1;
+	}
+};
+
+static std::string value_type(string_table &strings, const char *type, const char *unit)
+{
+	std::string s;
+	pb_uint(s, 1, strings.add(type));
+	pb_uint(s, 2, strings.add(unit));
+	return s;
+}
+
+bool jit_profile_write(const char *path)
+{
+	if (m68k_code)
+		update_trap_entries();
+
+	string_table strings;
+	std::map<std::string, int> functions;
+	std::string profile;
+
+	// Profile.sample_type
+	pb_bytes(profile, 1, value_type(strings, "blocks", "count"));
+	pb_bytes(profile, 1, value_type(strings, "instructions", "count"));
+
+	int host_key = strings.add("host_code");
+	int num_locations = 0;
+	for (std::map<uint32, profile_block>::iterator i = blocks.begin(); i != blocks.end(); ++i) {
+		uint32 pc = i->first;
+		const profile_block &b = i->second;
+		uint64 count = *b.counter;
+		if (count == 0)
+			continue;
+
+		// Profile.function, one per symbol
+		uint32 offset;
+		std::string symbol = guest_symbol(pc, offset);
+		int function_id;
+		std::map<std::string, int>::iterator f = functions.find(symbol);
+		if (f == functions.end()) {
+			function_id = functions.size() + 1;
+			functions[symbol] = function_id;
+			std::string function;
+			pb_uint(function, 1, function_id);
+			pb_uint(function, 2, strings.add(symbol));
+			pb_uint(function, 3, strings.add(symbol));
+			pb_uint(function, 4, strings.add(cpu_name));
+			pb_bytes(profile, 5, function);
+		} else
+			function_id = f->second;
+
+		// Profile.location, one per block
+		int location_id = ++num_locations;
+		std::string line, location;
+		pb_uint(line, 1, function_id);
+		pb_uint(location, 1, location_id);
+		pb_uint(location, 3, pc);
+		pb_bytes(location, 4, line);
+		pb_bytes(profile, 4, location);
+
+		// Profile.sample
+		std::string sample, location_ids, values, label;
+		pb_varint(location_ids, location_id);
+		pb_varint(values, count);
+		pb_varint(values, count * b.num_insns);
+		char host[32];
+		sprintf(host, "%p+%u", b.code, b.code_size);
+		pb_uint(label, 1, host_key);
+		pb_uint(label, 2, strings.add(host));
+		pb_bytes(sample, 1, location_ids);
+		pb_bytes(sample, 2, values);
+		pb_bytes(sample, 3, label);
+		pb_bytes(profile, 2, sample);
+	}
+
+	// Profile.string_table
+	for (size_t i = 0; i < strings.strings.size(); i++)
+		pb_bytes(profile, 6, strings.strings[i]);
+
+	FILE *f = fopen(path, "wb");
+	if (f == NULL) {
+		printf("WARNING: Cannot open %s\n", path);
+		return false;
+	}
+	bool ok = fwrite(profile.data(), 1, profile.size(), f) == profile.size();
+	if (fclose(f) != 0)
+		ok = false;
+	return ok;
+}
+
+
+/*
+ *  mon command
+ */
+
+#if ENABLE_MON
+static bool compare_counts(const std::pair<uint64, uint32> &a, const std::pair<uint64, uint32> &b)
+{
+	return a.first > b.first;
+}
+
+static void jit_profile_command(void)
+{
+	if (mon_token == T_STRING) {
+		if (jit_profile_write(mon_string))
+			fprintf(monout, "JIT profile written to %s\n", mon_string);
+		return;
+	}
+	if (mon_token == T_NAME) {
+		if (strcmp(mon_name, "on") == 0)
+			jit_profile_start();
+		else if (strcmp(mon_name, "off") == 0)
+			jit_profile_stop();
+		else if (strcmp(mon_name, "reset") == 0) {
+			for (std::map<uint32, profile_block>::iterator i = blocks.begin(); i != blocks.end(); ++i)
+				*i->second.counter = 0;
+		} else
+			mon_error("'on', 'off' or 'reset' expected");
+		return;
+	}
+	if (mon_token != T_END) {
+		mon_error("Too many arguments");
+		return;
+	}
+
+	// Show the 20 most frequently executed blocks
+	if (m68k_code)
+		update_trap_entries();
+	std::vector< std::pair<uint64, uint32> > counts;
+	uint64 total = 0;
+	for (std::map<uint32, profile_block>::iterator i = blocks.begin(); i != blocks.end(); ++i) {
+		uint64 count = *i->second.counter;
+		if (count) {
+			counts.push_back(std::make_pair(count, i->first));
+			total += count;
+		}
+	}
+	std::sort(counts.begin(), counts.end(), compare_counts);
+	fprintf(monout, "JIT profile %s, %lu blocks executed %llu times\n",
+		jit_profile_enabled ? "active" : "stopped", (unsigned long)counts.size(), (unsigned long long)total);
+	for (size_t i = 0; i < counts.size() && i < 20; i++) {
+		const profile_block &b = blocks[counts[i].second];
+		fprintf(monout, "%12llu %5.1f%%  %08x %-28s %3u insns  %p\n",
+			(unsigned long long)counts[i].first, 100.0 * counts[i].first / total,
+			counts[i].second, guest_name(counts[i].second).c_str(), b.num_insns, b.code);
+	}
+}
+#endif
@@ -0,0 +1,46 @@
+/*
+ *  jit_profile.h - Execution profile of JIT translated blocks
+ *
+ *  Basilisk II (C) 1997-2008 Christian Bauer
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#ifndef JIT_PROFILE_H
+#define JIT_PROFILE_H
+
+// Set while new blocks are to be translated with an execution counter
+extern bool jit_profile_enabled;
+
+// Initialization, "m68k_code" enables naming of blocks after the A-Traps
+// they belong to, "flush" must throw away all translated blocks
+extern void jit_profile_init(const char *cpu_name, bool m68k_code, uint32 rom_base, uint32 rom_size, void (*flush)(void));
+extern void jit_profile_exit(void);
+
+// Start or stop counting (flushes the translation cache)
+extern void jit_profile_start(void);
+extern void jit_profile_stop(void);
+
+// Returns execution counter for block at guest address "pc", located in
+// the low 4GB of the address space, or NULL if there are no more counters
+extern uint64 *jit_profile_counter(uint32 pc);
+
+// Called after a block was translated, adds it to the perf map
+extern void jit_profile_translated(uint32 pc, uint32 num_insns, uint8 *code, uint32 code_size);
+
+// Write profile in pprof format (uncompressed profile.proto)
+extern bool jit_profile_write(const char *path);
+
+#endif
@@ -50,6 +50,13 @@ extern void update_sdl_video(SDL_Surface *screen, int numrects, SDL_Rect *rects)
 #define VIDEO_DRV_WIDTH			drv->s->w
 #define VIDEO_DRV_HEIGHT		drv->s->h
 #define VIDEO_DRV_ROW_BYTES		drv->s->pitch
+#elif defined(USE_HEADLESS_VIDEO)
+// Only dirty page tracking is used, there is no host frame buffer to update
+#ifdef SHEEPSHAVER
+#define MONITOR_INIT			/* nothing */
+#else
+#define MONITOR_INIT			monitor_desc &monitor
+#endif
 #else
 #ifdef SHEEPSHAVER
 #define MONITOR_INIT			/* nothing */
@@ -223,6 +230,7 @@ static uint32 page_extend(uint32 size)
  *  Check if VOSF acceleration is profitable on this platform
  */
 
+#ifndef USE_HEADLESS_VIDEO
 #ifndef VOSF_PROFITABLE_TRIES
 #define VOSF_PROFITABLE_TRIES VOSF_PROFITABLE_TRIES_DFL
 #endif
@@ -266,6 +274,7 @@ static bool video_vosf_profitable(uint32 *duration_p = NULL, uint32 *n_page_faul
 	D(bug("Triggered %d page faults in %ld usec (%.1f usec per fault)\n", n_page_faults, duration, double(duration) / double(n_page_faults)));
 	return ((duration / n_tries) < (VOSF_PROFITABLE_THRESHOLD * (frame_skip ? frame_skip : 1)));
 }
+#endif
 
 
 /*
@@ -483,7 +492,7 @@ There are two cases to check:
 	than pageCount.
 */
 
-#ifndef TEST_VOSF_PERFORMANCE
+#if !defined(TEST_VOSF_PERFORMANCE) && !defined(USE_HEADLESS_VIDEO)
 static void update_display_window_vosf(VIDEO_DRV_WIN_INIT)
 {
 	VIDEO_MODE_INIT;
@@ -538,7 +547,7 @@ static void update_display_window_vosf(VIDEO_DRV_WIN_INIT)
  *	(only in Real or Direct Addressing mode)
  */
 
-#ifndef TEST_VOSF_PERFORMANCE
+#if !defined(TEST_VOSF_PERFORMANCE) && !defined(USE_HEADLESS_VIDEO)
 #if REAL_ADDRESSING || DIRECT_ADDRESSING
 static void update_display_dga_vosf(VIDEO_DRV_DGA_INIT)
 {
@@ -127,6 +127,150 @@ static int translate_map_flags(int vm_flags)
 }
 #endif
 
+/* Huge page support.  */
+
+#if defined(HAVE_MMAP_VM) && (defined(MAP_HUGETLB) || defined(MADV_HUGEPAGE))
+#define HAVE_VM_HUGE_PAGES 1
+#define HUGE_PAGE_SIZE (2 * 1024 * 1024)
+#endif
+
+static int huge_pages_mode = VM_HUGE_PAGES_NONE;
+
+#ifdef HAVE_VM_HUGE_PAGES
+/* Mappings acquired with VM_MAP_HUGE and how they are backed.
+
+   vm_protect() looks mappings up from SIGSEGV handlers while other
+   threads may add or remove them, so the table takes no locks: a
+   slot's sequence number is odd while the slot is changed. Writers
+   claim a slot by making it odd, readers skip odd slots and read the
+   others again if the number changed meanwhile.  */
+struct huge_mapping {
+	char * addr;
+	size_t size;
+	int backing;
+	bool used;
+};
+#define MAX_HUGE_MAPPINGS 64
+static huge_mapping huge_mappings[MAX_HUGE_MAPPINGS];
+static volatile unsigned int huge_mapping_seq[MAX_HUGE_MAPPINGS];
+static volatile int n_huge_mappings = 0;
+static bool transparent_huge_pages = false;
+
+/* Claim slot I if its sequence number is SEQ (even).  */
+static inline bool claim_huge_mapping(int i, unsigned int seq)
+{
+	return !(seq & 1) && __sync_bool_compare_and_swap(&huge_mapping_seq[i], seq, seq + 1);
+}
+
+static inline void release_huge_mapping(int i)
+{
+	__sync_synchronize();
+	huge_mapping_seq[i]++;
+}
+
+static void add_huge_mapping(void * addr, size_t size, int backing)
+{
+	for (int i = 0; i < MAX_HUGE_MAPPINGS; i++) {
+		if (huge_mappings[i].used || !claim_huge_mapping(i, huge_mapping_seq[i]))
+			continue;
+		huge_mapping * m = &huge_mappings[i];
+		const bool free_slot = !m->used;
+		if (free_slot) {
+			m->addr = (char *)addr;
+			m->size = size;
+			m->backing = backing;
+			m->used = true;
+		}
+		release_huge_mapping(i);
+		if (free_slot) {
+			__sync_fetch_and_add(&n_huge_mappings, 1);
+			return;
+		}
+	}
+}
+
+/* Copy the mapping containing ADDR to *M, returns its slot or -1.  */
+static int find_huge_mapping(void * addr, huge_mapping * m)
+{
+	for (int i = 0; i < MAX_HUGE_MAPPINGS; i++) {
+		unsigned int seq;
+		do {
+			seq = huge_mapping_seq[i];
+			__sync_synchronize();
+			*m = huge_mappings[i];
+			__sync_synchronize();
+		} while (!(seq & 1) && seq != huge_mapping_seq[i]);
+		if ((seq & 1) || !m->used)
+			continue;
+		if ((char *)addr >= m->addr && (char *)addr < m->addr + m->size)
+			return i;
+	}
+	return -1;
+}
+
+/* Remove slot I if it still holds the mapping at ADDR.  */
+static void remove_huge_mapping(int i, void * addr)
+{
+	while (!claim_huge_mapping(i, huge_mapping_seq[i]))
+		;
+	huge_mapping * m = &huge_mappings[i];
+	const bool found = m->used && m->addr == (char *)addr;
+	if (found)
+		m->used = false;
+	release_huge_mapping(i);
+	if (found)
+		__sync_fetch_and_sub(&n_huge_mappings, 1);
+}
+
+static inline vm_uintptr_t huge_page_round_up(vm_uintptr_t value)
+{
+	return (value + HUGE_PAGE_SIZE - 1) & -(vm_uintptr_t)HUGE_PAGE_SIZE;
+}
+
+/* Ask for transparent huge pages on [ ADDR, ADDR + SIZE [.  */
+static int advise_huge_pages(void * addr, size_t size)
+{
+#ifdef MADV_HUGEPAGE
+	if (transparent_huge_pages && madvise(addr, size, MADV_HUGEPAGE) == 0)
+		return VM_HUGE_PAGES_TRANSPARENT;
+#endif
+	return VM_HUGE_PAGES_NONE;
+}
+
+/* Map *SIZE bytes on huge pages if possible. *SIZE is updated to the
+   actual mapping size and *BACKING to the kind of pages used.  */
+static void * map_huge(void * hint, size_t * size, int flags, int fd, int * backing)
+{
+	char * addr;
+#ifdef MAP_HUGETLB
+	if (huge_pages_mode == VM_HUGE_PAGES_EXPLICIT) {
+		const size_t huge_size = huge_page_round_up(*size);
+		addr = (char *)mmap((caddr_t)hint, huge_size, VM_PAGE_DEFAULT, flags | MAP_HUGETLB, -1, 0);
+		if (addr != (char *)MAP_FAILED) {
+			*size = huge_size;
+			*backing = VM_HUGE_PAGES_EXPLICIT;
+			return addr;
+		}
+	}
+#endif
+
+	// Over-allocate and trim so that the mapping starts on a huge page boundary
+	const vm_uintptr_t page_size = vm_get_page_size();
+	const size_t map_size = ((*size + page_size - 1) & -page_size) + HUGE_PAGE_SIZE;
+	char * base = (char *)mmap((caddr_t)hint, map_size, VM_PAGE_DEFAULT, flags, fd, 0);
+	if (base == (char *)MAP_FAILED)
+		return MAP_FAILED;
+	addr = (char *)huge_page_round_up((vm_uintptr_t)base);
+	char * end = addr + map_size - HUGE_PAGE_SIZE;
+	if (addr > base)
+		munmap((caddr_t)base, addr - base);
+	if (base + map_size > end)
+		munmap((caddr_t)end, base + map_size - end);
+	*backing = advise_huge_pages(addr, *size);
+	return addr;
+}
+#endif
+
 /* Align ADDR and SIZE to 64K boundaries.  */
 
 #ifdef HAVE_WIN32_VM
@@ -229,6 +373,9 @@ void vm_exit(void)
 void * vm_acquire(size_t size, int options)
 {
 	void * addr;
+#ifdef HAVE_VM_HUGE_PAGES
+	int huge_backing = -1;
+#endif
 	
 	errno = 0;
 
@@ -252,6 +399,13 @@ void * vm_acquire(size_t size, int options)
 	int fd = zero_fd;
 	int the_map_flags = translate_map_flags(options) | map_flags;
 
+#ifdef HAVE_VM_HUGE_PAGES
+	if ((options & VM_MAP_HUGE) && huge_pages_mode != VM_HUGE_PAGES_NONE && size >= HUGE_PAGE_SIZE) {
+		if ((addr = map_huge(next_address, &size, the_map_flags, fd, &huge_backing)) == (void *)MAP_FAILED)
+			return VM_MAP_FAILED;
+	}
+	else
+#endif
 	if ((addr = mmap((caddr_t)next_address, size, VM_PAGE_DEFAULT, the_map_flags, fd, 0)) == (void *)MAP_FAILED)
 		return VM_MAP_FAILED;
 	//For virtual addressing (a.k.a memory banks), there is no need to enforce that 
@@ -282,6 +436,11 @@ void * vm_acquire(size_t size, int options)
 	// say MacOS X, mmap() doesn't honour the requested protection flags.
 	if (vm_protect(addr, size, VM_PAGE_DEFAULT) != 0)
 		return VM_MAP_FAILED;
+
+#ifdef HAVE_VM_HUGE_PAGES
+	if (huge_backing >= 0)
+		add_huge_mapping(addr, size, huge_backing);
+#endif
 	
 	return addr;
 }
@@ -315,6 +474,12 @@ int vm_acquire_fixed(void * addr, size_t size, int options)
 
 	if (mmap((caddr_t)addr, size, VM_PAGE_DEFAULT, the_map_flags, fd, 0) == (void *)MAP_FAILED)
 		return -1;
+
+#ifdef HAVE_VM_HUGE_PAGES
+	// Fixed addresses may not be huge page aligned, only use transparent huge pages
+	if ((options & VM_MAP_HUGE) && huge_pages_mode != VM_HUGE_PAGES_NONE)
+		add_huge_mapping(addr, size, advise_huge_pages(addr, size));
+#endif
 #elif defined(HAVE_WIN32_VM)
 	// Windows cannot allocate Low Memory
 	if (addr == NULL)
@@ -352,6 +517,17 @@ int vm_release(void * addr, size_t size)
 	if (addr == VM_MAP_FAILED)
 		return 0;
 
+#ifdef HAVE_VM_HUGE_PAGES
+	// Explicit huge page mappings were rounded up to whole huge pages
+	huge_mapping m;
+	int slot = find_huge_mapping(addr, &m);
+	if (slot >= 0 && m.addr == addr) {
+		if (m.backing == VM_HUGE_PAGES_EXPLICIT)
+			size = m.size;
+		remove_huge_mapping(slot, addr);
+	}
+#endif
+
 #ifdef HAVE_MACH_VM
 	if (vm_deallocate(mach_task_self(), (vm_address_t)addr, size) != KERN_SUCCESS)
 		return -1;
@@ -382,6 +558,20 @@ int vm_protect(void * addr, size_t size, int prot)
 	return ret_code == KERN_SUCCESS ? 0 : -1;
 #else
 #ifdef HAVE_MMAP_VM
+#ifdef HAVE_VM_HUGE_PAGES
+	// Protection of explicit huge pages can only change for whole pages
+	if (n_huge_mappings > 0) {
+		huge_mapping m;
+		if (find_huge_mapping(addr, &m) >= 0 && m.backing == VM_HUGE_PAGES_EXPLICIT) {
+			char * start = m.addr + (((char *)addr - m.addr) & -(vm_uintptr_t)HUGE_PAGE_SIZE);
+			char * end = m.addr + huge_page_round_up((char *)addr + size - m.addr);
+			if (end > m.addr + m.size)
+				end = m.addr + m.size;
+			addr = start;
+			size = end - start;
+		}
+	}
+#endif
 	int ret_code = mprotect((caddr_t)addr, size, prot);
 	return ret_code == 0 ? 0 : -1;
 #else
@@ -457,6 +647,56 @@ int vm_get_page_size(void)
 #endif
 }
 
+/* Select how VM_MAP_HUGE mappings are backed from now on. Returns 0
+   if successful, -1 if huge pages are not supported.  */
+
+int vm_set_huge_pages(int mode)
+{
+#ifdef HAVE_VM_HUGE_PAGES
+#ifdef MADV_HUGEPAGE
+	// madvise() succeeds even if transparent huge pages were disabled
+	transparent_huge_pages = false;
+	FILE * f = fopen("/sys/kernel/mm/transparent_hugepage/enabled", "r");
+	if (f) {
+		char line[128];
+		if (fgets(line, sizeof(line), f) && strstr(line, "[never]") == NULL)
+			transparent_huge_pages = true;
+		fclose(f);
+	}
+#endif
+	huge_pages_mode = mode;
+	return 0;
+#else
+	return mode == VM_HUGE_PAGES_NONE ? 0 : -1;
+#endif
+}
+
+/* Return how the VM_MAP_HUGE mapping containing ADDR is backed.  */
+
+int vm_get_huge_pages(void * addr)
+{
+#ifdef HAVE_VM_HUGE_PAGES
+	huge_mapping m;
+	if (find_huge_mapping(addr, &m) >= 0)
+		return m.backing;
+#endif
+	return VM_HUGE_PAGES_NONE;
+}
+
+/* Print how the VM_MAP_HUGE mapping containing ADDR is backed, unless
+   huge pages are disabled. NAME describes the mapping.  */
+
+void vm_report_huge_pages(const char * name, void * addr, size_t size)
+{
+	static const char * const backing_names[] = {
+		"small pages",
+		"transparent huge pages",
+		"explicit huge pages"
+	};
+	if (huge_pages_mode != VM_HUGE_PAGES_NONE)
+		printf("%s: %lu KB on %s\n", name, (unsigned long)(size / 1024), backing_names[vm_get_huge_pages(addr)]);
+}
+
 #ifdef CONFIGURE_TEST_VM_WRITE_WATCH
 int main(void)
 {
@@ -58,6 +58,7 @@ extern "C" {
 #define VM_MAP_FIXED			0x04
 #define VM_MAP_32BIT			0x08
 #define VM_MAP_WRITE_WATCH		0x10
+#define VM_MAP_HUGE				0x20
 
 /* Default mapping options.  */
 #define VM_MAP_DEFAULT			(VM_MAP_PRIVATE)
@@ -85,6 +86,16 @@ extern "C" {
 /* Default protection bits.  */
 #define VM_PAGE_DEFAULT			(VM_PAGE_READ | VM_PAGE_WRITE)
 
+/* Huge page backing of VM_MAP_HUGE mappings. Transparent huge pages
+   are advised with madvise() on 2MB aligned regions; explicit huge
+   pages come from the hugetlbfs pool with MAP_HUGETLB and fall back
+   to transparent huge pages when the pool is exhausted. Mappings
+   without VM_MAP_HUGE (e.g. VOSF frame buffers, which are protected
+   per page) always use small pages.  */
+#define VM_HUGE_PAGES_NONE			0
+#define VM_HUGE_PAGES_TRANSPARENT	1
+#define VM_HUGE_PAGES_EXPLICIT		2
+
 /* Initialize the VM system. Returns 0 if successful, -1 for errors.  */
 
 extern int vm_init(void);
@@ -131,4 +142,18 @@ extern int vm_reset_write_watch(void * addr, size_t size);
 
 extern int vm_get_page_size(void);
 
+/* Select how VM_MAP_HUGE mappings are backed from now on. Returns 0
+   if successful, -1 if huge pages are not supported.  */
+
+extern int vm_set_huge_pages(int mode);
+
+/* Return how the VM_MAP_HUGE mapping containing ADDR is backed.  */
+
+extern int vm_get_huge_pages(void * addr);
+
+/* Print how the VM_MAP_HUGE mapping containing ADDR is backed, unless
+   huge pages are disabled. NAME describes the mapping.  */
+
+extern void vm_report_huge_pages(const char * name, void * addr, size_t size);
+
 #endif /* VM_ALLOC_H */
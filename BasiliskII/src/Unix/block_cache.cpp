@@ -0,0 +1,445 @@
+/*
+ *  block_cache.cpp - Host block cache for disk, floppy and CD-ROM images
+ *
+ *  Basilisk II (C) 1997-2008 Christian Bauer
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+/*
+ *  All image files share one LRU cache of 4K blocks, bounded by the
+ *  "diskcachesize" pref (in MB, 0 disables the cache). Misses are read
+ *  from the host in runs, and sequential access grows a per-file
+ *  read-ahead window that is appended to those runs. Writes go through
+ *  to the host unless "diskcachewriteback" is set; in that case dirty
+ *  blocks are written back when they are evicted, when too many are
+ *  dirty, on eject and on close. Blocks that fail to be written back
+ *  stay dirty and cached; like any delayed write error, this is only
+ *  reported by the next eject or close, never by a later write.
+ */
+
+#include "sysdeps.h"
+#include "prefs.h"
+#include "block_cache.h"
+
+#include <pthread.h>
+#include <map>
+#include <list>
+#include <vector>
+
+#define DEBUG 0
+#include "debug.h"
+
+const uint32 BLOCK_SIZE = 4096;
+const uint32 MIN_READAHEAD = 4;		// Blocks
+const uint32 MAX_READAHEAD = 128;	// Blocks
+
+struct cache_block;
+typedef std::pair<block_cache_file *, uint64> block_key;
+typedef std::map<block_key, cache_block *> block_map;
+typedef std::list<cache_block *> lru_list;
+
+struct cache_block {
+	block_map::iterator pos;	// Position in block map
+	lru_list::iterator lru;		// Position in LRU list
+	uint32 valid;				// Number of valid bytes (less than BLOCK_SIZE at end of file)
+	bool dirty;
+	bool write_failed;			// Last write-back failed, not evicted until a flush succeeds
+	bool prefetched;			// Read ahead and not used yet
+	uint8 data[BLOCK_SIZE];
+};
+
+struct block_cache_file {
+	void *arg;
+	block_io_func read_func, write_func;
+	loff_t size;				// Size of file
+	loff_t last_end;			// End of last read request
+	uint32 readahead;			// Current read-ahead window (blocks)
+	uint32 dirty;				// Number of dirty blocks
+};
+
+// Cache state
+static uint32 max_blocks;		// 0 = cache disabled
+static bool write_back;
+static block_map blocks;
+static lru_list lru;			// Most recently used first
+static uint32 dirty_blocks;
+static pthread_mutex_t cache_lock = PTHREAD_MUTEX_INITIALIZER;
+
+// Statistics
+static uint64 stat_hits, stat_misses, stat_readahead, stat_readahead_hits, stat_writebacks;
+
+
+/*
+ *  Initialization
+ */
+
+void BlockCacheInit(void)
+{
+	int32 size = PrefsFindInt32("diskcachesize");
+	max_blocks = size > 0 ? (uint32)size * (1024 * 1024 / BLOCK_SIZE) : 0;
+	write_back = PrefsFindBool("diskcachewriteback");
+	D(bug("Block cache: %u blocks, %s\n", max_blocks, write_back ? "write-back" : "write-through"));
+}
+
+void BlockCacheExit(void)
+{
+	if (stat_hits + stat_misses) {
+		printf("Disk cache: %llu hits, %llu misses, %llu blocks read ahead (%llu used), %llu blocks written back\n",
+			(unsigned long long)stat_hits, (unsigned long long)stat_misses,
+			(unsigned long long)stat_readahead, (unsigned long long)stat_readahead_hits,
+			(unsigned long long)stat_writebacks);
+	}
+}
+
+
+/*
+ *  Block management (cache_lock must be held)
+ */
+
+static inline cache_block *find_block(block_cache_file *f, uint64 index)
+{
+	block_map::iterator it = blocks.find(block_key(f, index));
+	return it == blocks.end() ? NULL : it->second;
+}
+
+static inline void touch_block(cache_block *b)
+{
+	lru.splice(lru.begin(), lru, b->lru);
+}
+
+// Write a run of dirty blocks of one file with a single host call
+static bool write_back_run(block_cache_file *f, block_map::iterator first, block_map::iterator last)
+{
+	uint64 start = first->first.second;
+	std::vector<uint8> buf;
+	for (block_map::iterator it = first; it != last; ++it) {
+		cache_block *b = it->second;
+		buf.insert(buf.end(), b->data, b->data + b->valid);
+	}
+	bool ok = f->write_func(f->arg, &buf[0], start * BLOCK_SIZE, buf.size()) == buf.size();
+
+	// The blocks are only clean once the whole run is written
+	for (block_map::iterator it = first; it != last; ++it) {
+		cache_block *b = it->second;
+		b->write_failed = !ok;
+		if (ok) {
+			b->dirty = false;
+			f->dirty--;
+			dirty_blocks--;
+		}
+	}
+	if (ok)
+		stat_writebacks += std::distance(first, last);
+	return ok;
+}
+
+// Write back all dirty blocks of a file in offset order
+static bool flush_file(block_cache_file *f)
+{
+	bool ok = true;
+	block_map::iterator it = blocks.lower_bound(block_key(f, 0));
+	while (f->dirty && it != blocks.end() && it->first.first == f) {
+		if (!it->second->dirty) {
+			++it;
+			continue;
+		}
+		// Only full blocks can be followed by more blocks in the same run
+		block_map::iterator first = it;
+		uint64 next = it->first.second + 1;
+		bool full = it->second->valid == BLOCK_SIZE;
+		for (++it; full && it != blocks.end() && it->first.first == f && it->second->dirty
+			&& it->first.second == next; ++it) {
+			full = it->second->valid == BLOCK_SIZE;
+			next++;
+		}
+		if (!write_back_run(f, first, it))
+			ok = false;
+	}
+	return ok;
+}
+
+// Drop a block from the cache, dirty data is lost
+static void remove_block(cache_block *b)
+{
+	if (b->dirty) {
+		b->pos->first.first->dirty--;
+		dirty_blocks--;
+	}
+	lru.erase(b->lru);
+	blocks.erase(b->pos);
+	delete b;
+}
+
+// Write back a single dirty block before evicting it
+static bool clean_block(cache_block *b)
+{
+	if (!b->dirty)
+		return true;
+	block_map::iterator next = b->pos;
+	return write_back_run(b->pos->first.first, b->pos, ++next);
+}
+
+static cache_block *new_block(block_cache_file *f, uint64 index)
+{
+	// Evict least recently used blocks, skipping those that can't be
+	// written back (the cache may then exceed its size until a flush)
+	lru_list::iterator it = lru.end();
+	while (blocks.size() >= max_blocks && it != lru.begin()) {
+		cache_block *b = *--it;
+		if (!b->write_failed && clean_block(b)) {
+			++it;
+			remove_block(b);
+		}
+	}
+
+	cache_block *b = new cache_block;
+	b->pos = blocks.insert(block_map::value_type(block_key(f, index), b)).first;
+	lru.push_front(b);
+	b->lru = lru.begin();
+	b->valid = 0;
+	b->dirty = false;
+	b->write_failed = false;
+	b->prefetched = false;
+	return b;
+}
+
+static void mark_dirty(block_cache_file *f, cache_block *b)
+{
+	if (!b->dirty) {
+		b->dirty = true;
+		f->dirty++;
+		dirty_blocks++;
+	}
+}
+
+
+/*
+ *  Open/close file
+ */
+
+block_cache_file *block_cache_open(void *arg, loff_t size, block_io_func read_func, block_io_func write_func)
+{
+	if (max_blocks == 0)
+		return NULL;
+	block_cache_file *f = new block_cache_file;
+	f->arg = arg;
+	f->size = size;
+	f->read_func = read_func;
+	f->write_func = write_func;
+	f->last_end = -1;
+	f->readahead = 0;
+	f->dirty = 0;
+	return f;
+}
+
+bool block_cache_invalidate(block_cache_file *f)
+{
+	pthread_mutex_lock(&cache_lock);
+	bool ok = flush_file(f);
+
+	// Dirty blocks that could not be written back stay cached
+	block_map::iterator it = blocks.lower_bound(block_key(f, 0));
+	while (it != blocks.end() && it->first.first == f) {
+		cache_block *b = (it++)->second;
+		if (!b->dirty)
+			remove_block(b);
+	}
+	f->last_end = -1;
+	f->readahead = 0;
+	pthread_mutex_unlock(&cache_lock);
+	return ok;
+}
+
+void block_cache_close(block_cache_file *f)
+{
+	if (!block_cache_invalidate(f))
+		printf("WARNING: Disk cache write-back failed, changes are lost\n");
+
+	pthread_mutex_lock(&cache_lock);
+	block_map::iterator it = blocks.lower_bound(block_key(f, 0));
+	while (it != blocks.end() && it->first.first == f) {
+		cache_block *b = (it++)->second;
+		remove_block(b);
+	}
+	pthread_mutex_unlock(&cache_lock);
+	delete f;
+}
+
+bool block_cache_flush(block_cache_file *f)
+{
+	pthread_mutex_lock(&cache_lock);
+	bool ok = flush_file(f);
+	pthread_mutex_unlock(&cache_lock);
+	return ok;
+}
+
+
+/*
+ *  Read data through the cache
+ */
+
+// Read blocks [first, last] from the host into the cache
+static void fill_blocks(block_cache_file *f, uint64 first, uint64 last, uint64 demand_last)
+{
+	uint32 n = last - first + 1;
+	std::vector<uint8> buf(n * BLOCK_SIZE);
+	size_t actual = f->read_func(f->arg, &buf[0], first * BLOCK_SIZE, buf.size());
+	if ((ssize_t)actual < 0)
+		actual = 0;
+	for (uint32 i = 0; i < n && i * BLOCK_SIZE < actual; i++) {
+		cache_block *b = new_block(f, first + i);
+		b->valid = std::min((size_t)BLOCK_SIZE, actual - i * BLOCK_SIZE);
+		memcpy(b->data, &buf[i * BLOCK_SIZE], b->valid);
+		if (first + i > demand_last) {
+			b->prefetched = true;
+			stat_readahead++;
+		} else
+			stat_misses++;
+	}
+}
+
+size_t block_cache_read(block_cache_file *f, void *buffer, loff_t offset, size_t length)
+{
+	if (length == 0)
+		return 0;
+	pthread_mutex_lock(&cache_lock);
+
+	// Adapt read-ahead window to access pattern
+	if (offset == f->last_end)
+		f->readahead = f->readahead ? std::min(f->readahead * 2, MAX_READAHEAD) : MIN_READAHEAD;
+	else
+		f->readahead = 0;
+	f->last_end = offset + length;
+
+	uint8 *dest = (uint8 *)buffer;
+	const uint64 first = offset / BLOCK_SIZE;
+	const uint64 last = (offset + length - 1) / BLOCK_SIZE;
+	size_t done = 0;
+	for (uint64 i = first; i <= last; i++) {
+		cache_block *b = find_block(f, i);
+		if (b == NULL) {
+			// Read the run of missing blocks (plus read-ahead at the end)
+			uint64 end = i;
+			while (end < last && end - i < max_blocks / 2 && find_block(f, end + 1) == NULL)
+				end++;
+			if (end == last) {
+				uint64 limit = std::min(last + f->readahead, i + max_blocks / 2);
+				while (end < limit && find_block(f, end + 1) == NULL)
+					end++;
+			}
+			fill_blocks(f, i, end, last);
+			b = find_block(f, i);
+			if (b == NULL)
+				break;	// Read error or end of file
+		} else {
+			stat_hits++;
+			if (b->prefetched) {
+				b->prefetched = false;
+				stat_readahead_hits++;
+			}
+		}
+		touch_block(b);
+
+		// Copy data to caller
+		uint32 start = (i == first) ? offset % BLOCK_SIZE : 0;
+		uint32 len = std::min((size_t)BLOCK_SIZE - start, length - done);
+		if (start + len > b->valid) {
+			if (b->valid > start) {
+				memcpy(dest + done, b->data + start, b->valid - start);
+				done += b->valid - start;
+			}
+			break;
+		}
+		memcpy(dest + done, b->data + start, len);
+		done += len;
+	}
+
+	pthread_mutex_unlock(&cache_lock);
+	return done;
+}
+
+
+/*
+ *  Write data through the cache
+ */
+
+size_t block_cache_write(block_cache_file *f, void *buffer, loff_t offset, size_t length)
+{
+	if (length == 0)
+		return 0;
+	pthread_mutex_lock(&cache_lock);
+
+	if (!write_back) {
+		// Write-through, then update cached copies
+		size_t actual = f->write_func(f->arg, buffer, offset, length);
+		if ((ssize_t)actual < 0)
+			actual = 0;
+		const uint8 *src = (const uint8 *)buffer;
+		for (uint64 i = offset / BLOCK_SIZE; actual && i <= (offset + actual - 1) / BLOCK_SIZE; i++) {
+			cache_block *b = find_block(f, i);
+			if (b == NULL)
+				continue;
+			loff_t block_start = i * BLOCK_SIZE;
+			loff_t s = std::max(offset, block_start);
+			loff_t e = std::min(offset + (loff_t)actual, block_start + (loff_t)BLOCK_SIZE);
+			memcpy(b->data + (s - block_start), src + (s - offset), e - s);
+			b->valid = std::max(b->valid, uint32(e - block_start));
+		}
+		pthread_mutex_unlock(&cache_lock);
+		return actual;
+	}
+
+	// Write-back
+	if (offset >= f->size) {
+		pthread_mutex_unlock(&cache_lock);
+		return 0;
+	}
+	length = std::min((loff_t)length, f->size - offset);
+	const uint8 *src = (const uint8 *)buffer;
+	const uint64 first = offset / BLOCK_SIZE;
+	const uint64 last = (offset + length - 1) / BLOCK_SIZE;
+	size_t done = 0;
+	for (uint64 i = first; i <= last; i++) {
+		uint32 start = (i == first) ? offset % BLOCK_SIZE : 0;
+		uint32 len = std::min((size_t)BLOCK_SIZE - start, length - done);
+		cache_block *b = find_block(f, i);
+		if (b == NULL) {
+			if (len < BLOCK_SIZE) {
+				// Partial block, read the rest first
+				fill_blocks(f, i, i, i);
+				b = find_block(f, i);
+			}
+			if (b == NULL) {
+				b = new_block(f, i);
+				if (len < BLOCK_SIZE)
+					memset(b->data, 0, BLOCK_SIZE);
+			}
+		}
+		touch_block(b);
+		memcpy(b->data + start, src + done, len);
+		b->valid = std::max(b->valid, start + len);
+		mark_dirty(f, b);
+		done += len;
+	}
+
+	// Don't let dirty data take over the cache. The data of this write
+	// is cached either way, so a failed write-back is not reported here.
+	if (dirty_blocks > max_blocks / 2)
+		flush_file(f);
+
+	pthread_mutex_unlock(&cache_lock);
+	return done;
+}
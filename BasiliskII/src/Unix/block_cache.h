@@ -0,0 +1,41 @@
+/*
+ *  block_cache.h - Host block cache for disk, floppy and CD-ROM images
+ *
+ *  Basilisk II (C) 1997-2008 Christian Bauer
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#ifndef BLOCK_CACHE_H
+#define BLOCK_CACHE_H
+
+struct block_cache_file;
+
+// Uncached I/O functions of a file
+typedef size_t (*block_io_func)(void *arg, void *buffer, loff_t offset, size_t length);
+
+extern void BlockCacheInit(void);
+extern void BlockCacheExit(void);
+
+// Returns NULL if caching is disabled
+extern block_cache_file *block_cache_open(void *arg, loff_t size, block_io_func read_func, block_io_func write_func);
+extern void block_cache_close(block_cache_file *f);		// Writes back dirty blocks
+
+extern size_t block_cache_read(block_cache_file *f, void *buffer, loff_t offset, size_t length);
+extern size_t block_cache_write(block_cache_file *f, void *buffer, loff_t offset, size_t length);
+extern bool block_cache_flush(block_cache_file *f);		// Write barrier
+extern bool block_cache_invalidate(block_cache_file *f);	// Flush and forget cached blocks (media change), dirty blocks stay on error
+
+#endif
@@ -0,0 +1,385 @@
+/*
+ *  compress_disk.cpp - Convert disk images to and from the chunked compressed format
+ *
+ *  Basilisk II (C) 1997-2008 Christian Bauer
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+/*
+ *  Chunks are compressed in batches by several threads and written in
+ *  order, followed by the chunk index; the header is written last, so
+ *  an interrupted conversion doesn't leave a usable image behind.
+ *
+ *  Usage: compress_disk [-c zlib|zstd|lz4] [-l level] [-s chunk KB] [-j threads] <image> <compressed image>
+ *         compress_disk -x <compressed image> <image>
+ */
+
+#include "sysdeps.h"
+#include "disk_compressed.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/stat.h>
+#include <algorithm>
+#include <vector>
+
+static const int BATCH_CHUNKS = 16;		// Per thread
+
+static ssize_t pread_all(int fd, void *buf, size_t len, loff_t offset)
+{
+	char *p = (char *)buf;
+	size_t done = 0;
+	while (done < len) {
+		ssize_t n = pread(fd, p + done, len - done, offset + done);
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n <= 0)
+			break;
+		done += n;
+	}
+	return done;
+}
+
+static ssize_t pwrite_all(int fd, const void *buf, size_t len, loff_t offset)
+{
+	const char *p = (const char *)buf;
+	size_t done = 0;
+	while (done < len) {
+		ssize_t n = pwrite(fd, p + done, len - done, offset + done);
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n <= 0)
+			break;
+		done += n;
+	}
+	return done;
+}
+
+// One batch of chunks, compressed by all threads
+struct batch {
+	int fd;
+	uint32 codec;
+	int level;
+	uint32 chunk_size;
+	uint64 image_size;
+	uint64 first;				// First chunk of batch
+	int count;					// Number of chunks in batch
+	int num_threads;
+	std::vector<uint8> raw;		// Uncompressed chunks
+	std::vector<uint8> packed;	// Compressed chunks, chunk_size apart
+	std::vector<uint32> length;	// Compressed length (0 = all zeroes)
+	bool ok;
+};
+
+struct batch_thread {
+	batch *b;
+	int index;
+};
+
+static size_t chunk_length(const batch *b, uint64 chunk)
+{
+	uint64 rest = b->image_size - chunk * b->chunk_size;
+	return rest < b->chunk_size ? rest : b->chunk_size;
+}
+
+static void *compress_thread(void *arg)
+{
+	batch_thread *t = (batch_thread *)arg;
+	batch *b = t->b;
+	for (int i = t->index; i < b->count; i += b->num_threads) {
+		const uint64 chunk = b->first + i;
+		const size_t len = chunk_length(b, chunk);
+		uint8 *raw = &b->raw[(size_t)i * b->chunk_size];
+		uint8 *packed = &b->packed[(size_t)i * b->chunk_size];
+		if (pread_all(b->fd, raw, len, chunk * b->chunk_size) != (ssize_t)len) {
+			b->ok = false;
+			break;
+		}
+
+		size_t n = 0;
+		while (n < len && raw[n] == 0)
+			n++;
+		if (n == len) {
+			b->length[i] = 0;
+			continue;
+		}
+		n = cmp_compress(b->codec, b->level, raw, len, packed, len);
+		if (n == 0) {
+			memcpy(packed, raw, len);
+			n = len;
+		}
+		b->length[i] = n;
+	}
+	return NULL;
+}
+
+static bool compress_image(const char *in_path, const char *out_path, uint32 codec, int level,
+	uint32 chunk_size, int num_threads)
+{
+	int in = open(in_path, O_RDONLY);
+	struct stat st;
+	if (in < 0 || fstat(in, &st) < 0) {
+		fprintf(stderr, "Cannot open %s: %s\n", in_path, strerror(errno));
+		return false;
+	}
+	int out = open(out_path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	if (out < 0) {
+		fprintf(stderr, "Cannot create %s: %s\n", out_path, strerror(errno));
+		close(in);
+		return false;
+	}
+
+	cmp_header h;
+	memset(&h, 0, sizeof(h));
+	memcpy(h.magic, CMP_MAGIC, sizeof(h.magic));
+	h.version = CMP_VERSION;
+	h.codec = codec;
+	h.chunk_size = chunk_size;
+	h.image_size = st.st_size;
+	const uint64 num_chunks = (h.image_size + chunk_size - 1) / chunk_size;
+	std::vector<uint64> index(num_chunks + 1);
+
+	batch b;
+	b.fd = in;
+	b.codec = codec;
+	b.level = level;
+	b.chunk_size = chunk_size;
+	b.image_size = h.image_size;
+	b.num_threads = num_threads;
+	b.raw.resize((size_t)num_threads * BATCH_CHUNKS * chunk_size);
+	b.packed.resize(b.raw.size());
+	b.length.resize(num_threads * BATCH_CHUNKS);
+	b.ok = true;
+
+	std::vector<pthread_t> threads(num_threads);
+	std::vector<batch_thread> args(num_threads);
+	std::vector<bool> started(num_threads);
+	loff_t pos = sizeof(h);
+	uint64 zero_chunks = 0;
+	bool ok = true;
+	for (uint64 first = 0; ok && first < num_chunks; first += b.length.size()) {
+		b.first = first;
+		b.count = std::min((uint64)b.length.size(), num_chunks - first);
+		for (int i = 0; i < num_threads; i++) {
+			args[i].b = &b;
+			args[i].index = i;
+			started[i] = pthread_create(&threads[i], NULL, compress_thread, &args[i]) == 0;
+			if (!started[i])
+				compress_thread(&args[i]);
+		}
+		for (int i = 0; i < num_threads; i++)
+			if (started[i])
+				pthread_join(threads[i], NULL);
+		if (!b.ok) {
+			fprintf(stderr, "Cannot read %s: %s\n", in_path, strerror(errno));
+			ok = false;
+			break;
+		}
+
+		for (int i = 0; i < b.count; i++) {
+			index[first + i] = pos;
+			const size_t len = b.length[i];
+			if (len == 0)
+				zero_chunks++;
+			else if (pwrite_all(out, &b.packed[(size_t)i * chunk_size], len, pos) != (ssize_t)len) {
+				fprintf(stderr, "Cannot write %s: %s\n", out_path, strerror(errno));
+				ok = false;
+				break;
+			}
+			pos += len;
+		}
+		printf("\r%llu%%", (unsigned long long)((first + b.count) * 100 / num_chunks));
+		fflush(stdout);
+	}
+	index[num_chunks] = pos;
+	h.index_offset = pos;
+
+	const size_t index_size = index.size() * sizeof(uint64);
+	cmp_header file_h = h;
+	cmp_convert_header(file_h);
+	cmp_convert_index(index);
+	if (ok && (pwrite_all(out, &index[0], index_size, pos) != (ssize_t)index_size
+	        || fsync(out) < 0
+	        || pwrite_all(out, &file_h, sizeof(file_h), 0) != sizeof(file_h))) {
+		fprintf(stderr, "Cannot write %s: %s\n", out_path, strerror(errno));
+		ok = false;
+	}
+	close(in);
+	if (close(out) < 0)
+		ok = false;
+	if (!ok) {
+		unlink(out_path);
+		return false;
+	}
+
+	const uint64 out_size = pos + index_size;
+	printf("\r%s: %llu chunks of %u bytes (%llu empty), %s, %llu -> %llu bytes (%.1f%%)\n",
+		out_path, (unsigned long long)num_chunks, chunk_size, (unsigned long long)zero_chunks,
+		cmp_codec_name(codec), (unsigned long long)h.image_size, (unsigned long long)out_size,
+		h.image_size ? out_size * 100.0 / h.image_size : 100.0);
+	return true;
+}
+
+static bool expand_image(const char *in_path, const char *out_path)
+{
+	int in = open(in_path, O_RDONLY);
+	if (in < 0) {
+		fprintf(stderr, "Cannot open %s: %s\n", in_path, strerror(errno));
+		return false;
+	}
+	cmp_header h;
+	bool valid = pread_all(in, &h, sizeof(h), 0) == sizeof(h);
+	cmp_convert_header(h);
+	if (!valid
+	 || memcmp(h.magic, CMP_MAGIC, sizeof(h.magic)) != 0 || h.version != CMP_VERSION
+	 || h.chunk_size == 0 || h.chunk_size > CMP_MAX_CHUNK_SIZE) {
+		fprintf(stderr, "%s is not a compressed disk image\n", in_path);
+		close(in);
+		return false;
+	}
+	if (!cmp_codec_available(h.codec)) {
+		fprintf(stderr, "%s needs %s support, which is not compiled in\n", in_path, cmp_codec_name(h.codec));
+		close(in);
+		return false;
+	}
+	struct stat st;
+	uint64 num_chunks;
+	if (fstat(in, &st) < 0 || !cmp_index_chunks(h, st.st_size, num_chunks)) {
+		fprintf(stderr, "Cannot read chunk index of %s\n", in_path);
+		close(in);
+		return false;
+	}
+	std::vector<uint64> index(num_chunks + 1);
+	const size_t index_size = index.size() * sizeof(uint64);
+	if (pread_all(in, &index[0], index_size, h.index_offset) != (ssize_t)index_size) {
+		fprintf(stderr, "Cannot read chunk index of %s\n", in_path);
+		close(in);
+		return false;
+	}
+	cmp_convert_index(index);
+
+	int out = open(out_path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	if (out < 0) {
+		fprintf(stderr, "Cannot create %s: %s\n", out_path, strerror(errno));
+		close(in);
+		return false;
+	}
+	std::vector<uint8> raw(h.chunk_size), packed(h.chunk_size);
+	bool ok = ftruncate(out, h.image_size) == 0;
+	for (uint64 c = 0; ok && c < num_chunks; c++) {
+		const size_t len = std::min((uint64)h.chunk_size, h.image_size - c * h.chunk_size);
+		const uint64 clen = index[c + 1] - index[c];
+		if (clen == 0)
+			continue;		// Left as a hole
+		if (index[c + 1] < index[c] || clen > len
+		 || pread_all(in, &packed[0], clen, index[c]) != (ssize_t)clen) {
+			fprintf(stderr, "Cannot read chunk %llu of %s\n", (unsigned long long)c, in_path);
+			ok = false;
+		} else if (clen < len && !cmp_decompress(h.codec, &packed[0], clen, &raw[0], len)) {
+			fprintf(stderr, "Chunk %llu of %s is damaged\n", (unsigned long long)c, in_path);
+			ok = false;
+		} else if (pwrite_all(out, clen < len ? &raw[0] : &packed[0], len, c * h.chunk_size) != (ssize_t)len) {
+			fprintf(stderr, "Cannot write %s: %s\n", out_path, strerror(errno));
+			ok = false;
+		}
+	}
+	close(in);
+	if (close(out) < 0)
+		ok = false;
+	if (!ok)
+		unlink(out_path);
+	return ok;
+}
+
+static void usage(const char *prg)
+{
+	printf("Usage: %s [-c zlib|zstd|lz4] [-l level] [-s chunk KB] [-j threads] <image> <compressed image>\n", prg);
+	printf("       %s -x <compressed image> <image>\n", prg);
+	printf("Codecs compiled in:");
+	for (uint32 c = CMP_CODEC_ZLIB; c <= CMP_CODEC_LZ4; c++)
+		if (cmp_codec_available(c))
+			printf(" %s", cmp_codec_name(c));
+	printf("\n");
+	exit(1);
+}
+
+int main(int argc, char **argv)
+{
+	// Prefer the codec that decompresses fastest
+	uint32 codec = 0;
+	for (uint32 c = CMP_CODEC_LZ4; c >= CMP_CODEC_ZLIB; c--)
+		if (cmp_codec_available(c)) {
+			codec = c;
+			break;
+		}
+	int level = -1;
+	uint32 chunk_size = CMP_DEFAULT_CHUNK_SIZE;
+	long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+	int num_threads = cpus > 0 ? cpus : 1;
+	bool expand = false;
+
+	int opt;
+	while ((opt = getopt(argc, argv, "c:l:s:j:x")) != -1) {
+		switch (opt) {
+			case 'c':
+				codec = 0;
+				for (uint32 c = CMP_CODEC_ZLIB; c <= CMP_CODEC_LZ4; c++)
+					if (strcmp(optarg, cmp_codec_name(c)) == 0)
+						codec = c;
+				if (!cmp_codec_available(codec)) {
+					fprintf(stderr, "Codec %s is not available\n", optarg);
+					usage(argv[0]);
+				}
+				break;
+			case 'l':
+				level = atoi(optarg);
+				break;
+			case 's':
+				chunk_size = atoi(optarg) * 1024;
+				if (chunk_size < 4096 || chunk_size > CMP_MAX_CHUNK_SIZE || (chunk_size & 4095)) {
+					fprintf(stderr, "Chunk size must be a multiple of 4 KB, up to %u KB\n", CMP_MAX_CHUNK_SIZE / 1024);
+					usage(argv[0]);
+				}
+				break;
+			case 'j':
+				num_threads = atoi(optarg);
+				if (num_threads < 1)
+					num_threads = 1;
+				break;
+			case 'x':
+				expand = true;
+				break;
+			default:
+				usage(argv[0]);
+		}
+	}
+	if (argc - optind != 2)
+		usage(argv[0]);
+
+	if (expand)
+		return expand_image(argv[optind], argv[optind + 1]) ? 0 : 1;
+
+	if (codec == 0) {
+		fprintf(stderr, "No compression library was compiled in\n");
+		return 1;
+	}
+	// Images are compressed once and read many times, so the default levels favor size
+	if (level < 0)
+		level = codec == CMP_CODEC_ZSTD ? 9 : 6;
+	return compress_image(argv[optind], argv[optind + 1], codec, level, chunk_size, num_threads) ? 0 : 1;
+}
@@ -0,0 +1,493 @@
+/*
+ *  cpu_bench.cpp - Throughput of the 68k interpreter and JIT compiler
+ *
+ *  Basilisk II (C) 1997-2008 Christian Bauer
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+/*
+ *  The benchmark runs small 68k kernels out of a bare RAM area, without
+ *  ROM, GUI or Mac OS. Each kernel is a loop with its iteration count in
+ *  D0 that ends with M68K_EXEC_RETURN. It is run once instruction by
+ *  instruction to count the executed instructions, then with every
+ *  execution mode:
+ *
+ *    interp     plain interpreter, one cpufunctbl[] lookup per instruction
+ *    predecode  interpreter with the decode cache (needs M68K_DECODE_CACHE=1)
+ *    jit        JIT compiler (USE_JIT)
+ *
+ *  The first run of each mode is reported as warm-up time (it includes
+ *  decoding or translation), the best of the following runs gives the
+ *  MIPS figure. A raw code file (e.g. recorded with the "s" command of
+ *  mon) can be run as kernel "file" with -f, it must also end with
+ *  M68K_EXEC_RETURN (0x7100).
+ *
+ *  Results are printed to stdout as one JSON object per line, all other
+ *  output (including the JIT compiler log) goes to stderr.
+ *
+ *  Usage: cpu_bench [-m modes] [-k kernels] [-n runs] [-s scale] [-f file]
+ */
+
+#include "sysdeps.h"
+
+#include <unistd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "cpu_emulation.h"
+#include "main.h"
+#include "prefs.h"
+#include "emul_op.h"
+#include "rom_patches.h"
+#include "vm_alloc.h"
+#include "m68k.h"
+#include "memory.h"
+#include "readcpu.h"
+#include "newcpu.h"
+#include "compiler/compemu.h"
+#include "fpu/fpu.h"
+
+// From newcpu.cpp
+extern bool quit_program;
+
+// Memory layout
+static const uint32 BENCH_RAM_SIZE = 0x1000000;		// 16 MB RAM
+static const uint32 BENCH_ROM_SIZE = 0x100000;		// Empty ROM area
+static const uint32 CODE_ADDR = 0x10000;			// Kernel code
+static const uint32 SRC_ADDR = 0x100000;			// Source of memory copy
+static const uint32 DST_ADDR = 0x200000;			// Destination of memory copy
+static const uint32 STACK_ADDR = 0x800000;			// Top of supervisor stack
+static const uint32 COPY_LONGS = 0x4000;			// 64 KB per memory copy
+
+// Execution modes
+enum {
+	MODE_INTERP,
+	MODE_PREDECODE,
+	MODE_JIT
+};
+
+static const char *mode_names[] = {"interp", "predecode", "jit"};
+
+// Kernels
+struct kernel {
+	const char *name;
+	const uint16 *code;		// NULL for the code file
+	int code_words;
+	uint32 count;			// Iterations (D0) at scale 1
+	uint32 d[8];			// Initial data registers (D0 is set from count)
+};
+
+// ALU: add/eor/rotate chain
+static const uint16 alu_code[] = {
+	0xd481,					// loop: add.l   d1,d2
+	0xb583,					//       eor.l   d2,d3
+	0xe79b,					//       rol.l   #3,d3
+	0x5281,					//       addq.l  #1,d1
+	0x5380,					//       subq.l  #1,d0
+	0x66f4,					//       bne.s   loop
+	M68K_EXEC_RETURN
+};
+
+// Memory copy of COPY_LONGS longs from SRC_ADDR to DST_ADDR
+static const uint16 memcpy_code[] = {
+	0x41f9, SRC_ADDR >> 16, SRC_ADDR & 0xffff,	// loop: lea     SRC_ADDR,a0
+	0x43f9, DST_ADDR >> 16, DST_ADDR & 0xffff,	//       lea     DST_ADDR,a1
+	0x323c, COPY_LONGS - 1,						//       move.w  #COPY_LONGS-1,d1
+	0x22d8,										// copy: move.l  (a0)+,(a1)+
+	0x51c9, 0xfffc,								//       dbra    d1,copy
+	0x5380,										//       subq.l  #1,d0
+	0x66e6,										//       bne.s   loop
+	M68K_EXEC_RETURN
+};
+
+// FPU: square roots, multiply and divide
+static const uint16 fpu_code[] = {
+	0xf201, 0x4080,			//       fmove.l d1,fp1
+	0xf202, 0x4100,			//       fmove.l d2,fp2
+	0xf203, 0x4200,			//       fmove.l d3,fp4
+	0xf203, 0x4300,			//       fmove.l d3,fp6
+	0xf200, 0x4180,			// loop: fmove.l d0,fp3
+	0xf200, 0x0e84,			//       fsqrt.x fp3,fp5
+	0xf200, 0x1622,			//       fadd.x  fp5,fp4
+	0xf200, 0x05a3,			//       fmul.x  fp1,fp3
+	0xf200, 0x09a0,			//       fdiv.x  fp2,fp3
+	0xf200, 0x0f22,			//       fadd.x  fp3,fp6
+	0x5380,					//       subq.l  #1,d0
+	0x66e4,					//       bne.s   loop
+	0xf204, 0x6200,			//       fmove.l fp4,d4
+	0xf205, 0x6300,			//       fmove.l fp6,d5
+	M68K_EXEC_RETURN
+};
+
+// Branches: xorshift32 random numbers, with data dependent branches
+static const uint16 branchy_code[] = {
+	0x2401,					// loop: move.l  d1,d2
+	0xebaa,					//       lsl.l   d5,d2
+	0xb581,					//       eor.l   d2,d1
+	0x2401,					//       move.l  d1,d2
+	0xecaa,					//       lsr.l   d6,d2
+	0xb581,					//       eor.l   d2,d1
+	0x2401,					//       move.l  d1,d2
+	0xefaa,					//       lsl.l   d7,d2
+	0xb581,					//       eor.l   d2,d1
+	0x0801, 0x0000,			//       btst    #0,d1
+	0x6702,					//       beq.s   1f
+	0x5283,					//       addq.l  #1,d3
+	0x0801, 0x0003,			// 1:    btst    #3,d1
+	0x6602,					//       bne.s   2f
+	0x5384,					//       subq.l  #1,d4
+	0x0801, 0x0007,			// 2:    btst    #7,d1
+	0x6704,					//       beq.s   3f
+	0xd681,					//       add.l   d1,d3
+	0x9881,					//       sub.l   d1,d4
+	0x5380,					// 3:    subq.l  #1,d0
+	0x66d0,					//       bne.s   loop
+	M68K_EXEC_RETURN
+};
+
+#define CODE(x) x, sizeof(x) / sizeof(x[0])
+
+static kernel kernels[] = {
+	{"alu", CODE(alu_code), 2000000, {0, 1, 0x12345678, 0x9abcdef0}},
+	{"memcpy", CODE(memcpy_code), 200, {0}},
+	{"fpu", CODE(fpu_code), 500000, {0, 3, 1000003, 0}},
+	{"branchy", CODE(branchy_code), 500000, {0, 0x2545f491, 0, 0, 0, 13, 17, 5}},
+	{"file", NULL, 0, 1, {0}}
+};
+
+static const int NUM_KERNELS = sizeof(kernels) / sizeof(kernels[0]);
+
+static uint8 *file_code;
+static uint32 file_size;
+static bool jit_pref;
+static FILE *results;		// JSON results, the original stdout
+
+
+/*
+ *  Glue to the rest of Basilisk II
+ */
+
+int CPUType = 4;
+int FPUType = 1;
+uint32 InterruptFlags = 0;
+
+#if !REAL_ADDRESSING && !DIRECT_ADDRESSING
+// Init680x0() maps the memory banks like for a 32-bit clean ROM
+uint16 ROMVersion = ROM_VERSION_32;
+bool TwentyFourBitAddressing = false;
+#endif
+
+void EmulOp(uint16 opcode, M68kRegisters *r)
+{
+	fprintf(stderr, "Unexpected EMUL_OP %04x at %08x\n", opcode, m68k_getpc());
+	quit_program = true;
+}
+
+void idle_resume(void)
+{
+}
+
+bool PrefsFindBool(const char *name)
+{
+	if (strcmp(name, "jit") == 0)
+		return jit_pref;
+	return strcmp(name, "jitfpu") == 0 || strcmp(name, "jitlazyflush") == 0 || strcmp(name, "jitinline") == 0;
+}
+
+int32 PrefsFindInt32(const char *name)
+{
+	if (strcmp(name, "jitcachesize") == 0)
+		return 8192;
+	return 0;
+}
+
+const char *PrefsFindString(const char *name, int index)
+{
+	return NULL;
+}
+
+
+/*
+ *  Time in microseconds
+ */
+
+static uint64 now_usec(void)
+{
+	struct timeval tv;
+	gettimeofday(&tv, NULL);
+	return (uint64)tv.tv_sec * 1000000 + tv.tv_usec;
+}
+
+
+/*
+ *  Load kernel and reset registers for a run
+ */
+
+static void setup(const kernel &k, uint32 count)
+{
+	for (int i = 0; i < 8; i++) {
+		m68k_dreg(regs, i) = k.d[i];
+		m68k_areg(regs, i) = 0;
+	}
+	m68k_dreg(regs, 0) = count;
+	m68k_areg(regs, 7) = STACK_ADDR;
+	fpu_reset();
+	m68k_setpc(CODE_ADDR);
+	fill_prefetch_0();
+	quit_program = false;
+}
+
+static void load(const kernel &k)
+{
+	if (k.code)
+		for (int i = 0; i < k.code_words; i++)
+			WriteMacInt16(CODE_ADDR + i * 2, k.code[i]);
+	else
+		Host2Mac_memcpy(CODE_ADDR, file_code, file_size);
+
+	for (uint32 i = 0; i < COPY_LONGS; i++)
+		WriteMacInt32(SRC_ADDR + i * 4, i * 0x9e3779b9);
+	Mac_memset(DST_ADDR, 0, COPY_LONGS * 4);
+}
+
+// Checksum of registers and copied memory, to compare the execution modes
+static uint32 checksum(void)
+{
+	uint32 sum = 0;
+	for (int i = 0; i < 8; i++)
+		sum = (sum << 5 | sum >> 27) ^ m68k_dreg(regs, i);
+	for (uint32 i = 0; i < COPY_LONGS; i++)
+		sum += ReadMacInt32(DST_ADDR + i * 4);
+	return sum;
+}
+
+
+/*
+ *  Count instructions of one run, without timing
+ */
+
+static uint64 count_insns(void)
+{
+	uint64 n = 0;
+	while (!quit_program) {
+		uae_u32 opcode = GET_OPCODE;
+		(*cpufunctbl[opcode])(opcode);
+		n++;
+	}
+	SPCFLAGS_INIT(0);
+	return n;
+}
+
+
+/*
+ *  Run kernel once in the given mode, returns time in microseconds
+ */
+
+static uint64 run_once(const kernel &k, uint32 count, int mode)
+{
+	setup(k, count);
+#if M68K_DECODE_CACHE
+	m68k_use_decode_cache = (mode == MODE_PREDECODE);
+#endif
+	uint64 start = now_usec();
+#if USE_JIT
+	if (mode == MODE_JIT)
+		m68k_compile_execute();
+	else
+#endif
+	m68k_execute();
+	uint64 end = now_usec();
+	SPCFLAGS_INIT(0);
+	return end - start;
+}
+
+static bool bench(const kernel &k, uint32 count, int mode, int runs, uint64 insns, uint32 ref_sum)
+{
+#if USE_JIT
+	extern int soft_flush_count, hard_flush_count;
+	int soft_flushes = soft_flush_count, hard_flushes = hard_flush_count;
+	uint32 code_size = get_jitted_size();
+#endif
+
+	uint64 warmup = run_once(k, count, mode);
+	bool ok = checksum() == ref_sum;
+#if USE_JIT
+	if (mode == MODE_JIT)
+		code_size = get_jitted_size() - code_size;
+#endif
+
+	uint64 best = warmup;
+	for (int i = 0; i < runs; i++) {
+		uint64 t = run_once(k, count, mode);
+		if (t < best)
+			best = t;
+		ok &= checksum() == ref_sum;
+	}
+	if (best == 0)
+		best = 1;
+
+	fprintf(results, "{\"core\":\"uae_cpu\",\"kernel\":\"%s\",\"mode\":\"%s\",\"insns\":%llu,\"seconds\":%.6f,\"mips\":%.2f,\"warmup_seconds\":%.6f",
+		k.name, mode_names[mode], (unsigned long long)insns, best / 1e6, double(insns) / best, warmup / 1e6);
+#if USE_JIT
+	if (mode == MODE_JIT)
+		fprintf(results, ",\"code_bytes\":%u,\"soft_flushes\":%d,\"hard_flushes\":%d",
+			code_size, soft_flush_count - soft_flushes, hard_flush_count - hard_flushes);
+#endif
+	fprintf(results, ",\"checksum\":\"%08x\",\"ok\":%s}\n", ref_sum, ok ? "true" : "false");
+	fflush(results);
+	return ok;
+}
+
+
+/*
+ *  Main program
+ */
+
+static bool selected(const char *list, const char *name)
+{
+	if (list == NULL)
+		return true;
+	size_t len = strlen(name);
+	for (const char *p = list; (p = strstr(p, name)) != NULL; p += len)
+		if ((p == list || p[-1] == ',') && (p[len] == 0 || p[len] == ','))
+			return true;
+	return false;
+}
+
+static void usage(const char *prg)
+{
+	fprintf(stderr, "Usage: %s [-m interp,predecode,jit] [-k alu,memcpy,fpu,branchy,file] [-n runs] [-s scale] [-f file]\n", prg);
+	exit(1);
+}
+
+int main(int argc, char **argv)
+{
+	const char *modes = NULL, *kernel_list = NULL, *file_name = NULL;
+	int runs = 3;
+	double scale = 1.0;
+	int opt;
+	while ((opt = getopt(argc, argv, "m:k:n:s:f:")) != -1) {
+		switch (opt) {
+			case 'm': modes = optarg; break;
+			case 'k': kernel_list = optarg; break;
+			case 'n': runs = atoi(optarg); break;
+			case 's': scale = atof(optarg); break;
+			case 'f': file_name = optarg; break;
+			default: usage(argv[0]);
+		}
+	}
+	if (runs < 1 || scale <= 0)
+		usage(argv[0]);
+
+	// The emulator core logs with printf(), so keep stdout for the results
+	// and send everything else to stderr
+	int results_fd = dup(STDOUT_FILENO);
+	if (results_fd >= 0 && (results = fdopen(results_fd, "w")) != NULL)
+		dup2(STDERR_FILENO, STDOUT_FILENO);
+	else
+		results = stdout;
+
+	// Code file
+	if (file_name) {
+		FILE *f = fopen(file_name, "rb");
+		if (f == NULL) {
+			perror(file_name);
+			return 1;
+		}
+		file_code = new uint8[SRC_ADDR - CODE_ADDR];
+		file_size = fread(file_code, 1, SRC_ADDR - CODE_ADDR, f);
+		fclose(f);
+	}
+
+	// Set up memory, like main_unix.cpp does
+	vm_init();
+	uint8 *ram_rom_area = (uint8 *)vm_acquire(BENCH_RAM_SIZE + BENCH_ROM_SIZE, VM_MAP_DEFAULT | VM_MAP_32BIT);
+	if (ram_rom_area == VM_MAP_FAILED) {
+		fprintf(stderr, "Cannot allocate Mac memory\n");
+		return 1;
+	}
+	RAMSize = BENCH_RAM_SIZE;
+	RAMBaseHost = ram_rom_area;
+	ROMSize = BENCH_ROM_SIZE;
+	ROMBaseHost = RAMBaseHost + RAMSize;
+#if DIRECT_ADDRESSING
+	MEMBaseDiff = (uintptr)RAMBaseHost;
+	RAMBaseMac = 0;
+	ROMBaseMac = Host2MacAddr(ROMBaseHost);
+#endif
+
+	// The JIT compiler is only initialized if requested
+#if USE_JIT
+	jit_pref = selected(modes, "jit");
+#endif
+	if (!Init680x0()) {
+		fprintf(stderr, "Cannot initialize 68k emulation\n");
+		return 1;
+	}
+	m68k_reset();
+#if USE_JIT
+	// Turn on the instruction cache, as MacOS would with the CACR
+	if (UseJIT)
+		set_cache_state(1);
+#endif
+
+	bool ok = true;
+	for (int i = 0; i < NUM_KERNELS; i++) {
+		kernel &k = kernels[i];
+		if (k.code == NULL && file_code == NULL)
+			continue;
+		if (!selected(kernel_list, k.name))
+			continue;
+		uint32 count = uint32(k.count * scale);
+		if (count == 0)
+			count = 1;
+
+		load(k);
+#if USE_JIT
+		if (UseJIT)
+			flush_icache(0);
+#endif
+#if M68K_DECODE_CACHE
+		m68k_use_decode_cache = false;
+#endif
+		setup(k, count);
+		uint64 insns = count_insns();
+		uint32 ref_sum = checksum();
+
+		for (int mode = MODE_INTERP; mode <= MODE_JIT; mode++) {
+			if (!selected(modes, mode_names[mode]))
+				continue;
+#if !M68K_DECODE_CACHE
+			if (mode == MODE_PREDECODE)
+				continue;
+#endif
+#if USE_JIT
+			if (mode == MODE_JIT && !UseJIT)
+				continue;
+#else
+			if (mode == MODE_JIT)
+				continue;
+#endif
+			ok &= bench(k, count, mode, runs, insns, ref_sum);
+		}
+	}
+
+	Exit680x0();
+	vm_release(ram_rom_area, BENCH_RAM_SIZE + BENCH_ROM_SIZE);
+	vm_exit();
+	return ok ? 0 : 1;
+}
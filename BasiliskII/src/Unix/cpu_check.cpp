@@ -0,0 +1,1105 @@
+/*
+ *  cpu_check.cpp - Differential testing of the 68k JIT compiler
+ *
+ *  Basilisk II (C) 1997-2008 Christian Bauer
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+/*
+ *  Random basic blocks are run from the same initial registers and
+ *  memory through the interpreter (cpufunctbl[]) and the JIT compiler,
+ *  on a bare RAM area like cpu_bench. Both must leave the same registers
+ *  and memory behind, the first block that does not is reduced to the
+ *  smallest instruction sequence that still diverges, and printed with
+ *  a disassembly and the differences.
+ *
+ *  Integer instructions are random opcodes accepted by table68k, with
+ *  extension words made up for their addressing modes. Instructions
+ *  that change the control flow, the supervisor state or the caches are
+ *  left out. Address registers used as a base are loaded with a "lea"
+ *  into a scratch area right before the instruction, and indexed modes
+ *  only use address registers as index. FPU instructions are arithmetic
+ *  ones on FP registers, data registers and memory. The FP registers,
+ *  FPCR and FPSR are loaded by a prologue and stored by an epilogue,
+ *  which is also run by the handler of all exceptions.
+ *
+ *  Blocks are translated after a few runs only, so the JIT run is
+ *  repeated from the initial state until the block was translated. A
+ *  raw code file can be checked as a whole with -f, it must end with
+ *  M68K_EXEC_RETURN (0x7100).
+ *
+ *  The checks are repeated for each JIT configuration selected with -c
+ *  (all by default), a set of JIT prefs that the prefs glue returns.
+ *  The JIT compiler only reads its prefs once, so every configuration
+ *  is checked in a child process of its own.
+ *
+ *  Known differences are ignored unless -S (strict) is given. Blocks
+ *  that get a NaN from an FPU instruction in the interpreter are not
+ *  reported, since the JIT compiler stores the x87 default NaN where
+ *  the interpreter stores the 68881 one, and the difference spreads
+ *  from there. FP registers are not loaded with NaNs, nor with
+ *  infinities, which the x87 takes as invalid operands without the
+ *  integer bit, and the interpreter as NaNs with it. Instructions that
+ *  leave some flags undefined (in table68k, or N and Z after a division
+ *  overflow), shifts and rotates by a register count (the JIT compiler
+ *  does not handle counts of 0 and 32-63 like the 68k) and FPU
+ *  instructions that round to single or double precision are not
+ *  generated. The FPCR rounding mode is left to nearest (the JIT
+ *  compiler does not handle FPCR) and the exception handler clears the
+ *  condition codes, which are undefined after a division by zero.
+ *
+ *  The "sse" configuration compiles FPU instructions to SSE2 code, which
+ *  keeps FP registers as doubles. There, the initial FP registers hold
+ *  doubles, and every FPU instruction that writes an FP register is
+ *  followed by a round trip of that register through a double in memory,
+ *  which rounds the interpreter's result as well. Rounding to extended
+ *  and then to double is not always the same as rounding to double right
+ *  away, so FP registers and doubles in memory only have to agree to 48
+ *  bits, and blocks with values out of the double range are not reported
+ *  unless strict.
+ *
+ *  Usage: cpu_check [-c configs] [-n blocks] [-l insns] [-s seed] [-u int,fpu] [-e errors] [-f file] [-S] [-v]
+ */
+
+#include "sysdeps.h"
+
+#include <unistd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <math.h>
+#include <sys/wait.h>
+
+#include <vector>
+
+#include "cpu_emulation.h"
+#include "main.h"
+#include "prefs.h"
+#include "emul_op.h"
+#include "vm_alloc.h"
+#include "m68k.h"
+#include "memory.h"
+#include "readcpu.h"
+#include "newcpu.h"
+#include "compiler/compemu.h"
+#include "fpu/fpu.h"
+
+#if ENABLE_MON
+#include "mon.h"
+#include "mon_disass.h"
+#endif
+
+// From newcpu.cpp
+extern bool quit_program;
+
+// Memory layout
+static const uint32 CHECK_RAM_SIZE = 0x100000;		// 1 MB RAM
+static const uint32 CHECK_ROM_SIZE = 0x10000;		// Empty ROM area
+static const uint32 SCRATCH_SIZE = 0x20000;			// Memory accessed by the block, from 0
+static const uint32 AREG_BASE = 0x8000;				// Base addresses are AREG_BASE..AREG_BASE+0x7ffe
+static const uint32 STACK_ADDR = 0x1c000;			// Initial stack pointer
+static const uint32 FP_INIT_ADDR = 0x48000;			// FP registers, FPCR and FPSR loaded by the prologue
+static const uint32 FP_OUT_ADDR = 0x48100;			// ... stored by the epilogue
+static const uint32 FP_STATE_SIZE = 8 * 12 + 8;
+static const uint32 ROUND_ADDR = 0x48200;			// Double for rounding FP results
+static const uint32 VBR_ADDR = 0x4c000;				// Exception vectors
+static const uint32 HANDLER_ADDR = 0x4c400;			// Handler of all exceptions
+static const uint32 CODE_ADDR = 0x50000;			// Block code
+static const uint32 MAX_CODE_SIZE = 0x10000;
+
+// Number of JIT runs, blocks are translated on their 10th execution
+static const int JIT_RUNS = 12;
+
+static bool strict = false;
+
+// JIT configurations, by the boolean prefs that are set
+struct jit_config {
+	const char *name;
+	const char *prefs;
+	bool double_fp;		// JIT compiler keeps FP registers as doubles
+};
+
+static const jit_config jit_configs[] = {
+	{"default", "jit,jitfpu,jitlazyflush,jitinline", false},	// Emulator defaults
+	{"hardflush", "jit,jitfpu,jitinline", false},
+	{"nofpu", "jit,jitlazyflush,jitinline", false},			// FPU instructions interpreted
+	{"noinline", "jit,jitfpu,jitlazyflush", false},
+	{"sse", "jit,jitfpu,jitfpusse,jitlazyflush,jitinline", true}
+};
+static const int NUM_JIT_CONFIGS = sizeof(jit_configs) / sizeof(jit_configs[0]);
+
+static const jit_config *config;		// Configuration being checked
+
+static bool selected(const char *list, const char *name);
+
+
+/*
+ *  Glue to the rest of Basilisk II
+ */
+
+int CPUType = 4;
+int FPUType = 1;
+uint32 InterruptFlags = 0;
+
+void EmulOp(uint16 opcode, M68kRegisters *r)
+{
+	fprintf(stderr, "Unexpected EMUL_OP %04x at %08x\n", opcode, m68k_getpc());
+	quit_program = true;
+}
+
+void idle_resume(void)
+{
+}
+
+bool PrefsFindBool(const char *name)
+{
+	return config && selected(config->prefs, name);
+}
+
+int32 PrefsFindInt32(const char *name)
+{
+	if (strcmp(name, "jitcachesize") == 0)
+		return 8192;
+	return 0;
+}
+
+const char *PrefsFindString(const char *name, int index)
+{
+	return NULL;
+}
+
+#if ENABLE_MON
+static uint32 mon_read_byte_check(uintptr adr)
+{
+	return ReadMacInt8(adr);
+}
+#endif
+
+
+/*
+ *  Pseudo-random numbers (xorshift32), so that a seed gives the same
+ *  blocks everywhere
+ */
+
+static uint32 random_state;
+
+static void seed_random(uint32 seed)
+{
+	random_state = seed * 0x9e3779b9 + 0x7f4a7c15;
+	if (random_state == 0)
+		random_state = 1;
+}
+
+static uint32 random32(void)
+{
+	random_state ^= random_state << 13;
+	random_state ^= random_state >> 17;
+	random_state ^= random_state << 5;
+	return random_state;
+}
+
+static uint32 random_below(uint32 n)
+{
+	return random32() % n;
+}
+
+
+/*
+ *  Block generation
+ */
+
+// One instruction of a block, with the "lea" instructions setting up its address registers
+struct block_insn {
+	std::vector<uint16> setup;
+	std::vector<uint16> code;
+};
+
+typedef std::vector<block_insn> block;
+
+// Address registers set up for the current instruction
+static int areg_kind[8];
+enum { AREG_FREE, AREG_BASE_REG, AREG_INDEX_REG };
+
+static void set_areg(block_insn &bi, int reg, int kind)
+{
+	if (areg_kind[reg] != AREG_FREE)
+		return;
+	areg_kind[reg] = kind;
+	if (kind == AREG_BASE_REG) {
+		uint32 addr = AREG_BASE + (random_below(0x8000) & ~1);
+		bi.setup.push_back(0x41f9 | (reg << 9));		// lea addr.L,An
+		bi.setup.push_back(addr >> 16);
+		bi.setup.push_back(addr & 0xffff);
+	} else {
+		bi.setup.push_back(0x41f8 | (reg << 9));		// lea addr.W,An
+		bi.setup.push_back(random_below(0x100));
+	}
+}
+
+static bool is_memory_mode(int mode)
+{
+	return mode == Aind || mode == Aipi || mode == Apdi || mode == Ad16 || mode == Ad8r;
+}
+
+// Brief extension word, with an address register other than a base as index
+static uint16 index_extension(block_insn &bi)
+{
+	int reg;
+	do {
+		reg = random_below(7);
+	} while (areg_kind[reg] == AREG_BASE_REG);
+	set_areg(bi, reg, AREG_INDEX_REG);
+	return 0x8000 | (reg << 12) | (random32() & 0x0eff);
+}
+
+static void add_long(block_insn &bi, uint32 v)
+{
+	bi.code.push_back(v >> 16);
+	bi.code.push_back(v & 0xffff);
+}
+
+static void add_ea_extension(block_insn &bi, int mode, int size)
+{
+	switch (mode) {
+	case Ad16:
+	case PC16:
+		bi.code.push_back(random32());
+		break;
+	case Ad8r:
+	case PC8r:
+		bi.code.push_back(index_extension(bi));
+		break;
+	case absw:
+		bi.code.push_back(random_below(0x8000));
+		break;
+	case absl:
+		add_long(bi, random_below(SCRATCH_SIZE - 0x100));
+		break;
+	case imm:
+		if (size == sz_long)
+			add_long(bi, random32());
+		else
+			bi.code.push_back(size == sz_byte ? random32() & 0xff : random32());
+		break;
+	case imm0:
+		bi.code.push_back(random32() & 0xff);
+		break;
+	case imm1:
+		bi.code.push_back(random32());
+		break;
+	case imm2:
+		add_long(bi, random32());
+		break;
+	}
+}
+
+// Instructions left out of the blocks
+static bool is_excluded(const struct instr *ii)
+{
+	switch (ii->mnemo) {
+	case i_ILLG:
+	case i_TRAP: case i_RESET: case i_STOP: case i_RTE: case i_RTD: case i_RTS: case i_RTR:
+	case i_JSR: case i_JMP: case i_BSR: case i_Bcc: case i_DBcc: case i_TRAPcc:
+	case i_MOVEC2: case i_MOVE2C: case i_MOVES: case i_CAS2: case i_BKPT: case i_CALLM: case i_RTM:
+	case i_FPP: case i_FDBcc: case i_FScc: case i_FTRAPcc: case i_FBcc: case i_FSAVE: case i_FRESTORE:
+	case i_CINVL: case i_CINVP: case i_CINVA: case i_CPUSHL: case i_CPUSHP: case i_CPUSHA:
+	case i_MOVE16: case i_MMUOP: case i_EMULOP_RETURN: case i_EMULOP:
+		return true;
+	case i_ORSR: case i_ANDSR: case i_EORSR: case i_MV2SR:
+		return ii->size != sz_byte;			// Only the CCR forms
+	case i_BCHG: case i_BCLR: case i_BSET:
+		if (ii->dmode == PC16 || ii->dmode == PC8r)	// Not 68k instructions, and would modify the code
+			return true;
+		break;
+	}
+
+	// Some flags are undefined after these
+	if (!strict) {
+		switch (ii->mnemo) {
+		case i_ABCD: case i_SBCD: case i_NBCD: case i_NEGX: case i_CHK: case i_CHK2:
+		case i_DIVU: case i_DIVS: case i_DIVL:		// N and Z on overflow
+			return true;
+		case i_ASL: case i_ASR: case i_LSL: case i_LSR:
+		case i_ROL: case i_ROR: case i_ROXL: case i_ROXR:
+			// The JIT compiler takes register counts modulo 32 and
+			// does not clear C for a count of 0
+			if (ii->smode == Dreg)
+				return true;
+			break;
+		}
+	}
+
+	// A7 always points to the stack
+	return (ii->smode == Areg && ii->sreg == 7) || (ii->dmode == Areg && ii->dreg == 7);
+}
+
+static bool make_int_insn(block_insn &bi)
+{
+	uint16 opcode = random32();
+	const struct instr *ii = &table68k[opcode];
+	if (ii->clev > 3 || is_excluded(ii))
+		return false;
+
+	bi.code.push_back(opcode);
+	memset(areg_kind, 0, sizeof(areg_kind));
+	if (is_memory_mode(ii->smode))
+		set_areg(bi, ii->sreg, AREG_BASE_REG);
+	if (is_memory_mode(ii->dmode))
+		set_areg(bi, ii->dreg, AREG_BASE_REG);
+	if (ii->mnemo == i_UNLK)
+		set_areg(bi, ii->sreg, AREG_BASE_REG);
+
+	add_ea_extension(bi, ii->smode, ii->size);
+	add_ea_extension(bi, ii->dmode, ii->size);
+
+	// Instructions with an extension word (imm1 source) and special operands
+	switch (ii->mnemo) {
+	case i_MULL:
+	case i_DIVL:
+		bi.code[1] &= 0x7c07;
+		if ((bi.code[1] & 0x0400) && (bi.code[1] & 7) == ((bi.code[1] >> 12) & 7))
+			bi.code[1] ^= 1;				// 64 bit forms need two registers
+		break;
+	case i_CAS:
+		bi.code[1] &= 0x01c7;
+		break;
+	case i_CHK2:
+		bi.code[1] &= 0xf800;
+		break;
+	case i_MVMEL:
+		bi.code[1] &= 0x7fff;				// Not into A7
+		break;
+	case i_BFTST: case i_BFEXTU: case i_BFCHG: case i_BFEXTS:
+	case i_BFCLR: case i_BFFFO: case i_BFSET: case i_BFINS:
+		bi.code[1] &= ii->dmode == Dreg ? 0x7fff : 0x77ff;	// Constant offset into memory
+		break;
+	case i_LINK: {
+		// Keep the stack in the scratch area
+		int32 disp = (int32)(random32() & 0x7fe) - 0x400;
+		if (ii->dmode == imm2) {
+			bi.code[1] = disp >> 16;
+			bi.code[2] = disp;
+		} else
+			bi.code[1] = disp;
+		break;
+	}
+	case i_PACK:
+	case i_UNPK:
+		bi.code.push_back(random32());		// Adjustment
+		break;
+	}
+	return true;
+}
+
+// FPU arithmetic, on FP registers, data registers and memory. The JIT
+// compiler does not round to single or double precision, the explicit
+// rounding forms (FSGLxxx, FSxxx, FDxxx) are only used in strict mode
+static const uint8 fpu_opmodes[] = {
+	0x00, 0x01, 0x03, 0x04, 0x18, 0x1a,			// fmove fint fintrz fsqrt fabs fneg
+	0x20, 0x22, 0x23, 0x28, 0x38, 0x3a,			// fdiv fadd fmul fsub fcmp ftst
+	0x24, 0x27,									// fsgldiv fsglmul
+	0x40, 0x41, 0x44, 0x45, 0x58, 0x5a, 0x5c, 0x5e,	// fsmove fssqrt fdmove fdsqrt fsabs fsneg fdabs fdneg
+	0x60, 0x62, 0x63, 0x64, 0x66, 0x67, 0x68, 0x6c	// fsdiv fsadd fsmul fddiv fdadd fdmul fssub fdsub
+};
+static const int NUM_EXACT_FPU_OPMODES = 12;
+
+static const uint8 fpu_int_formats[] = {0, 1, 4, 6};	// Long, single, word, byte
+
+static bool make_fpu_insn(block_insn &bi)
+{
+	int opmode = fpu_opmodes[random_below(strict ? sizeof(fpu_opmodes) : NUM_EXACT_FPU_OPMODES)];
+	int fmt = fpu_int_formats[random_below(sizeof(fpu_int_formats))];
+	int src = random_below(8), dst = random_below(8);
+	int reg = random_below(8);
+	bool writes_dst = opmode != 0x38 && opmode != 0x3a;	// Not fcmp or ftst
+	memset(areg_kind, 0, sizeof(areg_kind));
+	switch (random_below(5)) {
+	case 0:
+	case 1:		// fop.x fpm,fpn
+		bi.code.push_back(0xf200);
+		bi.code.push_back((src << 10) | (dst << 7) | opmode);
+		break;
+	case 2:		// fop.<fmt> dn,fpn
+		bi.code.push_back(0xf200 | reg);
+		bi.code.push_back(0x4000 | (fmt << 10) | (dst << 7) | opmode);
+		break;
+	case 3:		// fmove.<fmt> fpm,dn
+		bi.code.push_back(0xf200 | reg);
+		bi.code.push_back(0x6000 | (fmt << 10) | (src << 7));
+		writes_dst = false;
+		break;
+	case 4:		// fop.d d16(an),fpn or fmove.d fpm,d16(an)
+		reg = random_below(7);
+		set_areg(bi, reg, AREG_BASE_REG);
+		bi.code.push_back(0xf228 | reg);
+		if (random_below(2))
+			bi.code.push_back(0x5400 | (dst << 7) | opmode);
+		else {
+			bi.code.push_back(0x7400 | (src << 7));
+			writes_dst = false;
+		}
+		bi.code.push_back(random32() & 0x7ff8);
+		break;
+	}
+
+	// If the JIT compiler keeps FP registers as doubles, round the
+	// result to double in the interpreter too, so that both go on with
+	// the same value
+	if (config->double_fp && writes_dst) {
+		const uint16 code[] = {
+			0xf239, (uint16)(0x7400 | (dst << 7)), ROUND_ADDR >> 16, ROUND_ADDR & 0xffff,	// fmove.d fpn,ROUND_ADDR
+			0xf239, (uint16)(0x5400 | (dst << 7)), ROUND_ADDR >> 16, ROUND_ADDR & 0xffff	// fmove.d ROUND_ADDR,fpn
+		};
+		bi.code.insert(bi.code.end(), code, code + sizeof(code) / sizeof(code[0]));
+	}
+	return true;
+}
+
+static void make_block(block &b, int max_insns, bool use_int, bool use_fpu)
+{
+	b.clear();
+	int n = 1 + random_below(max_insns);
+	while ((int)b.size() < n) {
+		block_insn bi;
+		bool fpu = use_fpu && (!use_int || random_below(4) == 0);
+		if (fpu ? make_fpu_insn(bi) : make_int_insn(bi))
+			b.push_back(bi);
+	}
+}
+
+
+/*
+ *  Code layout: prologue, block, epilogue and M68K_EXEC_RETURN
+ */
+
+static uint32 write_code(uint32 addr, const uint16 *code, int n)
+{
+	for (int i = 0; i < n; i++, addr += 2)
+		WriteMacInt16(addr, code[i]);
+	return addr;
+}
+
+static uint32 write_prologue(uint32 addr)
+{
+	const uint16 code[] = {
+		0xf239, 0xd0ff, FP_INIT_ADDR >> 16, FP_INIT_ADDR & 0xffff,				// fmovem.x FP_INIT_ADDR,fp0-fp7
+		0xf239, 0x9000, (FP_INIT_ADDR + 96) >> 16, (FP_INIT_ADDR + 96) & 0xffff,	// fmove.l FP_INIT_ADDR+96,fpcr
+		0xf239, 0x8800, (FP_INIT_ADDR + 100) >> 16, (FP_INIT_ADDR + 100) & 0xffff	// fmove.l FP_INIT_ADDR+100,fpsr
+	};
+	return write_code(addr, code, sizeof(code) / sizeof(code[0]));
+}
+
+static uint32 write_epilogue(uint32 addr)
+{
+	const uint16 code[] = {
+		0xf239, 0xa800, (FP_OUT_ADDR + 100) >> 16, (FP_OUT_ADDR + 100) & 0xffff,	// fmove.l fpsr,FP_OUT_ADDR+100
+		0xf239, 0xb000, (FP_OUT_ADDR + 96) >> 16, (FP_OUT_ADDR + 96) & 0xffff,	// fmove.l fpcr,FP_OUT_ADDR+96
+		0xf239, 0xf0ff, FP_OUT_ADDR >> 16, FP_OUT_ADDR & 0xffff,				// fmovem.x fp0-fp7,FP_OUT_ADDR
+		M68K_EXEC_RETURN
+	};
+	return write_code(addr, code, sizeof(code) / sizeof(code[0]));
+}
+
+// Load block, returns the address range of the block itself
+static void load_block(const block &b, uint32 &start, uint32 &end)
+{
+	start = write_prologue(CODE_ADDR);
+	end = start;
+	for (size_t i = 0; i < b.size(); i++) {
+		end = write_code(end, &b[i].setup[0], b[i].setup.size());
+		end = write_code(end, &b[i].code[0], b[i].code.size());
+	}
+	write_epilogue(end);
+	flush_icache(0);
+}
+
+static void print_code(uint32 start, uint32 end)
+{
+	for (uint32 addr = start; addr < end; ) {
+		printf("  %08x: ", addr);
+#if ENABLE_MON
+		addr += disass_68k(stdout, addr);
+#else
+		printf("%04x\n", ReadMacInt16(addr));
+		addr += 2;
+#endif
+	}
+}
+
+
+/*
+ *  Register and memory state
+ */
+
+struct check_state {
+	uint32 d[8], a[8];
+	uint32 usp, sr, pc;
+};
+
+struct check_result {
+	check_state regs;
+	uint8 mem[SCRATCH_SIZE];
+	uint8 fp[FP_STATE_SIZE];
+};
+
+static uint8 scratch_init[SCRATCH_SIZE];
+static uint8 fp_init[FP_STATE_SIZE];
+static check_result interp_result, jit_result;
+
+// Store double value "v" as extended precision
+static void put_extended(uint8 *p, uint64 v)
+{
+	uint32 se = (v >> 48) & 0x8000;
+	int e = (v >> 52) & 0x7ff;
+	uint64 m = v & UVAL64(0x000fffffffffffff);
+	uint64 mant;
+	if (e == 0)
+		mant = 0;
+	else if (e == 0x7ff) {
+		se |= 0x7fff;
+		mant = m ? (UVAL64(1) << 63) | (m << 11) : 0;
+	} else {
+		se |= e - 1023 + 16383;
+		mant = (UVAL64(1) << 63) | (m << 11);
+	}
+	p[0] = se >> 8;
+	p[1] = se;
+	p[2] = p[3] = 0;
+	for (int i = 0; i < 8; i++)
+		p[4 + i] = mant >> (56 - 8 * i);
+}
+
+static void random_state_values(check_state &s)
+{
+	static const uint32 reg_values[] = {
+		0, 1, 2, 0x7f, 0x80, 0xff, 0x7fff, 0x8000, 0xffff,
+		0x7fffffff, 0x80000000, 0x80000001, 0xfffffffe, 0xffffffff
+	};
+	static const uint64 fp_values[] = {
+		UVAL64(0x0000000000000000), UVAL64(0x8000000000000000),	// +/-0
+		UVAL64(0x3ff0000000000000), UVAL64(0xbff0000000000000),	// +/-1
+		UVAL64(0x7ff0000000000000), UVAL64(0xfff0000000000000),	// +/-Inf
+		UVAL64(0x7ff8000000000000), UVAL64(0x3fe0000000000000),	// NaN, 0.5
+		UVAL64(0x41e0000000000000), UVAL64(0xc1e0000000200000),	// 2^31, -(2^31+1)
+		UVAL64(0x40dfffc000000000), UVAL64(0x405fc00000000000)	// 32767, 127
+	};
+	static const int NUM_REG_VALUES = sizeof(reg_values) / sizeof(reg_values[0]);
+	static const int NUM_FP_VALUES = sizeof(fp_values) / sizeof(fp_values[0]);
+
+	for (int i = 0; i < 8; i++) {
+		switch (random_below(4)) {
+		case 0: s.d[i] = reg_values[random_below(NUM_REG_VALUES)]; break;
+		case 1: s.d[i] = (int8)random32(); break;
+		default: s.d[i] = random32(); break;
+		}
+		s.a[i] = random32();
+	}
+	s.a[7] = STACK_ADDR - (random_below(0x800) & ~1);
+	s.usp = random32();
+	s.sr = 0x2700 | (random32() & 0x1f);
+	s.pc = CODE_ADDR;
+
+	// FP registers, FPCR (rounding mode only) and FPSR
+	for (int i = 0; i < 8; i++) {
+		uint8 *p = fp_init + i * 12;
+		if (random_below(3) == 0) {
+			uint64 v;
+			do {
+				v = fp_values[random_below(NUM_FP_VALUES)];
+			} while (!strict && (v << 1) >= UVAL64(0xffe0000000000000));	// No infinities or NaNs, see above
+			put_extended(p, v);
+		} else {
+			// Random sign and mantissa, exponent around 1.0
+			uint32 se = (random32() & 0x8000) | (0x3fff - 40 + random_below(80));
+			p[0] = se >> 8;
+			p[1] = se;
+			p[2] = p[3] = 0;
+			p[4] = 0x80 | random32();
+			for (int j = 5; j < 12; j++)
+				p[j] = random32();
+			if (config->double_fp) {
+				p[10] &= 0xf8;		// Round toward zero to 53 bits
+				p[11] = 0;
+			}
+		}
+	}
+	memset(fp_init + 96, 0, 8);
+	if (strict)
+		fp_init[99] = random32() & 0x30;
+}
+
+
+/*
+ *  Run code from a state through the interpreter or the JIT compiler
+ */
+
+static void run_once(const check_state &init, bool jit)
+{
+	memcpy(RAMBaseHost, scratch_init, SCRATCH_SIZE);
+	Host2Mac_memcpy(FP_INIT_ADDR, fp_init, FP_STATE_SIZE);
+	Mac_memset(FP_OUT_ADDR, 0, FP_STATE_SIZE);
+
+	fpu_reset();
+	regs.s = 1;
+	regs.m = 0;
+	regs.sr = init.sr;
+	MakeFromSR();
+	for (int i = 0; i < 8; i++) {
+		m68k_dreg(regs, i) = init.d[i];
+		m68k_areg(regs, i) = init.a[i];
+	}
+	regs.usp = init.usp;
+	regs.vbr = VBR_ADDR;
+	m68k_setpc(init.pc);
+	fill_prefetch_0();
+	quit_program = false;
+
+#if USE_JIT
+	if (jit)
+		m68k_compile_execute();
+	else
+#endif
+	m68k_execute();
+	SPCFLAGS_INIT(0);
+}
+
+static void run(const check_state &init, bool jit, check_result &r)
+{
+	for (int i = 0; i < (jit ? JIT_RUNS : 1); i++)
+		run_once(init, jit);
+
+	MakeSR();
+	for (int i = 0; i < 8; i++) {
+		r.regs.d[i] = m68k_dreg(regs, i);
+		r.regs.a[i] = m68k_areg(regs, i);
+	}
+	r.regs.usp = regs.usp;
+	r.regs.sr = regs.sr;
+	r.regs.pc = m68k_getpc();
+	memcpy(r.mem, RAMBaseHost, SCRATCH_SIZE);
+	Mac2Host_memcpy(r.fp, FP_OUT_ADDR, FP_STATE_SIZE);
+}
+
+static inline uint32 get_be32(const uint8 *p)
+{
+	return (p[0] << 24) | (p[1] << 16) | (p[2] << 8) | p[3];
+}
+
+static inline bool is_nan(const uint8 *p)
+{
+	if ((get_be32(p) & 0x7fff0000) != 0x7fff0000)
+		return false;
+	return (get_be32(p + 4) & 0x7fffffff) != 0 || get_be32(p + 8) != 0;
+}
+
+static long double get_extended(const uint8 *p)
+{
+	int e = (get_be32(p) >> 16) & 0x7fff;
+	uint64 m = ((uint64)get_be32(p + 4) << 32) | get_be32(p + 8);
+	long double v = ldexpl((long double)m, e - 16383 - 63);
+	return (p[0] & 0x80) ? -v : v;
+}
+
+// Check whether the JIT result "y" is the interpreter result "x" in
+// double precision, give or take a few rounding errors along the way
+static bool close_to_double(const uint8 *x, const uint8 *y)
+{
+	if ((get_be32(x) & 0x7fff0000) == 0x7fff0000 || (get_be32(y) & 0x7fff0000) == 0x7fff0000)
+		return false;	// Infinity or NaN
+	long double a = get_extended(x), b = get_extended(y);
+	return fabsl(a - b) <= fabsl(a) * 0x1p-48L;
+}
+
+// Check whether the long at "offset" differs only within a double that
+// is close to the interpreter's one, as stored by fmove.d
+static bool close_to_double_in_memory(const uint8 *x, const uint8 *y, uint32 offset)
+{
+	uint32 first = offset, last = offset + 3;
+	while (x[first] == y[first])
+		first++;
+	while (x[last] == y[last])
+		last--;
+	for (uint32 start = offset & ~1; start + 6 >= offset; start -= 2) {
+		if (start > first || start + 8 <= last || start + 8 > SCRATCH_SIZE)
+			continue;
+		uint64 u = ((uint64)get_be32(x + start) << 32) | get_be32(x + start + 4);
+		uint64 v = ((uint64)get_be32(y + start) << 32) | get_be32(y + start + 4);
+		uint8 ux[12], vx[12];
+		put_extended(ux, u);
+		put_extended(vx, v);
+		if (close_to_double(ux, vx))
+			return true;
+		if (start == 0)
+			break;
+	}
+	return false;
+}
+
+// Compare results, print differences if "verbose", returns the number of differences
+static int compare(const check_state &init, const check_result &a, const check_result &b, bool verbose)
+{
+	int diffs = 0;
+#define DIFF(NAME, FMT, INIT, A, B) do {									\
+		diffs++;															\
+		if (verbose)														\
+			printf("  %-6s initial " FMT "  interp " FMT "  jit " FMT "\n",	\
+				   NAME, INIT, A, B);										\
+	} while (0)
+
+	char name[16];
+	for (int i = 0; i < 8; i++) {
+		if (a.regs.d[i] != b.regs.d[i]) {
+			sprintf(name, "d%d", i);
+			DIFF(name, "%08x", init.d[i], a.regs.d[i], b.regs.d[i]);
+		}
+	}
+	for (int i = 0; i < 8; i++) {
+		if (a.regs.a[i] != b.regs.a[i]) {
+			sprintf(name, "a%d", i);
+			DIFF(name, "%08x", init.a[i], a.regs.a[i], b.regs.a[i]);
+		}
+	}
+	if (a.regs.usp != b.regs.usp)
+		DIFF("usp", "%08x", init.usp, a.regs.usp, b.regs.usp);
+	if (a.regs.sr != b.regs.sr)
+		DIFF("sr", "%04x", init.sr, a.regs.sr, b.regs.sr);
+	if (a.regs.pc != b.regs.pc)
+		DIFF("pc", "%08x", init.pc, a.regs.pc, b.regs.pc);
+
+	// FP registers, by sign/exponent and mantissa
+	for (int i = 0; i < 8; i++) {
+		const uint8 *x = a.fp + i * 12, *y = b.fp + i * 12, *z = fp_init + i * 12;
+		if (memcmp(x, y, 12) == 0 || (!strict && is_nan(x) && is_nan(y)))
+			continue;
+		if (config->double_fp && close_to_double(x, y))
+			continue;
+		diffs++;
+		if (verbose)
+			printf("  fp%d    initial %04x:%08x%08x  interp %04x:%08x%08x  jit %04x:%08x%08x\n", i,
+				   get_be32(z) >> 16, get_be32(z + 4), get_be32(z + 8),
+				   get_be32(x) >> 16, get_be32(x + 4), get_be32(x + 8),
+				   get_be32(y) >> 16, get_be32(y + 4), get_be32(y + 8));
+	}
+	if (memcmp(a.fp + 96, b.fp + 96, 4) != 0)
+		DIFF("fpcr", "%08x", get_be32(fp_init + 96), get_be32(a.fp + 96), get_be32(b.fp + 96));
+	if (memcmp(a.fp + 100, b.fp + 100, 4) != 0)
+		DIFF("fpsr", "%08x", get_be32(fp_init + 100), get_be32(a.fp + 100), get_be32(b.fp + 100));
+
+	// Memory, by longs
+	for (uint32 i = 0; i < SCRATCH_SIZE; i += 4) {
+		if (memcmp(a.mem + i, b.mem + i, 4) != 0) {
+			if (config->double_fp && close_to_double_in_memory(a.mem, b.mem, i))
+				continue;
+			sprintf(name, "%05x", i);
+			DIFF(name, "%08x", get_be32(scratch_init + i), get_be32(a.mem + i), get_be32(b.mem + i));
+		}
+	}
+#undef DIFF
+	return diffs;
+}
+
+static int check_code(const check_state &init, bool verbose)
+{
+	run(init, false, interp_result);
+	run(init, true, jit_result);
+	return compare(init, interp_result, jit_result, verbose);
+}
+
+// Check whether an FP register holds a finite, non-zero value outside
+// the range of normalized doubles
+static bool out_of_double_range(const uint8 *p)
+{
+	int e = (get_be32(p) >> 16) & 0x7fff;
+	if (e == 0x7fff || (e == 0 && get_be32(p + 4) == 0 && get_be32(p + 8) == 0))
+		return false;
+	return e - 16383 > 1023 || e - 16383 < -1022;
+}
+
+// Check whether one of the FPU instructions of the block yields a NaN
+// in the interpreter, by running the block up to each of them. With
+// double precision FP registers in the JIT compiler, values out of the
+// double range count as well, as they overflow or lose precision there.
+static bool makes_nan(const block &b, const check_state &init)
+{
+	block part;
+	uint32 start, end;
+	for (size_t i = 0; i < b.size(); i++) {
+		part.push_back(b[i]);
+		if ((b[i].code[0] & 0xf000) != 0xf000)
+			continue;
+		load_block(part, start, end);
+		run(init, false, interp_result);
+		if (get_be32(interp_result.fp + 100) & 0x01000000)	// FPSR NAN condition code
+			return true;
+		for (int r = 0; config->double_fp && r < 8; r++)
+			if (out_of_double_range(interp_result.fp + r * 12))
+				return true;
+	}
+	return false;
+}
+
+// Check whether the block diverges, NaNs don't count unless strict
+static bool block_diverges(const block &b, const check_state &init)
+{
+	uint32 start, end;
+	load_block(b, start, end);
+	if (check_code(init, false) == 0)
+		return false;
+	return strict || !makes_nan(b, init);
+}
+
+// Remove instructions as long as the block keeps diverging
+static void reduce_block(block &b, const check_state &init)
+{
+	bool reduced;
+	do {
+		reduced = false;
+		for (size_t i = 0; i < b.size() && b.size() > 1; i++) {
+			block_insn bi = b[i];
+			b.erase(b.begin() + i);
+			if (block_diverges(b, init)) {
+				reduced = true;
+				i--;
+			} else
+				b.insert(b.begin() + i, bi);
+		}
+	} while (reduced);
+}
+
+
+/*
+ *  Main program
+ */
+
+static bool selected(const char *list, const char *name)
+{
+	if (list == NULL)
+		return true;
+	size_t len = strlen(name);
+	for (const char *p = list; (p = strstr(p, name)) != NULL; p += len)
+		if ((p == list || p[-1] == ',') && (p[len] == 0 || p[len] == ','))
+			return true;
+	return false;
+}
+
+static void usage(const char *prg)
+{
+	fprintf(stderr, "Usage: %s [-c configs] [-n blocks] [-l insns] [-s seed] [-u int,fpu] [-e errors] [-f file] [-S] [-v]\n", prg);
+	fprintf(stderr, "Configurations:");
+	for (int i = 0; i < NUM_JIT_CONFIGS; i++)
+		fprintf(stderr, " %s", jit_configs[i].name);
+	fprintf(stderr, "\n");
+	exit(1);
+}
+
+// Options
+static const char *file_name = NULL;
+static int num_blocks = 10000, max_insns = 16, max_errors = 10;
+static uint32 seed;
+static bool verbose = false;
+static bool use_int, use_fpu;
+
+static uint8 file_code[MAX_CODE_SIZE];
+static uint32 file_size = 0;
+
+// Check the code file or random blocks with one JIT configuration, returns the number of errors
+static int check_config(void)
+{
+	printf("Configuration %s (%s):\n", config->name, config->prefs);
+	fflush(stdout);
+
+	// Set up memory, like main_unix.cpp does
+	vm_init();
+	uint8 *ram_rom_area = (uint8 *)vm_acquire(CHECK_RAM_SIZE + CHECK_ROM_SIZE, VM_MAP_DEFAULT | VM_MAP_32BIT);
+	if (ram_rom_area == VM_MAP_FAILED) {
+		fprintf(stderr, "Cannot allocate Mac memory\n");
+		return 1;
+	}
+	RAMSize = CHECK_RAM_SIZE;
+	RAMBaseHost = ram_rom_area;
+	ROMSize = CHECK_ROM_SIZE;
+	ROMBaseHost = RAMBaseHost + RAMSize;
+#if DIRECT_ADDRESSING
+	MEMBaseDiff = (uintptr)RAMBaseHost;
+	RAMBaseMac = 0;
+	ROMBaseMac = Host2MacAddr(ROMBaseHost);
+#endif
+
+	if (!Init680x0()) {
+		fprintf(stderr, "Cannot initialize 68k emulation\n");
+		return 1;
+	}
+#if USE_JIT
+	if (!UseJIT)
+#endif
+	{
+		fprintf(stderr, "The JIT compiler is not available\n");
+		return 1;
+	}
+	m68k_reset();
+#if USE_JIT
+	set_cache_state(1);
+#endif
+#if M68K_DECODE_CACHE
+	m68k_use_decode_cache = false;
+#endif
+#if ENABLE_MON
+	mon_init();
+	mon_read_byte = mon_read_byte_check;
+#endif
+
+	// All exceptions store the FP registers and return
+	for (int i = 0; i < 256; i++)
+		WriteMacInt32(VBR_ADDR + i * 4, HANDLER_ADDR);
+	uint32 handler = HANDLER_ADDR;
+	if (!strict) {
+		const uint16 code[] = {
+			0x022f, 0x00e0, 0x0001,		// andi.b #$e0,1(a7)
+			0x44fc, 0x0000				// move #0,ccr
+		};
+		handler = write_code(handler, code, sizeof(code) / sizeof(code[0]));
+	}
+	write_epilogue(handler);
+
+	int errors = 0;
+	check_state init;
+	uint32 start, end;
+
+	// Code file, run as a whole from random registers
+	if (file_name) {
+		Host2Mac_memcpy(CODE_ADDR, file_code, file_size);
+		flush_icache(0);
+		seed_random(seed);
+		random_state_values(init);
+		for (uint32 i = 0; i < SCRATCH_SIZE; i++)
+			scratch_init[i] = random32();
+		if (check_code(init, false) != 0) {
+			printf("%s diverges (seed %u):\n", file_name, seed);
+			check_code(init, true);
+			errors++;
+		}
+		printf("%s: %s\n", file_name, errors ? "FAILED" : "ok");
+	}
+
+	// Random blocks
+	uint64 num_insns = 0;
+	int n;
+	for (n = 0; !file_name && n < num_blocks && errors < max_errors; n++) {
+		uint32 block_seed = seed + n;
+		seed_random(block_seed);
+		block b;
+		make_block(b, max_insns, use_int, use_fpu);
+		random_state_values(init);
+		for (uint32 i = 0; i < SCRATCH_SIZE; i++)
+			scratch_init[i] = random32();
+
+		num_insns += b.size();
+		if (verbose) {
+			load_block(b, start, end);
+			printf("Block %d (seed %u):\n", n, block_seed);
+			print_code(start, end);
+			fflush(stdout);
+		}
+		if (!block_diverges(b, init))
+			continue;
+
+		errors++;
+		load_block(b, start, end);
+		printf("Block %d (seed %u, reproduce with -c %s -s %u -n 1) diverges:\n", n, block_seed, config->name, block_seed);
+		print_code(start, end);
+		check_code(init, true);
+
+		reduce_block(b, init);
+		load_block(b, start, end);
+		printf("Reduced to:\n");
+		print_code(start, end);
+		check_code(init, true);
+		printf("\n");
+		fflush(stdout);
+	}
+	if (!file_name)
+		printf("%d blocks, %llu instructions, %d diverging\n", n, (unsigned long long)num_insns, errors);
+
+	Exit680x0();
+	vm_release(ram_rom_area, CHECK_RAM_SIZE + CHECK_ROM_SIZE);
+	vm_exit();
+	return errors;
+}
+
+int main(int argc, char **argv)
+{
+	const char *config_list = NULL, *unit_list = NULL;
+	seed = time(NULL);
+	int opt;
+	while ((opt = getopt(argc, argv, "c:n:l:s:u:e:f:Sv")) != -1) {
+		switch (opt) {
+			case 'c': config_list = optarg; break;
+			case 'n': num_blocks = atoi(optarg); break;
+			case 'l': max_insns = atoi(optarg); break;
+			case 's': seed = strtoul(optarg, NULL, 0); break;
+			case 'u': unit_list = optarg; break;
+			case 'e': max_errors = atoi(optarg); break;
+			case 'f': file_name = optarg; break;
+			case 'S': strict = true; break;
+			case 'v': verbose = true; break;
+			default: usage(argv[0]);
+		}
+	}
+	use_int = selected(unit_list, "int");
+	use_fpu = selected(unit_list, "fpu");
+	if (num_blocks < 1 || max_insns < 1 || max_insns > 1000 || !(use_int || use_fpu))
+		usage(argv[0]);
+
+	// Code file
+	if (file_name) {
+		FILE *f = fopen(file_name, "rb");
+		if (f == NULL) {
+			perror(file_name);
+			return 1;
+		}
+		file_size = fread(file_code, 1, MAX_CODE_SIZE, f);
+		fclose(f);
+	}
+
+	// Check each configuration in a child process
+	int checked = 0, failed = 0;
+	for (int i = 0; i < NUM_JIT_CONFIGS; i++) {
+		if (!selected(config_list, jit_configs[i].name))
+			continue;
+		checked++;
+		fflush(stdout);
+		pid_t pid = fork();
+		if (pid < 0) {
+			perror("fork");
+			return 1;
+		}
+		if (pid == 0) {
+			config = &jit_configs[i];
+			int errors = check_config();
+			fflush(stdout);
+			_exit(errors ? 1 : 0);
+		}
+		int status;
+		if (waitpid(pid, &status, 0) < 0 || !WIFEXITED(status) || WEXITSTATUS(status) != 0)
+			failed++;
+	}
+	if (checked == 0)
+		usage(argv[0]);
+	if (checked > 1)
+		printf("%d configurations, %d failed\n", checked, failed);
+	return failed ? 1 : 0;
+}
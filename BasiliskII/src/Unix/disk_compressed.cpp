@@ -0,0 +1,622 @@
+/*
+ *  disk_compressed.cpp - Chunked compressed disk images
+ *
+ *  Basilisk II (C) 1997-2008 Christian Bauer
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+/*
+ *  Compressed images are made from plain image files with the
+ *  compress_disk tool (see disk_compressed.h for the format). Every
+ *  opened image keeps an LRU cache of decompressed chunks, bounded by
+ *  the "diskchunkcache" pref (in MB). Misses are decompressed by the
+ *  reading thread together with a small pool of decompression threads
+ *  ("diskchunkthreads"), and sequential reads make the pool decompress
+ *  chunks ahead of the reader, in a window that grows while the reads
+ *  stay sequential.
+ *
+ *  The image file itself is never written. Writes go to a side log,
+ *  "<dir>/<image name>.log" if the "diskoverlay" pref names a directory
+ *  and "<image file>.log" otherwise; it holds whole chunks, appended
+ *  when a chunk is first written and updated in place afterwards. The
+ *  log records the full path of its image and is locked while the image
+ *  is open, so images with the same name in different directories can't
+ *  share one. With "diskoverlaymode" set to "discard" the log is deleted
+ *  on close; "commit" is not supported and keeps the log with a warning.
+ */
+
+#include "disk_unix.h"
+#include "disk_compressed.h"
+#include "prefs.h"
+#include "macos_util.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/file.h>
+#include <sys/stat.h>
+#include <algorithm>
+#include <deque>
+#include <list>
+#include <map>
+#include <vector>
+
+#define DEBUG 0
+#include "debug.h"
+
+static const char LOG_MAGIC[8] = {'B', '2', 'C', 'M', 'P', 'L', 'O', 'G'};
+static const uint32 LOG_VERSION = 2;
+
+static const int MAX_THREADS = 8;			// Decompression threads per image
+static const uint32 MAX_READAHEAD = 32;		// Chunks
+static const uint32 MIN_CACHE_CHUNKS = 16;
+
+// Side log file header, followed by records of one chunk of data and
+// its 64-bit chunk number. The chunk number comes last, so a record cut
+// short by a crash is ignored when the log is opened again. Integers are
+// little-endian, like in the image.
+struct log_header {
+	char magic[8];
+	uint32 version;
+	uint32 chunk_size;
+	uint64 image_size;
+	uint64 image_mtime;		// Modification time of image (must not change)
+	char image_path[PATH_MAX];	// Image (as returned by realpath())
+};
+
+static ssize_t pread_all(int fd, void *buf, size_t len, loff_t offset)
+{
+	char *p = (char *)buf;
+	size_t done = 0;
+	while (done < len) {
+		ssize_t n = pread(fd, p + done, len - done, offset + done);
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n <= 0)
+			break;
+		done += n;
+	}
+	return done;
+}
+
+static ssize_t pwrite_all(int fd, const void *buf, size_t len, loff_t offset)
+{
+	const char *p = (const char *)buf;
+	size_t done = 0;
+	while (done < len) {
+		ssize_t n = pwrite(fd, p + done, len - done, offset + done);
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n <= 0)
+			break;
+		done += n;
+	}
+	return done;
+}
+
+// Decompressed chunk in the cache
+struct chunk_entry {
+	enum state {
+		QUEUED,		// Waiting for a thread
+		BUSY,		// Being decompressed
+		READY,
+		FAILED
+	};
+
+	uint64 chunk;
+	state st;
+	int pins;		// Number of reads waiting for this chunk
+	std::list<chunk_entry *>::iterator lru;
+	std::vector<uint8> data;
+};
+
+struct disk_compressed : disk_generic {
+	disk_compressed(int fd, const cmp_header &h, std::vector<uint64> &idx)
+	: fd(fd), log_fd(-1), log_path(NULL), discard_log(false), log_end(0), h(h),
+		start_byte(0), real_size(h.image_size), last_end(-1), readahead(0),
+		num_threads(0), quit(false) {
+		index.swap(idx);
+		pthread_mutex_init(&lock, NULL);
+		pthread_cond_init(&work_cond, NULL);
+		pthread_cond_init(&ready_cond, NULL);
+
+		int32 mb = PrefsFindInt32("diskchunkcache");
+		max_chunks = std::max((uint64)MIN_CACHE_CHUNKS, (uint64)std::max(mb, 0) * 1024 * 1024 / h.chunk_size);
+	}
+
+	virtual ~disk_compressed() {
+		stop_threads();
+		for (std::map<uint64, chunk_entry *>::iterator i = cache.begin(); i != cache.end(); ++i)
+			delete i->second;
+		pthread_cond_destroy(&ready_cond);
+		pthread_cond_destroy(&work_cond);
+		pthread_mutex_destroy(&lock);
+		if (log_fd >= 0) {
+			close(log_fd);
+			if (discard_log) {
+				D(bug("compressed: removing log %s\n", log_path));
+				unlink(log_path);
+			}
+		}
+		free(log_path);
+		close(fd);
+	}
+
+	// Decompression threads, the reading thread helps them
+	void start_threads() {
+		int n = PrefsFindInt32("diskchunkthreads");
+		if (n <= 0) {
+			long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+			n = cpus > 1 ? std::min(cpus - 1, 4L) : 0;
+		}
+		n = std::min(n, MAX_THREADS);
+		for (int i = 0; i < n; i++) {
+			if (pthread_create(&threads[num_threads], NULL, thread_func, this) != 0)
+				break;
+			num_threads++;
+		}
+		D(bug("compressed: %d decompression threads\n", num_threads));
+	}
+
+	void stop_threads() {
+		pthread_mutex_lock(&lock);
+		quit = true;
+		pthread_cond_broadcast(&work_cond);
+		pthread_mutex_unlock(&lock);
+		for (int i = 0; i < num_threads; i++)
+			pthread_join(threads[i], NULL);
+		num_threads = 0;
+	}
+
+	// Set up the side log for writes, returns false on errors
+	bool open_log(const char *path, const struct stat &st) {
+		const char *dir = PrefsFindString("diskoverlay");
+		char log[PATH_MAX + 1];
+		int len;
+		if (dir) {
+			const char *name = strrchr(path, '/');
+			len = snprintf(log, PATH_MAX, "%s/%s.log", dir, name ? name + 1 : path);
+		} else
+			len = snprintf(log, PATH_MAX, "%s.log", path);
+		if (len >= PATH_MAX)
+			return false;
+		log_path = strdup(log);
+		const char *mode = PrefsFindString("diskoverlaymode");
+		discard_log = mode && strcmp(mode, "discard") == 0;
+		if (mode && strcmp(mode, "commit") == 0)
+			fprintf(stderr, "compressed: cannot commit changes to %s, keeping them in %s\n", path, log_path);
+
+		char image_path[PATH_MAX];
+		if (realpath(path, image_path) == NULL)
+			return false;
+
+		// log_fd is only set once the log is ours, so that a log that
+		// belongs to another image is never discarded on close
+		int lfd = open(log_path, O_RDWR | O_CREAT, 0644);
+		if (lfd < 0) {
+			fprintf(stderr, "compressed: cannot open log %s: %s\n", log_path, strerror(errno));
+			return false;
+		}
+		if (flock(lfd, LOCK_EX | LOCK_NB) < 0) {
+			fprintf(stderr, "compressed: log %s is already in use\n", log_path);
+			close(lfd);
+			return false;
+		}
+		log_header lh;
+		struct stat log_st;
+		if (fstat(lfd, &log_st) < 0) {
+			close(lfd);
+			return false;
+		}
+		if (log_st.st_size == 0) {
+			memset(&lh, 0, sizeof(lh));
+			memcpy(lh.magic, LOG_MAGIC, sizeof(lh.magic));
+			lh.version = cmp_le32(LOG_VERSION);
+			lh.chunk_size = cmp_le32(h.chunk_size);
+			lh.image_size = cmp_le64(h.image_size);
+			lh.image_mtime = cmp_le64(st.st_mtime);
+			strcpy(lh.image_path, image_path);
+			log_fd = lfd;
+			log_end = sizeof(lh);
+			return pwrite_all(log_fd, &lh, sizeof(lh), 0) == sizeof(lh);
+		}
+
+		// The log must belong to this image, which must not have been replaced behind our back
+		if (pread_all(lfd, &lh, sizeof(lh), 0) != sizeof(lh)
+		 || memcmp(lh.magic, LOG_MAGIC, sizeof(lh.magic)) != 0 || cmp_le32(lh.version) != LOG_VERSION
+		 || cmp_le32(lh.chunk_size) != h.chunk_size || cmp_le64(lh.image_size) != h.image_size) {
+			fprintf(stderr, "compressed: %s is not a log for %s\n", log_path, path);
+			close(lfd);
+			return false;
+		}
+		lh.image_path[sizeof(lh.image_path) - 1] = 0;
+		if (strcmp(lh.image_path, image_path) != 0) {
+			fprintf(stderr, "compressed: log %s belongs to %s, not %s\n", log_path, lh.image_path, image_path);
+			close(lfd);
+			return false;
+		}
+		if (cmp_le64(lh.image_mtime) != (uint64)st.st_mtime) {
+			fprintf(stderr, "compressed: image %s was modified after %s was created\n", path, log_path);
+			close(lfd);
+			return false;
+		}
+		log_fd = lfd;
+
+		// Find the chunks in the log, a later record of a chunk replaces an earlier one
+		const loff_t record_size = h.chunk_size + sizeof(uint64);
+		const uint64 records = (log_st.st_size - sizeof(lh)) / record_size;
+		for (uint64 r = 0; r < records; r++) {
+			loff_t pos = sizeof(lh) + r * record_size;
+			uint64 chunk;
+			if (pread_all(log_fd, &chunk, sizeof(chunk), pos + h.chunk_size) != sizeof(chunk))
+				return false;
+			chunk = cmp_le64(chunk);
+			if (chunk < num_chunks())
+				log_chunks[chunk] = pos;
+		}
+		log_end = sizeof(lh) + records * record_size;
+		D(bug("compressed: %s has %u chunks\n", log_path, (unsigned)log_chunks.size()));
+		return true;
+	}
+
+	void set_layout(loff_t start, loff_t size) {
+		start_byte = start;
+		real_size = size;
+	}
+
+	virtual bool is_read_only() { return log_fd < 0; }
+	virtual loff_t size() { return real_size; }
+	virtual bool has_cache() { return true; }
+
+	virtual size_t read(void *buf, loff_t offset, size_t length) {
+		if (offset >= real_size)
+			return 0;
+		length = std::min((loff_t)length, real_size - offset);
+		return read_image(buf, offset + start_byte, length);
+	}
+
+	virtual size_t write(void *buf, loff_t offset, size_t length) {
+		if (log_fd < 0 || offset >= real_size)
+			return 0;
+		length = std::min((loff_t)length, real_size - offset);
+		offset += start_byte;
+
+		const uint8 *b = (const uint8 *)buf;
+		size_t done = 0;
+		std::vector<uint8> tmp;
+		while (done < length) {
+			loff_t pos = offset + done;
+			uint64 chunk = pos / h.chunk_size;
+			size_t start = pos % h.chunk_size;
+			size_t segment = std::min((size_t)h.chunk_size - start, length - done);
+			std::map<uint64, loff_t>::iterator i = log_chunks.find(chunk);
+			if (i != log_chunks.end()) {
+				if (pwrite_all(log_fd, b + done, segment, i->second + start) < (ssize_t)segment)
+					break;
+			} else {
+				// First write to this chunk, append a merged copy to the log
+				tmp.resize(h.chunk_size + sizeof(uint64));
+				if (start != 0 || segment != chunk_length(chunk)) {
+					memset(&tmp[0], 0, h.chunk_size);
+					if (read_image(&tmp[0], chunk * h.chunk_size, chunk_length(chunk)) < chunk_length(chunk))
+						break;
+				}
+				memcpy(&tmp[start], b + done, segment);
+				uint64 le_chunk = cmp_le64(chunk);
+				memcpy(&tmp[h.chunk_size], &le_chunk, sizeof(le_chunk));
+				if (pwrite_all(log_fd, &tmp[0], tmp.size(), log_end) < (ssize_t)tmp.size())
+					break;
+				pthread_mutex_lock(&lock);
+				log_chunks[chunk] = log_end;
+				drop(chunk);
+				pthread_mutex_unlock(&lock);
+				log_end += tmp.size();
+			}
+			done += segment;
+		}
+		return done;
+	}
+
+	virtual void flush() {
+		if (log_fd >= 0)
+			fsync(log_fd);
+	}
+
+protected:
+	int fd;					// Compressed image
+	int log_fd;				// Side log (-1 = read-only)
+	char *log_path;
+	bool discard_log;
+	loff_t log_end;			// Where the next log record goes
+	std::map<uint64, loff_t> log_chunks;	// File offsets of chunks in the log
+	cmp_header h;
+	std::vector<uint64> index;
+	loff_t start_byte;		// Size of image header (if any)
+	loff_t real_size;		// Size of image data
+
+	// Chunk cache, protected by lock
+	pthread_mutex_t lock;
+	pthread_cond_t work_cond;	// Chunks were queued
+	pthread_cond_t ready_cond;	// Chunks were decompressed
+	std::map<uint64, chunk_entry *> cache;
+	std::list<chunk_entry *> lru;	// Most recently used first
+	std::deque<chunk_entry *> queue;
+	uint64 max_chunks;
+
+	// Sequential access detection
+	loff_t last_end;		// End of last read request
+	uint32 readahead;		// Current read-ahead window (chunks)
+
+	pthread_t threads[MAX_THREADS];
+	int num_threads;
+	bool quit;
+
+	uint64 num_chunks() const {
+		return index.size() - 1;
+	}
+
+	size_t chunk_length(uint64 chunk) const {
+		return std::min((uint64)h.chunk_size, h.image_size - chunk * h.chunk_size);
+	}
+
+	// Chunks that are neither all zeroes nor in the log go through the cache
+	bool cached(uint64 chunk) const {
+		return index[chunk + 1] != index[chunk] && log_chunks.find(chunk) == log_chunks.end();
+	}
+
+	// Read from the image file (including header), with the log applied
+	size_t read_image(void *buf, loff_t offset, size_t length) {
+		if (length == 0)
+			return 0;
+		uint64 first = offset / h.chunk_size;
+		uint64 last = (offset + length - 1) / h.chunk_size;
+
+		pthread_mutex_lock(&lock);
+		if (offset == last_end)
+			readahead = std::min(std::max(readahead * 2, (uint32)num_threads), MAX_READAHEAD);
+		else
+			readahead = 0;
+		last_end = offset + length;
+
+		// Look up the chunks and queue the missing ones, in order
+		std::vector<chunk_entry *> entries(last - first + 1);
+		size_t insert_pos = 0;
+		for (uint64 c = first; c <= last; c++) {
+			chunk_entry *e = NULL;
+			if (cached(c)) {
+				e = lookup(c, true, insert_pos);
+				e->pins++;
+			}
+			entries[c - first] = e;
+		}
+		uint64 ra_end = std::min(last + 1 + std::min((uint64)readahead, max_chunks / 2), num_chunks());
+		for (uint64 c = last + 1; c < ra_end; c++)
+			if (cached(c))
+				lookup(c, false, insert_pos);
+		if (!queue.empty())
+			pthread_cond_broadcast(&work_cond);
+
+		// Decompress what no thread has taken yet, then wait for the rest
+		for (size_t i = 0; i < entries.size(); i++) {
+			chunk_entry *e = entries[i];
+			if (e == NULL)
+				continue;
+			if (e->st == chunk_entry::QUEUED) {
+				queue.erase(std::find(queue.begin(), queue.end(), e));
+				decompress(e);
+			}
+			while (e->st == chunk_entry::BUSY)
+				pthread_cond_wait(&ready_cond, &lock);
+		}
+
+		// Copy the data
+		uint8 *b = (uint8 *)buf;
+		size_t done = 0;
+		bool ok = true;
+		for (uint64 c = first; c <= last; c++) {
+			chunk_entry *e = entries[c - first];
+			loff_t pos = offset + done;
+			size_t start = pos - c * h.chunk_size;
+			size_t segment = std::min(chunk_length(c) - start, length - done);
+			if (ok) {
+				if (e) {
+					if (e->st == chunk_entry::READY)
+						memcpy(b + done, &e->data[start], segment);
+					else
+						ok = false;
+				} else {
+					std::map<uint64, loff_t>::iterator i = log_chunks.find(c);
+					if (i == log_chunks.end())
+						memset(b + done, 0, segment);
+					else if (pread_all(log_fd, b + done, segment, i->second + start) < (ssize_t)segment)
+						ok = false;
+				}
+				if (ok)
+					done += segment;
+			}
+			if (e) {
+				e->pins--;
+				if (e->st == chunk_entry::FAILED && e->pins == 0)
+					drop(c);
+			}
+		}
+		pthread_mutex_unlock(&lock);
+		return done;
+	}
+
+	// Find chunk in the cache or queue it for decompression (lock held).
+	// Chunks needed right now are queued in front of read-ahead chunks.
+	chunk_entry *lookup(uint64 chunk, bool needed, size_t &insert_pos) {
+		std::map<uint64, chunk_entry *>::iterator i = cache.find(chunk);
+		if (i != cache.end()) {
+			chunk_entry *e = i->second;
+			lru.erase(e->lru);
+			lru.push_front(e);
+			e->lru = lru.begin();
+			return e;
+		}
+		evict();
+		chunk_entry *e = new chunk_entry;
+		e->chunk = chunk;
+		e->st = chunk_entry::QUEUED;
+		e->pins = 0;
+		lru.push_front(e);
+		e->lru = lru.begin();
+		cache[chunk] = e;
+		if (needed)
+			queue.insert(queue.begin() + insert_pos++, e);
+		else
+			queue.push_back(e);
+		return e;
+	}
+
+	// Make room for one chunk, chunks in use are skipped
+	void evict() {
+		std::list<chunk_entry *>::iterator i = lru.end();
+		while (cache.size() >= max_chunks && i != lru.begin()) {
+			chunk_entry *e = *--i;
+			if (e->pins == 0 && (e->st == chunk_entry::READY || e->st == chunk_entry::FAILED)) {
+				i = lru.erase(i);
+				cache.erase(e->chunk);
+				delete e;
+			}
+		}
+	}
+
+	// Remove chunk from the cache, unless it's in use (lock held)
+	void drop(uint64 chunk) {
+		std::map<uint64, chunk_entry *>::iterator i = cache.find(chunk);
+		if (i == cache.end())
+			return;
+		chunk_entry *e = i->second;
+		if (e->pins || e->st == chunk_entry::QUEUED || e->st == chunk_entry::BUSY)
+			return;
+		lru.erase(e->lru);
+		cache.erase(i);
+		delete e;
+	}
+
+	// Decompress a queued chunk, called with lock held
+	void decompress(chunk_entry *e) {
+		e->st = chunk_entry::BUSY;
+		pthread_mutex_unlock(&lock);
+
+		const uint64 c = e->chunk;
+		const size_t len = chunk_length(c);
+		const size_t clen = index[c + 1] - index[c];
+		e->data.resize(len);
+		bool ok;
+		if (clen == len)
+			ok = pread_all(fd, &e->data[0], len, index[c]) == (ssize_t)len;
+		else {
+			std::vector<uint8> packed(clen);
+			ok = pread_all(fd, &packed[0], clen, index[c]) == (ssize_t)clen
+				&& cmp_decompress(h.codec, &packed[0], clen, &e->data[0], len);
+		}
+		if (!ok)
+			fprintf(stderr, "compressed: cannot read chunk %llu\n", (unsigned long long)c);
+
+		pthread_mutex_lock(&lock);
+		e->st = ok ? chunk_entry::READY : chunk_entry::FAILED;
+		pthread_cond_broadcast(&ready_cond);
+	}
+
+	static void *thread_func(void *arg) {
+		disk_compressed *d = (disk_compressed *)arg;
+		pthread_mutex_lock(&d->lock);
+		for (;;) {
+			while (!d->quit && d->queue.empty())
+				pthread_cond_wait(&d->work_cond, &d->lock);
+			if (d->quit)
+				break;
+			chunk_entry *e = d->queue.front();
+			d->queue.pop_front();
+			d->decompress(e);
+		}
+		pthread_mutex_unlock(&d->lock);
+		return NULL;
+	}
+};
+
+
+disk_generic::status disk_compressed_factory(const char *path,
+		bool read_only, disk_generic **disk) {
+	int fd = open(path, O_RDONLY);
+	if (fd < 0)
+		return disk_generic::DISK_UNKNOWN;
+	struct stat st;
+	cmp_header h;
+	if (fstat(fd, &st) < 0 || !S_ISREG(st.st_mode)
+	 || pread_all(fd, &h, sizeof(h), 0) != sizeof(h)
+	 || memcmp(h.magic, CMP_MAGIC, sizeof(h.magic)) != 0) {
+		close(fd);
+		return disk_generic::DISK_UNKNOWN;
+	}
+	cmp_convert_header(h);
+	if (h.version != CMP_VERSION || h.chunk_size == 0 || h.chunk_size > CMP_MAX_CHUNK_SIZE) {
+		fprintf(stderr, "compressed: %s has an unsupported format\n", path);
+		close(fd);
+		return disk_generic::DISK_INVALID;
+	}
+	if (!cmp_codec_available(h.codec)) {
+		fprintf(stderr, "compressed: %s needs %s support, which is not compiled in\n", path, cmp_codec_name(h.codec));
+		close(fd);
+		return disk_generic::DISK_INVALID;
+	}
+
+	// Load and check the chunk index
+	uint64 num_chunks;
+	if (!cmp_index_chunks(h, st.st_size, num_chunks)) {
+		fprintf(stderr, "compressed: %s has a damaged chunk index\n", path);
+		close(fd);
+		return disk_generic::DISK_INVALID;
+	}
+	std::vector<uint64> index(num_chunks + 1);
+	size_t index_size = index.size() * sizeof(uint64);
+	bool ok = pread_all(fd, &index[0], index_size, h.index_offset) == (ssize_t)index_size;
+	cmp_convert_index(index);
+	for (uint64 i = 0; ok && i < num_chunks; i++) {
+		uint64 len = std::min((uint64)h.chunk_size, h.image_size - i * h.chunk_size);
+		ok = index[i] <= index[i + 1] && index[i + 1] - index[i] <= len;
+	}
+	if (!ok || index[num_chunks] > h.index_offset) {
+		fprintf(stderr, "compressed: %s has a damaged chunk index\n", path);
+		close(fd);
+		return disk_generic::DISK_INVALID;
+	}
+
+	disk_compressed *d = new disk_compressed(fd, h, index);
+	if (!read_only && !d->open_log(path, st)) {
+		delete d;
+		return disk_generic::DISK_INVALID;
+	}
+	d->start_threads();
+
+	// Detect disk image file layout
+	uint8 data[256];
+	memset(data, 0, sizeof(data));
+	d->read(data, 0, std::min((uint64)sizeof(data), h.image_size));
+	loff_t start_byte, real_size;
+	FileDiskLayout(h.image_size, data, start_byte, real_size);
+	d->set_layout(start_byte, real_size);
+
+	D(bug("compressed: opened %s (%s, %llu chunks of %u bytes)\n", path, cmp_codec_name(h.codec),
+		(unsigned long long)num_chunks, h.chunk_size));
+	*disk = d;
+	return disk_generic::DISK_VALID;
+}
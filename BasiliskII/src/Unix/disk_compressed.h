@@ -0,0 +1,197 @@
+/*
+ *  disk_compressed.h - Chunked compressed disk image format
+ *
+ *  Basilisk II (C) 1997-2008 Christian Bauer
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#ifndef DISK_COMPRESSED_H
+#define DISK_COMPRESSED_H
+
+#include <vector>
+
+/*
+ *  A compressed image is a header, the chunks of the original image file,
+ *  each compressed on its own, and an index of num_chunks + 1 file
+ *  offsets (chunk i occupies index[i] to index[i + 1]). A chunk of
+ *  length 0 is all zeroes, a chunk that is as long as its uncompressed
+ *  data is stored as is. All integers are stored little-endian.
+ */
+
+#if defined(HAVE_ZLIB_H) && defined(HAVE_LIBZ)
+#define CMP_HAVE_ZLIB 1
+#include <zlib.h>
+#endif
+#if defined(HAVE_ZSTD_H) && defined(HAVE_LIBZSTD)
+#define CMP_HAVE_ZSTD 1
+#include <zstd.h>
+#endif
+#if defined(HAVE_LZ4_H) && defined(HAVE_LIBLZ4)
+#define CMP_HAVE_LZ4 1
+#include <lz4.h>
+#endif
+
+static const char CMP_MAGIC[8] = {'B', '2', 'C', 'M', 'P', 'I', 'M', 'G'};
+static const uint32 CMP_VERSION = 1;
+static const uint32 CMP_DEFAULT_CHUNK_SIZE = 65536;
+static const uint32 CMP_MAX_CHUNK_SIZE = 16 * 1024 * 1024;
+
+enum {
+	CMP_CODEC_ZLIB = 1,
+	CMP_CODEC_ZSTD = 2,
+	CMP_CODEC_LZ4 = 3
+};
+
+// Image file header
+struct cmp_header {
+	char magic[8];
+	uint32 version;
+	uint32 codec;
+	uint32 chunk_size;		// Uncompressed size of a chunk (the last one may be shorter)
+	uint32 reserved;
+	uint64 image_size;		// Size of uncompressed image file
+	uint64 index_offset;	// File offset of chunk index
+};
+
+// Convert between host byte order and little-endian file data
+static inline uint32 cmp_le32(uint32 v)
+{
+#ifdef WORDS_BIGENDIAN
+	return (v >> 24) | ((v >> 8) & 0xff00) | ((v & 0xff00) << 8) | (v << 24);
+#else
+	return v;
+#endif
+}
+
+static inline uint64 cmp_le64(uint64 v)
+{
+#ifdef WORDS_BIGENDIAN
+	return ((uint64)cmp_le32(v) << 32) | cmp_le32(v >> 32);
+#else
+	return v;
+#endif
+}
+
+static inline void cmp_convert_header(cmp_header &h)
+{
+	h.version = cmp_le32(h.version);
+	h.codec = cmp_le32(h.codec);
+	h.chunk_size = cmp_le32(h.chunk_size);
+	h.reserved = cmp_le32(h.reserved);
+	h.image_size = cmp_le64(h.image_size);
+	h.index_offset = cmp_le64(h.index_offset);
+}
+
+static inline void cmp_convert_index(std::vector<uint64> &index)
+{
+#ifdef WORDS_BIGENDIAN
+	for (size_t i = 0; i < index.size(); i++)
+		index[i] = cmp_le64(index[i]);
+#endif
+}
+
+// Get number of chunks of an image whose index lies within a file of
+// file_size bytes; returns false if the header can't describe such a file
+static inline bool cmp_index_chunks(const cmp_header &h, uint64 file_size, uint64 &num_chunks)
+{
+	num_chunks = h.image_size / h.chunk_size + (h.image_size % h.chunk_size != 0);
+	if (h.index_offset > file_size)
+		return false;
+	uint64 index_entries = (file_size - h.index_offset) / sizeof(uint64);
+	return num_chunks < index_entries;
+}
+
+static inline const char *cmp_codec_name(uint32 codec)
+{
+	switch (codec) {
+		case CMP_CODEC_ZLIB: return "zlib";
+		case CMP_CODEC_ZSTD: return "zstd";
+		case CMP_CODEC_LZ4: return "lz4";
+	}
+	return "unknown";
+}
+
+static inline bool cmp_codec_available(uint32 codec)
+{
+	switch (codec) {
+#ifdef CMP_HAVE_ZLIB
+		case CMP_CODEC_ZLIB: return true;
+#endif
+#ifdef CMP_HAVE_ZSTD
+		case CMP_CODEC_ZSTD: return true;
+#endif
+#ifdef CMP_HAVE_LZ4
+		case CMP_CODEC_LZ4: return true;
+#endif
+	}
+	return false;
+}
+
+// Compress LEN bytes, returns the compressed size or 0 if the data doesn't get smaller
+static inline size_t cmp_compress(uint32 codec, int level, const uint8 *src, size_t len, uint8 *dst, size_t dst_len)
+{
+	switch (codec) {
+#ifdef CMP_HAVE_ZLIB
+		case CMP_CODEC_ZLIB: {
+			uLongf n = dst_len;
+			if (compress2(dst, &n, src, len, level) != Z_OK)
+				return 0;
+			return n < len ? n : 0;
+		}
+#endif
+#ifdef CMP_HAVE_ZSTD
+		case CMP_CODEC_ZSTD: {
+			size_t n = ZSTD_compress(dst, dst_len, src, len, level);
+			if (ZSTD_isError(n))
+				return 0;
+			return n < len ? n : 0;
+		}
+#endif
+#ifdef CMP_HAVE_LZ4
+		case CMP_CODEC_LZ4: {
+			int n = LZ4_compress_default((const char *)src, (char *)dst, len, dst_len);
+			return n > 0 && (size_t)n < len ? n : 0;
+		}
+#endif
+	}
+	return 0;
+}
+
+// Decompress a chunk, returns false unless exactly DST_LEN bytes come out
+static inline bool cmp_decompress(uint32 codec, const uint8 *src, size_t len, uint8 *dst, size_t dst_len)
+{
+	switch (codec) {
+#ifdef CMP_HAVE_ZLIB
+		case CMP_CODEC_ZLIB: {
+			uLongf n = dst_len;
+			return uncompress(dst, &n, src, len) == Z_OK && n == dst_len;
+		}
+#endif
+#ifdef CMP_HAVE_ZSTD
+		case CMP_CODEC_ZSTD: {
+			size_t n = ZSTD_decompress(dst, dst_len, src, len);
+			return !ZSTD_isError(n) && n == dst_len;
+		}
+#endif
+#ifdef CMP_HAVE_LZ4
+		case CMP_CODEC_LZ4:
+			return LZ4_decompress_safe((const char *)src, (char *)dst, len, dst_len) == (int)dst_len;
+#endif
+	}
+	return false;
+}
+
+#endif
@@ -0,0 +1,392 @@
+/*
+ *  disk_cow.cpp - Copy-on-write overlays for shared disk images
+ *
+ *  Basilisk II (C) 1997-2008 Christian Bauer
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+/*
+ *  An overlay file holds a header naming the (read-only) base image, a
+ *  bitmap of the blocks that were written, and the written blocks at
+ *  their natural position in a sparse data area. Unwritten blocks are
+ *  read from the base image, so any number of emulators can share one
+ *  base image through the page cache.
+ *
+ *  Overlays are used for a disk image when it is given as an overlay file
+ *  directly, or when the "diskoverlay" pref names a directory; in that
+ *  case "<dir>/<image name>.cow" is created (or reused) for every
+ *  writable plain disk image. An existing overlay is only reused if it
+ *  names the same base image, and it's locked while open so that two
+ *  emulators can't write to it at once. The "diskoverlaymode" pref
+ *  selects what happens to the overlay when the disk is closed: "keep"
+ *  (default), "commit" (write changes back to the base image) or
+ *  "discard".
+ */
+
+#include "disk_unix.h"
+#include "prefs.h"
+#include "macos_util.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <unistd.h>
+#include <sys/file.h>
+#include <sys/stat.h>
+#include <algorithm>
+#include <vector>
+
+#define DEBUG 0
+#include "debug.h"
+
+static const char COW_MAGIC[8] = {'B', '2', 'C', 'O', 'W', 'O', 'V', 'L'};
+static const uint32 COW_VERSION = 1;
+static const uint32 COW_BLOCK_SIZE = 65536;
+
+// Overlay file header (host byte order)
+struct cow_header {
+	char magic[8];
+	uint32 version;
+	uint32 block_size;		// Size of a copy-on-write block
+	uint64 base_size;		// Size of base image
+	uint64 base_mtime;		// Modification time of base image (must not change)
+	uint64 bitmap_offset;	// File offset of block bitmap
+	uint64 data_offset;		// File offset of block 0
+	char base_path[PATH_MAX];	// Base image
+};
+
+// What to do with the overlay when the disk is closed
+enum cow_mode {
+	COW_KEEP,
+	COW_COMMIT,
+	COW_DISCARD
+};
+
+static ssize_t pread_all(int fd, void *buf, size_t len, loff_t offset)
+{
+	char *p = (char *)buf;
+	size_t done = 0;
+	while (done < len) {
+		ssize_t n = pread(fd, p + done, len - done, offset + done);
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n <= 0)
+			break;
+		done += n;
+	}
+	return done;
+}
+
+static ssize_t pwrite_all(int fd, const void *buf, size_t len, loff_t offset)
+{
+	const char *p = (const char *)buf;
+	size_t done = 0;
+	while (done < len) {
+		ssize_t n = pwrite(fd, p + done, len - done, offset + done);
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n <= 0)
+			break;
+		done += n;
+	}
+	return done;
+}
+
+struct disk_cow : disk_generic {
+	disk_cow(const char *path, int fd, int base_fd, bool read_only,
+		const cow_header &h, loff_t start_byte, loff_t real_size, cow_mode mode)
+	: overlay_path(strdup(path)), fd(fd), base_fd(base_fd), read_only(read_only),
+		h(h), start_byte(start_byte), real_size(real_size),
+		mode(read_only ? COW_KEEP : mode) {
+		bitmap.resize((num_blocks() + 7) / 8);
+	}
+
+	virtual ~disk_cow() {
+		if (mode == COW_COMMIT)
+			commit();
+		close(base_fd);
+		close(fd);
+		if (mode != COW_KEEP) {
+			D(bug("cow: removing overlay %s\n", overlay_path));
+			unlink(overlay_path);
+		}
+		free(overlay_path);
+	}
+
+	bool load_bitmap() {
+		return bitmap.empty() || pread_all(fd, &bitmap[0], bitmap.size(),
+			h.bitmap_offset) == (ssize_t)bitmap.size();
+	}
+
+	virtual bool is_read_only() { return read_only; }
+	virtual loff_t size() { return real_size; }
+
+	virtual size_t read(void *buf, loff_t offset, size_t length) {
+		offset += start_byte;
+		if (offset >= (loff_t)h.base_size)
+			return 0;
+		length = std::min((loff_t)length, (loff_t)h.base_size - offset);
+
+		// Read runs of blocks from the same source with a single pread()
+		char *b = (char *)buf;
+		size_t done = 0;
+		while (done < length) {
+			loff_t pos = offset + done;
+			uint64 block = pos / h.block_size;
+			bool in_overlay = present(block);
+			size_t run = h.block_size - pos % h.block_size;
+			while (done + run < length && present(block + 1) == in_overlay) {
+				run += h.block_size;
+				++block;
+			}
+			run = std::min(run, length - done);
+			ssize_t n = in_overlay
+				? pread_all(fd, b + done, run, h.data_offset + pos)
+				: pread_all(base_fd, b + done, run, pos);
+			if (n > 0)
+				done += n;
+			if (n < (ssize_t)run)
+				break;
+		}
+		return done;
+	}
+
+	virtual size_t write(void *buf, loff_t offset, size_t length) {
+		offset += start_byte;
+		if (read_only || offset >= (loff_t)h.base_size)
+			return 0;
+		length = std::min((loff_t)length, (loff_t)h.base_size - offset);
+
+		const char *b = (const char *)buf;
+		size_t done = 0;
+		while (done < length) {
+			loff_t pos = offset + done;
+			uint64 block = pos / h.block_size;
+			size_t start = pos % h.block_size;
+			size_t segment = std::min((size_t)h.block_size - start, length - done);
+			if (present(block)) {
+				if (pwrite_all(fd, b + done, segment, h.data_offset + pos) < (ssize_t)segment)
+					break;
+			} else if (!copy_up(block, b + done, start, segment))
+				break;
+			done += segment;
+		}
+		return done;
+	}
+
+protected:
+	char *overlay_path;
+	int fd;					// Overlay file
+	int base_fd;			// Base image (read-only)
+	bool read_only;
+	cow_header h;
+	loff_t start_byte;		// Size of image header (if any)
+	loff_t real_size;		// Size of image data
+	cow_mode mode;
+	std::vector<uint8> bitmap;	// Blocks present in the overlay
+
+	uint64 num_blocks() const {
+		return (h.base_size + h.block_size - 1) / h.block_size;
+	}
+
+	bool present(uint64 block) const {
+		return block < num_blocks() && (bitmap[block / 8] & (1 << (block % 8)));
+	}
+
+	// Copy a block to the overlay before it's first written, merging in
+	// the new data. Data is written before the bitmap is updated, so a
+	// crash can only lose the write, not expose a block of garbage.
+	bool copy_up(uint64 block, const char *data, size_t start, size_t len) {
+		loff_t pos = block * h.block_size;
+		size_t block_len = std::min((loff_t)h.block_size, (loff_t)h.base_size - pos);
+		if (start != 0 || len != block_len) {
+			std::vector<char> tmp(block_len);
+			if (pread_all(base_fd, &tmp[0], block_len, pos) < (ssize_t)block_len)
+				return false;
+			memcpy(&tmp[start], data, len);
+			if (pwrite_all(fd, &tmp[0], block_len, h.data_offset + pos) < (ssize_t)block_len)
+				return false;
+		} else if (pwrite_all(fd, data, len, h.data_offset + pos) < (ssize_t)len)
+			return false;
+		bitmap[block / 8] |= 1 << (block % 8);
+		return pwrite_all(fd, &bitmap[block / 8], 1, h.bitmap_offset + block / 8) == 1;
+	}
+
+	// Write all blocks of the overlay back to the base image
+	void commit() {
+		int wfd = open(h.base_path, O_WRONLY);
+		if (wfd < 0) {
+			fprintf(stderr, "cow: cannot commit to %s: %s\n", h.base_path, strerror(errno));
+			mode = COW_KEEP;
+			return;
+		}
+		std::vector<char> tmp(h.block_size);
+		uint64 n = 0;
+		for (uint64 block = 0; block < num_blocks(); block++) {
+			if (!present(block))
+				continue;
+			loff_t pos = block * h.block_size;
+			size_t block_len = std::min((loff_t)h.block_size, (loff_t)h.base_size - pos);
+			if (pread_all(fd, &tmp[0], block_len, h.data_offset + pos) < (ssize_t)block_len
+			 || pwrite_all(wfd, &tmp[0], block_len, pos) < (ssize_t)block_len) {
+				fprintf(stderr, "cow: commit to %s failed: %s\n", h.base_path, strerror(errno));
+				mode = COW_KEEP;
+				break;
+			}
+			n++;
+		}
+		if (fsync(wfd) < 0)
+			mode = COW_KEEP;
+		close(wfd);
+		D(bug("cow: committed %llu blocks to %s\n", (unsigned long long)n, h.base_path));
+	}
+};
+
+
+static cow_mode get_cow_mode()
+{
+	const char *str = PrefsFindString("diskoverlaymode");
+	if (str && strcmp(str, "commit") == 0)
+		return COW_COMMIT;
+	if (str && strcmp(str, "discard") == 0)
+		return COW_DISCARD;
+	return COW_KEEP;
+}
+
+// Create a new overlay file for the base image
+static bool create_overlay(const char *path, const char *base_path,
+	const struct stat &st)
+{
+	cow_header h;
+	memset(&h, 0, sizeof(h));
+	memcpy(h.magic, COW_MAGIC, sizeof(h.magic));
+	h.version = COW_VERSION;
+	h.block_size = COW_BLOCK_SIZE;
+	h.base_size = st.st_size;
+	h.base_mtime = st.st_mtime;
+	h.bitmap_offset = sizeof(h);
+	uint64 bitmap_size = ((h.base_size + h.block_size - 1) / h.block_size + 7) / 8;
+	h.data_offset = (h.bitmap_offset + bitmap_size + h.block_size - 1) / h.block_size * h.block_size;
+	if (realpath(base_path, h.base_path) == NULL)
+		return false;
+
+	int fd = open(path, O_WRONLY | O_CREAT | O_EXCL, 0644);
+	if (fd < 0)
+		return false;
+	bool ok = pwrite_all(fd, &h, sizeof(h), 0) == sizeof(h)
+		&& ftruncate(fd, h.data_offset + h.base_size) == 0;
+	close(fd);
+	if (!ok)
+		unlink(path);
+	return ok;
+}
+
+// Open an existing overlay file, returns DISK_UNKNOWN if it's not one;
+// if base_path is given, the overlay must belong to that base image
+static disk_generic::status open_overlay(const char *path, bool read_only,
+	disk_generic **disk, const char *base_path = NULL)
+{
+	int fd = open(path, read_only ? O_RDONLY : O_RDWR);
+	if (fd < 0)
+		return disk_generic::DISK_UNKNOWN;
+	cow_header h;
+	if (pread_all(fd, &h, sizeof(h), 0) != sizeof(h)
+	 || memcmp(h.magic, COW_MAGIC, sizeof(h.magic)) != 0) {
+		close(fd);
+		return disk_generic::DISK_UNKNOWN;
+	}
+	h.base_path[sizeof(h.base_path) - 1] = 0;
+	if (h.version != COW_VERSION || h.block_size == 0) {
+		fprintf(stderr, "cow: %s has an unsupported format\n", path);
+		close(fd);
+		return disk_generic::DISK_INVALID;
+	}
+	if (base_path && strcmp(base_path, h.base_path) != 0) {
+		fprintf(stderr, "cow: overlay %s belongs to %s, not %s\n", path, h.base_path, base_path);
+		close(fd);
+		return disk_generic::DISK_INVALID;
+	}
+	if (flock(fd, (read_only ? LOCK_SH : LOCK_EX) | LOCK_NB) < 0) {
+		fprintf(stderr, "cow: %s is already in use\n", path);
+		close(fd);
+		return disk_generic::DISK_INVALID;
+	}
+
+	// The base image must not have been modified behind our back
+	int base_fd = open(h.base_path, O_RDONLY);
+	struct stat st;
+	if (base_fd < 0 || fstat(base_fd, &st) < 0) {
+		fprintf(stderr, "cow: cannot open base image %s: %s\n", h.base_path, strerror(errno));
+		if (base_fd >= 0)
+			close(base_fd);
+		close(fd);
+		return disk_generic::DISK_INVALID;
+	}
+	if ((uint64)st.st_size != h.base_size || st.st_mtime != h.base_mtime) {
+		fprintf(stderr, "cow: base image %s was modified after %s was created\n", h.base_path, path);
+		close(base_fd);
+		close(fd);
+		return disk_generic::DISK_INVALID;
+	}
+
+	// Detect disk image file layout
+	uint8 data[256];
+	memset(data, 0, sizeof(data));
+	pread_all(base_fd, data, sizeof(data), 0);
+	loff_t start_byte, real_size;
+	FileDiskLayout(h.base_size, data, start_byte, real_size);
+
+	disk_cow *cow = new disk_cow(path, fd, base_fd, read_only, h, start_byte, real_size, get_cow_mode());
+	if (!cow->load_bitmap()) {
+		fprintf(stderr, "cow: cannot read %s\n", path);
+		delete cow;
+		return disk_generic::DISK_INVALID;
+	}
+	D(bug("cow: opened %s over %s\n", path, h.base_path));
+	*disk = cow;
+	return disk_generic::DISK_VALID;
+}
+
+disk_generic::status disk_cow_factory(const char *path,
+		bool read_only, disk_generic **disk) {
+	struct stat base_st;
+	if (stat(path, &base_st) < 0 || !S_ISREG(base_st.st_mode))
+		return disk_generic::DISK_UNKNOWN;
+
+	// Is it an overlay file?
+	disk_generic::status st = open_overlay(path, read_only, disk);
+	if (st != disk_generic::DISK_UNKNOWN)
+		return st;
+
+	// Otherwise, only put writable images under an overlay
+	const char *dir = PrefsFindString("diskoverlay");
+	if (dir == NULL || read_only)
+		return disk_generic::DISK_UNKNOWN;
+
+	char base_path[PATH_MAX];
+	if (realpath(path, base_path) == NULL)
+		return disk_generic::DISK_INVALID;
+	const char *name = strrchr(path, '/');
+	name = name ? name + 1 : path;
+	char overlay[PATH_MAX + 1];
+	if (snprintf(overlay, PATH_MAX, "%s/%s.cow", dir, name) >= PATH_MAX)
+		return disk_generic::DISK_INVALID;
+	if (access(overlay, F_OK) < 0 && !create_overlay(overlay, path, base_st)) {
+		fprintf(stderr, "cow: cannot create overlay %s: %s\n", overlay, strerror(errno));
+		return disk_generic::DISK_INVALID;
+	}
+	return open_overlay(overlay, false, disk, base_path);
+}
@@ -0,0 +1,197 @@
+/*
+ *  disk_mmap.cpp - Memory-mapped raw disk images
+ *
+ *  Basilisk II (C) 1997-2008 Christian Bauer
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+/*
+ *  When the "diskmmap" pref is set, plain image files are mapped into
+ *  the host address space and requests are served with a memcpy() from
+ *  or to the mapping, without any system call once the pages are
+ *  resident. Dirty pages are handed to the kernel with msync() at most
+ *  once per second and synchronously when the disk is flushed or
+ *  closed. The access pattern is tracked to give the kernel sequential
+ *  or random read-ahead hints.
+ */
+
+#include "disk_unix.h"
+#include "prefs.h"
+#include "macos_util.h"
+#include "timer.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <algorithm>
+
+#define DEBUG 0
+#include "debug.h"
+
+// Number of consecutive sequential (or random) requests before the
+// kernel read-ahead hint is changed
+static const int PATTERN_THRESHOLD = 8;
+
+// Minimum interval between asynchronous msync() calls
+static const uint64 SYNC_INTERVAL_USEC = 1000000;
+
+struct disk_mmap : disk_generic {
+	disk_mmap(int fd, bool read_only, uint8 *map, loff_t map_size,
+		loff_t start_byte, loff_t real_size)
+	: fd(fd), read_only(read_only), map(map), map_size(map_size),
+		data(map + start_byte), real_size(real_size),
+		last_end(-1), seq_count(0), random_count(0), advice(MADV_NORMAL),
+		dirty_start(map_size), dirty_end(0), last_sync(GetTicks_usec()) {
+		page_size = getpagesize();
+	}
+
+	virtual ~disk_mmap() {
+		flush();
+		munmap(map, map_size);
+		close(fd);
+	}
+
+	virtual bool is_read_only() { return read_only; }
+	virtual loff_t size() { return real_size; }
+	virtual bool has_cache() { return true; }
+
+	virtual size_t read(void *buf, loff_t offset, size_t length) {
+		if (offset >= real_size)
+			return 0;
+		length = std::min((loff_t)length, real_size - offset);
+		track_pattern(offset, length);
+		memcpy(buf, data + offset, length);
+		return length;
+	}
+
+	virtual size_t write(void *buf, loff_t offset, size_t length) {
+		if (read_only || offset >= real_size)
+			return 0;
+		length = std::min((loff_t)length, real_size - offset);
+		track_pattern(offset, length);
+		memcpy(data + offset, buf, length);
+
+		// Remember dirty range and let the kernel start writing it back
+		loff_t start = (data - map) + offset;
+		dirty_start = std::min(dirty_start, start);
+		dirty_end = std::max(dirty_end, start + (loff_t)length);
+		uint64 now = GetTicks_usec();
+		if (now - last_sync >= SYNC_INTERVAL_USEC) {
+			sync_dirty(MS_ASYNC);
+			last_sync = now;
+		}
+		return length;
+	}
+
+	virtual void flush() {
+		sync_dirty(MS_SYNC);
+	}
+
+protected:
+	int fd;
+	bool read_only;
+	uint8 *map;				// Mapping of complete file
+	loff_t map_size;
+	uint8 *data;			// Start of image data (after header)
+	loff_t real_size;		// Size of image data
+	uint32 page_size;
+
+	// Access pattern tracking
+	loff_t last_end;		// End of last request
+	int seq_count;			// Number of consecutive sequential requests
+	int random_count;		// Number of consecutive random requests
+	int advice;				// Current madvise() hint
+
+	// Dirty range not yet synced
+	loff_t dirty_start, dirty_end;
+	uint64 last_sync;
+
+	void sync_dirty(int flags) {
+		if (dirty_start >= dirty_end)
+			return;
+		loff_t start = dirty_start & ~(loff_t)(page_size - 1);
+		if (msync(map + start, dirty_end - start, flags) < 0)
+			D(bug("mmap: msync failed: %s\n", strerror(errno)));
+		if (flags & MS_SYNC) {
+			dirty_start = map_size;
+			dirty_end = 0;
+		}
+	}
+
+	void track_pattern(loff_t offset, size_t length) {
+		if (offset == last_end) {
+			random_count = 0;
+			if (++seq_count >= PATTERN_THRESHOLD)
+				set_advice(MADV_SEQUENTIAL);
+		} else {
+			seq_count = 0;
+			if (++random_count >= PATTERN_THRESHOLD)
+				set_advice(MADV_RANDOM);
+		}
+		last_end = offset + length;
+	}
+
+	void set_advice(int a) {
+		if (a == advice)
+			return;
+		D(bug("mmap: switching to %s access\n", a == MADV_SEQUENTIAL ? "sequential" : "random"));
+		madvise(map, map_size, a);
+		advice = a;
+	}
+};
+
+disk_generic::status disk_mmap_factory(const char *path,
+		bool read_only, disk_generic **disk) {
+	if (!PrefsFindBool("diskmmap"))
+		return disk_generic::DISK_UNKNOWN;
+
+	// Only plain files can be mapped
+	struct stat st;
+	if (stat(path, &st) < 0 || !S_ISREG(st.st_mode) || st.st_size == 0)
+		return disk_generic::DISK_UNKNOWN;
+	if ((uint64)st.st_size != (uint64)(size_t)st.st_size)
+		return disk_generic::DISK_UNKNOWN;
+
+	int fd = open(path, read_only ? O_RDONLY : O_RDWR);
+	if (fd < 0 && !read_only) {
+		read_only = true;
+		fd = open(path, O_RDONLY);
+	}
+	if (fd < 0)
+		return disk_generic::DISK_UNKNOWN;
+
+	int prot = read_only ? PROT_READ : (PROT_READ | PROT_WRITE);
+	void *map = mmap(NULL, st.st_size, prot, MAP_SHARED, fd, 0);
+	if (map == MAP_FAILED) {
+		// Not enough address space, use regular file I/O
+		D(bug("mmap: cannot map %s: %s\n", path, strerror(errno)));
+		close(fd);
+		return disk_generic::DISK_UNKNOWN;
+	}
+
+	// Detect disk image file layout
+	loff_t start_byte, real_size;
+	uint8 header[256];
+	memset(header, 0, sizeof(header));
+	memcpy(header, map, std::min((loff_t)sizeof(header), (loff_t)st.st_size));
+	FileDiskLayout(st.st_size, header, start_byte, real_size);
+
+	D(bug("mmap: mapped %s at %p\n", path, map));
+	*disk = new disk_mmap(fd, read_only, (uint8 *)map, st.st_size, start_byte, real_size);
+	return disk_generic::DISK_VALID;
+}
@@ -37,6 +37,8 @@ struct disk_generic {
 	virtual size_t read(void *buf, loff_t offset, size_t length) = 0;
 	virtual size_t write(void *buf, loff_t offset, size_t length) = 0;
 	virtual loff_t size() = 0;
+	virtual void flush() { }	// Write back cached data (on eject)
+	virtual bool has_cache() { return false; }	// Caches data itself, bypass the host block cache
 };
 
 typedef disk_generic::status (disk_factory)(const char *path, bool read_only,
@@ -44,5 +46,8 @@ typedef disk_generic::status (disk_factory)(const char *path, bool read_only,
 
 extern disk_factory disk_sparsebundle_factory;
 extern disk_factory disk_vhd_factory;
+extern disk_factory disk_compressed_factory;
+extern disk_factory disk_cow_factory;
+extern disk_factory disk_mmap_factory;
 
 #endif
@@ -135,9 +135,37 @@ const bool ether_driver_opened = true;		// Flag: is the MacOS driver opened?
 // Attached network protocols, maps protocol type to MacOS handler address
 static map<uint16, uint32> net_protocols;
 
+// Transmit ring, the emulator thread only copies outgoing frames into
+// the ring and the transmit thread hands them to the host in batches
+static const int TX_RING_SIZE = 64;			// Number of frames that can be queued
+static const int TX_HIST_SIZE = 7;			// Batch size histogram buckets (1, 2-3, 4-7, ..., 64)
+
+struct tx_frame {
+	int length;
+	uint8 data[1516];
+};
+
+static tx_frame tx_ring[TX_RING_SIZE];
+static uint32 tx_head = 0;					// Next slot to fill (emulator thread)
+static uint32 tx_tail = 0;					// Next slot to send (transmit thread)
+static pthread_mutex_t tx_lock = PTHREAD_MUTEX_INITIALIZER;	// Protects tx_head and tx_tail
+static sem_t tx_wakeup;						// Posted when the ring becomes non-empty
+static pthread_t tx_thread;					// Packet transmission thread
+static bool tx_thread_active = false;		// Flag: Packet transmission thread installed
+static volatile bool tx_thread_cancel = false;	// Flag: Cancel transmission thread
+
+// Transmit statistics
+static uint32 tx_queued = 0;				// Frames put into the ring
+static uint32 tx_dropped = 0;				// Frames dropped because the ring was full
+static uint32 tx_errors = 0;				// Frames the host refused to send
+static uint32 tx_max_depth = 0;				// Maximum queue depth
+static uint64 tx_depth_sum = 0;				// Sum of queue depths after each enqueue
+static uint32 tx_batches[TX_HIST_SIZE];		// Batch size histogram
+
 // Prototypes
 static void *receive_func(void *arg);
 static void *slirp_receive_func(void *arg);
+static void *transmit_func(void *arg);
 static int16 ether_do_add_multicast(uint8 *addr);
 static int16 ether_do_del_multicast(uint8 *addr);
 static int16 ether_do_write(uint32 arg);
@@ -164,6 +192,21 @@ static bool start_thread(void)
 		return false;
 	}
 
+	// The UDP tunnel transmits on its own
+	if (!udp_tunnel) {
+		if (sem_init(&tx_wakeup, 0, 0) < 0) {
+			printf("WARNING: Cannot init semaphore");
+			return false;
+		}
+		tx_thread_cancel = false;
+		tx_thread_active = (pthread_create(&tx_thread, NULL, transmit_func, NULL) == 0);
+		if (!tx_thread_active) {
+			sem_destroy(&tx_wakeup);
+			printf("WARNING: Cannot start Ethernet transmission thread\n");
+			return false;
+		}
+	}
+
 #ifdef HAVE_SLIRP
 	if (net_if_type == NET_IF_SLIRP) {
 		slirp_thread_active = (pthread_create(&slirp_thread, NULL, slirp_receive_func, NULL) == 0);
@@ -184,12 +227,22 @@ static bool start_thread(void)
 
 static void stop_thread(void)
 {
+	// The transmission thread sends what is left in the ring first
+	if (tx_thread_active) {
+		tx_thread_cancel = true;
+		sem_post(&tx_wakeup);
+		pthread_join(tx_thread, NULL);
+		sem_destroy(&tx_wakeup);
+		tx_thread_active = false;
+	}
+
 #ifdef HAVE_SLIRP
 	if (slirp_thread_active) {
 #ifdef HAVE_PTHREAD_CANCEL
 		pthread_cancel(slirp_thread);
 #endif
 		pthread_join(slirp_thread, NULL);
+		slirp_events_exit();
 		slirp_thread_active = false;
 	}
 #endif
@@ -296,15 +349,16 @@ bool ether_init(void)
 			return false;
 		}
 
-		// Open slirp output pipe
+		// Open slirp output channel, a datagram socket keeps the
+		// frame boundaries and lets the receiver read frames in batches
 		int fds[2];
-		if (pipe(fds) < 0)
+		if (socketpair(AF_UNIX, SOCK_DGRAM, 0, fds) < 0)
 			return false;
 		fd = fds[0];
 		slirp_output_fd = fds[1];
 
-		// Open slirp input pipe
-		if (pipe(slirp_input_fds) < 0)
+		// Open slirp input channel
+		if (socketpair(AF_UNIX, SOCK_DGRAM, 0, slirp_input_fds) < 0)
 			return false;
 
 		// Set up port redirects
@@ -533,6 +587,14 @@ void ether_exit(void)
 	printf("%ld rx packets dropped because stream not ready\n", num_rx_stream_not_ready);
 	printf("%ld rx packets dropped because no memory for unitdata_ind\n", num_rx_no_unitdata_mem);
 #endif
+#if STATISTICS
+	printf("%u frames queued for transmission, %u dropped because ring full, %u host errors\n", tx_queued, tx_dropped, tx_errors);
+	printf("transmit queue depth: %.1f average, %u maximum\n", tx_queued ? (double)tx_depth_sum / tx_queued : 0.0, tx_max_depth);
+	printf("transmit batch sizes:");
+	for (int i = 0; i < TX_HIST_SIZE; i++)
+		printf(" %d-%d: %u", 1 << i, (2 << i) - 1, tx_batches[i]);
+	printf("\n");
+#endif
 }
 
 
@@ -782,14 +844,123 @@ int16 ether_detach_ph(uint16 type)
 }
 
 
+/*
+ *  Send frames to the host network device
+ */
+
+static void ether_send_frames(tx_frame *frames, int n)
+{
+#ifdef HAVE_SLIRP
+	if (net_if_type == NET_IF_SLIRP) {
+		const int slirp_input_fd = slirp_input_fds[1];
+		int sent = 0;
+#ifdef HAVE_SENDMMSG
+		struct mmsghdr msgs[TX_RING_SIZE];
+		struct iovec iov[TX_RING_SIZE];
+		memset(msgs, 0, sizeof(msgs));
+		for (int i = 0; i < n; i++) {
+			iov[i].iov_base = frames[i].data;
+			iov[i].iov_len = frames[i].length;
+			msgs[i].msg_hdr.msg_iov = &iov[i];
+			msgs[i].msg_hdr.msg_iovlen = 1;
+		}
+		while (sent < n) {
+			int res = sendmmsg(slirp_input_fd, msgs + sent, n - sent, 0);
+			if (res < 0) {
+				if (errno == EINTR)
+					continue;
+				break;
+			}
+			sent += res;
+		}
+#endif
+		for (; sent < n; sent++) {
+			if (write(slirp_input_fd, frames[sent].data, frames[sent].length) < 0)
+				tx_errors++;
+		}
+		return;
+	}
+#endif
+
+	for (int i = 0; i < n; i++) {
+		uint8 *packet = frames[i].data;
+		int len = frames[i].length;
+#ifdef HAVE_LIBVDEPLUG
+		if (net_if_type == NET_IF_VDE) {
+			if (fd == -1 || vde_conn == NULL) {	// which means vde service is not running
+				D(bug("WARNING: Couldn't transmit VDE packet\n"));
+				tx_errors++;
+				continue;
+			}
+			while (vde_send(vde_conn, packet, len, 0) < 0)
+				;
+		} else
+#endif
+		if (write(fd, packet, len) < 0) {
+			D(bug("WARNING: Couldn't transmit packet\n"));
+			tx_errors++;
+		}
+	}
+}
+
+
+/*
+ *  Packet transmission thread
+ */
+
+static void *transmit_func(void *arg)
+{
+	for (;;) {
+		pthread_mutex_lock(&tx_lock);
+		uint32 tail = tx_tail, head = tx_head;
+		pthread_mutex_unlock(&tx_lock);
+
+		// Wait for frames to arrive
+		if (head == tail) {
+			if (tx_thread_cancel)
+				break;
+			sem_wait(&tx_wakeup);
+			continue;
+		}
+
+		// Send everything up to the end of the ring in one batch
+		int first = tail % TX_RING_SIZE;
+		int n = head - tail;
+		if (first + n > TX_RING_SIZE)
+			n = TX_RING_SIZE - first;
+		ether_send_frames(tx_ring + first, n);
+
+		int bucket = 0;
+		while ((2 << bucket) <= n && bucket < TX_HIST_SIZE - 1)
+			bucket++;
+		tx_batches[bucket]++;
+
+		pthread_mutex_lock(&tx_lock);
+		tx_tail += n;
+		pthread_mutex_unlock(&tx_lock);
+	}
+	return NULL;
+}
+
+
 /*
  *  Transmit raw ethernet packet
  */
 
 static int16 ether_do_write(uint32 arg)
 {
-	// Copy packet to buffer
-	uint8 packet[1516], *p = packet;
+	pthread_mutex_lock(&tx_lock);
+	uint32 depth = tx_head - tx_tail;
+	pthread_mutex_unlock(&tx_lock);
+	if (depth == TX_RING_SIZE) {
+		D(bug("WARNING: Transmit ring full, packet dropped\n"));
+		tx_dropped++;
+		return excessCollsns;
+	}
+
+	// Copy packet to the free slot, which the transmission thread doesn't touch
+	tx_frame *frame = &tx_ring[tx_head % TX_RING_SIZE];
+	uint8 *p = frame->data;
 	int len = 0;
 #if defined(__linux__)
 	if (net_if_type == NET_IF_ETHERTAP) {
@@ -799,48 +970,35 @@ static int16 ether_do_write(uint32 arg)
 	}
 #endif
 	len += ether_arg_to_buffer(arg, p);
+	frame->length = len;
 
 #if MONITOR
 	bug("Sending Ethernet packet:\n");
 	for (int i=0; i<len; i++) {
-		bug("%02x ", packet[i]);
+		bug("%02x ", frame->data[i]);
 	}
 	bug("\n");
 #endif
 
-	// Transmit packet
-#ifdef HAVE_SLIRP
-	if (net_if_type == NET_IF_SLIRP) {
-		const int slirp_input_fd = slirp_input_fds[1];
-		write(slirp_input_fd, &len, sizeof(len));
-		write(slirp_input_fd, packet, len);
+	// Send directly if there is no transmission thread
+	if (!tx_thread_active) {
+		ether_send_frames(frame, 1);
 		return noErr;
-	} else
-#endif
-#ifdef HAVE_LIBVDEPLUG
-	if (net_if_type == NET_IF_VDE) {
-		if (fd == -1) {	// which means vde service is not running
-			D(bug("WARNING: Couldn't transmit VDE packet\n"));
-			return excessCollsns;
-		}
-
-		if (vde_conn == NULL) {
-			D(bug("WARNING: vde_conn is NULL\n"));
-			return -1;
-		}
-
-		do {
-			len = vde_send(vde_conn, packet, sizeof(packet), 0);
-		} while (len < 0);
+	}
 
-		return noErr;
-	} else
-#endif
-	if (write(fd, packet, len) < 0) {
-		D(bug("WARNING: Couldn't transmit packet\n"));
-		return excessCollsns;
-	} else
-		return noErr;
+	// Queue packet
+	pthread_mutex_lock(&tx_lock);
+	bool was_empty = (tx_head == tx_tail);
+	tx_head++;
+	depth = tx_head - tx_tail;
+	pthread_mutex_unlock(&tx_lock);
+	tx_queued++;
+	tx_depth_sum += depth;
+	if (depth > tx_max_depth)
+		tx_max_depth = depth;
+	if (was_empty)
+		sem_post(&tx_wakeup);
+	return noErr;
 }
 
 
@@ -882,10 +1040,42 @@ void slirp_output(const uint8 *packet, int len)
 	write(slirp_output_fd, packet, len);
 }
 
+// Maximum number of queued guest packets handed to slirp per wakeup
+static const int SLIRP_INPUT_BATCH = 32;
+
+// Hand one queued guest packet to slirp, returns false if there was none
+static bool slirp_input_packet(int slirp_input_fd)
+{
+	uint8 packet[1516];
+	ssize_t len = recv(slirp_input_fd, packet, sizeof(packet), MSG_DONTWAIT);
+	if (len <= 0)
+		return false;
+	slirp_input(packet, len);
+	return true;
+}
+
 void *slirp_receive_func(void *arg)
 {
 	const int slirp_input_fd = slirp_input_fds[0];
 
+	// With epoll(), the input queue, the sockets and the slirp timers
+	// are all waited for at once, so guest packets are not delayed
+	if (slirp_events_init() == 0) {
+		D(bug("slirp: using epoll event loop\n"));
+		for (;;) {
+			int ready = slirp_events_wait(slirp_input_fd);
+			if (ready < 0) {
+				printf("WARNING: slirp event loop failed, falling back to select()\n");
+				break;
+			}
+			for (int i = 0; ready > 0 && i < SLIRP_INPUT_BATCH; i++) {
+				if (!slirp_input_packet(slirp_input_fd))
+					break;
+			}
+		}
+		slirp_events_exit();
+	}
+
 	for (;;) {
 		// Wait for packets to arrive
 		fd_set rfds, wfds, xfds;
@@ -897,14 +1087,8 @@ void *slirp_receive_func(void *arg)
 		FD_SET(slirp_input_fd, &rfds);
 		tv.tv_sec = 0;
 		tv.tv_usec = 0;
-		if (select(slirp_input_fd + 1, &rfds, NULL, NULL, &tv) > 0) {
-			int len;
-			read(slirp_input_fd, &len, sizeof(len));
-			uint8 packet[1516];
-			assert(len <= sizeof(packet));
-			read(slirp_input_fd, packet, len);
-			slirp_input(packet, len);
-		}
+		if (select(slirp_input_fd + 1, &rfds, NULL, NULL, &tv) > 0)
+			slirp_input_packet(slirp_input_fd);
 
 		// ... in the output queue
 		nfds = -1;
@@ -985,52 +1169,113 @@ static void *receive_func(void *arg)
 
 
 /*
- *  Ethernet interrupt - activate deferred tasks to call IODone or protocol handlers
+ *  Receive ring - frames are read from the host in batches to save
+ *  system calls, and then handed to the MacOS one at a time
  */
 
-void ether_do_interrupt(void)
+static const int RX_RING_SIZE = 32;			// Maximum number of frames read at once
+
+static uint8 rx_frames[RX_RING_SIZE][1516];	// Frame data
+static ssize_t rx_lengths[RX_RING_SIZE];		// Frame lengths
+static struct sockaddr_in rx_from[RX_RING_SIZE];	// Frame senders (UDP tunnel)
+#ifdef HAVE_RECVMMSG
+static bool rx_use_recvmmsg = true;			// Flag: recvmmsg() works on the fd
+#endif
+
+// Read a batch of frames into the receive ring, returns the number of frames
+static int ether_rx_fill(void)
 {
-	// Call protocol handler for received packets
-	EthernetPacket ether_packet;
-	uint32 packet = ether_packet.addr();
-	ssize_t length;
-	for (;;) {
+#ifdef HAVE_RECVMMSG
+	// Datagram sockets deliver a whole batch with one system call
+	if (rx_use_recvmmsg && (udp_tunnel || net_if_type == NET_IF_SLIRP)) {
+		struct mmsghdr msgs[RX_RING_SIZE];
+		struct iovec iov[RX_RING_SIZE];
+		memset(msgs, 0, sizeof(msgs));
+		for (int i = 0; i < RX_RING_SIZE; i++) {
+			iov[i].iov_base = rx_frames[i];
+			iov[i].iov_len = 1514;
+			msgs[i].msg_hdr.msg_iov = &iov[i];
+			msgs[i].msg_hdr.msg_iovlen = 1;
+			if (udp_tunnel) {
+				msgs[i].msg_hdr.msg_name = &rx_from[i];
+				msgs[i].msg_hdr.msg_namelen = sizeof(rx_from[i]);
+			}
+		}
+		int n = recvmmsg(fd, msgs, RX_RING_SIZE, MSG_DONTWAIT, NULL);
+		if (n >= 0) {
+			for (int i = 0; i < n; i++)
+				rx_lengths[i] = msgs[i].msg_len;
+			return n;
+		}
+		if (errno != ENOSYS && errno != ENOTSOCK)
+			return 0;
+		D(bug("recvmmsg() not supported, reading frames one by one\n"));
+		rx_use_recvmmsg = false;
+	}
+#endif
 
+	int n;
+	for (n = 0; n < RX_RING_SIZE; n++) {
+		ssize_t length;
+		uint8 *frame = rx_frames[n];
 #ifndef SHEEPSHAVER
 		if (udp_tunnel) {
 
 			// Read packet from socket
-			struct sockaddr_in from;
-			socklen_t from_len = sizeof(from);
-			length = recvfrom(fd, Mac2HostAddr(packet), 1514, 0, (struct sockaddr *)&from, &from_len);
-			if (length < 14)
-				break;
-			ether_udp_read(packet, length, &from);
+			socklen_t from_len = sizeof(rx_from[n]);
+			length = recvfrom(fd, frame, 1514, 0, (struct sockaddr *)&rx_from[n], &from_len);
 
 		} else
 #endif
-		{
 #ifdef HAVE_LIBVDEPLUG
-			if (net_if_type == NET_IF_VDE) {
-				length = vde_recv(vde_conn, Mac2HostAddr(packet), 1514, 0);
-			} else
+		if (net_if_type == NET_IF_VDE) {
+			length = vde_recv(vde_conn, frame, 1514, 0);
+		} else
 #endif
-			{
-				// Read packet from sheep_net device
+		{
+			// Read packet from sheep_net device
 #if defined(__linux__)
-				length = read(fd, Mac2HostAddr(packet), net_if_type == NET_IF_ETHERTAP ? 1516 : 1514);
+			length = read(fd, frame, net_if_type == NET_IF_ETHERTAP ? 1516 : 1514);
 #else
-				length = read(fd, Mac2HostAddr(packet), 1514);
+			length = read(fd, frame, 1514);
 #endif
-			}
-			
+		}
+		if (length < 14)
+			break;
+		rx_lengths[n] = length;
+	}
+	return n;
+}
+
+
+/*
+ *  Ethernet interrupt - activate deferred tasks to call IODone or protocol handlers
+ */
+
+void ether_do_interrupt(void)
+{
+	// Call protocol handler for received packets
+	EthernetPacket ether_packet;
+	uint32 packet = ether_packet.addr();
+	for (;;) {
+		int n = ether_rx_fill();
+		for (int i = 0; i < n; i++) {
+			ssize_t length = rx_lengths[i];
 			if (length < 14)
-				break;
+				continue;
+			Host2Mac_memcpy(packet, rx_frames[i], length);
+
+#ifndef SHEEPSHAVER
+			if (udp_tunnel) {
+				ether_udp_read(packet, length, &rx_from[i]);
+				continue;
+			}
+#endif
 
 #if MONITOR
 			bug("Receiving Ethernet packet:\n");
-			for (int i=0; i<length; i++) {
-				bug("%02x ", ReadMacInt8(packet + i));
+			for (int j=0; j<length; j++) {
+				bug("%02x ", ReadMacInt8(packet + j));
 			}
 			bug("\n");
 #endif
@@ -1047,6 +1292,10 @@ void ether_do_interrupt(void)
 			// Dispatch packet
 			ether_dispatch_packet(p, length);
 		}
+
+		// A short batch means that the host queue is empty
+		if (n < RX_RING_SIZE)
+			break;
 	}
 }
 
@@ -31,7 +31,7 @@
 # include <SDL_main.h>
 #endif
 
-#ifndef USE_SDL_VIDEO
+#if !defined(USE_SDL_VIDEO) && !defined(USE_HEADLESS_VIDEO)
 # include <X11/Xlib.h>
 #endif
 
@@ -92,6 +92,11 @@ using std::string;
 #include "vm_alloc.h"
 #include "sigsegv.h"
 #include "rpc.h"
+#include "disk.h"
+#include "sony.h"
+#include "cdrom.h"
+#include "extfs.h"
+#include "snapshot_unix.h"
 
 #if USE_JIT
 extern void flush_icache_range(uint8 *start, uint32 size); // from compemu_support.cpp
@@ -111,6 +116,7 @@ const char ROM_FILE_NAME[] = "ROM";
 const int SIG_STACK_SIZE = SIGSTKSZ;	// Size of signal stack
 #endif
 const int SCRATCH_MEM_SIZE = 0x10000;	// Size of scratch memory area
+const uint32 ROM_AREA_SIZE = 0x100000;	// Size of ROM area following Mac RAM
 
 
 #if !EMULATED_68K
@@ -132,7 +138,7 @@ bool TwentyFourBitAddressing;
 
 
 // Global variables
-#ifndef USE_SDL_VIDEO
+#if !defined(USE_SDL_VIDEO) && !defined(USE_HEADLESS_VIDEO)
 extern char *x_display_name;						// X11 display name
 extern Display *x_display;							// X11 display handle
 #ifdef X11_LOCK_TYPE
@@ -142,6 +148,10 @@ X11_LOCK_TYPE x_display_lock = X11_LOCK_INIT;		// X11 display lock
 
 static uint8 last_xpram[XPRAM_SIZE];				// Buffer for monitoring XPRAM changes
 
+#if EMULATED_68K
+static int32 snapshot_save_delay = 0;				// Seconds until snapshot is saved (0 = never)
+#endif
+
 #ifdef HAVE_PTHREADS
 #if !EMULATED_68K
 static pthread_t emul_thread;						// Handle of MacOS emulation thread (main thread)
@@ -205,6 +215,10 @@ static const char *gui_connection_path = NULL;	// GUI connection identifier
 static void *xpram_func(void *arg);
 static void *tick_func(void *arg);
 static void one_tick(...);
+#if EMULATED_68K
+static void snapshot_restore(void);
+static void snapshot_save(void);
+#endif
 #if !EMULATED_68K
 static void sigirq_handler(int sig, int code, struct sigcontext *scp);
 static void sigill_handler(int sig, int code, struct sigcontext *scp);
@@ -410,7 +424,7 @@ int main(int argc, char **argv)
 	for (int i=1; i<argc; i++) {
 		if (strcmp(argv[i], "--help") == 0) {
 			usage(argv[0]);
-#ifndef USE_SDL_VIDEO
+#if !defined(USE_SDL_VIDEO) && !defined(USE_HEADLESS_VIDEO)
 		} else if (strcmp(argv[i], "--display") == 0) {
 			i++; // don't remove the argument, gtk_init() needs it too
 			if (i < argc)
@@ -518,7 +532,7 @@ int main(int argc, char **argv)
 		}
 	}
 
-#ifndef USE_SDL_VIDEO
+#if !defined(USE_SDL_VIDEO) && !defined(USE_HEADLESS_VIDEO)
 	// Open display
 	x_display = XOpenDisplay(x_display_name);
 	if (x_display == NULL) {
@@ -599,6 +613,14 @@ int main(int argc, char **argv)
 	// Initialize VM system
 	vm_init();
 
+	// Back RAM, ROM and JIT caches with huge pages, if requested
+	const char *huge_pages = PrefsFindString("hugepages");
+	if (huge_pages && strcmp(huge_pages, "none") != 0) {
+		int mode = strcmp(huge_pages, "explicit") == 0 ? VM_HUGE_PAGES_EXPLICIT : VM_HUGE_PAGES_TRANSPARENT;
+		if (vm_set_huge_pages(mode) < 0)
+			printf("WARNING: Huge pages are not supported on this platform\n");
+	}
+
 #if REAL_ADDRESSING
 	// Flag: RAM and ROM are contigously allocated from address 0
 	bool memory_mapped_from_zero = false;
@@ -643,11 +665,12 @@ int main(int argc, char **argv)
 	else
 #endif
 	{
-		uint8 *ram_rom_area = (uint8 *)vm_acquire_mac(RAMSize + 0x100000);
+		uint8 *ram_rom_area = (uint8 *)vm_acquire(RAMSize + 0x100000, VM_MAP_DEFAULT | VM_MAP_32BIT | VM_MAP_HUGE);
 		if (ram_rom_area == VM_MAP_FAILED) {	
 			ErrorAlert(STR_NO_MEM_ERR);
 			QuitEmulator();
 		}
+		vm_report_huge_pages("RAM and ROM", ram_rom_area, RAMSize + 0x100000);
 		RAMBaseHost = ram_rom_area;
 		ROMBaseHost = RAMBaseHost + RAMSize;
 	}
@@ -738,6 +761,13 @@ int main(int argc, char **argv)
 	D(bug("Mac RAM starts at %p (%08x)\n", RAMBaseHost, RAMBaseMac));
 	D(bug("Mac ROM starts at %p (%08x)\n", ROMBaseHost, ROMBaseMac));
 
+#if EMULATED_68K
+	// Resume from snapshot if there is one
+	snapshot_restore();
+	if (PrefsFindString("snapshot"))
+		snapshot_save_delay = PrefsFindInt32("snapshotsave");
+#endif
+
 #if !EMULATED_68K
 	// (Virtual) supervisor mode, disable interrupts
 	EmulatedSR = 0x2700;
@@ -962,7 +992,7 @@ void QuitEmulator(void)
 	PrefsExit();
 
 	// Close X11 server connection
-#ifndef USE_SDL_VIDEO
+#if !defined(USE_SDL_VIDEO) && !defined(USE_HEADLESS_VIDEO)
 	if (x_display)
 		XCloseDisplay(x_display);
 #endif
@@ -1190,6 +1220,143 @@ static void *xpram_func(void *arg)
 #endif
 
 
+/*
+ *  Snapshot support
+ */
+
+#if EMULATED_68K
+// Configuration a snapshot must have been taken with
+struct snapshot_config {
+	uint32 ram_size;
+	uint32 rom_size;
+	uint32 rom_checksum;
+	uint32 rom_version;
+	int32 cpu_type;
+	int32 fpu_type;
+	uint32 twenty_four_bit;
+};
+
+static void get_snapshot_config(snapshot_config &c)
+{
+	memset(&c, 0, sizeof(c));
+	c.ram_size = RAMSize;
+	c.rom_size = ROMSize;
+	c.rom_checksum = *(uint32 *)ROMBaseHost;
+	c.rom_version = ROMVersion;
+	c.cpu_type = CPUType;
+	c.fpu_type = FPUType;
+	c.twenty_four_bit = TwentyFourBitAddressing;
+}
+
+// Host-side state of drivers and managers
+static const struct {
+	uint32 tag;
+	void (*save)(vector<uint32> &state);
+	bool (*restore)(const vector<uint32> &state);
+} snapshot_modules[] = {
+	{SNAPSHOT_TAG_TIMER, TimerSaveState, TimerRestoreState},
+	{SNAPSHOT_TAG_SONY, SonySaveState, SonyRestoreState},
+	{SNAPSHOT_TAG_DISK, DiskSaveState, DiskRestoreState},
+	{SNAPSHOT_TAG_CDROM, CDROMSaveState, CDROMRestoreState},
+	{SNAPSHOT_TAG_EXTFS, ExtFSSaveState, ExtFSRestoreState},
+	{SNAPSHOT_TAG_VIDEO, VideoSaveState, VideoRestoreState}
+};
+
+// Frame buffer of main monitor (in current video mode)
+static uint8 *snapshot_frame_buffer(uint32 &size)
+{
+	const monitor_desc *m = VideoMonitors[0];
+	const video_mode &mode = m->get_current_mode();
+	size = mode.bytes_per_row * mode.y;
+	return Mac2HostAddr(m->get_mac_frame_base());
+}
+
+// Save snapshot (called from the 680x0 execution loop)
+static void snapshot_save(void)
+{
+	const char *path = PrefsFindString("snapshot");
+	uint64 start = GetTicks_usec();
+
+	bool ok = false;
+	snapshot_file *s = snapshot_create(path);
+	if (s) {
+		snapshot_config config;
+		get_snapshot_config(config);
+		ok = snapshot_write_data(s, SNAPSHOT_TAG_CONFIG, &config, sizeof(config));
+
+		vector<uint32> state;
+		Save680x0State(state);
+		ok = ok && snapshot_write_data(s, SNAPSHOT_TAG_CPU, state);
+		ok = ok && snapshot_write_memory(s, SNAPSHOT_TAG_RAM, RAMBaseHost, RAMSize);
+		ok = ok && snapshot_write_memory(s, SNAPSHOT_TAG_ROM, ROMBaseHost, ROM_AREA_SIZE);
+		ok = ok && snapshot_write_data(s, SNAPSHOT_TAG_XPRAM, XPRAM, XPRAM_SIZE);
+		for (int i = 0; ok && i < (int)(sizeof(snapshot_modules) / sizeof(snapshot_modules[0])); i++) {
+			snapshot_modules[i].save(state);
+			ok = snapshot_write_data(s, snapshot_modules[i].tag, state);
+		}
+
+		uint32 frame_size;
+		uint8 *frame = snapshot_frame_buffer(frame_size);
+		ok = ok && snapshot_write_data(s, SNAPSHOT_TAG_FRAME, frame, frame_size);
+
+		if (ok)
+			ok = snapshot_commit(s);
+		else
+			snapshot_close(s);
+	}
+
+	if (ok)
+		printf("Snapshot saved to %s in %d ms\n", path, int((GetTicks_usec() - start) / 1000));
+	else
+		printf("WARNING: Cannot save snapshot to %s (%s)\n", path, strerror(errno));
+
+	if (PrefsFindBool("snapshotquit"))
+		QuitEmulator();
+}
+
+// Restore snapshot before starting the 680x0 (RAM is mapped copy-on-write)
+static void snapshot_restore(void)
+{
+	const char *path = PrefsFindString("snapshot");
+	if (path == NULL || access(path, F_OK) < 0)
+		return;
+	uint64 start = GetTicks_usec();
+
+	snapshot_config config, saved_config;
+	get_snapshot_config(config);
+	snapshot_file *s = snapshot_open(path);
+	if (s == NULL
+	 || !snapshot_read_data(s, SNAPSHOT_TAG_CONFIG, &saved_config, sizeof(saved_config))
+	 || memcmp(&config, &saved_config, sizeof(config)) != 0) {
+		printf("WARNING: Snapshot %s is invalid or doesn't match the current configuration, ignored\n", path);
+		if (s)
+			snapshot_close(s);
+		return;
+	}
+
+	// From here on, there is no way back to a clean boot
+	vector<uint32> state;
+	bool ok = snapshot_read_data(s, SNAPSHOT_TAG_CPU, state) && Restore680x0State(state);
+	ok = ok && snapshot_map_memory(s, SNAPSHOT_TAG_RAM, RAMBaseHost, RAMSize);
+	ok = ok && snapshot_map_memory(s, SNAPSHOT_TAG_ROM, ROMBaseHost, ROM_AREA_SIZE);
+	ok = ok && snapshot_read_data(s, SNAPSHOT_TAG_XPRAM, XPRAM, XPRAM_SIZE);
+	for (int i = 0; ok && i < (int)(sizeof(snapshot_modules) / sizeof(snapshot_modules[0])); i++)
+		ok = snapshot_read_data(s, snapshot_modules[i].tag, state) && snapshot_modules[i].restore(state);
+
+	uint32 frame_size;
+	uint8 *frame = snapshot_frame_buffer(frame_size);
+	ok = ok && snapshot_read_data(s, SNAPSHOT_TAG_FRAME, frame, frame_size);
+	snapshot_close(s);
+
+	if (!ok) {
+		ErrorAlert("Cannot restore snapshot, the file is damaged.");
+		QuitEmulator();
+	}
+	printf("Snapshot restored from %s in %d ms\n", path, int((GetTicks_usec() - start) / 1000));
+}
+#endif
+
+
 /*
  *  60Hz thread (really 60.15Hz)
  */
@@ -1209,6 +1376,12 @@ static void one_second(void)
 		xpram_watchdog();
 	}
 #endif
+
+#if EMULATED_68K
+	// Save snapshot when the requested time has passed
+	if (snapshot_save_delay > 0 && --snapshot_save_delay == 0)
+		Call680x0AtToplevel(snapshot_save);
+#endif
 }
 
 static void one_tick(...)
@@ -1618,7 +1791,7 @@ void ErrorAlert(const char *text)
 			rpc_method_wait_for_reply(gui_connection, RPC_TYPE_INVALID) == RPC_ERROR_NO_ERROR)
 			return;
 	}
-#if defined(ENABLE_GTK) && !defined(USE_SDL_VIDEO)
+#if defined(ENABLE_GTK) && !defined(USE_SDL_VIDEO) && !defined(USE_HEADLESS_VIDEO)
 	if (PrefsFindBool("nogui") || x_display == NULL) {
 		printf(GetString(STR_SHELL_ERROR_PREFIX), text);
 		return;
@@ -1642,7 +1815,7 @@ void WarningAlert(const char *text)
 			rpc_method_wait_for_reply(gui_connection, RPC_TYPE_INVALID) == RPC_ERROR_NO_ERROR)
 			return;
 	}
-#if defined(ENABLE_GTK) && !defined(USE_SDL_VIDEO)
+#if defined(ENABLE_GTK) && !defined(USE_SDL_VIDEO) && !defined(USE_HEADLESS_VIDEO)
 	if (PrefsFindBool("nogui") || x_display == NULL) {
 		printf(GetString(STR_SHELL_WARNING_PREFIX), text);
 		return;
@@ -0,0 +1,530 @@
+/*
+ *  slirp_bench.cpp - Latency and throughput of the slirp event loops
+ *
+ *  Basilisk II (C) 1997-2008 Christian Bauer
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+/*
+ *  The benchmark plays the guest: it sends UDP datagrams to the host
+ *  alias address 10.0.2.2 through slirp, which forwards them to a local
+ *  echo server, and waits for the echoed frames to come out of slirp.
+ *  The slirp thread is driven the same way as in ether_unix.cpp, either
+ *  with the select() loop or with the epoll() event loop.
+ *
+ *  The "scale" mode measures how the throughput changes with the number
+ *  of concurrent flows (slirp sockets), using different guest ports.
+ *
+ *  The "frag" mode sends fragmented datagrams and checks that the number
+ *  of allocated mbufs stays the same after they are reassembled, and
+ *  after incomplete ones time out (this takes about a minute).
+ *
+ *  Usage: slirp_bench [select|epoll|both|scale|frag] [seconds]
+ */
+
+#include "sysdeps.h"
+
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/ip.h>
+#include <arpa/inet.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+#include <vector>
+
+#include "libslirp.h"
+#include "ctl.h"
+
+extern "C" int mbuf_alloced;				// slirp/mbuf.c
+
+// Benchmark parameters
+static const int LATENCY_ROUNDS = 2000;		// Number of ping-pongs
+static const int PAYLOAD_SIZE = 1024;		// UDP payload for throughput test
+static const int WINDOW = 32;				// Datagrams in flight for throughput test
+static const int GUEST_PORT = 4321;
+static const int SCALE_FLOWS[] = {1, 16, 128, 512};
+static const int FRAG_DATAGRAMS = 256;		// More than a slab of mbufs
+static const int FRAG_PAYLOAD_SIZE = 1016;	// UDP payload, split into two 512 byte fragments
+static const int FRAG_TIMEOUT = 32;			// Seconds until slirp drops incomplete datagrams
+
+static int input_fds[2];					// Guest -> slirp
+static int output_fds[2];					// slirp -> guest
+static volatile bool stop_slirp;
+static uint16 echo_port;
+
+
+/*
+ *  Time in microseconds
+ */
+
+static uint64 now_usec(void)
+{
+	struct timeval tv;
+	gettimeofday(&tv, NULL);
+	return (uint64)tv.tv_sec * 1000000 + tv.tv_usec;
+}
+
+
+/*
+ *  UDP echo server on the loopback interface
+ */
+
+static void *echo_func(void *arg)
+{
+	int s = (int)(intptr_t)arg;
+	uint8 buf[2048];
+	for (;;) {
+		struct sockaddr_in from;
+		socklen_t from_len = sizeof(from);
+		ssize_t n = recvfrom(s, buf, sizeof(buf), 0, (struct sockaddr *)&from, &from_len);
+		if (n < 0)
+			break;
+		sendto(s, buf, n, 0, (struct sockaddr *)&from, from_len);
+	}
+	return NULL;
+}
+
+static bool start_echo_server(void)
+{
+	int s = socket(AF_INET, SOCK_DGRAM, 0);
+	if (s < 0)
+		return false;
+	struct sockaddr_in sa;
+	memset(&sa, 0, sizeof(sa));
+	sa.sin_family = AF_INET;
+	sa.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	sa.sin_port = 0;
+	socklen_t len = sizeof(sa);
+	if (bind(s, (struct sockaddr *)&sa, sizeof(sa)) < 0 || getsockname(s, (struct sockaddr *)&sa, &len) < 0) {
+		close(s);
+		return false;
+	}
+	echo_port = ntohs(sa.sin_port);
+	pthread_t thread;
+	return pthread_create(&thread, NULL, echo_func, (void *)(intptr_t)s) == 0;
+}
+
+
+/*
+ *  slirp glue, as in ether_unix.cpp
+ */
+
+int slirp_can_output(void)
+{
+	return 1;
+}
+
+void slirp_output(const uint8 *packet, int len)
+{
+	write(output_fds[1], packet, len);
+}
+
+static bool slirp_input_packet(int fd)
+{
+	uint8 packet[1516];
+	ssize_t len = recv(fd, packet, sizeof(packet), MSG_DONTWAIT);
+	if (len <= 0)
+		return false;
+	slirp_input(packet, len);
+	return true;
+}
+
+static void *slirp_epoll_func(void *arg)
+{
+	while (!stop_slirp) {
+		int ready = slirp_events_wait(input_fds[0]);
+		if (ready < 0)
+			break;
+		for (int i = 0; ready > 0 && i < 32; i++) {
+			if (!slirp_input_packet(input_fds[0]))
+				break;
+		}
+	}
+	return NULL;
+}
+
+static void *slirp_select_func(void *arg)
+{
+	while (!stop_slirp) {
+		fd_set rfds, wfds, xfds;
+		int nfds;
+		struct timeval tv;
+
+		FD_ZERO(&rfds);
+		FD_SET(input_fds[0], &rfds);
+		tv.tv_sec = 0;
+		tv.tv_usec = 0;
+		if (select(input_fds[0] + 1, &rfds, NULL, NULL, &tv) > 0)
+			slirp_input_packet(input_fds[0]);
+
+		nfds = -1;
+		FD_ZERO(&rfds);
+		FD_ZERO(&wfds);
+		FD_ZERO(&xfds);
+		int timeout = slirp_select_fill(&nfds, &rfds, &wfds, &xfds);
+		tv.tv_sec = 0;
+		tv.tv_usec = timeout;
+		if (select(nfds + 1, &rfds, &wfds, &xfds, &tv) >= 0)
+			slirp_select_poll(&rfds, &wfds, &xfds);
+	}
+	return NULL;
+}
+
+
+/*
+ *  Guest side
+ */
+
+static uint16 ip_checksum(const uint8 *p, int len)
+{
+	uint32 sum = 0;
+	for (int i = 0; i < len; i += 2)
+		sum += (p[i] << 8) | p[i + 1];
+	while (sum >> 16)
+		sum = (sum & 0xffff) + (sum >> 16);
+	return ~sum;
+}
+
+// Build Ethernet and IP headers of a packet of the given length to the host
+static void guest_headers(uint8 *packet, int len, uint16 id, uint16 frag)
+{
+	memset(packet, 0, len);
+
+	// Ethernet header
+	memset(packet, 0x52, 6);
+	packet[6] = 0x52; packet[7] = 0x54; packet[11] = 0x15;
+	packet[12] = 0x08; packet[13] = 0x00;
+
+	// IP header
+	uint8 *ip = packet + 14;
+	ip[0] = 0x45;
+	ip[2] = (len - 14) >> 8; ip[3] = (len - 14) & 0xff;
+	ip[4] = id >> 8; ip[5] = id & 0xff;
+	ip[6] = frag >> 8; ip[7] = frag & 0xff;
+	ip[8] = 64;
+	ip[9] = IPPROTO_UDP;
+	ip[12] = 10; ip[13] = 0; ip[14] = 2; ip[15] = 15;
+	ip[16] = 10; ip[17] = 0; ip[18] = 2; ip[19] = CTL_ALIAS;
+	uint16 sum = ip_checksum(ip, 20);
+	ip[10] = sum >> 8; ip[11] = sum & 0xff;
+}
+
+// Build UDP header (no checksum) and sequence number
+static void guest_udp_header(uint8 *udp, uint32 seq, int payload_size, int port)
+{
+	udp[0] = port >> 8; udp[1] = port & 0xff;
+	udp[2] = echo_port >> 8; udp[3] = echo_port & 0xff;
+	udp[4] = (8 + payload_size) >> 8; udp[5] = (8 + payload_size) & 0xff;
+	memcpy(udp + 8, &seq, sizeof(seq));
+}
+
+// Send UDP datagram with sequence number to echo server
+static void guest_send(uint32 seq, int payload_size, int port = GUEST_PORT)
+{
+	uint8 packet[1516];
+	int len = 14 + 20 + 8 + payload_size;
+	guest_headers(packet, len, seq, 0);
+	guest_udp_header(packet + 14 + 20, seq, payload_size, port);
+	write(input_fds[1], packet, len);
+}
+
+// Send UDP datagram to echo server as two IP fragments, or only the first one
+static void guest_send_fragmented(uint32 seq, bool complete)
+{
+	const int frag_len = (8 + FRAG_PAYLOAD_SIZE) / 2;
+	uint8 packet[1516];
+	guest_headers(packet, 14 + 20 + frag_len, seq, IP_MF);
+	guest_udp_header(packet + 14 + 20, seq, FRAG_PAYLOAD_SIZE, GUEST_PORT);
+	write(input_fds[1], packet, 14 + 20 + frag_len);
+	if (complete) {
+		guest_headers(packet, 14 + 20 + frag_len, seq, frag_len / 8);
+		write(input_fds[1], packet, 14 + 20 + frag_len);
+	}
+}
+
+// Wait for echoed datagram, returns sequence number or -1 on timeout
+static int64 guest_receive(int timeout_ms)
+{
+	for (;;) {
+		struct pollfd pfd;
+		pfd.fd = output_fds[0];
+		pfd.events = POLLIN;
+		if (poll(&pfd, 1, timeout_ms) <= 0)
+			return -1;
+		uint8 packet[1516];
+		ssize_t len = read(output_fds[0], packet, sizeof(packet));
+		if (len < 14 + 20 + 8 + 4 || packet[12] != 0x08 || packet[13] != 0x00 || packet[14 + 9] != IPPROTO_UDP)
+			continue;
+		uint32 seq;
+		memcpy(&seq, packet + 14 + 20 + 8, sizeof(seq));
+		return seq;
+	}
+}
+
+
+/*
+ *  Start and stop slirp thread
+ */
+
+static pthread_t slirp_thread;
+
+static bool start_slirp(void *(*loop_func)(void *))
+{
+	stop_slirp = false;
+	return pthread_create(&slirp_thread, NULL, loop_func, NULL) == 0;
+}
+
+static void stop_slirp_thread(void)
+{
+	stop_slirp = true;
+	write(input_fds[1], "", 0);		// Wake up slirp thread
+	pthread_join(slirp_thread, NULL);
+}
+
+
+/*
+ *  Throughput with a window of datagrams in flight, spread over the
+ *  given number of flows
+ */
+
+static uint32 seq = 0;
+
+static double throughput(int seconds, int flows, uint64 &sent, uint64 &lost)
+{
+	uint64 received = 0;
+	uint64 start = now_usec(), end = start + (uint64)seconds * 1000000;
+	int in_flight = 0;
+	int flow = 0;
+	sent = lost = 0;
+	while (now_usec() < end) {
+		while (in_flight < WINDOW) {
+			guest_send(seq++, PAYLOAD_SIZE, GUEST_PORT + flow);
+			if (++flow == flows)
+				flow = 0;
+			sent++;
+			in_flight++;
+		}
+		if (guest_receive(100) >= 0)
+			received++;
+		else {
+			lost += in_flight;		// Don't stall on lost datagrams
+			in_flight = 0;
+			continue;
+		}
+		in_flight--;
+	}
+	double elapsed = (now_usec() - start) / 1e6;
+	while (guest_receive(100) >= 0)
+		;
+	return received / elapsed;
+}
+
+// Create slirp sockets for the flows by sending one datagram each
+static bool open_flows(int first, int last)
+{
+	for (int port = GUEST_PORT + first; port < GUEST_PORT + last; port++) {
+		guest_send(seq, 4, port);
+		int64 r;
+		while ((r = guest_receive(1000)) >= 0 && r != seq)
+			;
+		if (r < 0)
+			return false;
+		seq++;
+	}
+	return true;
+}
+
+
+/*
+ *  Run benchmark with given event loop
+ */
+
+static bool run(const char *name, void *(*loop_func)(void *), int seconds)
+{
+	if (!start_slirp(loop_func))
+		return false;
+
+	// Warm up, this creates the slirp UDP socket
+	if (!open_flows(0, 1)) {
+		fprintf(stderr, "%s: no reply from echo server\n", name);
+		stop_slirp_thread();
+		return false;
+	}
+
+	// Round-trip latency
+	std::vector<uint64> rtt;
+	rtt.reserve(LATENCY_ROUNDS);
+	for (int i = 0; i < LATENCY_ROUNDS; i++, seq++) {
+		uint64 start = now_usec();
+		guest_send(seq, 4);
+		int64 r;
+		while ((r = guest_receive(1000)) >= 0 && r != seq)
+			;
+		if (r < 0) {
+			fprintf(stderr, "%s: packet lost\n", name);
+			continue;
+		}
+		rtt.push_back(now_usec() - start);
+	}
+	std::sort(rtt.begin(), rtt.end());
+	uint64 total = 0;
+	for (size_t i = 0; i < rtt.size(); i++)
+		total += rtt[i];
+
+	// Throughput
+	uint64 sent, lost;
+	double rate = throughput(seconds, 1, sent, lost);
+	stop_slirp_thread();
+
+	if (rtt.empty())
+		return false;
+	printf("%-6s latency: avg %6.1f us, median %6.1f us, 99%% %6.1f us\n", name,
+		(double)total / rtt.size(), (double)rtt[rtt.size() / 2], (double)rtt[rtt.size() * 99 / 100]);
+	printf("%-6s throughput: %.0f packets/s, %.2f MB/s (%llu sent, %llu lost)\n", name,
+		rate, rate * PAYLOAD_SIZE / (1024 * 1024),
+		(unsigned long long)sent, (unsigned long long)lost);
+	return true;
+}
+
+/*
+ *  Check that IP fragment reassembly doesn't leak mbufs. The first pass
+ *  of each test grows the mbuf pool to its working size, the second one
+ *  must not allocate more.
+ */
+
+static bool run_frag(const char *name, void *(*loop_func)(void *))
+{
+	if (!start_slirp(loop_func))
+		return false;
+	bool ok = open_flows(0, 1);
+
+	// Reassembled datagrams
+	int alloced[2];
+	for (int pass = 0; ok && pass < 2; pass++) {
+		for (int i = 0; i < FRAG_DATAGRAMS; i++, seq++) {
+			guest_send_fragmented(seq, true);
+			int64 r;
+			while ((r = guest_receive(1000)) >= 0 && r != seq)
+				;
+			if (r < 0) {
+				fprintf(stderr, "%s: fragmented datagram not reassembled\n", name);
+				ok = false;
+				break;
+			}
+		}
+		alloced[pass] = mbuf_alloced;
+	}
+	if (ok) {
+		printf("%-6s reassembly: %d mbufs allocated after first pass, %d after second\n", name, alloced[0], alloced[1]);
+		ok = alloced[1] == alloced[0];
+	}
+
+	// Incomplete datagrams
+	for (int pass = 0; ok && pass < 2; pass++) {
+		for (int i = 0; i < FRAG_DATAGRAMS; i++)
+			guest_send_fragmented(seq++, false);
+		sleep(FRAG_TIMEOUT);
+		alloced[pass] = mbuf_alloced;
+	}
+	if (ok) {
+		printf("%-6s timeout: %d mbufs allocated after first pass, %d after second\n", name, alloced[0], alloced[1]);
+		ok = alloced[1] == alloced[0];
+	}
+
+	stop_slirp_thread();
+	return ok;
+}
+
+static bool run_scale(const char *name, void *(*loop_func)(void *), int seconds)
+{
+	if (!start_slirp(loop_func))
+		return false;
+
+	bool ok = true;
+	int open = 0;
+	for (size_t i = 0; i < sizeof(SCALE_FLOWS) / sizeof(SCALE_FLOWS[0]); i++) {
+		int flows = SCALE_FLOWS[i];
+		if (!open_flows(open, flows)) {
+			fprintf(stderr, "%s: cannot open %d flows\n", name, flows);
+			ok = false;
+			break;
+		}
+		open = flows;
+		uint64 sent, lost;
+		double rate = throughput(seconds, flows, sent, lost);
+		printf("%-6s %4d flows: %.0f packets/s (%llu sent, %llu lost)\n", name, flows, rate,
+			(unsigned long long)sent, (unsigned long long)lost);
+	}
+	stop_slirp_thread();
+	return ok;
+}
+
+int main(int argc, char **argv)
+{
+	const char *mode = argc > 1 ? argv[1] : "both";
+	int seconds = argc > 2 ? atoi(argv[2]) : 5;
+	if (seconds <= 0)
+		seconds = 5;
+
+	if (socketpair(AF_UNIX, SOCK_DGRAM, 0, input_fds) < 0 || socketpair(AF_UNIX, SOCK_DGRAM, 0, output_fds) < 0) {
+		perror("socketpair");
+		return 1;
+	}
+	if (slirp_init() < 0) {
+		fprintf(stderr, "Cannot initialize slirp\n");
+		return 1;
+	}
+	if (!start_echo_server()) {
+		fprintf(stderr, "Cannot start echo server\n");
+		return 1;
+	}
+
+	bool ok = true;
+	if (strcmp(mode, "frag") == 0) {
+		if (slirp_events_init() == 0) {
+			ok = run_frag("epoll", slirp_epoll_func);
+			slirp_events_exit();
+		} else
+			ok = run_frag("select", slirp_select_func);
+		return ok ? 0 : 1;
+	}
+	if (strcmp(mode, "scale") == 0) {
+		if (slirp_events_init() == 0) {
+			ok = run_scale("epoll", slirp_epoll_func, seconds);
+			slirp_events_exit();
+		} else
+			ok = run_scale("select", slirp_select_func, seconds);
+		return ok ? 0 : 1;
+	}
+	if (strcmp(mode, "select") == 0 || strcmp(mode, "both") == 0)
+		ok &= run("select", slirp_select_func, seconds);
+	if (strcmp(mode, "epoll") == 0 || strcmp(mode, "both") == 0) {
+		if (slirp_events_init() < 0)
+			printf("epoll event loop not available on this system\n");
+		else {
+			ok &= run("epoll", slirp_epoll_func, seconds);
+			slirp_events_exit();
+		}
+	}
+	return ok ? 0 : 1;
+}
@@ -0,0 +1,60 @@
+#!/bin/sh
+# Compare cold boot time with resume-from-snapshot time.
+#
+# The emulator is booted with the current prefs, a snapshot is saved after
+# the given number of seconds (long enough to reach the Finder), and then
+# the emulator is started again from that snapshot. Works with both
+# BasiliskII and SheepShaver; extra arguments are passed to the emulator.
+
+case $# in
+  0)
+	echo "Usage: snapshot_bench.sh emulator [seconds [emulator options...]]" >&2
+	exit 2
+	;;
+esac
+
+emulator=$1
+seconds=${2:-30}
+shift
+[ $# -gt 0 ] && shift
+
+snapshot=${TMPDIR:-/tmp}/snapshot_bench.$$
+trap 'rm -f "$snapshot" "$snapshot.tmp" "$snapshot.log"' 0
+
+now_ms() {
+	# Milliseconds since the epoch (GNU date), falling back to seconds
+	ms=`date +%s%3N 2>/dev/null`
+	case "$ms" in
+	  *N) echo `expr \`date +%s\` \* 1000` ;;
+	  *) echo $ms ;;
+	esac
+}
+
+# Cold boot, then save and quit
+echo "Booting for $seconds seconds..."
+start=`now_ms`
+"$emulator" "$@" --snapshot "$snapshot" --snapshotsave "$seconds" --snapshotquit true >"$snapshot.log" 2>&1
+end=`now_ms`
+if [ ! -f "$snapshot" ]; then
+	echo "No snapshot was saved:" >&2
+	cat "$snapshot.log" >&2
+	exit 1
+fi
+grep '^Snapshot saved' "$snapshot.log"
+boot=`expr $end - $start`
+echo "Snapshot size: `du -k "$snapshot" | cut -f1` KB on disk, `ls -l "$snapshot" | awk '{print $5}'` bytes"
+
+# Resume, run for one second, then save and quit again
+echo "Resuming from snapshot..."
+start=`now_ms`
+"$emulator" "$@" --snapshot "$snapshot" --snapshotsave 1 --snapshotquit true >"$snapshot.log" 2>&1
+end=`now_ms`
+if ! grep '^Snapshot restored' "$snapshot.log"; then
+	echo "Snapshot was not restored:" >&2
+	cat "$snapshot.log" >&2
+	exit 1
+fi
+resume=`expr $end - $start - 1000`
+
+echo "Boot to snapshot point: $boot ms"
+echo "Resume to same point:   $resume ms"
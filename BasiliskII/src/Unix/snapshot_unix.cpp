@@ -0,0 +1,478 @@
+/*
+ *  snapshot_unix.cpp - Guest state snapshot files
+ *
+ *  Basilisk II (C) 1997-2008 Christian Bauer
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#include "sysdeps.h"
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+
+#include <map>
+#include <string>
+
+#include "snapshot_unix.h"
+#include "vm_alloc.h"
+
+#define DEBUG 0
+#include "debug.h"
+
+
+/*
+ *  File layout (host byte order, all offsets from start of file)
+ *
+ *  header
+ *  { chunk_header, payload }...
+ *
+ *  Data chunk payload:   raw bytes
+ *  Memory chunk payload: uint32 page table (0 = zero page, n = n-th pool page),
+ *                        padding to the next page boundary, page pool
+ */
+
+static const char SNAPSHOT_MAGIC[8] = {'M', 'A', 'C', 'S', 'N', 'A', 'P', 0};
+static const uint32 SNAPSHOT_VERSION = 1;
+
+struct snapshot_header {
+	char magic[8];
+	uint32 version;
+	uint32 page_size;
+	uint32 pointer_size;	// Snapshots are not portable across hosts
+	uint32 byte_order;
+};
+
+enum {
+	CHUNK_DATA,
+	CHUNK_MEMORY
+};
+
+struct chunk_header {
+	uint32 tag;
+	uint32 type;
+	uint64 size;			// Size of data or memory region
+	uint64 pool_offset;		// File offset of page pool (memory chunks)
+	uint64 pool_pages;		// Number of pages in pool (memory chunks)
+};
+
+struct chunk_info {
+	chunk_header h;
+	off_t offset;			// File offset of payload
+};
+
+struct snapshot_file {
+	int fd;
+	bool writing;
+	std::string path, tmp_path;
+	off_t pos;
+	std::map<uint32, chunk_info> chunks;
+};
+
+static uint32 page_size;
+
+
+/*
+ *  Write/read helpers
+ */
+
+static bool write_all(int fd, const void *buf, size_t size)
+{
+	const uint8 *p = (const uint8 *)buf;
+	while (size) {
+		ssize_t n = write(fd, p, size);
+		if (n < 0) {
+			if (errno == EINTR)
+				continue;
+			return false;
+		}
+		p += n;
+		size -= n;
+	}
+	return true;
+}
+
+static bool read_all(int fd, void *buf, size_t size, off_t offset)
+{
+	uint8 *p = (uint8 *)buf;
+	while (size) {
+		ssize_t n = pread(fd, p, size, offset);
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n <= 0)
+			return false;
+		p += n;
+		size -= n;
+		offset += n;
+	}
+	return true;
+}
+
+static bool write_padding(snapshot_file *s)
+{
+	static const uint8 zero[256] = {0};
+	off_t aligned = (s->pos + page_size - 1) & ~(off_t)(page_size - 1);
+	while (s->pos < aligned) {
+		size_t n = aligned - s->pos;
+		if (n > sizeof(zero))
+			n = sizeof(zero);
+		if (!write_all(s->fd, zero, n))
+			return false;
+		s->pos += n;
+	}
+	return true;
+}
+
+
+/*
+ *  Create snapshot file
+ */
+
+snapshot_file *snapshot_create(const char *path)
+{
+	page_size = getpagesize();
+
+	snapshot_file *s = new snapshot_file;
+	s->writing = true;
+	s->path = path;
+	s->tmp_path = s->path + ".tmp";
+	s->fd = open(s->tmp_path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	if (s->fd < 0) {
+		delete s;
+		return NULL;
+	}
+
+	snapshot_header h;
+	memset(&h, 0, sizeof(h));
+	memcpy(h.magic, SNAPSHOT_MAGIC, sizeof(h.magic));
+	h.version = SNAPSHOT_VERSION;
+	h.page_size = page_size;
+	h.pointer_size = sizeof(void *);
+	h.byte_order = 0x01020304;
+	if (!write_all(s->fd, &h, sizeof(h))) {
+		snapshot_close(s);
+		return NULL;
+	}
+	s->pos = sizeof(h);
+	return s;
+}
+
+
+/*
+ *  Write data chunk
+ */
+
+bool snapshot_write_data(snapshot_file *s, uint32 tag, const void *data, size_t size)
+{
+	chunk_header h;
+	memset(&h, 0, sizeof(h));
+	h.tag = tag;
+	h.type = CHUNK_DATA;
+	h.size = size;
+	if (!write_all(s->fd, &h, sizeof(h)) || !write_all(s->fd, data, size))
+		return false;
+	s->pos += sizeof(h) + size;
+	return true;
+}
+
+bool snapshot_write_data(snapshot_file *s, uint32 tag, const std::vector<uint32> &data)
+{
+	return snapshot_write_data(s, tag, data.empty() ? NULL : &data[0], data.size() * sizeof(uint32));
+}
+
+
+/*
+ *  Write memory chunk, deduplicating pages
+ */
+
+static uint64 hash_page(const uint8 *p)
+{
+	// FNV-1a over 64-bit words
+	const uint64 *q = (const uint64 *)p;
+	uint64 h = UVAL64(0xcbf29ce484222325);
+	for (uint32 i = 0; i < page_size / 8; i++)
+		h = (h ^ q[i]) * UVAL64(0x100000001b3);
+	return h;
+}
+
+static bool is_zero_page(const uint8 *p)
+{
+	const uint64 *q = (const uint64 *)p;
+	for (uint32 i = 0; i < page_size / 8; i++)
+		if (q[i])
+			return false;
+	return true;
+}
+
+bool snapshot_write_memory(snapshot_file *s, uint32 tag, const uint8 *base, size_t size)
+{
+	if (size % page_size)
+		return false;
+	const uint32 n_pages = size / page_size;
+
+	// Build page table and pool of unique pages
+	std::vector<uint32> table(n_pages);
+	std::vector<const uint8 *> pool;
+	std::multimap<uint64, uint32> hashes;
+	for (uint32 i = 0; i < n_pages; i++) {
+		const uint8 *p = base + i * page_size;
+		if (is_zero_page(p)) {
+			table[i] = 0;
+			continue;
+		}
+		uint64 h = hash_page(p);
+		uint32 index = 0;
+		std::pair<std::multimap<uint64, uint32>::iterator, std::multimap<uint64, uint32>::iterator> r = hashes.equal_range(h);
+		for (std::multimap<uint64, uint32>::iterator it = r.first; it != r.second; ++it) {
+			if (memcmp(pool[it->second - 1], p, page_size) == 0) {
+				index = it->second;
+				break;
+			}
+		}
+		if (index == 0) {
+			pool.push_back(p);
+			index = pool.size();
+			hashes.insert(std::make_pair(h, index));
+		}
+		table[i] = index;
+	}
+
+	chunk_header h;
+	memset(&h, 0, sizeof(h));
+	h.tag = tag;
+	h.type = CHUNK_MEMORY;
+	h.size = size;
+	h.pool_pages = pool.size();
+	off_t table_end = s->pos + sizeof(h) + n_pages * sizeof(uint32);
+	h.pool_offset = (table_end + page_size - 1) & ~(off_t)(page_size - 1);
+	if (!write_all(s->fd, &h, sizeof(h)) || !write_all(s->fd, &table[0], n_pages * sizeof(uint32)))
+		return false;
+	s->pos = table_end;
+	if (!write_padding(s))
+		return false;
+	for (size_t i = 0; i < pool.size(); i++) {
+		if (!write_all(s->fd, pool[i], page_size))
+			return false;
+	}
+	s->pos += pool.size() * page_size;
+
+	D(bug("snapshot: %08x memory %u pages, %u stored\n", tag, n_pages, (uint32)pool.size()));
+	return true;
+}
+
+
+/*
+ *  Finish writing snapshot file
+ */
+
+bool snapshot_commit(snapshot_file *s)
+{
+	if (fsync(s->fd) < 0 || close(s->fd) < 0) {
+		s->fd = -1;
+		snapshot_close(s);
+		return false;
+	}
+	s->fd = -1;
+	bool ok = rename(s->tmp_path.c_str(), s->path.c_str()) == 0;
+	if (ok)
+		s->writing = false;
+	snapshot_close(s);
+	return ok;
+}
+
+
+/*
+ *  Open snapshot file and read chunk directory
+ */
+
+snapshot_file *snapshot_open(const char *path)
+{
+	page_size = getpagesize();
+
+	snapshot_file *s = new snapshot_file;
+	s->writing = false;
+	s->path = path;
+	s->fd = open(path, O_RDONLY);
+	if (s->fd < 0) {
+		delete s;
+		return NULL;
+	}
+
+	snapshot_header h;
+	if (!read_all(s->fd, &h, sizeof(h), 0)
+	 || memcmp(h.magic, SNAPSHOT_MAGIC, sizeof(h.magic)) != 0
+	 || h.version != SNAPSHOT_VERSION
+	 || h.page_size != page_size
+	 || h.pointer_size != sizeof(void *)
+	 || h.byte_order != 0x01020304) {
+		D(bug("snapshot: incompatible file %s\n", path));
+		snapshot_close(s);
+		return NULL;
+	}
+
+	struct stat st;
+	if (fstat(s->fd, &st) < 0) {
+		snapshot_close(s);
+		return NULL;
+	}
+
+	off_t pos = sizeof(h);
+	while (pos < st.st_size) {
+		chunk_info c;
+		if (!read_all(s->fd, &c.h, sizeof(c.h), pos)) {
+			snapshot_close(s);
+			return NULL;
+		}
+		c.offset = pos + sizeof(c.h);
+		s->chunks[c.h.tag] = c;
+
+		// Each chunk must end within the file and after the previous one,
+		// or a damaged file could make us loop forever
+		const uint64 file_size = st.st_size;
+		uint64 next = 0;
+		if (c.h.type == CHUNK_MEMORY) {
+			if (c.h.pool_offset <= file_size && c.h.pool_pages <= (file_size - c.h.pool_offset) / page_size)
+				next = c.h.pool_offset + c.h.pool_pages * page_size;
+		} else {
+			if (c.h.size <= file_size - c.offset)
+				next = c.offset + c.h.size;
+		}
+		if (next <= (uint64)pos) {
+			D(bug("snapshot: damaged chunk directory in %s\n", path));
+			snapshot_close(s);
+			return NULL;
+		}
+		pos = next;
+	}
+	return s;
+}
+
+
+/*
+ *  Read data chunk
+ */
+
+bool snapshot_read_data(snapshot_file *s, uint32 tag, void *data, size_t size)
+{
+	std::map<uint32, chunk_info>::const_iterator it = s->chunks.find(tag);
+	if (it == s->chunks.end() || it->second.h.type != CHUNK_DATA || it->second.h.size != size)
+		return false;
+	return read_all(s->fd, data, size, it->second.offset);
+}
+
+bool snapshot_read_data(snapshot_file *s, uint32 tag, std::vector<uint32> &data)
+{
+	std::map<uint32, chunk_info>::const_iterator it = s->chunks.find(tag);
+	if (it == s->chunks.end() || it->second.h.type != CHUNK_DATA || it->second.h.size % sizeof(uint32))
+		return false;
+	data.resize(it->second.h.size / sizeof(uint32));
+	return data.empty() || read_all(s->fd, &data[0], it->second.h.size, it->second.offset);
+}
+
+
+/*
+ *  Map memory chunk copy-on-write over an existing region
+ */
+
+bool snapshot_map_memory(snapshot_file *s, uint32 tag, uint8 *base, size_t size)
+{
+	// File pages can't replace explicit huge pages (mmap() fails) and
+	// would silently drop transparent ones, copy the data in instead
+	if (vm_get_huge_pages(base) != VM_HUGE_PAGES_NONE)
+		return snapshot_read_memory(s, tag, base, size);
+
+	const int prot = PROT_READ | PROT_WRITE;
+	std::map<uint32, chunk_info>::const_iterator it = s->chunks.find(tag);
+	if (it == s->chunks.end() || it->second.h.type != CHUNK_MEMORY || it->second.h.size != size)
+		return false;
+	const chunk_info &c = it->second;
+	const uint32 n_pages = size / page_size;
+
+	std::vector<uint32> table(n_pages);
+	if (!read_all(s->fd, &table[0], n_pages * sizeof(uint32), c.offset))
+		return false;
+
+	// Map runs of consecutive pool pages (or zero pages) with a single mmap() each
+	uint32 i = 0;
+	while (i < n_pages) {
+		uint32 j = i + 1;
+		if (table[i] == 0) {
+			while (j < n_pages && table[j] == 0)
+				j++;
+		} else {
+			while (j < n_pages && table[j] == table[j - 1] + 1)
+				j++;
+		}
+
+		void *addr = base + i * page_size;
+		size_t len = (j - i) * page_size;
+		void *p;
+		if (table[i] == 0)
+			p = mmap(addr, len, prot, MAP_PRIVATE | MAP_ANON | MAP_FIXED, -1, 0);
+		else
+			p = mmap(addr, len, prot, MAP_PRIVATE | MAP_FIXED, s->fd, c.h.pool_offset + (off_t)(table[i] - 1) * page_size);
+		if (p == MAP_FAILED)
+			return false;
+		i = j;
+	}
+	return true;
+}
+
+
+/*
+ *  Copy memory chunk into an existing region (for shared or aliased
+ *  memory that cannot be replaced by a private mapping)
+ */
+
+bool snapshot_read_memory(snapshot_file *s, uint32 tag, uint8 *base, size_t size)
+{
+	std::map<uint32, chunk_info>::const_iterator it = s->chunks.find(tag);
+	if (it == s->chunks.end() || it->second.h.type != CHUNK_MEMORY || it->second.h.size != size)
+		return false;
+	const chunk_info &c = it->second;
+	const uint32 n_pages = size / page_size;
+
+	std::vector<uint32> table(n_pages);
+	if (!read_all(s->fd, &table[0], n_pages * sizeof(uint32), c.offset))
+		return false;
+
+	for (uint32 i = 0; i < n_pages; i++) {
+		uint8 *p = base + i * page_size;
+		if (table[i] == 0) {
+			// Don't write to pages that are already zero (they may be read-only)
+			if (!is_zero_page(p))
+				memset(p, 0, page_size);
+		} else if (!read_all(s->fd, p, page_size, c.h.pool_offset + (off_t)(table[i] - 1) * page_size))
+			return false;
+	}
+	return true;
+}
+
+
+/*
+ *  Close snapshot file
+ */
+
+void snapshot_close(snapshot_file *s)
+{
+	if (s->fd >= 0)
+		close(s->fd);
+	if (s->writing)
+		unlink(s->tmp_path.c_str());
+	delete s;
+}
@@ -0,0 +1,81 @@
+/*
+ *  snapshot_unix.h - Guest state snapshot files
+ *
+ *  Basilisk II (C) 1997-2008 Christian Bauer
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#ifndef SNAPSHOT_UNIX_H
+#define SNAPSHOT_UNIX_H
+
+#include <vector>
+
+#include "macos_util.h"
+
+/*
+ *  A snapshot file is a sequence of tagged chunks. Data chunks hold
+ *  small blobs (CPU registers, XPRAM, driver state). Memory chunks hold
+ *  a page table followed by a pool of page-aligned, deduplicated pages;
+ *  all-zero pages are not stored at all. This layout lets memory chunks
+ *  be mapped copy-on-write, so restoring only costs the pages actually
+ *  touched afterwards.
+ *
+ *  Snapshots are only valid for the same emulator binary, host and
+ *  prefs (RAM size, ROM, disks) they were created with.
+ */
+
+struct snapshot_file;
+
+// Chunk tags used by both emulators
+enum {
+	SNAPSHOT_TAG_CONFIG	= FOURCC('C','O','N','F'),	// Emulator configuration (validated on restore)
+	SNAPSHOT_TAG_CPU	= FOURCC('C','P','U',' '),	// CPU registers
+	SNAPSHOT_TAG_RAM	= FOURCC('R','A','M',' '),	// Mac RAM
+	SNAPSHOT_TAG_ROM	= FOURCC('R','O','M',' '),	// Mac ROM (patched)
+	SNAPSHOT_TAG_LOWMEM	= FOURCC('L','M','E','M'),	// Low memory globals (SheepShaver)
+	SNAPSHOT_TAG_KERNEL	= FOURCC('K','E','R','N'),	// Kernel data (SheepShaver)
+	SNAPSHOT_TAG_DR_EMUL	= FOURCC('D','R','E','M'),	// DR emulator (SheepShaver)
+	SNAPSHOT_TAG_DR_CACHE	= FOURCC('D','R','C','A'),	// DR cache (SheepShaver)
+	SNAPSHOT_TAG_SHEEPMEM	= FOURCC('S','M','E','M'),	// SheepShaver thunks and data
+	SNAPSHOT_TAG_SHEEPMEM_PTRS	= FOURCC('S','P','T','R'),	// SheepShaver thunks allocation state
+	SNAPSHOT_TAG_XPRAM	= FOURCC('X','P','R','M'),	// XPRAM
+	SNAPSHOT_TAG_SONY	= FOURCC('S','O','N','Y'),	// Floppy driver state
+	SNAPSHOT_TAG_DISK	= FOURCC('D','I','S','K'),	// Disk driver state
+	SNAPSHOT_TAG_CDROM	= FOURCC('C','D','R','M'),	// CD-ROM driver state
+	SNAPSHOT_TAG_TIMER	= FOURCC('T','I','M','R'),	// Time Manager state
+	SNAPSHOT_TAG_EXTFS	= FOURCC('E','X','F','S'),	// External file system state
+	SNAPSHOT_TAG_VIDEO	= FOURCC('V','I','D','O'),	// Video driver state
+	SNAPSHOT_TAG_FRAME	= FOURCC('F','R','A','M')	// Frame buffer contents
+};
+
+// Create a new snapshot file (written to a temporary file until snapshot_commit())
+extern snapshot_file *snapshot_create(const char *path);
+extern bool snapshot_write_data(snapshot_file *s, uint32 tag, const void *data, size_t size);
+extern bool snapshot_write_data(snapshot_file *s, uint32 tag, const std::vector<uint32> &data);
+extern bool snapshot_write_memory(snapshot_file *s, uint32 tag, const uint8 *base, size_t size);
+extern bool snapshot_commit(snapshot_file *s);
+
+// Open an existing snapshot file
+extern snapshot_file *snapshot_open(const char *path);
+extern bool snapshot_read_data(snapshot_file *s, uint32 tag, void *data, size_t size);
+extern bool snapshot_read_data(snapshot_file *s, uint32 tag, std::vector<uint32> &data);
+extern bool snapshot_map_memory(snapshot_file *s, uint32 tag, uint8 *base, size_t size);	// Read/write, copy-on-write (copied into huge pages)
+extern bool snapshot_read_memory(snapshot_file *s, uint32 tag, uint8 *base, size_t size);
+
+// Close snapshot file, discarding it if it was being created and not committed
+extern void snapshot_close(snapshot_file *s);
+
+#endif
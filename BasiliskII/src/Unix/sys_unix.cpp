@@ -57,6 +57,7 @@
 #include "user_strings.h"
 #include "sys.h"
 #include "disk_unix.h"
+#include "block_cache.h"
 
 #if defined(BINCUE)
 #include "bincue_unix.h"
@@ -73,6 +74,9 @@ static disk_factory *disk_factories[] = {
 #if defined(HAVE_LIBVHD)
 	disk_vhd_factory,
 #endif
+	disk_compressed_factory,
+	disk_cow_factory,
+	disk_mmap_factory,
 #endif
 	NULL
 };
@@ -92,6 +96,7 @@ struct mac_file_handle {
 
 	bool is_media_present;		// Flag: media is inserted and available
 	disk_generic *generic_disk;
+	block_cache_file *cache;	// Host block cache (image files only)
 
 #if defined(__linux__)
 	int cdrom_cap;		// CD-ROM capability flags (only valid if is_cdrom is true)
@@ -121,6 +126,8 @@ static mac_file_handle *first_floppy = NULL;
 // Prototypes
 static void cdrom_close(mac_file_handle *fh);
 static bool cdrom_open(mac_file_handle *fh, const char *path = NULL);
+static size_t sys_read_uncached(void *arg, void *buffer, loff_t offset, size_t length);
+static size_t sys_write_uncached(void *arg, void *buffer, loff_t offset, size_t length);
 
 
 /*
@@ -129,6 +136,7 @@ static bool cdrom_open(mac_file_handle *fh, const char *path = NULL);
 
 void SysInit(void)
 {
+	BlockCacheInit();
 #if defined __MACOSX__
 	extern void DarwinSysInit(void);
 	DarwinSysInit();
@@ -142,6 +150,7 @@ void SysInit(void)
 
 void SysExit(void)
 {
+	BlockCacheExit();
 #if defined __MACOSX__
 	extern void DarwinSysExit(void);
 	DarwinSysExit();
@@ -599,6 +608,7 @@ void *Sys_open(const char *name, bool read_only)
 		fh->is_bincue = true;
 		fh->read_only = true;
 		fh->is_media_present = true;
+		fh->cache = block_cache_open(fh, SysGetFileSize(fh), sys_read_uncached, sys_write_uncached);
 		sys_add_mac_file_handle(fh);
 		return fh;
 	}
@@ -617,6 +627,8 @@ void *Sys_open(const char *name, bool read_only)
 			fh->file_size = generic->size();
 			fh->read_only = generic->is_read_only();
 			fh->is_media_present = true;
+			if (!generic->has_cache())
+				fh->cache = block_cache_open(fh, fh->file_size, sys_read_uncached, sys_write_uncached);
 			sys_add_mac_file_handle(fh);
 			return fh;
 		}
@@ -664,6 +676,7 @@ void *Sys_open(const char *name, bool read_only)
 			lseek(fd, 0, SEEK_SET);
 			read(fd, data, 256);
 			FileDiskLayout(size, data, fh->start_byte, fh->file_size);
+			fh->cache = block_cache_open(fh, fh->file_size, sys_read_uncached, sys_write_uncached);
 		} else {
 			struct stat st;
 			if (fstat(fd, &st) == 0) {
@@ -724,6 +737,8 @@ void Sys_close(void *arg)
 
 	sys_remove_mac_file_handle(fh);
 
+	if (fh->cache)
+		block_cache_close(fh->cache);
 #if defined(BINCUE)
 	if (fh->is_bincue)
 		close_bincue(fh->bincue_fd);
@@ -752,6 +767,15 @@ size_t Sys_read(void *arg, void *buffer, loff_t offset, size_t length)
 	if (!fh)
 		return 0;
 
+	if (fh->cache)
+		return block_cache_read(fh->cache, buffer, offset, length);
+	return sys_read_uncached(fh, buffer, offset, length);
+}
+
+static size_t sys_read_uncached(void *arg, void *buffer, loff_t offset, size_t length)
+{
+	mac_file_handle *fh = (mac_file_handle *)arg;
+
 #if defined(BINCUE)
 	if (fh->is_bincue)
 		return read_bincue(fh->bincue_fd, buffer, offset, length);
@@ -780,6 +804,15 @@ size_t Sys_write(void *arg, void *buffer, loff_t offset, size_t length)
 	if (!fh)
 		return 0;
 
+	if (fh->cache)
+		return block_cache_write(fh->cache, buffer, offset, length);
+	return sys_write_uncached(fh, buffer, offset, length);
+}
+
+static size_t sys_write_uncached(void *arg, void *buffer, loff_t offset, size_t length)
+{
+	mac_file_handle *fh = (mac_file_handle *)arg;
+
 	if (fh->generic_disk)
 		return fh->generic_disk->write(buffer, offset, length);
 
@@ -846,6 +879,12 @@ void SysEject(void *arg)
 	if (!fh)
 		return;
 
+	// Write barrier, the media may change
+	if (fh->cache && !block_cache_invalidate(fh->cache))
+		printf("WARNING: Disk cache write-back failed on %s\n", fh->name);
+	if (fh->generic_disk)
+		fh->generic_disk->flush();
+
 #if defined(__linux__)
 	if (fh->is_floppy) {
 		if (fh->fd >= 0) {
@@ -102,7 +102,7 @@
 #endif
 
 /* Direct Addressing requires Video on SEGV signals in plain X11 mode */
-#if DIRECT_ADDRESSING && (!ENABLE_VOSF && !USE_SDL_VIDEO)
+#if DIRECT_ADDRESSING && (!ENABLE_VOSF && !USE_SDL_VIDEO && !USE_HEADLESS_VIDEO)
 # undef  ENABLE_VOSF
 # define ENABLE_VOSF 1
 #endif
@@ -219,6 +219,7 @@ typedef uae_u32 uaecptr;
 
 /* Timing functions */
 extern uint64 GetTicks_usec(void);
+extern uint64 GetTicks_nsec(void);
 extern void Delay_usec(uint32 usec);
 
 /* Spinlocks */
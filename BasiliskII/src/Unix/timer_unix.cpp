@@ -51,25 +51,133 @@ static inline void mach_current_time(tm_time_t &t) {
 
 
 /*
- *  Return microseconds since boot (64 bit)
+ *  Host clock in nanoseconds since the epoch
+ *
+ *  On x86 hosts with an invariant TSC, it is the TSC scaled with a 32.32
+ *  fixed-point factor that is calibrated against the monotonic clock the
+ *  first time the clock is read, so reading it takes neither a system
+ *  call nor a division. It is anchored to the wall clock only once, so
+ *  later adjustments of the system time are not followed; it never goes
+ *  backwards. Other hosts read the system clock.
  */
 
-void Microseconds(uint32 &hi, uint32 &lo)
+#if (defined(__i386__) || defined(__x86_64__)) && defined(__GNUC__) && defined(HAVE_CLOCK_GETTIME) && defined(CLOCK_MONOTONIC)
+#define USE_TSC_CLOCK 1
+#endif
+
+static uint64 system_clock_nsec(void)
 {
-	D(bug("Microseconds\n"));
 #if defined(__MACH__)
 	tm_time_t t;
 	mach_current_time(t);
-	uint64 tl = (uint64)t.tv_sec * 1000000 + t.tv_nsec / 1000;
+	return (uint64)t.tv_sec * 1000000000 + t.tv_nsec;
 #elif defined(HAVE_CLOCK_GETTIME)
 	struct timespec t;
 	clock_gettime(CLOCK_REALTIME, &t);
-	uint64 tl = (uint64)t.tv_sec * 1000000 + t.tv_nsec / 1000;
+	return (uint64)t.tv_sec * 1000000000 + t.tv_nsec;
 #else
 	struct timeval t;
 	gettimeofday(&t, NULL);
-	uint64 tl = (uint64)t.tv_sec * 1000000 + t.tv_usec;
+	return (uint64)t.tv_sec * 1000000000 + t.tv_usec * 1000;
+#endif
+}
+
+#if USE_TSC_CLOCK
+struct tsc_clock {
+	bool usable;
+	uint64 tsc0;		// TSC at calibration
+	uint64 nsec0;		// System clock at calibration
+	uint64 scale;		// Nanoseconds per TSC tick (32.32 fixed-point)
+};
+
+static inline uint64 read_tsc(void)
+{
+	uint32 lo, hi;
+	__asm__ __volatile__("rdtsc" : "=a" (lo), "=d" (hi));
+	return ((uint64)hi << 32) | lo;
+}
+
+static inline void cpuid(uint32 op, uint32 *eax, uint32 *ebx, uint32 *ecx, uint32 *edx)
+{
+#if defined(__i386__) && defined(__PIC__)
+	// %ebx is the PIC register
+	__asm__ __volatile__("xchgl %%ebx, %1; cpuid; xchgl %%ebx, %1"
+						 : "=a" (*eax), "=r" (*ebx), "=c" (*ecx), "=d" (*edx) : "0" (op), "2" (0));
+#else
+	__asm__ __volatile__("cpuid" : "=a" (*eax), "=b" (*ebx), "=c" (*ecx), "=d" (*edx) : "0" (op), "2" (0));
 #endif
+}
+
+static uint64 monotonic_clock_nsec(void)
+{
+	struct timespec t;
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	return (uint64)t.tv_sec * 1000000000 + t.tv_nsec;
+}
+
+// Read the monotonic clock and the TSC at (about) the same time
+static uint64 read_tsc_and_clock(uint64 &nsec)
+{
+	uint64 t0 = read_tsc();
+	nsec = monotonic_clock_nsec();
+	uint64 t1 = read_tsc();
+	return t0 + (t1 - t0) / 2;
+}
+
+static tsc_clock calibrate_tsc_clock(void)
+{
+	tsc_clock c;
+	c.usable = false;
+
+	// The TSC must run at a constant rate, in all power states
+	uint32 eax, ebx, ecx, edx;
+	cpuid(0x80000000, &eax, &ebx, &ecx, &edx);
+	if (eax < 0x80000007)
+		return c;
+	cpuid(0x80000007, &eax, &ebx, &ecx, &edx);
+	if ((edx & (1 << 8)) == 0)
+		return c;
+
+	uint64 mono0, mono1;
+	uint64 tsc0 = read_tsc_and_clock(mono0);
+	c.nsec0 = system_clock_nsec();
+	c.nsec0 -= monotonic_clock_nsec() - mono0;
+	struct timespec delay = {0, 20000000};
+	while (nanosleep(&delay, &delay) < 0 && errno == EINTR)
+		;
+	uint64 tsc1 = read_tsc_and_clock(mono1);
+	if (tsc1 <= tsc0 || mono1 <= mono0)
+		return c;
+
+	c.tsc0 = tsc0;
+	c.scale = ((mono1 - mono0) << 32) / (tsc1 - tsc0);
+	c.usable = c.scale != 0;
+	D(bug("TSC clock at %.1f MHz\n", (tsc1 - tsc0) * 1000.0 / (mono1 - mono0)));
+	return c;
+}
+#endif
+
+uint64 GetTicks_nsec(void)
+{
+#if USE_TSC_CLOCK
+	static const tsc_clock c = calibrate_tsc_clock();
+	if (c.usable) {
+		uint64 t = read_tsc() - c.tsc0;
+		return c.nsec0 + (t >> 32) * c.scale + (((t & 0xffffffff) * c.scale) >> 32);
+	}
+#endif
+	return system_clock_nsec();
+}
+
+
+/*
+ *  Return microseconds since boot (64 bit)
+ */
+
+void Microseconds(uint32 &hi, uint32 &lo)
+{
+	D(bug("Microseconds\n"));
+	uint64 tl = GetTicks_usec();
 	hi = tl >> 32;
 	lo = tl;
 }
@@ -81,6 +189,7 @@ void Microseconds(uint32 &hi, uint32 &lo)
 
 uint32 TimerDateTime(void)
 {
+	// Not from GetTicks_nsec(), the date must follow changes of the system time
 	return TimeToMacTime(time(NULL));
 }
 
@@ -229,19 +338,7 @@ int32 timer_host2mac_time(tm_time_t hosttime)
 
 uint64 GetTicks_usec(void)
 {
-#if defined(__MACH__)
-	tm_time_t t;
-	mach_current_time(t);
-	return (uint64)t.tv_sec * 1000000 + t.tv_nsec / 1000;
-#elif defined(HAVE_CLOCK_GETTIME)
-	struct timespec t;
-	clock_gettime(CLOCK_REALTIME, &t);
-	return (uint64)t.tv_sec * 1000000 + t.tv_nsec / 1000;
-#else
-	struct timeval t;
-	gettimeofday(&t, NULL);
-	return (uint64)t.tv_sec * 1000000 + t.tv_usec;
-#endif
+	return GetTicks_nsec() / 1000;
 }
 
 
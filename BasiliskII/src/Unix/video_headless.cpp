@@ -0,0 +1,711 @@
+/*
+ *  video_headless.cpp - Video/graphics emulation without a display
+ *
+ *  Basilisk II (C) 1997-2008 Christian Bauer
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+/*
+ *  NOTES:
+ *    This driver is meant for batch servers. The Mac frame buffer lives in
+ *    plain host memory and is never converted or displayed, there is no
+ *    redraw thread and no input. VBL interrupts work as with the other
+ *    drivers. Sending SIGUSR2 to the emulator writes the current screen
+ *    contents as a binary PPM file to the path given by the "screendump"
+ *    prefs item (default /tmp/screendump-<pid>.ppm); the conversion
+ *    happens at the next video interrupt. SheepShaver needs the PowerPC
+ *    emulator, as native mode uses SIGUSR2 for interrupts.
+ *
+ *    If the built-in VNC server is enabled (USE_VNC_SERVER), changed
+ *    rows are converted and fed to it at video interrupt time. With VOSF
+ *    only the rows of frame buffer pages written since the last update
+ *    are looked at, otherwise the whole screen is.
+ */
+
+#include "sysdeps.h"
+
+#include <signal.h>
+#include <errno.h>
+#include <unistd.h>
+#include <string>
+#include <vector>
+
+#include "cpu_emulation.h"
+#include "main.h"
+#include "adb.h"
+#include "prefs.h"
+#include "user_strings.h"
+#include "video.h"
+#include "video_defs.h"
+#include "video_blit.h"
+#include "vm_alloc.h"
+
+#ifdef USE_VNC_SERVER
+#include "vnc_server.h"
+#endif
+
+// SIGUSR2 triggers interrupts in SheepShaver's native mode
+#if defined(SHEEPSHAVER) && !EMULATED_PPC
+#error "The headless video driver requires the PowerPC emulator"
+#endif
+
+#define DEBUG 0
+#include "debug.h"
+
+using std::string;
+using std::vector;
+
+// Supported video modes
+static vector<VIDEO_MODE> VideoModes;
+
+#ifndef SHEEPSHAVER
+// Mac Screen Width and Height
+uint32 MacScreenWidth;
+uint32 MacScreenHeight;
+#endif
+
+// Global variables
+static uint8 *the_buffer = NULL;					// Mac frame buffer (where MacOS draws into)
+static uint32 the_buffer_size;						// Size of allocated the_buffer
+static uint8 screen_palette[256 * 3];				// Color palette for indexed modes (RGB)
+
+static volatile sig_atomic_t dump_requested = 0;	// Flag: SIGUSR2 received, dump screen at next interrupt
+static struct sigaction old_sigusr2_sa;				// Previous SIGUSR2 action
+
+#ifdef USE_VNC_SERVER
+static bool vnc_active = false;						// Flag: VNC server running
+static bool palette_changed = false;				// Flag: all rows must be fed to the VNC server
+#endif
+
+#ifdef ENABLE_VOSF
+static bool use_vosf = false;						// Flag: VOSF tracks changed frame buffer pages
+# include "video_vosf.h"
+#endif
+
+
+/*
+ *  SheepShaver glue
+ */
+
+#ifdef SHEEPSHAVER
+// Color depth modes type
+typedef int video_depth;
+
+// Find Apple mode matching best specified dimensions
+static int find_apple_resolution(int xsize, int ysize)
+{
+	if (xsize == 640 && ysize == 480)
+		return APPLE_640x480;
+	if (xsize == 800 && ysize == 600)
+		return APPLE_800x600;
+	if (xsize == 1024 && ysize == 768)
+		return APPLE_1024x768;
+	if (xsize == 1152 && ysize == 768)
+		return APPLE_1152x768;
+	if (xsize == 1152 && ysize == 900)
+		return APPLE_1152x900;
+	if (xsize == 1280 && ysize == 1024)
+		return APPLE_1280x1024;
+	if (xsize == 1600 && ysize == 1200)
+		return APPLE_1600x1200;
+	return APPLE_CUSTOM;
+}
+#else
+/*
+ *  monitor_desc subclass for the headless display
+ */
+
+class headless_monitor_desc : public monitor_desc {
+public:
+	headless_monitor_desc(const vector<video_mode> &available_modes, video_depth default_depth, uint32 default_id) : monitor_desc(available_modes, default_depth, default_id) {}
+	~headless_monitor_desc() {}
+
+	virtual void switch_to_current_mode(void);
+	virtual void set_palette(uint8 *pal, int num);
+};
+#endif
+
+
+/*
+ *  Utility functions
+ */
+
+// Add mode to list of supported modes
+static void add_mode(int width, int height, int resolution_id, int depth)
+{
+	VIDEO_MODE mode;
+#ifdef SHEEPSHAVER
+	resolution_id = find_apple_resolution(width, height);
+	mode.viType = DIS_WINDOW;
+#else
+	mode.user_data = 0;
+#endif
+	VIDEO_MODE_X = width;
+	VIDEO_MODE_Y = height;
+	VIDEO_MODE_RESOLUTION = resolution_id;
+	VIDEO_MODE_ROW_BYTES = TrivialBytesPerRow(width, (video_depth)depth);
+	VIDEO_MODE_DEPTH = (video_depth)depth;
+	VideoModes.push_back(mode);
+}
+
+// Allocate frame buffer for video mode
+static bool open_frame_buffer(const VIDEO_MODE &mode)
+{
+	the_buffer_size = (VIDEO_MODE_Y + 2) * VIDEO_MODE_ROW_BYTES;
+#ifdef ENABLE_VOSF
+	the_buffer_size = page_extend(the_buffer_size);
+#endif
+	the_buffer = (uint8 *)vm_acquire(the_buffer_size, VM_MAP_DEFAULT | VM_MAP_32BIT);
+	if (the_buffer == VM_MAP_FAILED) {
+		the_buffer = NULL;
+		return false;
+	}
+	D(bug("the_buffer = %p (%d bytes)\n", the_buffer, the_buffer_size));
+
+#ifdef SHEEPSHAVER
+	screen_base = Host2MacAddr(the_buffer);
+#else
+	MacScreenWidth = VIDEO_MODE_X;
+	MacScreenHeight = VIDEO_MODE_Y;
+#endif
+	return true;
+}
+
+// Free frame buffer
+static void close_frame_buffer(void)
+{
+#ifdef ENABLE_VOSF
+	if (use_vosf) {
+		video_vosf_exit();
+		use_vosf = false;
+	}
+#endif
+	if (the_buffer) {
+		vm_release(the_buffer, the_buffer_size);
+		the_buffer = NULL;
+	}
+}
+
+#ifndef SHEEPSHAVER
+// Set Mac frame layout and base address (uses the_buffer/MacFrameBaseMac)
+static void set_mac_frame_buffer(headless_monitor_desc &monitor)
+{
+#if !REAL_ADDRESSING && !DIRECT_ADDRESSING
+	// Frame buffer is stored in Mac format, so no conversion is needed on access
+	MacFrameLayout = FLAYOUT_DIRECT;
+
+	if (TwentyFourBitAddressing)
+		monitor.set_mac_frame_base(MacFrameBaseMac24Bit);
+	else
+		monitor.set_mac_frame_base(MacFrameBaseMac);
+
+	// Set variables used by UAE memory banking
+	const VIDEO_MODE &mode = monitor.get_current_mode();
+	MacFrameBaseHost = the_buffer;
+	MacFrameSize = VIDEO_MODE_ROW_BYTES * VIDEO_MODE_Y;
+	InitFrameBufferMapping();
+#else
+	monitor.set_mac_frame_base(Host2MacAddr(the_buffer));
+#endif
+	D(bug("monitor.mac_frame_base = %08x\n", monitor.get_mac_frame_base()));
+}
+#endif
+
+
+/*
+ *  Screen dumps
+ */
+
+// SIGUSR2 handler, the dump itself is done by the emulation thread
+static void sigusr2_handler(int sig)
+{
+	dump_requested = 1;
+}
+
+// Expand 5-bit color component to 8 bits
+static inline uint8 expand_5bit(uint32 c)
+{
+	return (c << 3) | (c >> 2);
+}
+
+// Convert row Y of the frame buffer to 0x00RRGGBB pixels
+static void convert_row(const VIDEO_MODE &mode, int y, uint32 *dst)
+{
+	const uint8 *src = the_buffer + y * VIDEO_MODE_ROW_BYTES;
+	const uint32 width = VIDEO_MODE_X;
+	switch (VIDEO_MODE_DEPTH) {
+	case VIDEO_DEPTH_16BIT:
+		for (uint32 x = 0; x < width; x++) {
+			uint32 p = (src[x * 2] << 8) | src[x * 2 + 1];
+			dst[x] = (expand_5bit((p >> 10) & 0x1f) << 16) | (expand_5bit((p >> 5) & 0x1f) << 8) | expand_5bit(p & 0x1f);
+		}
+		break;
+	case VIDEO_DEPTH_32BIT:
+		for (uint32 x = 0; x < width; x++)
+			dst[x] = (src[x * 4 + 1] << 16) | (src[x * 4 + 2] << 8) | src[x * 4 + 3];
+		break;
+	default: {
+		// Indexed modes, leftmost pixel in the most significant bits
+		const uint32 bits = 1 << (VIDEO_MODE_DEPTH - VIDEO_DEPTH_1BIT);
+		const uint32 mask = (1 << bits) - 1;
+		for (uint32 x = 0; x < width; x++) {
+			uint32 bit = x * bits;
+			uint32 c = (src[bit >> 3] >> (8 - bits - (bit & 7))) & mask;
+			dst[x] = (screen_palette[c * 3 + 0] << 16) | (screen_palette[c * 3 + 1] << 8) | screen_palette[c * 3 + 2];
+		}
+		break;
+	}
+	}
+}
+
+// Write current frame buffer contents to the screen dump file as binary PPM
+static void dump_screen(const VIDEO_MODE &mode)
+{
+	if (the_buffer == NULL)
+		return;
+
+	char default_path[64];
+	const char *path = PrefsFindString("screendump");
+	if (path == NULL) {
+		snprintf(default_path, sizeof(default_path), "/tmp/screendump-%d.ppm", (int)getpid());
+		path = default_path;
+	}
+
+	// Write to a temporary file first, so readers never see a partial image
+	string tmp_path = string(path) + ".tmp";
+	FILE *f = fopen(tmp_path.c_str(), "wb");
+	if (f == NULL) {
+		printf("WARNING: Cannot create screen dump %s: %s\n", tmp_path.c_str(), strerror(errno));
+		return;
+	}
+
+	const uint32 width = VIDEO_MODE_X;
+	const uint32 height = VIDEO_MODE_Y;
+	fprintf(f, "P6\n%u %u\n255\n", width, height);
+
+	vector<uint32> row(width);
+	vector<uint8> line(width * 3);
+	for (uint32 y = 0; y < height; y++) {
+		convert_row(mode, y, &row[0]);
+		for (uint32 x = 0; x < width; x++) {
+			line[x * 3 + 0] = row[x] >> 16;
+			line[x * 3 + 1] = row[x] >> 8;
+			line[x * 3 + 2] = row[x];
+		}
+		fwrite(&line[0], 1, line.size(), f);
+	}
+
+	bool ok = !ferror(f);
+	if (fclose(f) != 0)
+		ok = false;
+	if (ok && rename(tmp_path.c_str(), path) == 0) {
+		D(bug("Screen dumped to %s\n", path));
+	} else {
+		printf("WARNING: Cannot write screen dump %s: %s\n", path, strerror(errno));
+		unlink(tmp_path.c_str());
+	}
+}
+
+// Called on every video interrupt
+static inline void check_dump_request(const VIDEO_MODE &mode)
+{
+	if (dump_requested) {
+		dump_requested = 0;
+		dump_screen(mode);
+	}
+}
+
+
+/*
+ *  VNC server
+ */
+
+#ifdef USE_VNC_SERVER
+// Start feeding the (new) frame buffer to the VNC server
+static void vnc_open_frame_buffer(const VIDEO_MODE &mode)
+{
+	if (!vnc_active)
+		return;
+	VNCServerSetSize(VIDEO_MODE_X, VIDEO_MODE_Y);
+#ifdef ENABLE_VOSF
+#ifdef SHEEPSHAVER
+	use_vosf = video_vosf_init();
+#else
+	use_vosf = video_vosf_init(*VideoMonitors[0]);
+#endif
+	if (!use_vosf) {
+		video_vosf_exit();
+		vm_protect(the_buffer, the_buffer_size, VM_PAGE_READ | VM_PAGE_WRITE);
+		D(bug("VOSF initialization failed, feeding whole screen to VNC server\n"));
+	}
+#endif
+}
+
+// Feed changed rows to the VNC server, called on every video interrupt
+static void vnc_update(const VIDEO_MODE &mode)
+{
+	bool all_rows;
+	if (!vnc_active || the_buffer == NULL || !VNCServerBeginUpdate(&all_rows))
+		return;
+	if (palette_changed) {
+		palette_changed = false;
+		all_rows = true;
+	}
+
+	vector<uint32> row(VIDEO_MODE_X);
+#ifdef ENABLE_VOSF
+	if (use_vosf) {
+		LOCK_VOSF;
+		if (all_rows) {
+			PFLAG_CLEAR_ALL;
+			vm_protect((char *)mainBuffer.memStart, mainBuffer.memLength, VM_PAGE_READ);
+		} else if (mainBuffer.dirty) {
+			unsigned page = 0;
+			for (;;) {
+				const unsigned first_page = find_next_page_set(page);
+				if (first_page >= mainBuffer.pageCount)
+					break;
+
+				page = find_next_page_clear(first_page);
+				PFLAG_CLEAR_RANGE(first_page, page);
+
+				// Make the dirty pages read-only again before looking at them
+				const int32 offset  = first_page << mainBuffer.pageBits;
+				const uint32 length = (page - first_page) << mainBuffer.pageBits;
+				vm_protect((char *)mainBuffer.memStart + offset, length, VM_PAGE_READ);
+
+				for (int y = mainBuffer.pageInfo[first_page].top; y <= (int)mainBuffer.pageInfo[page - 1].bottom; y++) {
+					convert_row(mode, y, &row[0]);
+					VNCServerUpdateRow(y, &row[0]);
+				}
+			}
+			mainBuffer.dirty = false;
+		}
+		UNLOCK_VOSF;
+	} else
+#endif
+	all_rows = true;
+
+	if (all_rows) {
+		for (int y = 0; y < (int)VIDEO_MODE_Y; y++) {
+			convert_row(mode, y, &row[0]);
+			VNCServerUpdateRow(y, &row[0]);
+		}
+	}
+	VNCServerEndUpdate();
+}
+#endif
+
+
+/*
+ *  Initialization
+ */
+
+#ifdef SHEEPSHAVER
+bool VideoInit(void)
+{
+	const bool classic = false;
+#else
+bool VideoInit(bool classic)
+{
+#endif
+	// Install screen dump signal handler
+	struct sigaction sigusr2_sa;
+	sigemptyset(&sigusr2_sa.sa_mask);
+	sigusr2_sa.sa_handler = sigusr2_handler;
+	sigusr2_sa.sa_flags = SA_RESTART;
+	if (sigaction(SIGUSR2, &sigusr2_sa, &old_sigusr2_sa) < 0) {
+		char str[256];
+		sprintf(str, GetString(STR_SIG_INSTALL_ERR), "SIGUSR2", strerror(errno));
+		ErrorAlert(str);
+		return false;
+	}
+
+	// Get screen size from preferences, the display type is ignored
+	int default_width = classic ? 512 : 640;
+	int default_height = classic ? 342 : 480;
+	const char *mode_str = PrefsFindString("screen");
+	if (mode_str) {
+		int width, height;
+		if (sscanf(mode_str, "%*[^/]/%d/%d", &width, &height) == 2 && width > 0 && height > 0 && !classic) {
+			default_width = width;
+			default_height = height;
+		}
+	}
+
+	// Construct list of supported modes, all depths are possible
+	if (classic)
+		add_mode(default_width, default_height, 0x80, VIDEO_DEPTH_1BIT);
+	else {
+		static const struct {
+			int w;
+			int h;
+			int resolution_id;
+		} video_modes[] = {
+			{   -1,   -1, 0x80 },
+			{  640,  480, 0x81 },
+			{  800,  600, 0x82 },
+			{ 1024,  768, 0x83 },
+			{ 1152,  870, 0x84 },
+			{ 1280, 1024, 0x85 },
+			{ 1600, 1200, 0x86 },
+			{ 0, }
+		};
+		for (int i = 0; video_modes[i].w != 0; i++) {
+			int w = video_modes[i].w;
+			int h = video_modes[i].h;
+			if (i == 0) {
+				w = default_width;
+				h = default_height;
+			} else if (w >= default_width || h >= default_height)
+				continue;
+			for (int d = VIDEO_DEPTH_1BIT; d <= VIDEO_DEPTH_32BIT; d++)
+				add_mode(w, h, video_modes[i].resolution_id, d);
+		}
+	}
+
+	// Default depth is the deepest one, unless requested otherwise
+	int default_depth = classic ? VIDEO_DEPTH_1BIT : VIDEO_DEPTH_32BIT;
+#ifndef SHEEPSHAVER
+	if (!classic) {
+		switch (PrefsFindInt32("displaycolordepth")) {
+		case 8:
+			default_depth = VIDEO_DEPTH_8BIT;
+			break;
+		case 15: case 16:
+			default_depth = VIDEO_DEPTH_16BIT;
+			break;
+		}
+	}
+#endif
+
+#ifdef SHEEPSHAVER
+	for (int i = 0; i < (int)VideoModes.size(); i++) {
+		VModes[i] = VideoModes[i];
+		if (VModes[i].viXsize == default_width && VModes[i].viYsize == default_height && VModes[i].viAppleMode == default_depth)
+			cur_mode = i;
+	}
+	VideoInfo *p = &VModes[VideoModes.size()];
+	p->viType = DIS_INVALID;		// End marker
+	p->viRowBytes = 0;
+	p->viXsize = p->viYsize = 0;
+	p->viAppleMode = 0;
+	p->viAppleID = 0;
+
+	private_data = NULL;
+	display_type = DIS_WINDOW;
+	if (!open_frame_buffer(VModes[cur_mode])) {
+		ErrorAlert(GetString(STR_OPEN_WINDOW_ERR));
+		return false;
+	}
+#ifdef USE_VNC_SERVER
+	vnc_active = VNCServerInit(VModes[cur_mode].viXsize, VModes[cur_mode].viYsize);
+	vnc_open_frame_buffer(VModes[cur_mode]);
+#endif
+	video_activated = true;
+	return true;
+#else
+	// Create monitor_desc for this (the only) display
+	headless_monitor_desc *monitor = new headless_monitor_desc(VideoModes, (video_depth)default_depth, VideoModes[0].resolution_id);
+	VideoMonitors.push_back(monitor);
+	if (!open_frame_buffer(monitor->get_current_mode())) {
+		ErrorAlert(GetString(STR_OPEN_WINDOW_ERR));
+		return false;
+	}
+	set_mac_frame_buffer(*monitor);
+#ifdef USE_VNC_SERVER
+	const video_mode &mode = monitor->get_current_mode();
+	vnc_active = VNCServerInit(mode.x, mode.y);
+	vnc_open_frame_buffer(mode);
+#endif
+	ADBSetRelMouseMode(false);
+	return true;
+#endif
+}
+
+
+/*
+ *  Deinitialization
+ */
+
+void VideoExit(void)
+{
+#ifdef USE_VNC_SERVER
+	if (vnc_active)
+		VNCServerExit();
+	vnc_active = false;
+#endif
+	close_frame_buffer();
+	sigaction(SIGUSR2, &old_sigusr2_sa, NULL);
+#ifdef SHEEPSHAVER
+	video_activated = false;
+#endif
+}
+
+
+/*
+ *  Close down full-screen mode (there is none)
+ */
+
+void VideoQuitFullScreen(void)
+{
+}
+
+
+/*
+ *  Mac VBL interrupt
+ */
+
+#ifdef SHEEPSHAVER
+void VideoVBL(void)
+{
+	check_dump_request(VModes[cur_mode]);
+#ifdef USE_VNC_SERVER
+	vnc_update(VModes[cur_mode]);
+#endif
+
+	// Execute video VBL
+	if (private_data != NULL && private_data->interruptsEnabled)
+		VSLDoInterruptService(private_data->vslServiceID);
+}
+#else
+void VideoInterrupt(void)
+{
+	check_dump_request(VideoMonitors[0]->get_current_mode());
+#ifdef USE_VNC_SERVER
+	vnc_update(VideoMonitors[0]->get_current_mode());
+#endif
+}
+
+// Called on non-threaded platforms from a timer interrupt, nothing to refresh
+void VideoRefresh(void)
+{
+}
+#endif
+
+
+/*
+ *  Set palette
+ */
+
+#ifdef SHEEPSHAVER
+void video_set_palette(void)
+{
+	for (int c = 0; c < 256; c++) {
+		screen_palette[c*3 + 0] = mac_pal[c].red;
+		screen_palette[c*3 + 1] = mac_pal[c].green;
+		screen_palette[c*3 + 2] = mac_pal[c].blue;
+	}
+#ifdef USE_VNC_SERVER
+	palette_changed = true;
+#endif
+}
+#else
+void headless_monitor_desc::set_palette(uint8 *pal, int num)
+{
+	// Gamma tables of direct modes are ignored
+	if (!IsDirectMode(get_current_mode())) {
+		memcpy(screen_palette, pal, num * 3);
+#ifdef USE_VNC_SERVER
+		palette_changed = true;
+#endif
+	}
+}
+#endif
+
+
+/*
+ *  Switch video mode
+ */
+
+#ifdef SHEEPSHAVER
+int16 video_mode_change(VidLocals *csSave, uint32 ParamPtr)
+{
+	/* return if no mode change */
+	if ((csSave->saveData == ReadMacInt32(ParamPtr + csData)) &&
+	    (csSave->saveMode == ReadMacInt16(ParamPtr + csMode))) return noErr;
+
+	/* first find video mode in table */
+	for (int i=0; VModes[i].viType != DIS_INVALID; i++) {
+		if ((ReadMacInt16(ParamPtr + csMode) == VModes[i].viAppleMode) &&
+		    (ReadMacInt32(ParamPtr + csData) == VModes[i].viAppleID)) {
+			csSave->saveMode = ReadMacInt16(ParamPtr + csMode);
+			csSave->saveData = ReadMacInt32(ParamPtr + csData);
+			csSave->savePage = ReadMacInt16(ParamPtr + csPage);
+
+			DisableInterrupt();
+			close_frame_buffer();
+			cur_mode = i;
+			if (!open_frame_buffer(VModes[cur_mode])) {
+				ErrorAlert(GetString(STR_OPEN_WINDOW_ERR));
+				QuitEmulator();
+			}
+#ifdef USE_VNC_SERVER
+			vnc_open_frame_buffer(VModes[cur_mode]);
+#endif
+
+			WriteMacInt32(ParamPtr + csBaseAddr, screen_base);
+			csSave->saveBaseAddr=screen_base;
+			csSave->saveData=VModes[cur_mode].viAppleID;/* First mode ... */
+			csSave->saveMode=VModes[cur_mode].viAppleMode;
+
+			EnableInterrupt();
+			return noErr;
+		}
+	}
+	return paramErr;
+}
+#else
+void headless_monitor_desc::switch_to_current_mode(void)
+{
+	close_frame_buffer();
+	if (!open_frame_buffer(get_current_mode())) {
+		ErrorAlert(GetString(STR_OPEN_WINDOW_ERR));
+		QuitEmulator();
+	}
+	set_mac_frame_buffer(*this);
+#ifdef USE_VNC_SERVER
+	vnc_open_frame_buffer(get_current_mode());
+#endif
+}
+#endif
+
+
+/*
+ *  Cursor and dirty area handling (SheepShaver), the Mac draws its own
+ *  cursor into the frame buffer
+ */
+
+#ifdef SHEEPSHAVER
+bool video_can_change_cursor(void)
+{
+	return false;
+}
+
+void video_set_cursor(void)
+{
+}
+
+void video_set_dirty_area(int x, int y, int w, int h)
+{
+#ifdef ENABLE_VOSF
+	if (use_vosf) {
+		const VideoInfo &mode = VModes[cur_mode];
+		vosf_set_dirty_area(x, y, w, h, VIDEO_MODE_X, VIDEO_MODE_Y, VIDEO_MODE_ROW_BYTES);
+	}
+#endif
+}
+#endif
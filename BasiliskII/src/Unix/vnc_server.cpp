@@ -0,0 +1,1895 @@
+/*
+ *  vnc_server.cpp - Built-in VNC (RFB) server for the headless video driver
+ *
+ *  Basilisk II (C) 1997-2008 Christian Bauer
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+/*
+ *  NOTES:
+ *    The server speaks RFB 3.3 to 3.8 without authentication, so it
+ *    should only listen on the loopback interface ("vnclisten" and
+ *    "vncport" prefs items) or on a Unix domain socket ("vncsocket").
+ *
+ *    Every client has its own thread that reads its messages and sends
+ *    its updates. An update is cut into bands which are encoded in
+ *    parallel by "vncthreads" threads; Tight bands use the four zlib
+ *    streams of the protocol so that they can be compressed in parallel
+ *    as well, ZRLE tiles are prepared in parallel but the single ZRLE
+ *    stream is compressed sequentially. Raw, Hextile, ZRLE and Tight
+ *    (without JPEG) are supported, plus the DesktopSize pseudo-encoding.
+ *
+ *    All clients share one copy of the screen. Each client has a map of
+ *    the 16x16 tiles that changed since its last update; incremental
+ *    update requests get all of them, not only those in the requested
+ *    area. The screen copy is only refreshed from the Mac frame buffer
+ *    when a client waits for an update and the time its link needed for
+ *    the previous one has passed, so slow links get fewer, larger
+ *    updates instead of a backlog of small ones.
+ */
+
+#include "sysdeps.h"
+
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <netdb.h>
+#include <poll.h>
+#include <pthread.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <zlib.h>
+#include <list>
+#include <string>
+#include <vector>
+
+#include "adb.h"
+#include "prefs.h"
+#include "user_strings.h"
+#include "vnc_server.h"
+
+#define DEBUG 0
+#include "debug.h"
+
+using std::list;
+using std::string;
+using std::vector;
+
+const int TILE_SIZE = 16;						// Granularity of change detection (and Hextile tile size)
+const int BAND_HEIGHT = 64;						// Height of independently encoded bands (and ZRLE tile size)
+const int TIGHT_MAX_WIDTH = 2048;				// Maximum width of Tight rectangles
+const int TIGHT_MAX_PIXELS = 65536;				// Maximum size of Tight rectangles
+const int TIGHT_MIN_TO_COMPRESS = 12;			// Tight data shorter than this is sent uncompressed
+const int TIGHT_STREAMS = 4;					// Number of Tight zlib streams
+const int MAX_ENCODER_THREADS = 16;
+const uint64 MIN_UPDATE_INTERVAL = 1000000 / 60;	// Fastest screen refresh for a client (usec)
+const uint64 MAX_UPDATE_INTERVAL = 1000000;			// Slowest screen refresh for a client (usec)
+
+// RFB encodings
+enum {
+	ENC_RAW = 0,
+	ENC_HEXTILE = 5,
+	ENC_TIGHT = 7,
+	ENC_ZRLE = 16,
+	ENC_DESKTOP_SIZE = -223,
+	ENC_COMPRESS_LEVEL_0 = -256,
+	ENC_COMPRESS_LEVEL_9 = -247
+};
+
+// Hextile subencoding flags
+enum {
+	HEXTILE_RAW = 1,
+	HEXTILE_BACKGROUND = 2,
+	HEXTILE_FOREGROUND = 4,
+	HEXTILE_ANY_SUBRECTS = 8,
+	HEXTILE_SUBRECTS_COLOURED = 16
+};
+
+// RFB pixel format
+struct pixel_format {
+	uint8 bits_per_pixel;
+	uint8 depth;
+	uint8 big_endian;
+	uint8 true_colour;
+	uint16 red_max, green_max, blue_max;
+	uint8 red_shift, green_shift, blue_shift;
+};
+
+// Rectangle on the screen
+struct vnc_rect {
+	int x, y, w, h;
+};
+
+// Connected client
+struct vnc_client {
+	int fd;						// Connection
+	int wake_pipe[2];			// Written to when the client has something to send
+	bool ready;					// Initialization done
+	volatile bool quit;
+
+	// Protected by screen_lock
+	vector<uint8> dirty;		// Changed tiles not sent yet
+	bool has_dirty;
+	bool size_changed;			// DesktopSize must be sent
+	bool update_requested;		// Client waits for an update
+	uint64 next_update;			// Earliest time for the next screen refresh
+
+	// Only used by the client thread
+	pixel_format format;
+	int bytes_per_pixel;
+	int cpixel_size, cpixel_shift;	// ZRLE compressed pixels
+	bool tight_rgb;					// Tight pixels are packed as R, G, B
+	uint32 red_table[256], green_table[256], blue_table[256];
+	int encoding;
+	bool desktop_size;			// Client understands DesktopSize
+	int compress_level;
+	z_stream zrle_stream;
+	bool zrle_stream_active;
+	z_stream tight_streams[TIGHT_STREAMS];
+	bool tight_stream_active[TIGHT_STREAMS];
+	uint8 buttons;				// Last button mask
+	uint64 update_sent;			// Time the last update was sent, 0 if acknowledged
+	uint32 update_bytes;		// Size of that update
+	double bandwidth;			// Estimated bandwidth (bytes per usec), 0 if unknown
+};
+
+// Screen copy and client list
+static pthread_mutex_t screen_lock = PTHREAD_MUTEX_INITIALIZER;
+static vector<uint32> screen;		// Screen contents as 0x00RRGGBB
+static int screen_width, screen_height;
+static int tiles_x, tiles_y;
+static vector<uint8> new_dirty;		// Tiles changed by the current update
+static bool new_changes;
+static bool refresh_all;			// Next update must feed all rows
+static list<vnc_client *> clients;
+
+// Client threads
+static pthread_mutex_t client_threads_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t client_threads_cond = PTHREAD_COND_INITIALIZER;
+static int num_client_threads = 0;
+
+// Listening socket
+static int listen_fd = -1;
+static int listen_pipe[2] = {-1, -1};	// Written to stop the accept thread
+static pthread_t accept_thread;
+static bool accept_thread_active = false;
+static string socket_path;				// Unix domain socket to remove on exit
+
+// Encoder threads
+static pthread_t encoder_threads[MAX_ENCODER_THREADS];
+static int num_encoder_threads = 0;		// Not counting the client thread itself
+static pthread_mutex_t job_lock = PTHREAD_MUTEX_INITIALIZER;	// Serializes jobs
+static pthread_mutex_t pool_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t job_cond = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t done_cond = PTHREAD_COND_INITIALIZER;
+static void (*job_func)(void *arg, int index);
+static void *job_arg;
+static int job_count, job_next, job_done;
+static bool pool_quit = false;
+
+// Keyboard state
+static bool caps_on = false;
+
+
+/*
+ *  Byte order helpers
+ */
+
+static inline uint32 get16(const uint8 *p)
+{
+	return (p[0] << 8) | p[1];
+}
+
+static inline uint32 get32(const uint8 *p)
+{
+	return (p[0] << 24) | (p[1] << 16) | (p[2] << 8) | p[3];
+}
+
+static inline void put8(vector<uint8> &out, uint32 v)
+{
+	out.push_back(v);
+}
+
+static inline void put16(vector<uint8> &out, uint32 v)
+{
+	out.push_back(v >> 8);
+	out.push_back(v);
+}
+
+static inline void put32(vector<uint8> &out, uint32 v)
+{
+	out.push_back(v >> 24);
+	out.push_back(v >> 16);
+	out.push_back(v >> 8);
+	out.push_back(v);
+}
+
+
+/*
+ *  Socket I/O
+ */
+
+static bool read_full(int fd, void *buf, size_t len)
+{
+	uint8 *p = (uint8 *)buf;
+	while (len > 0) {
+		ssize_t actual = recv(fd, p, len, 0);
+		if (actual < 0 && errno == EINTR)
+			continue;
+		if (actual <= 0)
+			return false;
+		p += actual;
+		len -= actual;
+	}
+	return true;
+}
+
+static bool write_full(int fd, const void *buf, size_t len)
+{
+	const uint8 *p = (const uint8 *)buf;
+	while (len > 0) {
+		ssize_t actual = send(fd, p, len, MSG_NOSIGNAL);
+		if (actual < 0 && errno == EINTR)
+			continue;
+		if (actual <= 0)
+			return false;
+		p += actual;
+		len -= actual;
+	}
+	return true;
+}
+
+// Wake up client thread
+static void wake_client(vnc_client *c)
+{
+	char b = 0;
+	if (write(c->wake_pipe[1], &b, 1) < 0) {
+		// Pipe full, the client will wake up anyway
+	}
+}
+
+
+/*
+ *  Encoder threads, run FUNC(ARG, 0..COUNT-1) in parallel
+ */
+
+static void *encoder_thread(void *arg)
+{
+	pthread_mutex_lock(&pool_lock);
+	for (;;) {
+		while (!pool_quit && job_next >= job_count)
+			pthread_cond_wait(&job_cond, &pool_lock);
+		if (pool_quit)
+			break;
+		int index = job_next++;
+		void (*func)(void *, int) = job_func;
+		void *func_arg = job_arg;
+		pthread_mutex_unlock(&pool_lock);
+		func(func_arg, index);
+		pthread_mutex_lock(&pool_lock);
+		if (++job_done == job_count)
+			pthread_cond_signal(&done_cond);
+	}
+	pthread_mutex_unlock(&pool_lock);
+	return NULL;
+}
+
+static void run_parallel(int count, void (*func)(void *arg, int index), void *arg)
+{
+	if (num_encoder_threads == 0 || count < 2) {
+		for (int i = 0; i < count; i++)
+			func(arg, i);
+		return;
+	}
+
+	pthread_mutex_lock(&job_lock);
+	pthread_mutex_lock(&pool_lock);
+	job_func = func;
+	job_arg = arg;
+	job_count = count;
+	job_next = job_done = 0;
+	pthread_cond_broadcast(&job_cond);
+
+	// Help with the job
+	while (job_next < job_count) {
+		int index = job_next++;
+		pthread_mutex_unlock(&pool_lock);
+		func(arg, index);
+		pthread_mutex_lock(&pool_lock);
+		job_done++;
+	}
+	while (job_done < job_count)
+		pthread_cond_wait(&done_cond, &pool_lock);
+	job_count = job_next = job_done = 0;
+	pthread_mutex_unlock(&pool_lock);
+	pthread_mutex_unlock(&job_lock);
+}
+
+static void start_encoder_threads(void)
+{
+	int threads = PrefsFindInt32("vncthreads");
+	if (threads <= 0) {
+		threads = sysconf(_SC_NPROCESSORS_ONLN);
+		if (threads > 4)
+			threads = 4;
+	}
+	if (threads > MAX_ENCODER_THREADS)
+		threads = MAX_ENCODER_THREADS;
+
+	pool_quit = false;
+	num_encoder_threads = 0;
+	for (int i = 1; i < threads; i++) {
+		if (pthread_create(&encoder_threads[num_encoder_threads], NULL, encoder_thread, NULL) != 0)
+			break;
+		num_encoder_threads++;
+	}
+	D(bug("VNC: %d encoder threads\n", num_encoder_threads + 1));
+}
+
+static void stop_encoder_threads(void)
+{
+	pthread_mutex_lock(&pool_lock);
+	pool_quit = true;
+	pthread_cond_broadcast(&job_cond);
+	pthread_mutex_unlock(&pool_lock);
+	for (int i = 0; i < num_encoder_threads; i++)
+		pthread_join(encoder_threads[i], NULL);
+	num_encoder_threads = 0;
+}
+
+
+/*
+ *  Pixel format handling
+ */
+
+// Set client pixel format, returns false if it is not supported
+static bool set_pixel_format(vnc_client *c, const pixel_format &format)
+{
+	pixel_format f = format;
+	if (f.bits_per_pixel != 8 && f.bits_per_pixel != 16 && f.bits_per_pixel != 32)
+		return false;
+	if (!f.true_colour) {
+		// Use a fixed BGR233 color map
+		if (f.bits_per_pixel != 8)
+			return false;
+		f.red_max = 7; f.red_shift = 0;
+		f.green_max = 7; f.green_shift = 3;
+		f.blue_max = 3; f.blue_shift = 6;
+
+		vector<uint8> msg;
+		put8(msg, 1);		// SetColourMapEntries
+		put8(msg, 0);
+		put16(msg, 0);
+		put16(msg, 256);
+		for (int i = 0; i < 256; i++) {
+			put16(msg, (i & 7) * 65535 / 7);
+			put16(msg, ((i >> 3) & 7) * 65535 / 7);
+			put16(msg, ((i >> 6) & 3) * 65535 / 3);
+		}
+		if (!write_full(c->fd, &msg[0], msg.size()))
+			return false;
+	}
+
+	c->format = f;
+	c->bytes_per_pixel = f.bits_per_pixel / 8;
+	for (int i = 0; i < 256; i++) {
+		c->red_table[i] = ((i * f.red_max + 127) / 255) << f.red_shift;
+		c->green_table[i] = ((i * f.green_max + 127) / 255) << f.green_shift;
+		c->blue_table[i] = ((i * f.blue_max + 127) / 255) << f.blue_shift;
+	}
+
+	// ZRLE drops the unused byte of 24 bit pixels
+	const uint32 mask = (uint32(f.red_max) << f.red_shift) | (uint32(f.green_max) << f.green_shift) | (uint32(f.blue_max) << f.blue_shift);
+	c->cpixel_size = c->bytes_per_pixel;
+	c->cpixel_shift = 0;
+	if (f.bits_per_pixel == 32 && f.depth <= 24 && f.true_colour) {
+		if ((mask & 0xff000000) == 0)
+			c->cpixel_size = 3;
+		else if ((mask & 0x000000ff) == 0) {
+			c->cpixel_size = 3;
+			c->cpixel_shift = 8;
+		}
+	}
+
+	// Tight does the same, but only for 8 bits per component
+	c->tight_rgb = f.bits_per_pixel == 32 && f.depth == 24 && f.true_colour
+		&& f.red_max == 255 && f.green_max == 255 && f.blue_max == 255;
+	return true;
+}
+
+// Translate 0x00RRGGBB to client pixel value
+static inline uint32 client_pixel(const vnc_client *c, uint32 rgb)
+{
+	return c->red_table[(rgb >> 16) & 0xff] | c->green_table[(rgb >> 8) & 0xff] | c->blue_table[rgb & 0xff];
+}
+
+// Store pixel value of SIZE bytes in client byte order
+static inline uint8 *store_pixel(uint8 *p, uint32 v, int size, bool big_endian)
+{
+	if (big_endian) {
+		for (int i = size - 1; i >= 0; i--)
+			*p++ = v >> (i * 8);
+	} else {
+		for (int i = 0; i < size; i++)
+			*p++ = v >> (i * 8);
+	}
+	return p;
+}
+
+static inline void put_pixel(const vnc_client *c, vector<uint8> &out, uint32 v)
+{
+	uint8 buf[4];
+	out.insert(out.end(), buf, store_pixel(buf, v, c->bytes_per_pixel, c->format.big_endian));
+}
+
+static inline void put_cpixel(const vnc_client *c, vector<uint8> &out, uint32 v)
+{
+	uint8 buf[4];
+	out.insert(out.end(), buf, store_pixel(buf, v >> c->cpixel_shift, c->cpixel_size, c->format.big_endian));
+}
+
+static inline void put_tpixel(const vnc_client *c, vector<uint8> &out, uint32 v)
+{
+	if (c->tight_rgb) {
+		const pixel_format &f = c->format;
+		out.push_back(v >> f.red_shift);
+		out.push_back(v >> f.green_shift);
+		out.push_back(v >> f.blue_shift);
+	} else
+		put_pixel(c, out, v);
+}
+
+// Get client pixel values of a screen rectangle
+static void translate_rect(const vnc_client *c, const vnc_rect &r, vector<uint32> &px)
+{
+	px.resize(r.w * r.h);
+	uint32 *dst = &px[0];
+	for (int y = r.y; y < r.y + r.h; y++) {
+		const uint32 *src = &screen[y * screen_width + r.x];
+		for (int x = 0; x < r.w; x++)
+			*dst++ = client_pixel(c, src[x]);
+	}
+}
+
+
+/*
+ *  Color palette of a tile or rectangle
+ */
+
+struct color_palette {
+	static const int HASH_SIZE = 512;
+
+	int size, max_size;
+	uint32 colors[256];
+	int16 hash_index[HASH_SIZE];
+
+	void reset(int max)
+	{
+		size = 0;
+		max_size = max;
+		memset(hash_index, 0xff, sizeof(hash_index));
+	}
+
+	static int hash(uint32 c)
+	{
+		return (c * 2654435761u) >> 23;
+	}
+
+	// Returns index of color, or -1 if it is not in the palette
+	int lookup(uint32 c) const
+	{
+		for (int h = hash(c); hash_index[h] >= 0; h = (h + 1) & (HASH_SIZE - 1))
+			if (colors[hash_index[h]] == c)
+				return hash_index[h];
+		return -1;
+	}
+
+	// Returns index of color, or -1 if the palette is full
+	int insert(uint32 c)
+	{
+		int h = hash(c);
+		for (; hash_index[h] >= 0; h = (h + 1) & (HASH_SIZE - 1))
+			if (colors[hash_index[h]] == c)
+				return hash_index[h];
+		if (size == max_size)
+			return -1;
+		colors[size] = c;
+		hash_index[h] = size;
+		return size++;
+	}
+};
+
+
+/*
+ *  zlib helpers
+ */
+
+// Compress DATA with Z_SYNC_FLUSH and append result to OUT
+static bool compress_data(z_stream *zs, bool &active, int level, const vector<uint8> &data, vector<uint8> &out)
+{
+	if (!active) {
+		memset(zs, 0, sizeof(z_stream));
+		if (deflateInit(zs, level) != Z_OK)
+			return false;
+		active = true;
+	}
+
+	size_t pos = out.size();
+	out.resize(pos + deflateBound(zs, data.size()) + 64);
+	zs->next_in = data.empty() ? NULL : (Bytef *)&data[0];
+	zs->avail_in = data.size();
+	for (;;) {
+		zs->next_out = &out[pos];
+		zs->avail_out = out.size() - pos;
+		int err = deflate(zs, Z_SYNC_FLUSH);
+		pos = out.size() - zs->avail_out;
+		if (err != Z_OK && err != Z_BUF_ERROR)
+			return false;
+		if (zs->avail_out != 0)
+			break;
+		out.resize(out.size() * 2);
+	}
+	out.resize(pos);
+	return true;
+}
+
+static void end_streams(vnc_client *c)
+{
+	if (c->zrle_stream_active)
+		deflateEnd(&c->zrle_stream);
+	c->zrle_stream_active = false;
+	for (int i = 0; i < TIGHT_STREAMS; i++) {
+		if (c->tight_stream_active[i])
+			deflateEnd(&c->tight_streams[i]);
+		c->tight_stream_active[i] = false;
+	}
+}
+
+
+/*
+ *  Encoders, each one appends a complete rectangle to OUT
+ */
+
+static void put_rect_header(vector<uint8> &out, const vnc_rect &r, int32 encoding)
+{
+	put16(out, r.x);
+	put16(out, r.y);
+	put16(out, r.w);
+	put16(out, r.h);
+	put32(out, encoding);
+}
+
+// Raw encoding
+static void encode_raw(const vnc_client *c, const vnc_rect &r, vector<uint8> &out)
+{
+	put_rect_header(out, r, ENC_RAW);
+	const int size = c->bytes_per_pixel;
+	const bool big_endian = c->format.big_endian;
+	size_t pos = out.size();
+	out.resize(pos + r.w * r.h * size);
+	uint8 *p = &out[pos];
+	for (int y = r.y; y < r.y + r.h; y++) {
+		const uint32 *src = &screen[y * screen_width + r.x];
+		for (int x = 0; x < r.w; x++)
+			p = store_pixel(p, client_pixel(c, src[x]), size, big_endian);
+	}
+}
+
+// Hextile encoding
+struct hextile_state {
+	uint32 bg, fg;
+	bool bg_valid, fg_valid;
+};
+
+static void encode_hextile_tile(const vnc_client *c, const uint32 *px, int w, int h, hextile_state &st, vector<uint8> &out)
+{
+	const int n = w * h;
+
+	// Find the two most frequent colors, and whether there are more
+	uint32 c0 = px[0], c1 = px[0];
+	int n0 = 0, n1 = 0;
+	bool more = false;
+	for (int i = 0; i < n; i++) {
+		if (px[i] == c0)
+			n0++;
+		else if (n1 == 0 || px[i] == c1) {
+			c1 = px[i];
+			n1++;
+		} else
+			more = true;
+	}
+
+	// Solid tile
+	if (n1 == 0) {
+		if (st.bg_valid && st.bg == c0)
+			put8(out, 0);
+		else {
+			put8(out, HEXTILE_BACKGROUND);
+			put_pixel(c, out, c0);
+			st.bg = c0;
+			st.bg_valid = true;
+		}
+		return;
+	}
+
+	const uint32 bg = n0 >= n1 ? c0 : c1;
+	const uint32 fg = n0 >= n1 ? c1 : c0;
+	const size_t start = out.size();
+	const size_t raw_size = n * c->bytes_per_pixel;
+	uint8 flags = HEXTILE_ANY_SUBRECTS;
+	put8(out, 0);
+	if (!st.bg_valid || st.bg != bg) {
+		flags |= HEXTILE_BACKGROUND;
+		put_pixel(c, out, bg);
+	}
+	if (more)
+		flags |= HEXTILE_SUBRECTS_COLOURED;
+	else if (!st.fg_valid || st.fg != fg) {
+		flags |= HEXTILE_FOREGROUND;
+		put_pixel(c, out, fg);
+	}
+	const size_t count_pos = out.size();
+	put8(out, 0);
+
+	// Cover all other pixels with subrectangles, as wide and then as high as possible
+	bool covered[TILE_SIZE * TILE_SIZE];
+	memset(covered, 0, sizeof(covered));
+	int count = 0;
+	for (int y = 0; y < h; y++) {
+		for (int x = 0; x < w; x++) {
+			const int i = y * w + x;
+			if (covered[i] || px[i] == bg)
+				continue;
+			const uint32 color = px[i];
+			int sw = 1;
+			while (x + sw < w && px[i + sw] == color && !covered[i + sw])
+				sw++;
+			int sh = 1;
+			for (; y + sh < h; sh++) {
+				const int j = i + sh * w;
+				int k;
+				for (k = 0; k < sw; k++)
+					if (px[j + k] != color || covered[j + k])
+						break;
+				if (k < sw)
+					break;
+			}
+			for (int yy = 0; yy < sh; yy++)
+				memset(covered + i + yy * w, 1, sw);
+
+			if (more)
+				put_pixel(c, out, color);
+			put8(out, (x << 4) | y);
+			put8(out, ((sw - 1) << 4) | (sh - 1));
+			if (++count > 255 || out.size() - start > raw_size)
+				goto raw;
+		}
+	}
+	out[start] = flags;
+	out[count_pos] = count;
+	st.bg = bg;
+	st.bg_valid = true;
+	if (more)
+		st.fg_valid = false;
+	else {
+		st.fg = fg;
+		st.fg_valid = true;
+	}
+	return;
+
+raw:
+	out.resize(start);
+	put8(out, HEXTILE_RAW);
+	for (int i = 0; i < n; i++)
+		put_pixel(c, out, px[i]);
+	st.bg_valid = st.fg_valid = false;
+}
+
+static void encode_hextile(const vnc_client *c, const vnc_rect &r, vector<uint8> &out)
+{
+	put_rect_header(out, r, ENC_HEXTILE);
+	vector<uint32> px;
+	translate_rect(c, r, px);
+
+	hextile_state st;
+	st.bg = st.fg = 0;
+	st.bg_valid = st.fg_valid = false;
+	uint32 tile[TILE_SIZE * TILE_SIZE];
+	for (int ty = 0; ty < r.h; ty += TILE_SIZE) {
+		const int th = r.h - ty < TILE_SIZE ? r.h - ty : TILE_SIZE;
+		for (int tx = 0; tx < r.w; tx += TILE_SIZE) {
+			const int tw = r.w - tx < TILE_SIZE ? r.w - tx : TILE_SIZE;
+			for (int y = 0; y < th; y++)
+				memcpy(tile + y * tw, &px[(ty + y) * r.w + tx], tw * sizeof(uint32));
+			encode_hextile_tile(c, tile, tw, th, st, out);
+		}
+	}
+}
+
+// ZRLE encoding, tile data before compression
+static inline void put_run_length(vector<uint8> &out, int len)
+{
+	len--;
+	while (len >= 255) {
+		out.push_back(255);
+		len -= 255;
+	}
+	out.push_back(len);
+}
+
+static void encode_zrle_tile(const vnc_client *c, const uint32 *px, int w, int h, color_palette &pal, vector<uint8> &out)
+{
+	const int n = w * h;
+	const int cb = c->cpixel_size;
+
+	// Collect palette and sizes of the run-length encodings
+	pal.reset(127);
+	bool too_many = false;
+	int plain_rle = 0, palette_rle = 0;
+	for (int i = 0; i < n; ) {
+		const uint32 color = px[i];
+		int j = i + 1;
+		while (j < n && px[j] == color)
+			j++;
+		const int len = j - i, len_bytes = (len - 1) / 255 + 1;
+		if (!too_many && pal.insert(color) < 0)
+			too_many = true;
+		plain_rle += cb + len_bytes;
+		palette_rle += len == 1 ? 1 : 1 + len_bytes;
+		i = j;
+	}
+
+	if (!too_many && pal.size == 1) {
+		put8(out, 1);
+		put_cpixel(c, out, px[0]);
+		return;
+	}
+
+	// Pick the shortest subencoding
+	int best = n * cb, mode = 0;
+	if (plain_rle < best) {
+		best = plain_rle;
+		mode = 128;
+	}
+	int bits = 0;
+	if (!too_many) {
+		if (pal.size * cb + palette_rle < best) {
+			best = pal.size * cb + palette_rle;
+			mode = 128 + pal.size;
+		}
+		if (pal.size <= 16) {
+			bits = pal.size <= 2 ? 1 : pal.size <= 4 ? 2 : 4;
+			if (pal.size * cb + h * ((w * bits + 7) / 8) < best)
+				mode = pal.size;
+		}
+	}
+
+	put8(out, mode);
+	if (mode == 0) {
+		for (int i = 0; i < n; i++)
+			put_cpixel(c, out, px[i]);
+	} else if (mode == 128) {
+		for (int i = 0; i < n; ) {
+			int j = i + 1;
+			while (j < n && px[j] == px[i])
+				j++;
+			put_cpixel(c, out, px[i]);
+			put_run_length(out, j - i);
+			i = j;
+		}
+	} else {
+		for (int i = 0; i < pal.size; i++)
+			put_cpixel(c, out, pal.colors[i]);
+		if (mode > 128) {
+			for (int i = 0; i < n; ) {
+				int j = i + 1;
+				while (j < n && px[j] == px[i])
+					j++;
+				const int index = pal.lookup(px[i]);
+				if (j - i == 1)
+					put8(out, index);
+				else {
+					put8(out, index | 128);
+					put_run_length(out, j - i);
+				}
+				i = j;
+			}
+		} else {
+			for (int y = 0; y < h; y++) {
+				uint32 acc = 0;
+				int acc_bits = 0;
+				for (int x = 0; x < w; x++) {
+					acc = (acc << bits) | pal.lookup(px[y * w + x]);
+					acc_bits += bits;
+					if (acc_bits == 8) {
+						put8(out, acc);
+						acc = acc_bits = 0;
+					}
+				}
+				if (acc_bits)
+					put8(out, acc << (8 - acc_bits));
+			}
+		}
+	}
+}
+
+static void encode_zrle_tiles(const vnc_client *c, const vnc_rect &r, vector<uint8> &out)
+{
+	vector<uint32> px;
+	translate_rect(c, r, px);
+
+	color_palette pal;
+	vector<uint32> tile(BAND_HEIGHT * BAND_HEIGHT);
+	for (int ty = 0; ty < r.h; ty += BAND_HEIGHT) {
+		const int th = r.h - ty < BAND_HEIGHT ? r.h - ty : BAND_HEIGHT;
+		for (int tx = 0; tx < r.w; tx += BAND_HEIGHT) {
+			const int tw = r.w - tx < BAND_HEIGHT ? r.w - tx : BAND_HEIGHT;
+			for (int y = 0; y < th; y++)
+				memcpy(&tile[y * tw], &px[(ty + y) * r.w + tx], tw * sizeof(uint32));
+			encode_zrle_tile(c, &tile[0], tw, th, pal, out);
+		}
+	}
+}
+
+// Tight encoding (basic and fill compression only)
+static bool encode_tight(vnc_client *c, const vnc_rect &r, int stream, vector<uint8> &out)
+{
+	put_rect_header(out, r, ENC_TIGHT);
+	vector<uint32> px;
+	translate_rect(c, r, px);
+	const int n = r.w * r.h;
+
+	// Count colors
+	color_palette pal;
+	pal.reset(256);
+	bool use_palette = true;
+	for (int i = 0; i < n; i++) {
+		if ((i == 0 || px[i] != px[i - 1]) && pal.insert(px[i]) < 0) {
+			use_palette = false;
+			break;
+		}
+	}
+
+	if (use_palette && pal.size == 1) {
+		put8(out, 0x80);	// Fill compression
+		put_tpixel(c, out, px[0]);
+		return true;
+	}
+
+	// A palette only helps if pixels are larger than indices
+	const int tpixel_size = c->tight_rgb ? 3 : c->bytes_per_pixel;
+	if (tpixel_size == 1 && pal.size > 2)
+		use_palette = false;
+
+	vector<uint8> data;
+	if (use_palette) {
+		put8(out, (stream << 4) | 0x40);	// Basic compression, explicit filter
+		put8(out, 1);						// Palette filter
+		put8(out, pal.size - 1);
+		for (int i = 0; i < pal.size; i++)
+			put_tpixel(c, out, pal.colors[i]);
+		if (pal.size == 2) {
+			for (int y = 0; y < r.h; y++) {
+				uint32 acc = 0;
+				int acc_bits = 0;
+				for (int x = 0; x < r.w; x++) {
+					acc = (acc << 1) | (px[y * r.w + x] == pal.colors[0] ? 0 : 1);
+					if (++acc_bits == 8) {
+						data.push_back(acc);
+						acc = acc_bits = 0;
+					}
+				}
+				if (acc_bits)
+					data.push_back(acc << (8 - acc_bits));
+			}
+		} else {
+			data.resize(n);
+			for (int i = 0; i < n; i++)
+				data[i] = pal.lookup(px[i]);
+		}
+	} else {
+		put8(out, stream << 4);				// Basic compression, copy filter
+		data.reserve(n * tpixel_size);
+		for (int i = 0; i < n; i++)
+			put_tpixel(c, data, px[i]);
+	}
+
+	if (data.size() < (size_t)TIGHT_MIN_TO_COMPRESS) {
+		out.insert(out.end(), data.begin(), data.end());
+		return true;
+	}
+
+	vector<uint8> compressed;
+	if (!compress_data(&c->tight_streams[stream], c->tight_stream_active[stream], c->compress_level, data, compressed))
+		return false;
+	const uint32 len = compressed.size();
+	put8(out, (len & 0x7f) | (len > 0x7f ? 0x80 : 0));
+	if (len > 0x7f) {
+		put8(out, ((len >> 7) & 0x7f) | (len > 0x3fff ? 0x80 : 0));
+		if (len > 0x3fff)
+			put8(out, len >> 14);
+	}
+	out.insert(out.end(), compressed.begin(), compressed.end());
+	return true;
+}
+
+
+/*
+ *  Framebuffer updates
+ */
+
+struct encode_job {
+	vnc_client *c;
+	vector<vnc_rect> bands;
+	vector< vector<uint8> > out;
+	int streams;
+	bool ok;
+};
+
+static void encode_band(void *arg, int index)
+{
+	encode_job *job = (encode_job *)arg;
+	const vnc_rect &r = job->bands[index];
+	switch (job->c->encoding) {
+	case ENC_HEXTILE:
+		encode_hextile(job->c, r, job->out[index]);
+		break;
+	case ENC_ZRLE:
+		encode_zrle_tiles(job->c, r, job->out[index]);
+		break;
+	default:
+		encode_raw(job->c, r, job->out[index]);
+		break;
+	}
+}
+
+// Tight bands are distributed round-robin over the zlib streams, each stream is compressed in order
+static void encode_tight_stream(void *arg, int stream)
+{
+	encode_job *job = (encode_job *)arg;
+	for (size_t i = stream; i < job->bands.size(); i += job->streams)
+		if (!encode_tight(job->c, job->bands[i], stream, job->out[i]))
+			job->ok = false;
+}
+
+// Collect changed tiles into rectangles and clear them
+static void collect_rects(vnc_client *c, vector<vnc_rect> &rects)
+{
+	uint8 *dirty = &c->dirty[0];
+	for (int ty = 0; ty < tiles_y; ty++) {
+		int tx = 0;
+		while (tx < tiles_x) {
+			if (!dirty[ty * tiles_x + tx]) {
+				tx++;
+				continue;
+			}
+			int tx1 = tx + 1;
+			while (tx1 < tiles_x && dirty[ty * tiles_x + tx1])
+				tx1++;
+
+			// Extend downwards while the same tiles changed
+			int ty1 = ty + 1;
+			for (; ty1 < tiles_y; ty1++) {
+				int x;
+				for (x = tx; x < tx1; x++)
+					if (!dirty[ty1 * tiles_x + x])
+						break;
+				if (x < tx1)
+					break;
+			}
+			for (int y = ty; y < ty1; y++)
+				memset(dirty + y * tiles_x + tx, 0, tx1 - tx);
+
+			vnc_rect r;
+			r.x = tx * TILE_SIZE;
+			r.y = ty * TILE_SIZE;
+			r.w = (tx1 * TILE_SIZE < screen_width ? tx1 * TILE_SIZE : screen_width) - r.x;
+			r.h = (ty1 * TILE_SIZE < screen_height ? ty1 * TILE_SIZE : screen_height) - r.y;
+			rects.push_back(r);
+			tx = tx1;
+		}
+	}
+	c->has_dirty = false;
+}
+
+// Cut rectangles into bands that can be encoded independently
+static void split_rects(const vnc_client *c, const vector<vnc_rect> &rects, vector<vnc_rect> &bands)
+{
+	for (size_t i = 0; i < rects.size(); i++) {
+		const vnc_rect &r = rects[i];
+		int max_w = r.w, max_h = BAND_HEIGHT;
+		if (c->encoding == ENC_TIGHT) {
+			if (max_w > TIGHT_MAX_WIDTH)
+				max_w = TIGHT_MAX_WIDTH;
+			if (max_h > TIGHT_MAX_PIXELS / max_w)
+				max_h = TIGHT_MAX_PIXELS / max_w;
+		}
+		for (int y = r.y; y < r.y + r.h; y += max_h) {
+			for (int x = r.x; x < r.x + r.w; x += max_w) {
+				vnc_rect b;
+				b.x = x;
+				b.y = y;
+				b.w = r.x + r.w - x < max_w ? r.x + r.w - x : max_w;
+				b.h = r.y + r.h - y < max_h ? r.y + r.h - y : max_h;
+				bands.push_back(b);
+			}
+		}
+	}
+}
+
+// Send all changed tiles to the client
+static bool send_update(vnc_client *c)
+{
+	encode_job job;
+	job.c = c;
+	job.ok = true;
+	job.streams = 1;
+
+	pthread_mutex_lock(&screen_lock);
+	const bool resize = c->size_changed;
+	if (resize && !c->desktop_size) {
+		pthread_mutex_unlock(&screen_lock);
+		printf("WARNING: VNC client cannot follow screen size change, disconnecting\n");
+		return false;
+	}
+	vector<vnc_rect> rects;
+	collect_rects(c, rects);
+	split_rects(c, rects, job.bands);
+	c->size_changed = false;
+	c->update_requested = false;
+	const int width = screen_width, height = screen_height;
+
+	job.out.resize(job.bands.size());
+	if (c->encoding == ENC_TIGHT) {
+		job.streams = job.bands.size() < (size_t)TIGHT_STREAMS ? job.bands.size() : TIGHT_STREAMS;
+		run_parallel(job.streams, encode_tight_stream, &job);
+	} else
+		run_parallel(job.bands.size(), encode_band, &job);
+	pthread_mutex_unlock(&screen_lock);
+	if (!job.ok)
+		return false;
+
+	// ZRLE has a single zlib stream, so the tiles are compressed here
+	if (c->encoding == ENC_ZRLE) {
+		for (size_t i = 0; i < job.bands.size(); i++) {
+			vector<uint8> data;
+			put_rect_header(data, job.bands[i], ENC_ZRLE);
+			put32(data, 0);
+			const size_t header_size = data.size();
+			if (!compress_data(&c->zrle_stream, c->zrle_stream_active, c->compress_level, job.out[i], data))
+				return false;
+			const uint32 len = data.size() - header_size;
+			data[header_size - 4] = len >> 24;
+			data[header_size - 3] = len >> 16;
+			data[header_size - 2] = len >> 8;
+			data[header_size - 1] = len;
+			job.out[i].swap(data);
+		}
+	}
+
+	vector<uint8> header;
+	put8(header, 0);		// FramebufferUpdate
+	put8(header, 0);
+	put16(header, job.bands.size() + (resize ? 1 : 0));
+	if (resize) {
+		vnc_rect r = {0, 0, width, height};
+		put_rect_header(header, r, ENC_DESKTOP_SIZE);
+	}
+
+	c->update_sent = GetTicks_usec();
+	c->update_bytes = header.size();
+	if (!write_full(c->fd, &header[0], header.size()))
+		return false;
+	for (size_t i = 0; i < job.out.size(); i++) {
+		if (!write_full(c->fd, &job.out[i][0], job.out[i].size()))
+			return false;
+		c->update_bytes += job.out[i].size();
+	}
+	D(bug("VNC: sent %d rectangles, %u bytes\n", (int)job.bands.size(), c->update_bytes));
+	return true;
+}
+
+// Client acknowledged the last update by requesting the next one, adapt update rate
+static void update_bandwidth(vnc_client *c)
+{
+	if (c->update_sent == 0)
+		return;
+	const uint64 now = GetTicks_usec();
+	const uint64 elapsed = now - c->update_sent;
+
+	// Small updates mostly measure latency
+	if (c->update_bytes >= 4096 && elapsed > 0) {
+		const double bw = double(c->update_bytes) / double(elapsed);
+		c->bandwidth = c->bandwidth == 0 ? bw : (c->bandwidth * 3 + bw) / 4;
+	}
+
+	uint64 interval = MIN_UPDATE_INTERVAL;
+	if (c->bandwidth > 0) {
+		interval = uint64(c->update_bytes / c->bandwidth);
+		if (interval < MIN_UPDATE_INTERVAL)
+			interval = MIN_UPDATE_INTERVAL;
+		else if (interval > MAX_UPDATE_INTERVAL)
+			interval = MAX_UPDATE_INTERVAL;
+	}
+	c->next_update = c->update_sent + interval;
+	c->update_sent = 0;
+}
+
+
+/*
+ *  Input events
+ */
+
+// Translate X keysym to Mac keycode, returns -1 if unknown
+static int keysym_to_mac(uint32 ks)
+{
+	if (ks >= 'a' && ks <= 'z')
+		ks -= 'a' - 'A';
+	switch (ks) {
+		case 'A': return 0x00;
+		case 'B': return 0x0b;
+		case 'C': return 0x08;
+		case 'D': return 0x02;
+		case 'E': return 0x0e;
+		case 'F': return 0x03;
+		case 'G': return 0x05;
+		case 'H': return 0x04;
+		case 'I': return 0x22;
+		case 'J': return 0x26;
+		case 'K': return 0x28;
+		case 'L': return 0x25;
+		case 'M': return 0x2e;
+		case 'N': return 0x2d;
+		case 'O': return 0x1f;
+		case 'P': return 0x23;
+		case 'Q': return 0x0c;
+		case 'R': return 0x0f;
+		case 'S': return 0x01;
+		case 'T': return 0x11;
+		case 'U': return 0x20;
+		case 'V': return 0x09;
+		case 'W': return 0x0d;
+		case 'X': return 0x07;
+		case 'Y': return 0x10;
+		case 'Z': return 0x06;
+
+		case '1': case '!': return 0x12;
+		case '2': case '@': return 0x13;
+		case '3': case '#': return 0x14;
+		case '4': case '$': return 0x15;
+		case '5': case '%': return 0x17;
+		case '6': case '^': return 0x16;
+		case '7': case '&': return 0x1a;
+		case '8': case '*': return 0x1c;
+		case '9': case '(': return 0x19;
+		case '0': case ')': return 0x1d;
+
+		case '`': case '~': return 0x0a;
+		case '-': case '_': return 0x1b;
+		case '=': case '+': return 0x18;
+		case '[': case '{': return 0x21;
+		case ']': case '}': return 0x1e;
+		case '\\': case '|': return 0x2a;
+		case ';': case ':': return 0x29;
+		case '\'': case '"': return 0x27;
+		case ',': case '<': return 0x2b;
+		case '.': case '>': return 0x2f;
+		case '/': case '?': return 0x2c;
+
+		case 0xff09: return 0x30;		// Tab
+		case 0xff0d: return 0x24;		// Return
+		case ' ': return 0x31;
+		case 0xff08: return 0x33;		// BackSpace
+
+		case 0xffff: return 0x75;		// Delete
+		case 0xff63: return 0x72;		// Insert
+		case 0xff50: case 0xff6a: return 0x73;	// Home, Help
+		case 0xff57: return 0x77;		// End
+		case 0xff55: return 0x74;		// Page_Up
+		case 0xff56: return 0x79;		// Page_Down
+
+		case 0xffe3: case 0xffe4: return 0x36;	// Control_L/R
+		case 0xffe1: case 0xffe2: return 0x38;	// Shift_L/R
+		case 0xffe9: case 0xffea: return 0x37;	// Alt_L/R
+		case 0xffe7: case 0xffe8: return 0x3a;	// Meta_L/R
+		case 0xffeb: case 0xffec: return 0x3a;	// Super_L/R
+		case 0xff67: return 0x32;		// Menu
+		case 0xffe5: return 0x39;		// Caps_Lock
+		case 0xff7f: return 0x47;		// Num_Lock
+
+		case 0xff52: return 0x3e;		// Up
+		case 0xff54: return 0x3d;		// Down
+		case 0xff51: return 0x3b;		// Left
+		case 0xff53: return 0x3c;		// Right
+
+		case 0xff1b: return 0x35;		// Escape
+
+		case 0xffbe: return 0x7a;		// F1
+		case 0xffbf: return 0x78;
+		case 0xffc0: return 0x63;
+		case 0xffc1: return 0x76;
+		case 0xffc2: return 0x60;
+		case 0xffc3: return 0x61;
+		case 0xffc4: return 0x62;
+		case 0xffc5: return 0x64;
+		case 0xffc6: return 0x65;
+		case 0xffc7: return 0x6d;
+		case 0xffc8: return 0x67;
+		case 0xffc9: return 0x6f;		// F12
+
+		case 0xff61: return 0x69;		// Print
+		case 0xff14: return 0x6b;		// Scroll_Lock
+		case 0xff13: return 0x71;		// Pause
+
+		case 0xffb0: case 0xff9e: return 0x52;	// KP_0, KP_Insert
+		case 0xffb1: case 0xff9c: return 0x53;	// KP_1, KP_End
+		case 0xffb2: case 0xff99: return 0x54;	// KP_2, KP_Down
+		case 0xffb3: case 0xff9b: return 0x55;	// KP_3, KP_Next
+		case 0xffb4: case 0xff96: return 0x56;	// KP_4, KP_Left
+		case 0xffb5: case 0xff9d: return 0x57;	// KP_5, KP_Begin
+		case 0xffb6: case 0xff98: return 0x58;	// KP_6, KP_Right
+		case 0xffb7: case 0xff95: return 0x59;	// KP_7, KP_Home
+		case 0xffb8: case 0xff97: return 0x5b;	// KP_8, KP_Up
+		case 0xffb9: case 0xff9a: return 0x5c;	// KP_9, KP_Prior
+		case 0xffae: case 0xff9f: return 0x41;	// KP_Decimal, KP_Delete
+		case 0xffab: return 0x45;		// KP_Add
+		case 0xffad: return 0x4e;		// KP_Subtract
+		case 0xffaa: return 0x43;		// KP_Multiply
+		case 0xffaf: return 0x4b;		// KP_Divide
+		case 0xff8d: return 0x4c;		// KP_Enter
+		case 0xffbd: return 0x51;		// KP_Equal
+	}
+	return -1;
+}
+
+static void handle_key(uint32 ks, bool down)
+{
+	int code = keysym_to_mac(ks);
+	if (code < 0)
+		return;
+	if (code == 0x39) {
+		// Caps Lock is a toggle on the Mac keyboard
+		if (down) {
+			if (caps_on)
+				ADBKeyUp(code);
+			else
+				ADBKeyDown(code);
+			caps_on = !caps_on;
+		}
+	} else if (down)
+		ADBKeyDown(code);
+	else
+		ADBKeyUp(code);
+}
+
+static void handle_pointer(vnc_client *c, uint8 mask, int x, int y)
+{
+	ADBMouseMoved(x, y);
+
+	const uint8 changed = mask ^ c->buttons;
+	for (int i = 0; i < 3; i++) {
+		if (changed & (1 << i)) {
+			if (mask & (1 << i))
+				ADBMouseDown(i);
+			else
+				ADBMouseUp(i);
+		}
+	}
+
+	// Wheel buttons
+	const uint8 wheel = changed & mask & 0x18;
+	if (wheel) {
+		const bool down = (wheel & 0x10) != 0;
+		if (PrefsFindInt32("mousewheelmode") == 0) {
+			int key = down ? 0x79 : 0x74;	// Page up/down
+			ADBKeyDown(key);
+			ADBKeyUp(key);
+		} else {
+			int key = down ? 0x3d : 0x3e;	// Cursor up/down
+			for (int i = 0; i < PrefsFindInt32("mousewheellines"); i++) {
+				ADBKeyDown(key);
+				ADBKeyUp(key);
+			}
+		}
+	}
+	c->buttons = mask;
+}
+
+
+/*
+ *  Client connection
+ */
+
+// Protocol version, security and initialization messages
+static bool handshake(vnc_client *c)
+{
+	if (!write_full(c->fd, "RFB 003.008\n", 12))
+		return false;
+	char version[13];
+	if (!read_full(c->fd, version, 12))
+		return false;
+	version[12] = 0;
+	int major, minor;
+	if (sscanf(version, "RFB %d.%d", &major, &minor) != 2 || major != 3) {
+		printf("WARNING: Unsupported VNC client version %.11s\n", version);
+		return false;
+	}
+
+	// Security type None only
+	if (minor >= 7) {
+		const uint8 types[2] = {1, 1};
+		uint8 type;
+		if (!write_full(c->fd, types, 2) || !read_full(c->fd, &type, 1) || type != 1)
+			return false;
+		if (minor >= 8) {
+			const uint8 result[4] = {0, 0, 0, 0};
+			if (!write_full(c->fd, result, 4))
+				return false;
+		}
+	} else {
+		const uint8 type[4] = {0, 0, 0, 1};
+		if (!write_full(c->fd, type, 4))
+			return false;
+	}
+
+	// ClientInit, the screen is always shared
+	uint8 shared;
+	if (!read_full(c->fd, &shared, 1))
+		return false;
+
+	// ServerInit with 32 bit xRGB pixels
+	pixel_format f;
+	f.bits_per_pixel = 32;
+	f.depth = 24;
+	f.big_endian = 0;
+	f.true_colour = 1;
+	f.red_max = f.green_max = f.blue_max = 255;
+	f.red_shift = 16;
+	f.green_shift = 8;
+	f.blue_shift = 0;
+	set_pixel_format(c, f);
+
+	vector<uint8> msg;
+	pthread_mutex_lock(&screen_lock);
+	put16(msg, screen_width);
+	put16(msg, screen_height);
+	pthread_mutex_unlock(&screen_lock);
+	put8(msg, f.bits_per_pixel);
+	put8(msg, f.depth);
+	put8(msg, f.big_endian);
+	put8(msg, f.true_colour);
+	put16(msg, f.red_max);
+	put16(msg, f.green_max);
+	put16(msg, f.blue_max);
+	put8(msg, f.red_shift);
+	put8(msg, f.green_shift);
+	put8(msg, f.blue_shift);
+	put8(msg, 0);
+	put8(msg, 0);
+	put8(msg, 0);
+	const char *name = GetString(STR_WINDOW_TITLE);
+	put32(msg, strlen(name));
+	msg.insert(msg.end(), name, name + strlen(name));
+	return write_full(c->fd, &msg[0], msg.size());
+}
+
+// Handle one client message, returns false if the connection is to be closed
+static bool handle_message(vnc_client *c)
+{
+	uint8 type;
+	if (!read_full(c->fd, &type, 1))
+		return false;
+
+	switch (type) {
+		case 0: {	// SetPixelFormat
+			uint8 msg[19];
+			if (!read_full(c->fd, msg, sizeof(msg)))
+				return false;
+			pixel_format f;
+			f.bits_per_pixel = msg[3];
+			f.depth = msg[4];
+			f.big_endian = msg[5];
+			f.true_colour = msg[6];
+			f.red_max = get16(msg + 7);
+			f.green_max = get16(msg + 9);
+			f.blue_max = get16(msg + 11);
+			f.red_shift = msg[13];
+			f.green_shift = msg[14];
+			f.blue_shift = msg[15];
+			if (!set_pixel_format(c, f)) {
+				printf("WARNING: Unsupported VNC pixel format (%d bits per pixel)\n", f.bits_per_pixel);
+				return false;
+			}
+			pthread_mutex_lock(&screen_lock);
+			memset(&c->dirty[0], 1, c->dirty.size());
+			c->has_dirty = true;
+			pthread_mutex_unlock(&screen_lock);
+			break;
+		}
+
+		case 2: {	// SetEncodings
+			uint8 msg[3];
+			if (!read_full(c->fd, msg, sizeof(msg)))
+				return false;
+			const int n = get16(msg + 1);
+			vector<uint8> encodings(n * 4 + 1);
+			if (!read_full(c->fd, &encodings[0], n * 4))
+				return false;
+			bool found = false;
+			c->encoding = ENC_RAW;
+			c->desktop_size = false;
+			for (int i = 0; i < n; i++) {
+				const int32 e = get32(&encodings[i * 4]);
+				if (!found && (e == ENC_RAW || e == ENC_HEXTILE || e == ENC_TIGHT || e == ENC_ZRLE)) {
+					c->encoding = e;
+					found = true;
+				} else if (e == ENC_DESKTOP_SIZE)
+					c->desktop_size = true;
+				else if (e >= ENC_COMPRESS_LEVEL_0 && e <= ENC_COMPRESS_LEVEL_9)
+					c->compress_level = e - ENC_COMPRESS_LEVEL_0;	// Used when a zlib stream is started
+			}
+			D(bug("VNC: encoding %d, compression level %d\n", c->encoding, c->compress_level));
+			break;
+		}
+
+		case 3: {	// FramebufferUpdateRequest
+			uint8 msg[9];
+			if (!read_full(c->fd, msg, sizeof(msg)))
+				return false;
+			update_bandwidth(c);
+			pthread_mutex_lock(&screen_lock);
+			if (!msg[0]) {
+				// Non-incremental, mark requested area as changed
+				int x0 = get16(msg + 1) / TILE_SIZE, y0 = get16(msg + 3) / TILE_SIZE;
+				int x1 = (get16(msg + 1) + get16(msg + 5) + TILE_SIZE - 1) / TILE_SIZE;
+				int y1 = (get16(msg + 3) + get16(msg + 7) + TILE_SIZE - 1) / TILE_SIZE;
+				if (x1 > tiles_x)
+					x1 = tiles_x;
+				if (y1 > tiles_y)
+					y1 = tiles_y;
+				for (int y = y0; y < y1; y++)
+					for (int x = x0; x < x1; x++) {
+						c->dirty[y * tiles_x + x] = 1;
+						c->has_dirty = true;
+					}
+			}
+			c->update_requested = true;
+			pthread_mutex_unlock(&screen_lock);
+			break;
+		}
+
+		case 4: {	// KeyEvent
+			uint8 msg[7];
+			if (!read_full(c->fd, msg, sizeof(msg)))
+				return false;
+			handle_key(get32(msg + 3), msg[0] != 0);
+			break;
+		}
+
+		case 5: {	// PointerEvent
+			uint8 msg[5];
+			if (!read_full(c->fd, msg, sizeof(msg)))
+				return false;
+			handle_pointer(c, msg[0], get16(msg + 1), get16(msg + 3));
+			break;
+		}
+
+		case 6: {	// ClientCutText, ignored
+			uint8 msg[7];
+			if (!read_full(c->fd, msg, sizeof(msg)))
+				return false;
+			uint32 len = get32(msg + 3);
+			uint8 buf[1024];
+			while (len > 0) {
+				uint32 chunk = len < sizeof(buf) ? len : sizeof(buf);
+				if (!read_full(c->fd, buf, chunk))
+					return false;
+				len -= chunk;
+			}
+			break;
+		}
+
+		default:
+			printf("WARNING: Unknown VNC client message %d\n", type);
+			return false;
+	}
+	return true;
+}
+
+static void *client_thread(void *arg)
+{
+	vnc_client *c = (vnc_client *)arg;
+
+	if (handshake(c)) {
+		pthread_mutex_lock(&screen_lock);
+		c->ready = true;
+		pthread_mutex_unlock(&screen_lock);
+		D(bug("VNC client connected\n"));
+
+		while (!c->quit) {
+			struct pollfd fds[2];
+			fds[0].fd = c->fd;
+			fds[0].events = POLLIN;
+			fds[1].fd = c->wake_pipe[0];
+			fds[1].events = POLLIN;
+			if (poll(fds, 2, -1) < 0) {
+				if (errno == EINTR)
+					continue;
+				break;
+			}
+			if (fds[1].revents & POLLIN) {
+				char buf[16];
+				if (read(c->wake_pipe[0], buf, sizeof(buf)) < 0) {
+					// Nothing to do
+				}
+			}
+			if (fds[0].revents & (POLLIN | POLLHUP | POLLERR)) {
+				if (!handle_message(c))
+					break;
+			}
+
+			pthread_mutex_lock(&screen_lock);
+			const bool send = c->update_requested && (c->has_dirty || c->size_changed);
+			pthread_mutex_unlock(&screen_lock);
+			if (send && !send_update(c))
+				break;
+		}
+		D(bug("VNC client disconnected\n"));
+	}
+
+	// Release buttons that are still held down
+	for (int i = 0; i < 3; i++)
+		if (c->buttons & (1 << i))
+			ADBMouseUp(i);
+
+	pthread_mutex_lock(&screen_lock);
+	clients.remove(c);
+	pthread_mutex_unlock(&screen_lock);
+	end_streams(c);
+	close(c->fd);
+	close(c->wake_pipe[0]);
+	close(c->wake_pipe[1]);
+	delete c;
+
+	pthread_mutex_lock(&client_threads_lock);
+	num_client_threads--;
+	pthread_cond_signal(&client_threads_cond);
+	pthread_mutex_unlock(&client_threads_lock);
+	return NULL;
+}
+
+static void *accept_thread_func(void *arg)
+{
+	for (;;) {
+		struct pollfd fds[2];
+		fds[0].fd = listen_fd;
+		fds[0].events = POLLIN;
+		fds[1].fd = listen_pipe[0];
+		fds[1].events = POLLIN;
+		if (poll(fds, 2, -1) < 0) {
+			if (errno == EINTR)
+				continue;
+			break;
+		}
+		if (fds[1].revents)
+			break;
+		if (!(fds[0].revents & POLLIN))
+			continue;
+
+		int fd = accept(listen_fd, NULL, NULL);
+		if (fd < 0)
+			continue;
+		int one = 1;
+		setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));	// Fails harmlessly on Unix domain sockets
+
+		vnc_client *c = new vnc_client;
+		c->fd = fd;
+		if (pipe(c->wake_pipe) < 0) {
+			close(fd);
+			delete c;
+			continue;
+		}
+		fcntl(c->wake_pipe[0], F_SETFL, O_NONBLOCK);
+		fcntl(c->wake_pipe[1], F_SETFL, O_NONBLOCK);
+		c->ready = false;
+		c->quit = false;
+		c->has_dirty = true;
+		c->size_changed = false;
+		c->update_requested = false;
+		c->next_update = 0;
+		c->encoding = ENC_RAW;
+		c->desktop_size = false;
+		c->compress_level = 1;
+		c->zrle_stream_active = false;
+		for (int i = 0; i < TIGHT_STREAMS; i++)
+			c->tight_stream_active[i] = false;
+		c->buttons = 0;
+		c->update_sent = 0;
+		c->update_bytes = 0;
+		c->bandwidth = 0;
+
+		pthread_mutex_lock(&screen_lock);
+		c->dirty.assign(tiles_x * tiles_y, 1);
+		clients.push_back(c);
+		pthread_mutex_unlock(&screen_lock);
+
+		pthread_mutex_lock(&client_threads_lock);
+		num_client_threads++;
+		pthread_mutex_unlock(&client_threads_lock);
+
+		pthread_t thread;
+		pthread_attr_t attr;
+		pthread_attr_init(&attr);
+		pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+		if (pthread_create(&thread, &attr, client_thread, c) != 0) {
+			pthread_mutex_lock(&screen_lock);
+			clients.remove(c);
+			pthread_mutex_unlock(&screen_lock);
+			pthread_mutex_lock(&client_threads_lock);
+			num_client_threads--;
+			pthread_mutex_unlock(&client_threads_lock);
+			close(c->wake_pipe[0]);
+			close(c->wake_pipe[1]);
+			close(fd);
+			delete c;
+		}
+		pthread_attr_destroy(&attr);
+	}
+	return NULL;
+}
+
+
+/*
+ *  Listening socket
+ */
+
+static int open_tcp_socket(const char *address, int port)
+{
+	struct addrinfo hints, *res;
+	memset(&hints, 0, sizeof(hints));
+	hints.ai_family = AF_UNSPEC;
+	hints.ai_socktype = SOCK_STREAM;
+	hints.ai_flags = AI_PASSIVE;
+	char port_str[16];
+	sprintf(port_str, "%d", port);
+	int err = getaddrinfo(address, port_str, &hints, &res);
+	if (err != 0) {
+		printf("WARNING: Cannot resolve VNC server address %s: %s\n", address ? address : "*", gai_strerror(err));
+		return -1;
+	}
+
+	int fd = -1;
+	for (struct addrinfo *ai = res; ai; ai = ai->ai_next) {
+		fd = socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol);
+		if (fd < 0)
+			continue;
+		int one = 1;
+		setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+		if (bind(fd, ai->ai_addr, ai->ai_addrlen) == 0 && listen(fd, 4) == 0)
+			break;
+		close(fd);
+		fd = -1;
+	}
+	freeaddrinfo(res);
+	if (fd < 0)
+		printf("WARNING: Cannot listen for VNC clients on port %d: %s\n", port, strerror(errno));
+	return fd;
+}
+
+static int open_unix_socket(const char *path)
+{
+	struct sockaddr_un addr;
+	if (strlen(path) >= sizeof(addr.sun_path)) {
+		printf("WARNING: VNC socket path %s too long\n", path);
+		return -1;
+	}
+
+	// Remove stale socket of an earlier run
+	struct stat st;
+	if (lstat(path, &st) == 0 && S_ISSOCK(st.st_mode))
+		unlink(path);
+
+	int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (fd < 0)
+		return -1;
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	strcpy(addr.sun_path, path);
+	if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0 || listen(fd, 4) < 0) {
+		printf("WARNING: Cannot listen for VNC clients on %s: %s\n", path, strerror(errno));
+		close(fd);
+		return -1;
+	}
+	socket_path = path;
+	return fd;
+}
+
+
+/*
+ *  Initialization
+ */
+
+bool VNCServerInit(int width, int height)
+{
+	const char *path = PrefsFindString("vncsocket");
+	if (path && *path)
+		listen_fd = open_unix_socket(path);
+	else {
+		int port = PrefsFindInt32("vncport");
+		if (port <= 0)
+			return false;
+		listen_fd = open_tcp_socket(PrefsFindString("vnclisten"), port);
+	}
+	if (listen_fd < 0)
+		return false;
+
+	VNCServerSetSize(width, height);
+	start_encoder_threads();
+
+	if (pipe(listen_pipe) < 0 || pthread_create(&accept_thread, NULL, accept_thread_func, NULL) != 0) {
+		VNCServerExit();
+		return false;
+	}
+	accept_thread_active = true;
+	if (path && *path)
+		printf("VNC server listening on %s\n", path);
+	else
+		printf("VNC server listening on port %d\n", PrefsFindInt32("vncport"));
+	return true;
+}
+
+
+/*
+ *  Deinitialization
+ */
+
+void VNCServerExit(void)
+{
+	// Stop accepting clients
+	if (accept_thread_active) {
+		char b = 0;
+		if (write(listen_pipe[1], &b, 1) < 0) {
+			// Cannot happen, the pipe is empty
+		}
+		pthread_join(accept_thread, NULL);
+		accept_thread_active = false;
+	}
+	for (int i = 0; i < 2; i++) {
+		if (listen_pipe[i] >= 0)
+			close(listen_pipe[i]);
+		listen_pipe[i] = -1;
+	}
+	if (listen_fd >= 0) {
+		close(listen_fd);
+		listen_fd = -1;
+	}
+	if (!socket_path.empty()) {
+		unlink(socket_path.c_str());
+		socket_path.clear();
+	}
+
+	// Disconnect clients and wait for their threads
+	pthread_mutex_lock(&screen_lock);
+	for (list<vnc_client *>::iterator i = clients.begin(); i != clients.end(); ++i) {
+		(*i)->quit = true;
+		shutdown((*i)->fd, SHUT_RDWR);
+		wake_client(*i);
+	}
+	pthread_mutex_unlock(&screen_lock);
+	pthread_mutex_lock(&client_threads_lock);
+	while (num_client_threads > 0)
+		pthread_cond_wait(&client_threads_cond, &client_threads_lock);
+	pthread_mutex_unlock(&client_threads_lock);
+
+	stop_encoder_threads();
+}
+
+
+/*
+ *  Screen size changed
+ */
+
+void VNCServerSetSize(int width, int height)
+{
+	pthread_mutex_lock(&screen_lock);
+	screen_width = width;
+	screen_height = height;
+	screen.assign(width * height, 0);
+	tiles_x = (width + TILE_SIZE - 1) / TILE_SIZE;
+	tiles_y = (height + TILE_SIZE - 1) / TILE_SIZE;
+	new_dirty.assign(tiles_x * tiles_y, 0);
+	new_changes = false;
+	refresh_all = true;
+	for (list<vnc_client *>::iterator i = clients.begin(); i != clients.end(); ++i) {
+		vnc_client *c = *i;
+		c->dirty.assign(tiles_x * tiles_y, 1);
+		c->has_dirty = true;
+		if (c->ready) {
+			c->size_changed = true;
+			wake_client(c);
+		}
+	}
+	pthread_mutex_unlock(&screen_lock);
+}
+
+
+/*
+ *  Feed screen contents, called by the emulation thread
+ */
+
+bool VNCServerBeginUpdate(bool *all_rows)
+{
+	// Don't wait for an update being encoded, the changes stay pending
+	if (pthread_mutex_trylock(&screen_lock) != 0)
+		return false;
+
+	const uint64 now = GetTicks_usec();
+	bool wanted = false;
+	for (list<vnc_client *>::iterator i = clients.begin(); i != clients.end(); ++i) {
+		vnc_client *c = *i;
+		if (c->ready && c->update_requested && now >= c->next_update) {
+			wanted = true;
+			break;
+		}
+	}
+	if (!wanted) {
+		pthread_mutex_unlock(&screen_lock);
+		return false;
+	}
+
+	*all_rows = refresh_all;
+	refresh_all = false;
+	return true;
+}
+
+void VNCServerUpdateRow(int y, const uint32 *pixels)
+{
+	if (y >= screen_height)
+		return;
+	uint32 *dst = &screen[y * screen_width];
+	uint8 *dirty = &new_dirty[(y / TILE_SIZE) * tiles_x];
+	for (int tx = 0; tx < tiles_x; tx++) {
+		const int x = tx * TILE_SIZE;
+		const int n = screen_width - x < TILE_SIZE ? screen_width - x : TILE_SIZE;
+		if (memcmp(dst + x, pixels + x, n * sizeof(uint32)) != 0) {
+			memcpy(dst + x, pixels + x, n * sizeof(uint32));
+			dirty[tx] = 1;
+			new_changes = true;
+		}
+	}
+}
+
+void VNCServerEndUpdate(void)
+{
+	if (new_changes) {
+		for (list<vnc_client *>::iterator i = clients.begin(); i != clients.end(); ++i) {
+			vnc_client *c = *i;
+			uint8 *dirty = &c->dirty[0];
+			for (size_t t = 0; t < new_dirty.size(); t++)
+				dirty[t] |= new_dirty[t];
+			c->has_dirty = true;
+			if (c->update_requested)
+				wake_client(c);
+		}
+		memset(&new_dirty[0], 0, new_dirty.size());
+		new_changes = false;
+	}
+	pthread_mutex_unlock(&screen_lock);
+}
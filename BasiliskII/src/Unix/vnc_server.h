@@ -0,0 +1,44 @@
+/*
+ *  vnc_server.h - Built-in VNC (RFB) server for the headless video driver
+ *
+ *  Basilisk II (C) 1997-2008 Christian Bauer
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#ifndef VNC_SERVER_H
+#define VNC_SERVER_H
+
+/*
+ *  The server keeps its own copy of the screen as 0x00RRGGBB pixels.
+ *  The video driver feeds changed rows into it from the emulation
+ *  thread, between VNCServerBeginUpdate() and VNCServerEndUpdate();
+ *  the server finds the 16x16 tiles that really changed and sends them
+ *  to the clients from its own threads.
+ */
+
+// Start server as configured in the prefs, returns false if it is disabled or could not be started
+extern bool VNCServerInit(int width, int height);
+extern void VNCServerExit(void);
+
+// Screen size changed, the whole screen has to be fed again
+extern void VNCServerSetSize(int width, int height);
+
+// Start feeding rows, returns false if no update is wanted now (ALL_ROWS is set if every row must be fed)
+extern bool VNCServerBeginUpdate(bool *all_rows);
+extern void VNCServerUpdateRow(int y, const uint32 *pixels);
+extern void VNCServerEndUpdate(void);
+
+#endif
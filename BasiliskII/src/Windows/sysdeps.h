@@ -168,6 +168,7 @@ typedef uae_u32 uaecptr;
 /* Timing functions */
 extern void timer_init(void);
 extern uint64 GetTicks_usec(void);
+extern uint64 GetTicks_nsec(void);
 extern void Delay_usec(uint32 usec);
 
 /* Spinlocks */
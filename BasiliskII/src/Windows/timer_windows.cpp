@@ -185,6 +185,19 @@ uint64 GetTicks_usec(void)
 }
 
 
+/*
+ *  Get current value of nanosecond timer
+ */
+
+uint64 GetTicks_nsec(void)
+{
+	LARGE_INTEGER tt;
+	QueryPerformanceCounter(&tt);
+	uint64 ticks = tt.QuadPart - mac_boot_ticks;
+	return (ticks / frequency) * 1000000000 + ((ticks % frequency) * 1000000000) / frequency;
+}
+
+
 /*
  *  Delay by specified number of microseconds (<1 second)
  */
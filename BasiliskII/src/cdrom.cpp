@@ -315,6 +315,51 @@ void CDROMExit(void)
 }
 
 
+/*
+ *  Save/restore driver state for snapshots (the drives themselves must
+ *  be the same as when the snapshot was taken)
+ */
+
+void CDROMSaveState(vector<uint32> &state)
+{
+	state.clear();
+	state.push_back(acc_run_called);
+	state.push_back(drives.size());
+	drive_vec::const_iterator info, end = drives.end();
+	for (info = drives.begin(); info != end; ++info) {
+		state.push_back(info->num);
+		state.push_back(info->status);
+		state.push_back(info->to_be_mounted);
+		state.push_back(info->block_size);
+		state.push_back(info->twok_offset);
+		state.push_back(info->mount_non_hfs);
+		state.push_back(info->play_mode);
+		state.push_back(info->power_mode);
+	}
+}
+
+bool CDROMRestoreState(const vector<uint32> &state)
+{
+	if (state.size() != 2 + drives.size() * 8 || state[1] != drives.size())
+		return false;
+	vector<uint32>::const_iterator p = state.begin();
+	acc_run_called = *p++;
+	p++;
+	drive_vec::iterator info, end = drives.end();
+	for (info = drives.begin(); info != end; ++info) {
+		info->num = *p++;
+		info->status = *p++;
+		info->to_be_mounted = *p++;
+		info->block_size = *p++;
+		info->twok_offset = *p++;
+		info->mount_non_hfs = *p++;
+		info->play_mode = *p++;
+		info->power_mode = *p++;
+	}
+	return true;
+}
+
+
 /*
  *  Disk was inserted, flag for mounting
  */
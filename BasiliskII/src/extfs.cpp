@@ -466,6 +466,72 @@ void ExtFSExit(void)
 }
 
 
+/*
+ *  Save/restore file system state for snapshots (CNID mapping and Mac
+ *  address of global data; host file descriptors of open forks are lost)
+ */
+
+void ExtFSSaveState(std::vector<uint32> &state)
+{
+	state.clear();
+	state.push_back(fs_data);
+	state.push_back(drive_number);
+	state.push_back(next_cnid);
+
+	// Root and root's parent are always created by ExtFSInit()
+	for (FSItem *p = first_fs_item->next->next; p; p = p->next) {
+		size_t len = strlen(p->name);
+		state.push_back(p->id);
+		state.push_back(p->parent_id);
+		state.push_back(len);
+		size_t pos = state.size();
+		state.resize(pos + (len + 4) / 4, 0);
+		memcpy(&state[pos], p->name, len);
+	}
+}
+
+bool ExtFSRestoreState(const std::vector<uint32> &state)
+{
+	if (state.size() < 3)
+		return false;
+
+	// Delete all FSItems but root and root's parent
+	FSItem *root = first_fs_item->next;
+	FSItem *p = root->next, *next;
+	while (p) {
+		next = p->next;
+		delete[] p->name;
+		delete p;
+		p = next;
+	}
+	root->next = NULL;
+	last_fs_item = root;
+
+	fs_data = state[0];
+	drive_number = state[1];
+	size_t pos = 3;
+	while (pos + 3 <= state.size()) {
+		uint32 id = state[pos], parent_id = state[pos + 1], len = state[pos + 2];
+		pos += 3;
+		if (pos + (len + 4) / 4 > state.size())
+			return false;
+		FSItem *parent = find_fsitem_by_id(parent_id);
+		if (parent == NULL)
+			return false;
+		char name[MAX_PATH_LENGTH];
+		if (len >= sizeof(name))
+			return false;
+		memcpy(name, &state[pos], len);
+		name[len] = 0;
+		pos += (len + 4) / 4;
+		next_cnid = id;
+		create_fsitem(name, host_encoding_to_macroman(name), parent);
+	}
+	next_cnid = state[2];
+	return pos == state.size();
+}
+
+
 /*
  *  Install file system
  */
@@ -21,6 +21,8 @@
 #ifndef CDROM_H
 #define CDROM_H
 
+#include <vector>
+
 const int CDROMRefNum = -62;			// RefNum of driver
 const uint16 CDROMDriverFlags = 0x6d04;	// Driver flags
 
@@ -31,6 +33,9 @@ extern uint32 CDROMIconAddr;			// Icon address (Mac address space, set by PatchR
 extern void CDROMInit(void);
 extern void CDROMExit(void);
 
+extern void CDROMSaveState(std::vector<uint32> &state);
+extern bool CDROMRestoreState(const std::vector<uint32> &state);
+
 extern void CDROMInterrupt(void);
 
 extern bool CDROMMountVolume(void *fh);
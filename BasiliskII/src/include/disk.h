@@ -21,6 +21,8 @@
 #ifndef DISK_H
 #define DISK_H
 
+#include <vector>
+
 const int DiskRefNum = -63;				// RefNum of driver
 const uint16 DiskDriverFlags = 0x6f04;	// Driver flags
 
@@ -31,6 +33,9 @@ extern uint32 DiskIconAddr;				// Icon address (Mac address space, set by PatchR
 extern void DiskInit(void);
 extern void DiskExit(void);
 
+extern void DiskSaveState(std::vector<uint32> &state);
+extern bool DiskRestoreState(const std::vector<uint32> &state);
+
 extern void DiskInterrupt(void);
 
 extern bool DiskMountVolume(void *fh);
@@ -21,9 +21,14 @@
 #ifndef EXTFS_H
 #define EXTFS_H
 
+#include <vector>
+
 extern void ExtFSInit(void);
 extern void ExtFSExit(void);
 
+extern void ExtFSSaveState(std::vector<uint32> &state);
+extern bool ExtFSRestoreState(const std::vector<uint32> &state);
+
 extern void InstallExtFS(void);
 
 extern int16 ExtFSComm(uint16 message, uint32 paramBlock, uint32 globalsPtr);
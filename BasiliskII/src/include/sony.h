@@ -21,6 +21,8 @@
 #ifndef SONY_H
 #define SONY_H
 
+#include <vector>
+
 const int SonyRefNum = -5;				// RefNum of driver
 const uint16 SonyDriverFlags = 0x6f00;	// Driver flags
 
@@ -33,6 +35,9 @@ extern uint32 SonyDriveIconAddr;
 extern void SonyInit(void);
 extern void SonyExit(void);
 
+extern void SonySaveState(std::vector<uint32> &state);
+extern bool SonyRestoreState(const std::vector<uint32> &state);
+
 extern void SonyInterrupt(void);
 
 extern bool SonyMountVolume(void *fh);
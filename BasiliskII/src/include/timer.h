@@ -21,10 +21,15 @@
 #ifndef TIMER_H
 #define TIMER_H
 
+#include <vector>
+
 extern void TimerInit(void);
 extern void TimerExit(void);
 extern void TimerReset(void);
 
+extern void TimerSaveState(std::vector<uint32> &state);
+extern bool TimerRestoreState(const std::vector<uint32> &state);
+
 extern void TimerInterrupt(void);
 
 extern int16 InsTime(uint32 tm, uint16 trap);
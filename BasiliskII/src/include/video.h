@@ -176,6 +176,10 @@ public:
 	int16 driver_control(uint16 code, uint32 param, uint32 dce);
 	int16 driver_status(uint16 code, uint32 param);
 
+	// Save/restore video driver state for snapshots
+	void save_state(vector<uint32> &state) const;
+	bool restore_state(vector<uint32>::const_iterator &p, vector<uint32>::const_iterator end);
+
 protected:
 	vector<video_mode> modes;                         // List of supported video modes
 	vector<video_mode>::const_iterator current_mode;  // Currently selected video mode
@@ -262,6 +266,9 @@ extern int16 VideoDriverOpen(uint32 pb, uint32 dce);
 extern int16 VideoDriverControl(uint32 pb, uint32 dce);
 extern int16 VideoDriverStatus(uint32 pb, uint32 dce);
 
+extern void VideoSaveState(vector<uint32> &state);
+extern bool VideoRestoreState(const vector<uint32> &state);
+
 
 // System specific and internal functions/data
 extern bool VideoInit(bool classic);
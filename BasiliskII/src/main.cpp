@@ -54,6 +54,16 @@ static void mon_write_byte_b2(uintptr adr, uint32 b)
 {
 	WriteMacInt8(adr, b);
 }
+
+static uint8 *mon_map_range_b2(uintptr adr, uintptr size)
+{
+	// RAM and ROM are contiguous in host memory, anything else goes through mon_read_byte_b2()
+	if (adr >= RAMBaseMac && size <= RAMSize && adr - RAMBaseMac <= RAMSize - size)
+		return Mac2HostAddr(adr);
+	if (adr >= ROMBaseMac && size <= ROMSize && adr - ROMBaseMac <= ROMSize - size)
+		return Mac2HostAddr(adr);
+	return NULL;
+}
 #endif
 
 
@@ -197,6 +207,7 @@ bool InitAll(const char *vmdir)
 	mon_init();
 	mon_read_byte = mon_read_byte_b2;
 	mon_write_byte = mon_write_byte_b2;
+	mon_map_range = mon_map_range_b2;
 #endif
 
 	return true;
@@ -62,11 +62,13 @@ prefs_desc common_prefs_items[] = {
 	{"nogui", TYPE_BOOLEAN, false,    "disable GUI"},
 	{"jit", TYPE_BOOLEAN, false,         "enable JIT compiler"},
 	{"jitfpu", TYPE_BOOLEAN, false,      "enable JIT compilation of FPU instructions"},
+	{"jitfpusse", TYPE_BOOLEAN, false,   "compile FPU instructions to SSE2 code (double precision)"},
 	{"jitdebug", TYPE_BOOLEAN, false,    "enable JIT debugger (requires mon builtin)"},
 	{"jitcachesize", TYPE_INT32, false,  "translation cache size in KB"},
 	{"jitlazyflush", TYPE_BOOLEAN, false, "enable lazy invalidation of translation cache"},
 	{"jitinline", TYPE_BOOLEAN, false,   "enable translation through constant jumps"},
 	{"jitblacklist", TYPE_STRING, false, "blacklist opcodes from translation"},
+	{"jitprofile", TYPE_STRING, false,   "count executions of translated blocks, write profile to file"},
 	{"keyboardtype", TYPE_INT32, false, "hardware keyboard type"},
 	{NULL, TYPE_END, false, NULL} // End of list
 };
@@ -98,6 +100,7 @@ void AddPrefsDefaults(void)
 	// JIT compiler specific options
 	PrefsAddBool("jit", true);
 	PrefsAddBool("jitfpu", true);
+	PrefsAddBool("jitfpusse", false);
 	PrefsAddBool("jitdebug", false);
 	PrefsAddInt32("jitcachesize", 8192);
 	PrefsAddBool("jitlazyflush", true);
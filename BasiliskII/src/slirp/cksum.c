@@ -32,106 +32,293 @@
 
 #include <slirp.h>
 
+#if defined(__GNUC__) && (defined(__x86_64__) || (defined(__i386__) && defined(__SSE2__)))
+#define CKSUM_SSE2 1
+#include <emmintrin.h>
+#if defined(__x86_64__) && (__GNUC__ >= 5 || defined(__clang__))
+#define CKSUM_AVX2 1
+#include <immintrin.h>
+#endif
+#endif
+
 /*
- * Checksum routine for Internet Protocol family headers (Portable Version).
+ * Checksum routines for Internet Protocol family headers.
  *
- * This routine is very heavily used in the network
- * code and should be modified for each CPU to be as fast as possible.
- * 
- * XXX Since we will never span more than 1 mbuf, we can optimise this
+ * The kernels below return the unfolded one's complement sum of the
+ * native 32-bit words of a buffer with an even length; the byte order
+ * only needs to be taken care of when the sum is folded. The words are
+ * zero-extended and added in 64-bit lanes, which cannot overflow for
+ * any buffer we will see, and several lanes are used to hide the
+ * latency of the adds. The data doesn't need to be aligned.
  */
 
-#define ADDCARRY(x)  (x > 65535 ? x -= 65535 : x)
-#define REDUCE {l_util.l = sum; sum = l_util.s[0] + l_util.s[1]; ADDCARRY(sum);}
+typedef u_int64_t (*cksum_kernel_t)(const u_int8_t *, size_t);
+typedef u_int64_t (*cksum_copy_kernel_t)(u_int8_t *, const u_int8_t *, size_t);
 
-int cksum(struct mbuf *m, int len)
+/* Sum of less than 16 bytes */
+static inline u_int64_t cksum_tail(const u_int8_t *p, size_t len)
+{
+	u_int64_t sum = 0;
+	u_int32_t w;
+
+	while (len >= 4) {
+		memcpy(&w, p, 4);
+		sum += w;
+		p += 4;
+		len -= 4;
+	}
+	if (len) {
+		u_int16_t h;
+		memcpy(&h, p, 2);
+		sum += h;
+	}
+	return sum;
+}
+
+/* Portable version */
+static u_int64_t cksum_generic(const u_int8_t *p, size_t len)
+{
+	u_int64_t sum0 = 0, sum1 = 0;
+	u_int64_t w[2];
+
+	while (len >= 16) {
+		memcpy(w, p, 16);
+		sum0 += (w[0] & 0xffffffff) + (w[0] >> 32);
+		sum1 += (w[1] & 0xffffffff) + (w[1] >> 32);
+		p += 16;
+		len -= 16;
+	}
+	return sum0 + sum1 + cksum_tail(p, len);
+}
+
+static u_int64_t cksum_copy_generic(u_int8_t *dst, const u_int8_t *src, size_t len)
+{
+	u_int64_t sum0 = 0, sum1 = 0;
+	u_int64_t w[2];
+
+	while (len >= 16) {
+		memcpy(w, src, 16);
+		memcpy(dst, w, 16);
+		sum0 += (w[0] & 0xffffffff) + (w[0] >> 32);
+		sum1 += (w[1] & 0xffffffff) + (w[1] >> 32);
+		src += 16;
+		dst += 16;
+		len -= 16;
+	}
+	memcpy(dst, src, len);
+	return sum0 + sum1 + cksum_tail(src, len);
+}
+
+#ifdef CKSUM_SSE2
+/* SSE2 version, 32 bytes per iteration */
+static inline u_int64_t sse2_sum(__m128i acc)
+{
+	u_int64_t l[2];
+	_mm_storeu_si128((__m128i *)l, acc);
+	return l[0] + l[1];
+}
+
+static u_int64_t cksum_sse2(const u_int8_t *p, size_t len)
 {
-	register u_int16_t *w;
-	register int sum = 0;
-	register int mlen = 0;
-	int byte_swapped = 0;
+	const __m128i zero = _mm_setzero_si128();
+	__m128i acc0 = zero, acc1 = zero;
 
+	while (len >= 32) {
+		__m128i v0 = _mm_loadu_si128((const __m128i *)p);
+		__m128i v1 = _mm_loadu_si128((const __m128i *)(p + 16));
+		acc0 = _mm_add_epi64(acc0, _mm_unpacklo_epi32(v0, zero));
+		acc1 = _mm_add_epi64(acc1, _mm_unpackhi_epi32(v0, zero));
+		acc0 = _mm_add_epi64(acc0, _mm_unpacklo_epi32(v1, zero));
+		acc1 = _mm_add_epi64(acc1, _mm_unpackhi_epi32(v1, zero));
+		p += 32;
+		len -= 32;
+	}
+	return sse2_sum(_mm_add_epi64(acc0, acc1)) + cksum_generic(p, len);
+}
+
+static u_int64_t cksum_copy_sse2(u_int8_t *dst, const u_int8_t *src, size_t len)
+{
+	const __m128i zero = _mm_setzero_si128();
+	__m128i acc0 = zero, acc1 = zero;
+
+	while (len >= 32) {
+		__m128i v0 = _mm_loadu_si128((const __m128i *)src);
+		__m128i v1 = _mm_loadu_si128((const __m128i *)(src + 16));
+		_mm_storeu_si128((__m128i *)dst, v0);
+		_mm_storeu_si128((__m128i *)(dst + 16), v1);
+		acc0 = _mm_add_epi64(acc0, _mm_unpacklo_epi32(v0, zero));
+		acc1 = _mm_add_epi64(acc1, _mm_unpackhi_epi32(v0, zero));
+		acc0 = _mm_add_epi64(acc0, _mm_unpacklo_epi32(v1, zero));
+		acc1 = _mm_add_epi64(acc1, _mm_unpackhi_epi32(v1, zero));
+		src += 32;
+		dst += 32;
+		len -= 32;
+	}
+	return sse2_sum(_mm_add_epi64(acc0, acc1)) + cksum_copy_generic(dst, src, len);
+}
+#endif
+
+#ifdef CKSUM_AVX2
+/*
+ * AVX2 version, 64 bytes per iteration. The rest is summed with
+ * generic code, to avoid mixing AVX and SSE instructions.
+ */
+__attribute__((target("avx2")))
+static inline u_int64_t avx2_sum(__m256i acc)
+{
+	u_int64_t l[4];
+	_mm256_storeu_si256((__m256i *)l, acc);
+	return l[0] + l[1] + l[2] + l[3];
+}
+
+__attribute__((target("avx2")))
+static u_int64_t cksum_avx2(const u_int8_t *p, size_t len)
+{
+	const __m256i zero = _mm256_setzero_si256();
+	__m256i acc0 = zero, acc1 = zero;
+
+	while (len >= 64) {
+		__m256i v0 = _mm256_loadu_si256((const __m256i *)p);
+		__m256i v1 = _mm256_loadu_si256((const __m256i *)(p + 32));
+		acc0 = _mm256_add_epi64(acc0, _mm256_unpacklo_epi32(v0, zero));
+		acc1 = _mm256_add_epi64(acc1, _mm256_unpackhi_epi32(v0, zero));
+		acc0 = _mm256_add_epi64(acc0, _mm256_unpacklo_epi32(v1, zero));
+		acc1 = _mm256_add_epi64(acc1, _mm256_unpackhi_epi32(v1, zero));
+		p += 64;
+		len -= 64;
+	}
+	return avx2_sum(_mm256_add_epi64(acc0, acc1)) + cksum_generic(p, len);
+}
+
+__attribute__((target("avx2")))
+static u_int64_t cksum_copy_avx2(u_int8_t *dst, const u_int8_t *src, size_t len)
+{
+	const __m256i zero = _mm256_setzero_si256();
+	__m256i acc0 = zero, acc1 = zero;
+
+	while (len >= 64) {
+		__m256i v0 = _mm256_loadu_si256((const __m256i *)src);
+		__m256i v1 = _mm256_loadu_si256((const __m256i *)(src + 32));
+		_mm256_storeu_si256((__m256i *)dst, v0);
+		_mm256_storeu_si256((__m256i *)(dst + 32), v1);
+		acc0 = _mm256_add_epi64(acc0, _mm256_unpacklo_epi32(v0, zero));
+		acc1 = _mm256_add_epi64(acc1, _mm256_unpackhi_epi32(v0, zero));
+		acc0 = _mm256_add_epi64(acc0, _mm256_unpacklo_epi32(v1, zero));
+		acc1 = _mm256_add_epi64(acc1, _mm256_unpackhi_epi32(v1, zero));
+		src += 64;
+		dst += 64;
+		len -= 64;
+	}
+	return avx2_sum(_mm256_add_epi64(acc0, acc1)) + cksum_copy_generic(dst, src, len);
+}
+#endif
+
+#if defined(CKSUM_SSE2)
+static cksum_kernel_t cksum_kernel = cksum_sse2;
+static cksum_copy_kernel_t cksum_copy_kernel = cksum_copy_sse2;
+#else
+static cksum_kernel_t cksum_kernel = cksum_generic;
+static cksum_copy_kernel_t cksum_copy_kernel = cksum_copy_generic;
+#endif
+
+/*
+ * Select the fastest kernels for this CPU
+ */
+void cksum_init(void)
+{
+#ifdef CKSUM_AVX2
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("avx2")) {
+		cksum_kernel = cksum_avx2;
+		cksum_copy_kernel = cksum_copy_avx2;
+	}
+#endif
+}
+
+/* Fold a sum to 16 bits */
+static inline u_int32_t cksum_fold(u_int64_t sum)
+{
+	sum = (sum & 0xffffffff) + (sum >> 32);
+	sum = (sum & 0xffffffff) + (sum >> 32);
+	sum = (sum & 0xffff) + (sum >> 16);
+	sum = (sum & 0xffff) + (sum >> 16);
+	sum = (sum & 0xffff) + (sum >> 16);
+	return (u_int32_t)sum;
+}
+
+/* Sum of a trailing odd byte, which is the first byte of a zero-padded word */
+static inline u_int32_t cksum_odd_byte(u_int8_t b)
+{
 	union {
 		u_int8_t	c[2];
 		u_int16_t	s;
 	} s_util;
-	union {
-		u_int16_t s[2];
-		u_int32_t l;
-	} l_util;
-	
-	if (m->m_len == 0)
-	   goto cont;
-	w = mtod(m, u_int16_t *);
-	
-	mlen = m->m_len;
-	
+	s_util.c[0] = b;
+	s_util.c[1] = 0;
+	return s_util.s;
+}
+
+/*
+ * Return the folded partial sum of len bytes (not complemented)
+ */
+u_int32_t cksum_partial(const void *buf, int len)
+{
+	const u_int8_t *p = (const u_int8_t *)buf;
+	u_int64_t sum;
+
+	if (len <= 0)
+		return 0;
+	sum = cksum_kernel(p, len & ~1);
+	if (len & 1)
+		sum += cksum_odd_byte(p[len - 1]);
+	return cksum_fold(sum);
+}
+
+/*
+ * Copy len bytes and return their folded partial sum
+ */
+u_int32_t cksum_copy(void *dst, const void *src, int len)
+{
+	u_int64_t sum;
+
+	if (len <= 0)
+		return 0;
+	sum = cksum_copy_kernel((u_int8_t *)dst, (const u_int8_t *)src, len & ~1);
+	if (len & 1) {
+		u_int8_t b = ((const u_int8_t *)src)[len - 1];
+		((u_int8_t *)dst)[len - 1] = b;
+		sum += cksum_odd_byte(b);
+	}
+	return cksum_fold(sum);
+}
+
+/*
+ * Add the partial sum b of data that starts offset bytes after the data
+ * of the partial sum a. Data at an odd offset is summed byte-swapped.
+ */
+u_int32_t cksum_add(u_int32_t a, u_int32_t b, int offset)
+{
+	if (offset & 1)
+		b = ((b & 0xff) << 8) | (b >> 8);
+	return cksum_fold((u_int64_t)a + b);
+}
+
+/*
+ * Checksum of the first len bytes of an mbuf.
+ *
+ * XXX Since we will never span more than 1 mbuf, we can optimise this
+ */
+int cksum(struct mbuf *m, int len)
+{
+	int mlen = m->m_len;
+
 	if (len < mlen)
 	   mlen = len;
-	len -= mlen;
-	/*
-	 * Force to even boundary.
-	 */
-	if ((1 & (long) w) && (mlen > 0)) {
-		REDUCE;
-		sum <<= 8;
-		s_util.c[0] = *(u_int8_t *)w;
-		w = (u_int16_t *)((int8_t *)w + 1);
-		mlen--;
-		byte_swapped = 1;
-	}
-	/*
-	 * Unroll the loop to make overhead from
-	 * branches &c small.
-	 */
-	while ((mlen -= 32) >= 0) {
-		sum += w[0]; sum += w[1]; sum += w[2]; sum += w[3];
-		sum += w[4]; sum += w[5]; sum += w[6]; sum += w[7];
-		sum += w[8]; sum += w[9]; sum += w[10]; sum += w[11];
-		sum += w[12]; sum += w[13]; sum += w[14]; sum += w[15];
-		w += 16;
-	}
-	mlen += 32;
-	while ((mlen -= 8) >= 0) {
-		sum += w[0]; sum += w[1]; sum += w[2]; sum += w[3];
-		w += 4;
-	}
-	mlen += 8;
-	if (mlen == 0 && byte_swapped == 0)
-	   goto cont;
-	REDUCE;
-	while ((mlen -= 2) >= 0) {
-		sum += *w++;
-	}
-	
-	if (byte_swapped) {
-		REDUCE;
-		sum <<= 8;
-		byte_swapped = 0;
-		if (mlen == -1) {
-			s_util.c[1] = *(u_int8_t *)w;
-			sum += s_util.s;
-			mlen = 0;
-		} else
-		   
-		   mlen = -1;
-	} else if (mlen == -1)
-	   s_util.c[0] = *(u_int8_t *)w;
-	
-cont:
 #ifdef DEBUG
-	if (len) {
+	if (len > mlen) {
 		DEBUG_ERROR((dfd, "cksum: out of data\n"));
-		DEBUG_ERROR((dfd, " len = %d\n", len));
+		DEBUG_ERROR((dfd, " len = %d\n", len - mlen));
 	}
 #endif
-	if (mlen == -1) {
-		/* The last mbuf has odd # of bytes. Follow the
-		 standard (the odd byte may be shifted left by 8 bits
-			   or not as determined by endian-ness of the machine) */
-		s_util.c[1] = 0;
-		sum += s_util.s;
-	}
-	REDUCE;
-	return (~sum & 0xffff);
+	return (~cksum_partial(mtod(m, u_int8_t *), mlen) & 0xffff);
 }
@@ -189,6 +189,7 @@ ip_input(m)
 		 */
 		if (((struct ipasfrag *)ip)->ipf_mff & 1 || ip->ip_off) {
 			ipstat.ips_fragments++;
+			m_track(m);
 			ip = ip_reass((struct ipasfrag *)ip, fp);
 			if (ip == 0)
 				return;
@@ -260,6 +261,7 @@ ip_reass(ip, fp)
 	if (fp == 0) {
 	  struct mbuf *t;
 	  if ((t = m_get()) == NULL) goto dropfrag;
+	  m_track(t);	/* ip_freef() and reassembly find it with dtom() */
 	  fp = mtod(t, struct ipq *);
 	  insque_32(fp, &ipq);
 	  fp->ipq_ttl = IPFRAGTTL;
@@ -20,6 +20,12 @@ int slirp_select_fill(int *pnfds,
 
 void slirp_select_poll(fd_set *readfds, fd_set *writefds, fd_set *xfds);
 
+/* epoll() based alternative to slirp_select_fill/poll(), if available */
+int slirp_events_init(void);
+void slirp_events_exit(void);
+/* Wait for and handle socket events and timers, returns 1 if input_fd is readable */
+int slirp_events_wait(int input_fd);
+
 void slirp_input(const uint8 *pkt, int pkt_len);
 
 /* you must provide the following functions: */
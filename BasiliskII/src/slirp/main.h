@@ -32,6 +32,8 @@ extern char *slirp_tty;
 extern char *exec_shell;
 extern u_int curtime;
 extern fd_set *global_readfds, *global_writefds, *global_xfds;
+extern struct socket *poll_so;
+extern int poll_events;
 extern struct in_addr ctl_addr;
 extern struct in_addr special_addr;
 extern struct in_addr alias_addr;
@@ -13,19 +13,114 @@
  * could hold, an external malloced buffer is pointed to
  * by m_ext (and the data pointers) and M_EXT is set in
  * the flags
+ *
+ * mbufs are carved from slabs of MBUF_SLAB_COUNT and never given back
+ * to malloc(), external buffers come from per-size free lists. Only
+ * mbufs that go through IP reassembly are put on the used list, the
+ * only user of dtom(). On 64-bit hosts, the slabs are allocated in the
+ * low 4GB if possible, because IP reassembly queues link mbufs with
+ * 32-bit pointers.
  */
 
 #include <stdlib.h>
 #include <slirp.h>
+#ifndef _WIN32
+#include <sys/mman.h>
+#endif
 
 struct	mbuf *mbutl;
 char	*mclrefcnt;
 int mbuf_alloced = 0;
 struct mbuf m_freelist, m_usedlist;
-int mbuf_thresh = 30;
 int mbuf_max = 0;
 size_t msize;
 
+#define MBUF_SLAB_COUNT 64	/* Number of mbufs allocated at once */
+
+/*
+ * Size classes for external buffers, MINCSIZE times a power of 2.
+ * Larger buffers are malloc()ed and free()d directly.
+ */
+#define M_EXT_CLASSES 5
+#define M_EXT_CACHED 16		/* Free buffers kept per class */
+
+struct m_ext_free {
+	struct m_ext_free *next;
+};
+static struct m_ext_free *m_ext_freelist[M_EXT_CLASSES];
+static int m_ext_nfree[M_EXT_CLASSES];
+
+static int m_ext_class(size_t size)
+{
+	int c;
+	for (c = 0; c < M_EXT_CLASSES; c++)
+		if (size <= ((size_t)MINCSIZE << c))
+			return c;
+	return -1;
+}
+
+static size_t m_ext_size(size_t size)
+{
+	int c = m_ext_class(size);
+	return c < 0 ? size : ((size_t)MINCSIZE << c);
+}
+
+static char *m_ext_alloc(size_t size)
+{
+	int c = m_ext_class(size);
+	if (c >= 0 && m_ext_freelist[c]) {
+		struct m_ext_free *p = m_ext_freelist[c];
+		m_ext_freelist[c] = p->next;
+		m_ext_nfree[c]--;
+		return (char *)p;
+	}
+	return (char *)malloc(c < 0 ? size : ((size_t)MINCSIZE << c));
+}
+
+static void m_ext_release(char *buf, size_t size)
+{
+	int c = m_ext_class(size);
+	if (c >= 0 && m_ext_nfree[c] < M_EXT_CACHED) {
+		struct m_ext_free *p = (struct m_ext_free *)buf;
+		p->next = m_ext_freelist[c];
+		m_ext_freelist[c] = p;
+		m_ext_nfree[c]++;
+	} else
+		free(buf);
+}
+
+static char *m_slab_alloc(size_t size)
+{
+#if SIZEOF_CHAR_P == 8 && defined(MAP_32BIT)
+	void *p = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_32BIT, -1, 0);
+	if (p != MAP_FAILED)
+		return (char *)p;
+#endif
+	return (char *)malloc(size);
+}
+
+/*
+ * Add a slab of mbufs to the free list
+ */
+static int m_grow(void)
+{
+	char *slab;
+	int i;
+
+	slab = m_slab_alloc(MBUF_SLAB_COUNT * msize);
+	if (slab == NULL)
+		return -1;
+	for (i = 0; i < MBUF_SLAB_COUNT; i++) {
+		struct mbuf *m = (struct mbuf *)(slab + i * msize);
+		m->m_flags = M_FREELIST;
+		insque(m, &m_freelist);
+	}
+	mbuf_alloced += MBUF_SLAB_COUNT;
+	if (mbuf_alloced > mbuf_max)
+		mbuf_max = mbuf_alloced;
+	return 0;
+}
+
 void m_init()
 {
 	m_freelist.m_next = m_freelist.m_prev = &m_freelist;
@@ -41,39 +136,25 @@ void msize_init()
 	 */
 	msize = (if_mtu>if_mru?if_mtu:if_mru) + 
 			if_maxlinkhdr + sizeof(struct m_hdr ) + 6;
+	/* Keep the mbufs in a slab aligned */
+	msize = (msize + sizeof(void *) - 1) & ~(sizeof(void *) - 1);
 }
 
 /*
  * Get an mbuf from the free list, if there are none
- * malloc one
- * 
- * Because fragmentation can occur if we alloc new mbufs and
- * free old mbufs, we mark all mbufs above mbuf_thresh as M_DOFREE,
- * which tells m_free to actually free() it
+ * allocate a new slab
  */
 struct mbuf *m_get()
 {
-	register struct mbuf *m;
-	int flags = 0;
+	register struct mbuf *m = NULL;
 	
 	DEBUG_CALL("m_get");
 	
-	if (m_freelist.m_next == &m_freelist) {
-		m = (struct mbuf *)malloc(msize);
-		if (m == NULL) goto end_error;
-		mbuf_alloced++;
-		if (mbuf_alloced > mbuf_thresh)
-			flags = M_DOFREE;
-		if (mbuf_alloced > mbuf_max)
-			mbuf_max = mbuf_alloced;
-	} else {
-		m = m_freelist.m_next;
-		remque(m);
-	}
-	
-	/* Insert it in the used list */
-	insque(m,&m_usedlist);
-	m->m_flags = (flags | M_USEDLIST);
+	if (m_freelist.m_next == &m_freelist && m_grow() < 0)
+		goto end_error;
+	m = m_freelist.m_next;
+	remque(m);
+	m->m_flags = 0;
 	
 	/* Initialise it */
 	m->m_size = msize - sizeof(struct m_hdr);
@@ -97,17 +178,14 @@ void m_free(struct mbuf *m)
 	if (m->m_flags & M_USEDLIST)
 	   remque(m);
 	
-	/* If it's M_EXT, free() it */
+	/* If it's M_EXT, release the buffer */
 	if (m->m_flags & M_EXT)
-	   free(m->m_ext);
+	   m_ext_release(m->m_ext, m->m_size);
 
 	/*
-	 * Either free() it or put it on the free list
+	 * Put it back on the free list
 	 */
-	if (m->m_flags & M_DOFREE) {
-		free(m);
-		mbuf_alloced--;
-	} else if ((m->m_flags & M_FREELIST) == 0) {
+	if ((m->m_flags & M_FREELIST) == 0) {
 		insque(m,&m_freelist);
 		m->m_flags = M_FREELIST; /* Clobber other flags */
 	}
@@ -141,18 +219,23 @@ void m_inc(struct mbuf *m, u_int size)
 
 	/* some compiles throw up on gotos.  This one we can fake. */
         if(m->m_size>size) return;
+        size = m_ext_size(size);
 
         if (m->m_flags & M_EXT) {
+	  char *dat;
          datasize = m->m_data - m->m_ext;
-	  m->m_ext = (char *)realloc(m->m_ext,size);
-/*		if (m->m_ext == NULL)
+	  dat = m_ext_alloc(size);
+/*		if (dat == NULL)
  *			return (struct mbuf *)NULL;
  */		
+	  memcpy(dat, m->m_ext, m->m_size);
+	  m_ext_release(m->m_ext, m->m_size);
+	  m->m_ext = dat;
          m->m_data = m->m_ext + datasize;
         } else {
 	  char *dat;
 	  datasize = m->m_data - m->m_dat;
-	  dat = (char *)malloc(size);
+	  dat = m_ext_alloc(size);
 /*		if (dat == NULL)
  *			return (struct mbuf *)NULL;
  */
@@ -200,6 +283,17 @@ m_copy(struct mbuf *n, struct mbuf *m, u_int off, u_int len)
 }
 
 
+/*
+ * Put an mbuf on the used list, so that dtom() can find it
+ */
+void m_track(struct mbuf *m)
+{
+	if ((m->m_flags & M_USEDLIST) == 0) {
+		insque(m,&m_usedlist);
+		m->m_flags |= M_USEDLIST;
+	}
+}
+
 /*
  * Given a pointer into an mbuf, return the mbuf
  * XXX This is a kludge, I should eliminate the need for it
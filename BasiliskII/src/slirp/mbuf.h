@@ -113,8 +113,6 @@ struct mbuf {
 #define M_EXT			0x01	/* m_ext points to more (malloced) data */
 #define M_FREELIST		0x02	/* mbuf is on free list */
 #define M_USEDLIST		0x04	/* XXX mbuf is on used list (for dtom()) */
-#define M_DOFREE		0x08	/* when m_free is called on the mbuf, free()
-					 * it rather than putting it on the free list */
 
 /*
  * Mbuf statistics. XXX
@@ -138,6 +136,7 @@ void m_cat(register struct mbuf *, register struct mbuf *);
 void m_inc(struct mbuf *, u_int);
 void m_adj(struct mbuf *, int);
 int m_copy(struct mbuf *, struct mbuf *, u_int, u_int);
+void m_track(struct mbuf *);
 struct mbuf * dtom(void *);
 
 #endif
@@ -180,4 +180,36 @@ void sbcopy(struct sbuf *sb, u_int off, u_int len, char *to)
 		   memcpy(to+off,sb->sb_data,len);
 	}
 }
+
+/*
+ * Like sbcopy(), but also return the partial checksum of the copied data
+ */
+u_int32_t
+sbcopy_cksum(struct sbuf *sb, u_int off, u_int len, char *to)
+{
+	char *from;
+	u_int32_t sum;
+	
+	from = sb->sb_rptr + off;
+	if (from >= sb->sb_data + sb->sb_datalen)
+		from -= sb->sb_datalen;
+
+	if (from < sb->sb_wptr) {
+		if (len > sb->sb_cc) {
+			/* Sum what sbcopy() would leave in the buffer */
+			memcpy(to,from,sb->sb_cc);
+			return cksum_partial(to, len);
+		}
+		sum = cksum_copy(to,from,len);
+	} else {
+		/* re-use off */
+		off = (sb->sb_data + sb->sb_datalen) - from;
+		if (off > len) off = len;
+		sum = cksum_copy(to,from,off);
+		len -= off;
+		if (len)
+		   sum = cksum_add(sum, cksum_copy(to+off,sb->sb_data,len), off);
+	}
+	return sum;
+}
 		
@@ -29,5 +29,6 @@ void sbreserve(struct sbuf *, size_t);
 void sbappend(struct socket *, struct mbuf *);
 void sbappendsb(struct sbuf *, struct mbuf *);
 void sbcopy(struct sbuf *, u_int, u_int, char *);
+u_int32_t sbcopy_cksum(struct sbuf *, u_int, u_int, char *);
 
 #endif
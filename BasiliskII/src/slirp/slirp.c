@@ -27,6 +27,10 @@ struct ex_list *exec_list;
 /* XXX: suppress those select globals */
 fd_set *global_readfds, *global_writefds, *global_xfds;
 
+/* Socket handled by tcp_poll() and its remaining events */
+struct socket *poll_so;
+int poll_events;
+
 char slirp_hostname[33];
 
 #ifdef _WIN32
@@ -141,6 +145,7 @@ int slirp_init(void)
 
     link_up = 1;
 
+    cksum_init();
     if_init();
     ip_init();
 
@@ -161,7 +166,6 @@ int slirp_init(void)
 
 #define CONN_CANFSEND(so) (((so)->so_state & (SS_FCANTSENDMORE|SS_ISFCONNECTED)) == SS_ISFCONNECTED)
 #define CONN_CANFRCV(so) (((so)->so_state & (SS_FCANTRCVMORE|SS_ISFCONNECTED)) == SS_ISFCONNECTED)
-#define UPD_NFDS(x) if (nfds < (x)) nfds = (x)
 
 /*
  * curtime kept to an accuracy of 1ms
@@ -188,19 +192,17 @@ static void updtime(void)
 }
 #endif
 
-int slirp_select_fill(int *pnfds, 
-					  fd_set *readfds, fd_set *writefds, fd_set *xfds)
+/*
+ * Walk all sockets, compute the events each one should be polled for
+ * and pass them to set_events(). Returns the timeout in usec for the
+ * next call to slirp_timers(), -1 if no timer is pending.
+ */
+static int slirp_fill_events(void (*set_events)(struct socket *, int))
 {
     struct socket *so, *so_next;
-    int nfds;
     int timeout, tmp_time;
+    int events;
 
-    /* fail safe */
-    global_readfds = NULL;
-    global_writefds = NULL;
-    global_xfds = NULL;
-    
-    nfds = *pnfds;
 	/*
 	 * First, TCP sockets
 	 */
@@ -226,15 +228,16 @@ int slirp_select_fill(int *pnfds,
 			 * NOFDREF can include still connecting to local-host,
 			 * newly socreated() sockets etc. Don't want to select these.
 	 		 */
-			if (so->so_state & SS_NOFDREF || so->s == -1)
+			if (so->so_state & SS_NOFDREF || so->s == -1) {
+				set_events(so, 0);
 				continue;
+			}
 			
 			/*
 			 * Set for reading sockets which are accepting
 			 */
 			if (so->so_state & SS_FACCEPTCONN) {
-                                FD_SET(so->s, readfds);
-				UPD_NFDS(so->s);
+				set_events(so, SO_EV_READ);
 				continue;
 			}
 			
@@ -242,8 +245,7 @@ int slirp_select_fill(int *pnfds,
 			 * Set for writing sockets which are connecting
 			 */
 			if (so->so_state & SS_ISFCONNECTING) {
-				FD_SET(so->s, writefds);
-				UPD_NFDS(so->s);
+				set_events(so, SO_EV_WRITE);
 				continue;
 			}
 			
@@ -251,20 +253,17 @@ int slirp_select_fill(int *pnfds,
 			 * Set for writing if we are connected, can send more, and
 			 * we have something to send
 			 */
-			if (CONN_CANFSEND(so) && so->so_rcv.sb_cc) {
-				FD_SET(so->s, writefds);
-				UPD_NFDS(so->s);
-			}
+			events = 0;
+			if (CONN_CANFSEND(so) && so->so_rcv.sb_cc)
+				events |= SO_EV_WRITE;
 			
 			/*
 			 * Set for reading (and urgent data) if we are connected, can
 			 * receive more, and we have room for it XXX /2 ?
 			 */
-			if (CONN_CANFRCV(so) && (so->so_snd.sb_cc < (so->so_snd.sb_datalen/2))) {
-				FD_SET(so->s, readfds);
-				FD_SET(so->s, xfds);
-				UPD_NFDS(so->s);
-			}
+			if (CONN_CANFRCV(so) && (so->so_snd.sb_cc < (so->so_snd.sb_datalen/2)))
+				events |= SO_EV_READ | SO_EV_URG;
+			set_events(so, events);
 		}
 		
 		/*
@@ -294,10 +293,10 @@ int slirp_select_fill(int *pnfds,
 			 * if the packets needed to be fragmented
 			 * (XXX <= 4 ?)
 			 */
-			if ((so->so_state & SS_ISFCONNECTED) && so->so_queued <= 4) {
-				FD_SET(so->s, readfds);
-				UPD_NFDS(so->s);
-			}
+			if ((so->so_state & SS_ISFCONNECTED) && so->so_queued <= 4)
+				set_events(so, SO_EV_READ | SO_EV_UDP);
+			else
+				set_events(so, SO_EV_UDP);
 		}
 	}
 	
@@ -332,7 +331,186 @@ int slirp_select_fill(int *pnfds,
 			   timeout = tmp_time;
 		}
 	}
-	*pnfds = nfds;
+	return timeout;
+}
+
+/*
+ * See if anything has timed out
+ */
+static void slirp_timers(void)
+{
+	/* Update time */
+	updtime();
+
+	if (link_up) {
+		if (time_fasttimo && ((curtime - time_fasttimo) >= FAST_TIMO)) {
+			tcp_fasttimo();
+			time_fasttimo = 0;
+		}
+		if (do_slowtimo && ((curtime - last_slowtimo) >= SLOW_TIMO)) {
+			ip_slowtimo();
+			tcp_slowtimo();
+			last_slowtimo = curtime;
+		}
+	}
+}
+
+/*
+ * Handle the events of a TCP socket. The events are kept in
+ * poll_events, so that sofcantrcvmore() and sofcantsendmore()
+ * can cancel the ones that no longer apply.
+ */
+static void tcp_poll(struct socket *so, int events)
+{
+	int ret;
+
+	poll_so = so;
+	poll_events = events;
+
+	/*
+	 * Check for URG data
+	 * This will soread as well, so no need to
+	 * test for readfds below if this succeeds
+	 */
+	if (poll_events & SO_EV_URG)
+		sorecvoob(so);
+	/*
+	 * Check sockets for reading
+	 */
+	else if (poll_events & SO_EV_READ) {
+		/*
+		 * Check for incoming connections
+		 */
+		if (so->so_state & SS_FACCEPTCONN) {
+			tcp_connect(so);
+			so->so_pollfd = -1;	/* The fd may have been replaced */
+			goto done;
+		} /* else */
+		ret = soread(so);
+
+		/* Output it if we read something */
+		if (ret > 0)
+			tcp_output(sototcpcb(so));
+	}
+
+	/*
+	 * Check sockets for writing
+	 */
+	if (poll_events & SO_EV_WRITE) {
+		/*
+		 * Check for non-blocking, still-connecting sockets
+		 */
+		if (so->so_state & SS_ISFCONNECTING) {
+			/* Connected */
+			so->so_state &= ~SS_ISFCONNECTING;
+
+			ret = send(so->s, (char*)&ret, 0, 0);
+			if (ret < 0) {
+				/* XXXXX Must fix, zero bytes is a NOP */
+				int error = WSAGetLastError();
+				if (error == EAGAIN || error == WSAEWOULDBLOCK ||
+					error == WSAEINPROGRESS || error == WSAENOTCONN)
+					goto done;
+
+				/* else failed */
+				so->so_state = SS_NOFDREF;
+			}
+			/* else so->so_state &= ~SS_ISFCONNECTING; */
+
+			/*
+			 * Continue tcp_input
+			 */
+			tcp_input((struct mbuf *)NULL, sizeof(struct ip), so);
+			/* continue; */
+		}
+		else
+			ret = sowrite(so);
+		/*
+		 * XXXXX If we wrote something (a lot), there
+		 * could be a need for a window update.
+		 * In the worst case, the remote will send
+		 * a window probe to get things going again
+		 */
+	}
+
+	/*
+	 * Probe a still-connecting, non-blocking socket
+	 * to check if it's still alive
+	 */
+#ifdef PROBE_CONN
+	if (so->so_state & SS_ISFCONNECTING) {
+		ret = recv(so->s, (char *)&ret, 0, 0);
+
+		if (ret < 0) {
+			/* XXX */
+			int error = WSAGetLastError();
+			if (error == EAGAIN || error == WSAEWOULDBLOCK ||
+				error == WSAEINPROGRESS || error == WSAENOTCONN)
+				goto done; /* Still connecting, continue */
+
+			  /* else failed */
+			so->so_state = SS_NOFDREF;
+
+			/* tcp_input will take care of it */
+		}
+		else {
+			ret = send(so->s, &ret, 0, 0);
+			if (ret < 0) {
+				/* XXX */
+				int error = WSAGetLastError();
+				if (error == EAGAIN || error == WSAEWOULDBLOCK ||
+					error == WSAEINPROGRESS || error == WSAENOTCONN)
+					goto done;
+				/* else failed */
+				so->so_state = SS_NOFDREF;
+			}
+			else
+				so->so_state &= ~SS_ISFCONNECTING;
+
+		}
+		tcp_input((struct mbuf *)NULL, sizeof(struct ip), so);
+	} /* SS_ISFCONNECTING */
+#endif
+
+done:
+	poll_so = NULL;
+}
+
+/*
+ * select() based event loop
+ */
+
+static fd_set *fill_readfds, *fill_writefds, *fill_xfds;
+static int fill_nfds;
+
+static void select_set_events(struct socket *so, int events)
+{
+	if (events & SO_EV_READ)
+		FD_SET(so->s, fill_readfds);
+	if (events & SO_EV_WRITE)
+		FD_SET(so->s, fill_writefds);
+	if (events & SO_EV_URG)
+		FD_SET(so->s, fill_xfds);
+	if ((events & (SO_EV_READ | SO_EV_WRITE | SO_EV_URG)) && fill_nfds < so->s)
+		fill_nfds = so->s;
+}
+
+int slirp_select_fill(int *pnfds, 
+					  fd_set *readfds, fd_set *writefds, fd_set *xfds)
+{
+    int timeout;
+
+    /* fail safe */
+    global_readfds = NULL;
+    global_writefds = NULL;
+    global_xfds = NULL;
+    
+	fill_readfds = readfds;
+	fill_writefds = writefds;
+	fill_xfds = xfds;
+	fill_nfds = *pnfds;
+	timeout = slirp_fill_events(select_set_events);
+	*pnfds = fill_nfds;
 
 	/*
 	 * Adjust the timeout to make the minimum timeout
@@ -347,29 +525,13 @@ int slirp_select_fill(int *pnfds,
 void slirp_select_poll(fd_set *readfds, fd_set *writefds, fd_set *xfds)
 {
 	struct socket *so, *so_next;
-	int ret;
+	int events;
 
 	global_readfds = readfds;
 	global_writefds = writefds;
 	global_xfds = xfds;
 
-	/* Update time */
-	updtime();
-
-	/*
-	 * See if anything has timed out
-	 */
-	if (link_up) {
-		if (time_fasttimo && ((curtime - time_fasttimo) >= FAST_TIMO)) {
-			tcp_fasttimo();
-			time_fasttimo = 0;
-		}
-		if (do_slowtimo && ((curtime - last_slowtimo) >= SLOW_TIMO)) {
-			ip_slowtimo();
-			tcp_slowtimo();
-			last_slowtimo = curtime;
-		}
-	}
+	slirp_timers();
 
 	/*
 	 * Check sockets
@@ -388,110 +550,15 @@ void slirp_select_poll(fd_set *readfds, fd_set *writefds, fd_set *xfds)
 			if (so->so_state & SS_NOFDREF || so->s == -1)
 				continue;
 
-			/*
-			 * Check for URG data
-			 * This will soread as well, so no need to
-			 * test for readfds below if this succeeds
-			 */
+			events = 0;
+			if (FD_ISSET(so->s, readfds))
+				events |= SO_EV_READ;
+			if (FD_ISSET(so->s, writefds))
+				events |= SO_EV_WRITE;
 			if (FD_ISSET(so->s, xfds))
-				sorecvoob(so);
-			/*
-			 * Check sockets for reading
-			 */
-			else if (FD_ISSET(so->s, readfds)) {
-				/*
-				 * Check for incoming connections
-				 */
-				if (so->so_state & SS_FACCEPTCONN) {
-					tcp_connect(so);
-					continue;
-				} /* else */
-				ret = soread(so);
-
-				/* Output it if we read something */
-				if (ret > 0)
-					tcp_output(sototcpcb(so));
-			}
-
-			/*
-			 * Check sockets for writing
-			 */
-			if (FD_ISSET(so->s, writefds)) {
-				/*
-				 * Check for non-blocking, still-connecting sockets
-				 */
-				if (so->so_state & SS_ISFCONNECTING) {
-					/* Connected */
-					so->so_state &= ~SS_ISFCONNECTING;
-
-					ret = send(so->s, (char*)&ret, 0, 0);
-					if (ret < 0) {
-						/* XXXXX Must fix, zero bytes is a NOP */
-						int error = WSAGetLastError();
-						if (error == EAGAIN || error == WSAEWOULDBLOCK ||
-							error == WSAEINPROGRESS || error == WSAENOTCONN)
-							continue;
-
-						/* else failed */
-						so->so_state = SS_NOFDREF;
-					}
-					/* else so->so_state &= ~SS_ISFCONNECTING; */
-
-					/*
-					 * Continue tcp_input
-					 */
-					tcp_input((struct mbuf *)NULL, sizeof(struct ip), so);
-					/* continue; */
-				}
-				else
-					ret = sowrite(so);
-				/*
-				 * XXXXX If we wrote something (a lot), there
-				 * could be a need for a window update.
-				 * In the worst case, the remote will send
-				 * a window probe to get things going again
-				 */
-			}
-
-			/*
-			 * Probe a still-connecting, non-blocking socket
-			 * to check if it's still alive
-			 */
-#ifdef PROBE_CONN
-			if (so->so_state & SS_ISFCONNECTING) {
-				ret = recv(so->s, (char *)&ret, 0, 0);
-
-				if (ret < 0) {
-					/* XXX */
-					int error = WSAGetLastError();
-					if (error == EAGAIN || error == WSAEWOULDBLOCK ||
-						error == WSAEINPROGRESS || error == WSAENOTCONN)
-						continue; /* Still connecting, continue */
-
-					  /* else failed */
-					so->so_state = SS_NOFDREF;
-
-					/* tcp_input will take care of it */
-				}
-				else {
-					ret = send(so->s, &ret, 0, 0);
-					if (ret < 0) {
-						/* XXX */
-						int error = WSAGetLastError();
-						if (error == EAGAIN || error == WSAEWOULDBLOCK ||
-							error == WSAEINPROGRESS || error == WSAENOTCONN)
-							continue;
-						/* else failed */
-						so->so_state = SS_NOFDREF;
-					}
-					else
-						so->so_state &= ~SS_ISFCONNECTING;
-
-				}
-				tcp_input((struct mbuf *)NULL, sizeof(struct ip), so);
-		} /* SS_ISFCONNECTING */
-#endif
-	}
+				events |= SO_EV_URG;
+			tcp_poll(so, events);
+		}
 
 		/*
 		 * Now UDP sockets.
@@ -505,7 +572,7 @@ void slirp_select_poll(fd_set *readfds, fd_set *writefds, fd_set *xfds)
 				sorecvfrom(so);
 			}
 		}
-}
+	}
 
 	/*
 	 * See if we can start outputting
@@ -523,6 +590,205 @@ void slirp_select_poll(fd_set *readfds, fd_set *writefds, fd_set *xfds)
 	global_xfds = NULL;
 }
 
+#ifdef HAVE_EPOLL
+
+/*
+ * epoll() based event loop
+ *
+ * Sockets stay registered with the epoll instance for their whole
+ * lifetime, epoll_ctl() is only called when the set of events a socket
+ * is interested in changes. The events returned by one epoll_wait() are
+ * handled as a batch; sofree() removes a socket from the pending batch.
+ */
+
+#define MAX_EVENTS 64
+
+static int epoll_fd = -1;
+static int epoll_input_fd = -1;
+static struct epoll_event ready_events[MAX_EVENTS];
+static int num_ready, next_ready;
+
+/* Marker for the caller's input fd in ready_events[] */
+static char input_marker;
+
+int slirp_events_init(void)
+{
+	if (epoll_fd < 0) {
+		epoll_fd = epoll_create(MAX_EVENTS);
+		if (epoll_fd < 0)
+			return -1;
+		fcntl(epoll_fd, F_SETFD, FD_CLOEXEC);
+	}
+	return 0;
+}
+
+void slirp_events_exit(void)
+{
+	if (epoll_fd >= 0) {
+		close(epoll_fd);
+		epoll_fd = -1;
+	}
+	epoll_input_fd = -1;
+}
+
+static void epoll_set_events(struct socket *so, int events)
+{
+	struct epoll_event ev;
+	int op;
+
+	if (so->s == -1) {
+		/* Socket was closed, and its registration with it */
+		so->so_pollev = 0;
+		return;
+	}
+	if (so->s == so->so_pollfd && events == so->so_pollev)
+		return;
+
+	if (so->s != so->so_pollfd || so->so_pollev == 0)
+		op = EPOLL_CTL_ADD;
+	else if (events & (SO_EV_READ | SO_EV_WRITE | SO_EV_URG))
+		op = EPOLL_CTL_MOD;
+	else
+		op = EPOLL_CTL_DEL;
+
+	memset(&ev, 0, sizeof(ev));
+	if (events & SO_EV_READ)
+		ev.events |= EPOLLIN;
+	if (events & SO_EV_WRITE)
+		ev.events |= EPOLLOUT;
+	if (events & SO_EV_URG)
+		ev.events |= EPOLLPRI;
+	ev.data.ptr = so;
+
+	if (op == EPOLL_CTL_ADD && ev.events == 0) {
+		/* Nothing to wait for yet */
+		so->so_pollfd = so->s;
+		so->so_pollev = 0;
+		return;
+	}
+
+	if (epoll_ctl(epoll_fd, op, so->s, &ev) < 0) {
+		/*
+		 * The registration was dropped when a previous fd with
+		 * the same number was closed, or still exists from one
+		 */
+		if (errno == ENOENT && op == EPOLL_CTL_MOD)
+			epoll_ctl(epoll_fd, EPOLL_CTL_ADD, so->s, &ev);
+		else if (errno == EEXIST)
+			epoll_ctl(epoll_fd, EPOLL_CTL_MOD, so->s, &ev);
+	}
+	so->so_pollfd = so->s;
+	so->so_pollev = (op == EPOLL_CTL_DEL) ? 0 : events;
+}
+
+/*
+ * Called by sofree(), the socket must not be touched by a pending event
+ */
+void slirp_events_forget(struct socket *so)
+{
+	int i;
+
+	for (i = next_ready; i < num_ready; i++)
+		if (ready_events[i].data.ptr == so)
+			ready_events[i].data.ptr = NULL;
+	if (so->so_pollev && so->s != -1 && so->s == so->so_pollfd)
+		epoll_ctl(epoll_fd, EPOLL_CTL_DEL, so->s, NULL);
+	so->so_pollev = 0;
+}
+
+int slirp_events_wait(int input_fd)
+{
+	struct socket *so;
+	int timeout, n, events, ready;
+	int input_ready = 0;
+
+	if (input_fd != epoll_input_fd) {
+		struct epoll_event ev;
+		memset(&ev, 0, sizeof(ev));
+		ev.events = EPOLLIN;
+		ev.data.ptr = &input_marker;
+		if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, input_fd, &ev) < 0)
+			return -1;
+		epoll_input_fd = input_fd;
+	}
+
+	timeout = slirp_fill_events(epoll_set_events);
+	if (timeout > 0)
+		timeout = (timeout + 999) / 1000;
+
+	n = epoll_wait(epoll_fd, ready_events, MAX_EVENTS, timeout);
+	if (n < 0) {
+		if (errno != EINTR)
+			return -1;
+		n = 0;
+	}
+
+	slirp_timers();
+
+	num_ready = n;
+	for (next_ready = 0; next_ready < num_ready; ) {
+		so = (struct socket *)ready_events[next_ready].data.ptr;
+		ready = ready_events[next_ready].events;
+		next_ready++;
+		if (so == NULL)
+			continue;	/* Freed while handling an earlier event */
+		if (so == (struct socket *)&input_marker) {
+			input_ready = 1;
+			continue;
+		}
+		if (!link_up)
+			continue;
+
+		/* Errors and hangups are reported like select() does */
+		events = 0;
+		if (ready & (EPOLLERR | EPOLLHUP))
+			events = so->so_pollev & (SO_EV_READ | SO_EV_WRITE);
+		if (ready & EPOLLIN)
+			events |= SO_EV_READ;
+		if (ready & EPOLLOUT)
+			events |= SO_EV_WRITE;
+		if (ready & EPOLLPRI)
+			events |= SO_EV_URG;
+
+		if (so->so_pollev & SO_EV_UDP) {
+			if (events & SO_EV_READ)
+				sorecvfrom(so);
+		} else if (!(so->so_state & SS_NOFDREF))
+			tcp_poll(so, events);
+	}
+	num_ready = next_ready = 0;
+
+	/*
+	 * See if we can start outputting
+	 */
+	if (if_queued && link_up)
+		if_start();
+
+	return input_ready;
+}
+
+#else
+
+int slirp_events_init(void)
+{
+	return -1;
+}
+
+void slirp_events_exit(void)
+{
+}
+
+void slirp_events_forget(struct socket *so)
+{
+}
+
+int slirp_events_wait(int input_fd)
+{
+	return -1;
+}
+
+#endif
+
 #define ETH_ALEN 6
 #define ETH_HLEN 14
 
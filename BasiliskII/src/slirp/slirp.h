@@ -200,6 +200,11 @@ int inet_aton(const char *cp, struct in_addr *ia);
 #include <sys/stropts.h>
 #endif
 
+#ifdef __linux__
+#define HAVE_EPOLL 1
+#include <sys/epoll.h>
+#endif
+
 #include "debug.h"
 
 #if defined __GNUC__
@@ -296,6 +301,10 @@ extern int do_echo;
 #define DEFAULT_BAUD 115200
 
 /* cksum.c */
+void cksum_init(void);
+u_int32_t cksum_partial(const void *buf, int len);
+u_int32_t cksum_copy(void *dst, const void *src, int len);
+u_int32_t cksum_add(u_int32_t a, u_int32_t b, int offset);
 int cksum(struct mbuf *m, int len);
 
 /* if.c */
@@ -342,6 +351,9 @@ int tcp_emu(struct socket *, struct mbuf *);
 int tcp_ctl(struct socket *);
 struct tcpcb *tcp_drop(struct tcpcb *tp, int err);
 
+/* slirp.c */
+void slirp_events_forget(struct socket *);
+
 #ifdef USE_PPP
 #define MIN_MRU MINMRU
 #define MAX_MRU MAXMRU
@@ -27,6 +27,66 @@ so_init()
 }
 
 
+/*
+ * Hash tables for demultiplexing, TCP sockets are hashed by their
+ * 4-tuple and UDP sockets by their local address and port only, as
+ * udp_input() looks them up
+ */
+static struct socket *tcp_hash[SO_HASH_SIZE];
+static struct socket *udp_hash[SO_HASH_SIZE];
+
+static inline u_int
+so_hashval(laddr, lport, faddr, fport)
+	u_int32_t laddr;
+	u_int lport;
+	u_int32_t faddr;
+	u_int fport;
+{
+	u_int32_t h = laddr ^ (faddr * 31) ^ ((lport << 16) | fport);
+	h *= 0x9e3779b1;
+	return h >> (32 - SO_HASH_BITS);
+}
+
+/*
+ * Remove a socket from its hash table
+ */
+void
+sounhash(so)
+	struct socket *so;
+{
+	if (so->so_hash_pprev) {
+		if (so->so_hash_next)
+			so->so_hash_next->so_hash_pprev = so->so_hash_pprev;
+		*so->so_hash_pprev = so->so_hash_next;
+		so->so_hash_next = NULL;
+		so->so_hash_pprev = NULL;
+	}
+}
+
+/*
+ * (Re)insert a socket into the hash table of the list head (tcb or udb),
+ * must be called whenever the addresses or ports used as key change
+ */
+void
+sohash(so, head)
+	struct socket *so;
+	struct socket *head;
+{
+	struct socket **bucket;
+
+	sounhash(so);
+	if (head == &udb)
+		bucket = &udp_hash[so_hashval(so->so_laddr.s_addr, so->so_lport, 0, 0)];
+	else
+		bucket = &tcp_hash[so_hashval(so->so_laddr.s_addr, so->so_lport,
+					      so->so_faddr.s_addr, so->so_fport)];
+	so->so_hash_next = *bucket;
+	if (*bucket)
+		(*bucket)->so_hash_pprev = &so->so_hash_next;
+	so->so_hash_pprev = bucket;
+	*bucket = so;
+}
+
 struct socket *
 solookup(head, laddr, lport, faddr, fport)
 	struct socket *head;
@@ -37,7 +97,11 @@ solookup(head, laddr, lport, faddr, fport)
 {
 	struct socket *so;
 	
-	for (so = head->so_next; so != head; so = so->so_next) {
+	if (head == &udb)
+		so = udp_hash[so_hashval(laddr.s_addr, lport, 0, 0)];
+	else
+		so = tcp_hash[so_hashval(laddr.s_addr, lport, faddr.s_addr, fport)];
+	for (; so; so = so->so_hash_next) {
 		if (so->so_lport == lport && 
 		    so->so_laddr.s_addr == laddr.s_addr &&
 		    so->so_faddr.s_addr == faddr.s_addr &&
@@ -45,10 +109,25 @@ solookup(head, laddr, lport, faddr, fport)
 		   break;
 	}
 	
-	if (so == head)
-	   return (struct socket *)NULL;
 	return so;
-	
+}
+
+/*
+ * Find the UDP socket for datagrams from the given local address and port
+ */
+struct socket *
+udp_solookup(laddr, lport)
+	struct in_addr laddr;
+	u_int lport;
+{
+	struct socket *so;
+
+	for (so = udp_hash[so_hashval(laddr.s_addr, lport, 0, 0)]; so; so = so->so_hash_next) {
+		if (so->so_lport == lport &&
+		    so->so_laddr.s_addr == laddr.s_addr)
+		   break;
+	}
+	return so;
 }
 
 /*
@@ -87,6 +166,9 @@ sofree(so)
     udp_last_so = &udb;
 	
   m_free(so->so_m);
+
+  slirp_events_forget(so);
+  sounhash(so);
 	
   if(so->so_next && so->so_prev) 
     remque(so);  /* crashes if so is not in a queue */
@@ -615,6 +697,7 @@ solisten(port, laddr, lport, flags)
 	   so->so_faddr = alias_addr;
 	else
 	   so->so_faddr = addr.sin_addr;
+	sohash(so, &tcb);
 
 	so->s = s;
 	return so;
@@ -677,6 +760,8 @@ sofcantrcvmore(so)
 		if(global_writefds) {
 		  FD_CLR(so->s,global_writefds);
 		}
+		if (so == poll_so)
+		  poll_events &= ~SO_EV_WRITE;
 	}
 	so->so_state &= ~(SS_ISFCONNECTING);
 	if (so->so_state & SS_FCANTSENDMORE)
@@ -697,6 +782,8 @@ sofcantsendmore(so)
             if (global_xfds) {
                 FD_CLR(so->s,global_xfds);
             }
+            if (so == poll_so)
+                poll_events &= ~(SO_EV_READ | SO_EV_URG);
 	}
 	so->so_state &= ~(SS_ISFCONNECTING);
 	if (so->so_state & SS_FCANTRCVMORE)
@@ -51,8 +51,25 @@ struct socket {
   struct sbuf so_rcv;		/* Receive buffer */
   struct sbuf so_snd;		/* Send buffer */
   void * extra;			/* Extra pointer */
+
+  int	so_pollfd;		/* fd registered with the event loop */
+  int	so_pollev;		/* Events registered for so_pollfd (SO_EV_*) */
+
+  struct socket *so_hash_next;	/* Next socket in hash bucket */
+  struct socket **so_hash_pprev;	/* Link to this socket in hash bucket */
 };
 
+#define SO_HASH_BITS 10
+#define SO_HASH_SIZE (1 << SO_HASH_BITS)
+
+/*
+ * Events a socket is polled for
+ */
+#define SO_EV_READ		0x01
+#define SO_EV_WRITE		0x02
+#define SO_EV_URG		0x04
+#define SO_EV_UDP		0x08	/* Socket is on the UDP list */
+
 
 /*
  * Socket state bits. (peer means the host on the Internet,
@@ -83,6 +100,9 @@ struct iovec {
 
 void so_init(void);
 struct socket * solookup(struct socket *, struct in_addr, u_int, struct in_addr, u_int);
+struct socket * udp_solookup(struct in_addr, u_int);
+void sohash(struct socket *, struct socket *);
+void sounhash(struct socket *);
 struct socket * socreate(void);
 void sofree(struct socket *);
 int soread(struct socket *);
@@ -404,6 +404,7 @@ findso:
 		so->so_lport = ti->ti_sport;
 		so->so_faddr = ti->ti_dst;
 		so->so_fport = ti->ti_dport;
+		sohash(so, &tcb);
 
 		if ((so->so_iptos = tcp_tos(so)) == 0)
 			so->so_iptos = ((struct ip *)ti)->ip_tos;
@@ -73,6 +73,7 @@ int tcp_output(register struct tcpcb *tp)
 	u_char opt[MAX_TCPOPTLEN];
 	unsigned optlen, hdrlen;
 	int idle, sendalot;
+	u_int32_t data_sum;			/* Partial checksum of the data */
 	
 	DEBUG_CALL("tcp_output");
 	DEBUG_ARG("tp = %lx", (long )tp);
@@ -92,6 +93,7 @@ int tcp_output(register struct tcpcb *tp)
 		 */
 		tp->snd_cwnd = tp->t_maxseg;
 again:
+	data_sum = 0;
 	sendalot = 0;
 	off = tp->snd_nxt - tp->snd_una;
 	win = min(tp->snd_wnd, tp->snd_cwnd);
@@ -357,7 +359,7 @@ send:
 		 */
 /*		if (len <= MHLEN - hdrlen - max_linkhdr) { */
 
-			sbcopy(&so->so_snd, off, len, mtod(m, caddr_t) + hdrlen);
+			data_sum = sbcopy_cksum(&so->so_snd, off, len, mtod(m, caddr_t) + hdrlen);
 			m->m_len += len;
 
 /*		} else {
@@ -464,7 +466,7 @@ send:
 	if (len + optlen)
 		ti->ti_len = htons((u_int16_t)(sizeof (struct tcphdr) +
 		    optlen + len));
-	ti->ti_sum = cksum(m, (int)(hdrlen + len));
+	ti->ti_sum = ~cksum_add(cksum_partial(mtod(m, caddr_t), hdrlen), data_sum, hdrlen) & 0xffff;
 
 	/*
 	 * In transmit state, time the transmission and arrange for
@@ -486,6 +486,7 @@ void tcp_connect(struct socket *inso)
 	/* Translate connections from localhost to the real hostname */
 	if (so->so_faddr.s_addr == 0 || so->so_faddr.s_addr == loopback_addr.s_addr)
 	   so->so_faddr = alias_addr;
+	sohash(so, &tcb);
 	
 	/* Close the accept() socket, set right state */
 	if (inso->so_state & SS_FACCEPTONCE) {
@@ -815,6 +816,7 @@ int tcp_emu(struct socket *so, struct mbuf *m)
 				if (ns->so_faddr.s_addr == 0 || 
 					ns->so_faddr.s_addr == loopback_addr.s_addr)
                   ns->so_faddr = alias_addr;
+				sohash(ns, &tcb);
 
 				ns->so_iptos = tcp_tos(ns);
 				tp = sototcpcb(ns);
@@ -164,20 +164,8 @@ udp_input(m, iphlen)
 	so = udp_last_so;
 	if (so->so_lport != uh->uh_sport ||
 	    so->so_laddr.s_addr != ip->ip_src.s_addr) {
-		struct socket *tmp;
-		
-		for (tmp = udb.so_next; tmp != &udb; tmp = tmp->so_next) {
-			if (tmp->so_lport == uh->uh_sport &&
-			    tmp->so_laddr.s_addr == ip->ip_src.s_addr) {
-				tmp->so_faddr.s_addr = ip->ip_dst.s_addr;
-				tmp->so_fport = uh->uh_dport;
-				so = tmp;
-				break;
-			}
-		}
-		if (tmp == &udb) {
-		  so = NULL;
-		} else {
+		so = udp_solookup(ip->ip_src, uh->uh_sport);
+		if (so) {
 		  udpstat.udpps_pcbcachemiss++;
 		  udp_last_so = so;
 		}
@@ -202,6 +190,7 @@ udp_input(m, iphlen)
 	  /* udp_last_so = so; */
 	  so->so_laddr = ip->ip_src;
 	  so->so_lport = uh->uh_sport;
+	  sohash(so, &udb);
 	  
 	  if ((so->so_iptos = udp_tos(so)) == 0)
 	    so->so_iptos = ip->ip_tos;
@@ -663,6 +652,7 @@ udp_listen(port, laddr, lport, flags)
 	
 	so->so_lport = lport;
 	so->so_laddr.s_addr = laddr;
+	sohash(so, &udb);
 	if (flags != SS_FACCEPTONCE)
 	   so->so_expire = 0;
 	
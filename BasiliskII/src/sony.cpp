@@ -184,6 +184,41 @@ void SonyExit(void)
 }
 
 
+/*
+ *  Save/restore driver state for snapshots (the drives themselves must
+ *  be the same as when the snapshot was taken)
+ */
+
+void SonySaveState(vector<uint32> &state)
+{
+	state.clear();
+	state.push_back(acc_run_called);
+	state.push_back(drives.size());
+	drive_vec::const_iterator info, end = drives.end();
+	for (info = drives.begin(); info != end; ++info) {
+		state.push_back(info->num);
+		state.push_back(info->status);
+		state.push_back(info->to_be_mounted);
+	}
+}
+
+bool SonyRestoreState(const vector<uint32> &state)
+{
+	if (state.size() != 2 + drives.size() * 3 || state[1] != drives.size())
+		return false;
+	vector<uint32>::const_iterator p = state.begin();
+	acc_run_called = *p++;
+	p++;
+	drive_vec::iterator info, end = drives.end();
+	for (info = drives.begin(); info != end; ++info) {
+		info->num = *p++;
+		info->status = *p++;
+		info->to_be_mounted = *p++;
+	}
+	return true;
+}
+
+
 /*
  *  Disk was inserted, flag for mounting
  */
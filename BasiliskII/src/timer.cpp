@@ -166,6 +166,56 @@ void TimerReset(void)
 }
 
 
+/*
+ *  Save/restore active timer tasks for snapshots (wakeup times are
+ *  stored relative to the current time)
+ */
+
+static uint32 wakeup_to_delay(tm_time_t wakeup, tm_time_t now)
+{
+	tm_time_t delay;
+	if (timer_cmp_time(wakeup, now) > 0)
+		timer_sub_time(delay, wakeup, now);
+	else
+		timer_mac2host_time(delay, 0);
+	return timer_host2mac_time(delay);
+}
+
+static tm_time_t delay_to_wakeup(uint32 mac_delay, tm_time_t now)
+{
+	tm_time_t delay, wakeup;
+	timer_mac2host_time(delay, mac_delay);
+	timer_add_time(wakeup, now, delay);
+	return wakeup;
+}
+
+void TimerSaveState(std::vector<uint32> &state)
+{
+	tm_time_t now;
+	timer_current_time(now);
+	state.clear();
+	for (int i=0; i<NUM_DESCS; i++)
+		if (desc[i].in_use) {
+			state.push_back(desc[i].task);
+			state.push_back(wakeup_to_delay(desc[i].wakeup, now));
+		}
+}
+
+bool TimerRestoreState(const std::vector<uint32> &state)
+{
+	if (state.size() % 2 || state.size() / 2 > NUM_DESCS)
+		return false;
+	TimerReset();
+	tm_time_t now;
+	timer_current_time(now);
+	for (size_t i=0; i<state.size(); i+=2) {
+		int j = alloc_desc(state[i]);
+		desc[j].wakeup = delay_to_wakeup(state[i + 1], now);
+	}
+	return true;
+}
+
+
 /*
  *  Insert timer task
  */
@@ -31,6 +31,7 @@
 #include "readcpu.h"
 #include "newcpu.h"
 #include "compiler/compemu.h"
+#include "fpu/fpu.h"
 
 
 // RAM and ROM pointers
@@ -131,6 +132,90 @@ void InitFrameBufferMapping(void)
 #endif
 }
 
+/*
+ *  CPU state for snapshots
+ */
+
+struct m68k_state {
+	uint32 regs[16];
+	uint32 pc;
+	uint32 sr;
+	uint32 usp, isp, msp;
+	uint32 vbr, sfc, dfc;
+	uint32 stopped;
+	fpu_t fpu;
+};
+
+static bool restore_pending = false;	// Flag: Start680x0() resumes from restored_state
+static m68k_state restored_state;
+
+static const size_t M68K_STATE_WORDS = (sizeof(m68k_state) + 3) / 4;
+
+void Save680x0State(std::vector<uint32> &state)
+{
+	m68k_state s;
+	memset(&s, 0, sizeof(s));
+	MakeSR();
+	memcpy(s.regs, regs.regs, sizeof(s.regs));
+	s.pc = m68k_getpc();
+	s.sr = regs.sr;
+	s.usp = regs.usp;
+	s.isp = regs.isp;
+	s.msp = regs.msp;
+	s.vbr = regs.vbr;
+	s.sfc = regs.sfc;
+	s.dfc = regs.dfc;
+	s.stopped = regs.stopped;
+	s.fpu = fpu;
+
+	state.assign(M68K_STATE_WORDS, 0);
+	memcpy(&state[0], &s, sizeof(s));
+}
+
+bool Restore680x0State(const std::vector<uint32> &state)
+{
+	if (state.size() != M68K_STATE_WORDS)
+		return false;
+	memcpy(&restored_state, &state[0], sizeof(restored_state));
+	restore_pending = true;
+	return true;
+}
+
+static void apply_restored_state(void)
+{
+	const m68k_state &s = restored_state;
+	memcpy(regs.regs, s.regs, sizeof(regs.regs));
+	regs.usp = s.usp;
+	regs.isp = s.isp;
+	regs.msp = s.msp;
+	regs.vbr = s.vbr;
+	regs.sfc = s.sfc;
+	regs.dfc = s.dfc;
+
+	// Set S/M first so MakeFromSR() doesn't swap stack pointers
+	regs.sr = s.sr;
+	regs.s = (s.sr >> 13) & 1;
+	regs.m = (s.sr >> 12) & 1;
+	MakeFromSR();
+
+	m68k_setpc(s.pc);
+	fill_prefetch_0();
+	if (s.stopped) {
+		regs.stopped = 1;
+		SPCFLAGS_SET( SPCFLAG_STOP );
+	}
+
+	fpu = s.fpu;
+	fpu_restore_control();
+	restore_pending = false;
+}
+
+void Call680x0AtToplevel(void (*func)(void))
+{
+	m68k_call_at_toplevel(func);
+}
+
+
 /*
  *  Reset and start 680x0 emulation (doesn't return)
  */
@@ -138,6 +223,8 @@ void InitFrameBufferMapping(void)
 void Start680x0(void)
 {
 	m68k_reset();
+	if (restore_pending)
+		apply_restored_state();
 #if USE_JIT
     if (UseJIT)
 	m68k_compile_execute();
@@ -3346,10 +3346,12 @@ static __inline__ void raw_flags_set_zero_FLAGREG(int s, int tmp)
 {
     raw_mov_l_rr(tmp,s);
     raw_lahf(s); /* flags into ah */
+    raw_setcc(s,0); /* V flag in al, sahf does not restore it */
     raw_and_l_ri(s,0xffffbfff);
     raw_and_l_ri(tmp,0x00004000);
     raw_xor_l_ri(tmp,0x00004000);
     raw_or_l(s,tmp);
+    raw_cmp_b_ri(s,-127); /* set V */
     raw_sahf(s);
 }
 
@@ -3417,6 +3419,7 @@ static __inline__ void raw_reg_to_flags_FLAGGEN(int r)
 		raw_xchg_b_rr(0,AH_INDEX);
 		raw_cmp_b_ri(r,-120); /* set V */
 		raw_sahf(0);
+		raw_xchg_b_rr(0,AH_INDEX); /* r still holds FLAGTMP, keep it in memory layout */
 	}
 	else
 		raw_reg_to_flags_FLAGSTK(r);
@@ -3436,12 +3439,12 @@ static __inline__ void raw_flags_init_FLAGGEN(void)
 	if (have_lahf_lm) {
 		FLAG_NREG1_FLAGGEN = FLAG_NREG1_FLAGREG;
 		FLAG_NREG2_FLAGGEN = FLAG_NREG2_FLAGREG;
-		FLAG_NREG1_FLAGGEN = FLAG_NREG3_FLAGREG;
+		FLAG_NREG3_FLAGGEN = FLAG_NREG3_FLAGREG;
 	}
 	else {
 		FLAG_NREG1_FLAGGEN = FLAG_NREG1_FLAGSTK;
 		FLAG_NREG2_FLAGGEN = FLAG_NREG2_FLAGSTK;
-		FLAG_NREG1_FLAGGEN = FLAG_NREG3_FLAGSTK;
+		FLAG_NREG3_FLAGGEN = FLAG_NREG3_FLAGSTK;
 	}
 }
 #endif
@@ -3983,6 +3986,7 @@ raw_init_cpu(void)
 
   /* Have CMOV support? */
   have_cmov = (c->x86_hwcap & (1 << 15)) != 0;
+  have_sse2 = (c->x86_hwcap & (1 << 26)) != 0;
 #if defined(__x86_64__)
   if (!have_cmov) {
 	  write_log("x86-64 implementations are bound to have CMOV!\n");
@@ -4204,8 +4208,54 @@ DEFINE_OP(fldt,  0xdb, 0x2d);
 #endif
 #undef DEFINE_OP
 
+/* SSE2 scalar FPU: FP registers are doubles in xmm0-xmm5, xmm7 and
+   sse2_temp are scratch. The x87 stack stays empty and is only used,
+   through memory, for the operations SSE2 does not have. Registers are
+   rounded to double when a block loads them from the register file, so
+   extended precision does not survive translated code, even for values
+   that are only moved */
+#define SSE2_REG(r)		(X86_XMM0 + (r))
+#define SSE2_SCRATCH	X86_XMM7
+
+static double sse2_temp;
+static const uae_u64 sse2_sign_mask = UVAL64(0x8000000000000000);
+static const uae_u64 sse2_abs_mask = UVAL64(0x7fffffffffffffff);
+static const double sse2_const_pi = 3.14159265358979323846;
+static const double sse2_const_log10_2 = 0.30102999566398119521;
+static const double sse2_const_log2_e = 1.44269504088896340736;
+static const double sse2_const_loge_2 = 0.69314718055994530942;
+static const double sse2_const_1 = 1.0;
+
+static inline void sse2_load(int r, uintptr m)
+{
+    MOVSDmr(m, X86_NOREG, X86_NOREG, 1, SSE2_REG(r));
+}
+
+static inline void sse2_store(uintptr m, int r)
+{
+    MOVSDrm(SSE2_REG(r), m, X86_NOREG, X86_NOREG, 1);
+}
+
+/* Push r onto the x87 stack */
+static inline void sse2_to_x87(int r)
+{
+    sse2_store((uintptr)&sse2_temp, r);
+    raw_fldl((uintptr)&sse2_temp);
+}
+
+/* Pop the top of the x87 stack into r */
+static inline void sse2_from_x87(int r)
+{
+    raw_fstpl((uintptr)&sse2_temp);
+    sse2_load(r, (uintptr)&sse2_temp);
+}
+
 LOWFUNC(NONE,WRITE,2,raw_fmov_mr,(MEMW m, FR r))
 {
+    if (use_sse2_fpu) {
+	sse2_store(m, r);
+	return;
+    }
     make_tos(r);
     raw_fstl(m);
 }
@@ -4213,6 +4263,10 @@ LENDFUNC(NONE,WRITE,2,raw_fmov_mr,(MEMW m, FR r))
 
 LOWFUNC(NONE,WRITE,2,raw_fmov_mr_drop,(MEMW m, FR r))
 {
+    if (use_sse2_fpu) {
+	sse2_store(m, r);
+	return;
+    }
     make_tos(r);
     raw_fstpl(m);
     live.onstack[live.tos]=-1;
@@ -4223,6 +4277,10 @@ LENDFUNC(NONE,WRITE,2,raw_fmov_mr,(MEMW m, FR r))
 
 LOWFUNC(NONE,READ,2,raw_fmov_rm,(FW r, MEMR m))
 {
+    if (use_sse2_fpu) {
+	sse2_load(r, m);
+	return;
+    }
     raw_fldl(m);
     tos_make(r);
 }
@@ -4230,6 +4288,10 @@ LENDFUNC(NONE,READ,2,raw_fmov_rm,(FW r, MEMR m))
 
 LOWFUNC(NONE,READ,2,raw_fmovi_rm,(FW r, MEMR m))
 {
+    if (use_sse2_fpu) {
+	CVTSI2SDLmr(m, X86_NOREG, X86_NOREG, 1, SSE2_REG(r));
+	return;
+    }
     raw_fildl(m);
     tos_make(r);
 }
@@ -4237,6 +4299,11 @@ LENDFUNC(NONE,READ,2,raw_fmovi_rm,(FW r, MEMR m))
 
 LOWFUNC(NONE,WRITE,2,raw_fmovi_mr,(MEMW m, FR r))
 {
+    if (use_sse2_fpu) {
+	CVTPD2DQrr(SSE2_REG(r), SSE2_SCRATCH);
+	MOVDXSrm(SSE2_SCRATCH, m, X86_NOREG, X86_NOREG, 1);
+	return;
+    }
     make_tos(r);
     raw_fistl(m);
 }
@@ -4244,6 +4311,10 @@ LENDFUNC(NONE,WRITE,2,raw_fmovi_mr,(MEMW m, FR r))
 
 LOWFUNC(NONE,READ,2,raw_fmovs_rm,(FW r, MEMR m))
 {
+    if (use_sse2_fpu) {
+	CVTSS2SDmr(m, X86_NOREG, X86_NOREG, 1, SSE2_REG(r));
+	return;
+    }
     raw_flds(m);
     tos_make(r);
 }
@@ -4251,6 +4322,11 @@ LENDFUNC(NONE,READ,2,raw_fmovs_rm,(FW r, MEMR m))
 
 LOWFUNC(NONE,WRITE,2,raw_fmovs_mr,(MEMW m, FR r))
 {
+    if (use_sse2_fpu) {
+	CVTSD2SSrr(SSE2_REG(r), SSE2_SCRATCH);
+	MOVSSrm(SSE2_SCRATCH, m, X86_NOREG, X86_NOREG, 1);
+	return;
+    }
     make_tos(r);
     raw_fsts(m);
 }
@@ -4260,6 +4336,13 @@ LOWFUNC(NONE,WRITE,2,raw_fmov_ext_mr,(MEMW m, FR r))
 {
     int rs;
 
+    if (use_sse2_fpu) {
+	sse2_store(m, r);
+	raw_fldl(m);
+	raw_fstpt(m);
+	return;
+    }
+
     /* Stupid x87 can't write a long double to mem without popping the 
        stack! */
     usereg(r);
@@ -4273,6 +4356,12 @@ LENDFUNC(NONE,WRITE,2,raw_fmov_ext_mr,(MEMW m, FR r))
 
 LOWFUNC(NONE,WRITE,2,raw_fmov_ext_mr_drop,(MEMW m, FR r))
 {
+    if (use_sse2_fpu) {
+	sse2_store(m, r);
+	raw_fldl(m);
+	raw_fstpt(m);
+	return;
+    }
     make_tos(r);
     raw_fstpt(m);	/* store and pop it */
     live.onstack[live.tos]=-1;
@@ -4283,6 +4372,11 @@ LENDFUNC(NONE,WRITE,2,raw_fmov_ext_mr,(MEMW m, FR r))
 
 LOWFUNC(NONE,READ,2,raw_fmov_ext_rm,(FW r, MEMR m))
 {
+    if (use_sse2_fpu) {
+	raw_fldt(m);
+	sse2_from_x87(r);
+	return;
+    }
     raw_fldt(m);
     tos_make(r);
 }
@@ -4290,6 +4384,10 @@ LENDFUNC(NONE,READ,2,raw_fmov_ext_rm,(FW r, MEMR m))
 
 LOWFUNC(NONE,NONE,1,raw_fmov_pi,(FW r))
 {
+    if (use_sse2_fpu) {
+	sse2_load(r, (uintptr)&sse2_const_pi);
+	return;
+    }
     emit_byte(0xd9);
     emit_byte(0xeb);
     tos_make(r);
@@ -4298,6 +4396,10 @@ LENDFUNC(NONE,NONE,1,raw_fmov_pi,(FW r))
 
 LOWFUNC(NONE,NONE,1,raw_fmov_log10_2,(FW r))
 {
+    if (use_sse2_fpu) {
+	sse2_load(r, (uintptr)&sse2_const_log10_2);
+	return;
+    }
     emit_byte(0xd9);
     emit_byte(0xec);
     tos_make(r);
@@ -4306,6 +4408,10 @@ LENDFUNC(NONE,NONE,1,raw_fmov_log10_2,(FW r))
 
 LOWFUNC(NONE,NONE,1,raw_fmov_log2_e,(FW r))
 {
+    if (use_sse2_fpu) {
+	sse2_load(r, (uintptr)&sse2_const_log2_e);
+	return;
+    }
     emit_byte(0xd9);
     emit_byte(0xea);
     tos_make(r);
@@ -4314,6 +4420,10 @@ LENDFUNC(NONE,NONE,1,raw_fmov_log2_e,(FW r))
 
 LOWFUNC(NONE,NONE,1,raw_fmov_loge_2,(FW r))
 {
+    if (use_sse2_fpu) {
+	sse2_load(r, (uintptr)&sse2_const_loge_2);
+	return;
+    }
     emit_byte(0xd9);
     emit_byte(0xed);
     tos_make(r);
@@ -4322,6 +4432,10 @@ LENDFUNC(NONE,NONE,1,raw_fmov_loge_2,(FW r))
 
 LOWFUNC(NONE,NONE,1,raw_fmov_1,(FW r))
 {
+    if (use_sse2_fpu) {
+	sse2_load(r, (uintptr)&sse2_const_1);
+	return;
+    }
     emit_byte(0xd9);
     emit_byte(0xe8);
     tos_make(r);
@@ -4330,6 +4444,10 @@ LENDFUNC(NONE,NONE,1,raw_fmov_1,(FW r))
 
 LOWFUNC(NONE,NONE,1,raw_fmov_0,(FW r))
 {
+    if (use_sse2_fpu) {
+	XORPDrr(SSE2_REG(r), SSE2_REG(r));
+	return;
+    }
     emit_byte(0xd9);
     emit_byte(0xee);
     tos_make(r);
@@ -4340,6 +4458,12 @@ LOWFUNC(NONE,NONE,2,raw_fmov_rr,(FW d, FR s))
 {
     int ds;
 
+    if (use_sse2_fpu) {
+	if (d != s)
+		MOVAPDrr(SSE2_REG(s), SSE2_REG(d));
+	return;
+    }
+
     usereg(s);
     ds=stackpos(s);
     if (ds==0 && live.spos[d]>=0) {
@@ -4369,6 +4493,11 @@ LOWFUNC(NONE,NONE,2,raw_fsqrt_rr,(FW d, FR s))
 {
     int ds;
 
+    if (use_sse2_fpu) {
+	SQRTSDrr(SSE2_REG(s), SSE2_REG(d));
+	return;
+    }
+
     if (d!=s) {
 	usereg(s);
 	ds=stackpos(s);
@@ -4390,6 +4519,14 @@ LOWFUNC(NONE,NONE,2,raw_fabs_rr,(FW d, FR s))
 {
     int ds;
 
+    if (use_sse2_fpu) {
+	MOVSDmr((uintptr)&sse2_abs_mask, X86_NOREG, X86_NOREG, 1, SSE2_SCRATCH);
+	if (d != s)
+		MOVAPDrr(SSE2_REG(s), SSE2_REG(d));
+	ANDPDrr(SSE2_SCRATCH, SSE2_REG(d));
+	return;
+    }
+
     if (d!=s) {
 	usereg(s);
 	ds=stackpos(s);
@@ -4411,6 +4548,14 @@ LOWFUNC(NONE,NONE,2,raw_frndint_rr,(FW d, FR s))
 {
     int ds;
 
+    if (use_sse2_fpu) {
+	sse2_to_x87(s);
+	emit_byte(0xd9);
+	emit_byte(0xfc); /* frndint */
+	sse2_from_x87(d);
+	return;
+    }
+
     if (d!=s) {
 	usereg(s);
 	ds=stackpos(s);
@@ -4432,6 +4577,14 @@ LOWFUNC(NONE,NONE,2,raw_fcos_rr,(FW d, FR s))
 {
     int ds;
 
+    if (use_sse2_fpu) {
+	sse2_to_x87(s);
+	emit_byte(0xd9);
+	emit_byte(0xff); /* fcos */
+	sse2_from_x87(d);
+	return;
+    }
+
     if (d!=s) {
 	usereg(s);
 	ds=stackpos(s);
@@ -4453,6 +4606,14 @@ LOWFUNC(NONE,NONE,2,raw_fsin_rr,(FW d, FR s))
 {
     int ds;
 
+    if (use_sse2_fpu) {
+	sse2_to_x87(s);
+	emit_byte(0xd9);
+	emit_byte(0xfe); /* fsin */
+	sse2_from_x87(d);
+	return;
+    }
+
     if (d!=s) {
 	usereg(s);
 	ds=stackpos(s);
@@ -4471,15 +4632,10 @@ LOWFUNC(NONE,NONE,2,raw_fsin_rr,(FW d, FR s))
 LENDFUNC(NONE,NONE,2,raw_fsin_rr,(FW d, FR s))
 
 static const double one=1;
-LOWFUNC(NONE,NONE,2,raw_ftwotox_rr,(FW d, FR s))
-{
-    int ds;
-
-    usereg(s);
-    ds=stackpos(s);
-    emit_byte(0xd9);
-    emit_byte(0xc0+ds); /* duplicate source */
 
+/* Replace the top of the x87 stack with 2^x */
+static void x87_twotox_tos(void)
+{
     emit_byte(0xd9);
     emit_byte(0xc0);  /* duplicate top of stack. Now up to 8 high */
     emit_byte(0xd9);
@@ -4495,38 +4651,65 @@ LOWFUNC(NONE,NONE,2,raw_ftwotox_rr,(FW d, FR s))
     emit_byte(0xfd);  /* and scale it */
     emit_byte(0xdd);
     emit_byte(0xd9);  /* take he rounded value off */
-    tos_make(d); /* store to destination */
 }
-LENDFUNC(NONE,NONE,2,raw_ftwotox_rr,(FW d, FR s))
 
-LOWFUNC(NONE,NONE,2,raw_fetox_rr,(FW d, FR s))
+/* Replace the top of the x87 stack with e^x */
+static void x87_etox_tos(void)
 {
-    int ds;
-
-    usereg(s);
-    ds=stackpos(s);
-    emit_byte(0xd9);
-    emit_byte(0xc0+ds); /* duplicate source */
     emit_byte(0xd9);
     emit_byte(0xea);   /* fldl2e */
     emit_byte(0xde);
     emit_byte(0xc9);  /* fmulp --- multiply source by log2(e) */
+    x87_twotox_tos();
+}
 
+/* Replace the top of the x87 stack with log2(x) */
+static void x87_log2_tos(void)
+{
     emit_byte(0xd9);
-    emit_byte(0xc0);  /* duplicate top of stack. Now up to 8 high */
+    emit_byte(0xe8); /* push '1' */
     emit_byte(0xd9);
-    emit_byte(0xfc);  /* rndint */
+    emit_byte(0xc9); /* swap top two */
     emit_byte(0xd9);
-    emit_byte(0xc9);  /* swap top two elements */
-    emit_byte(0xd8);
-    emit_byte(0xe1);  /* subtract rounded from original */
+    emit_byte(0xf1); /* take 1*log2(x) */
+}
+
+LOWFUNC(NONE,NONE,2,raw_ftwotox_rr,(FW d, FR s))
+{
+    int ds;
+
+    if (use_sse2_fpu) {
+	sse2_to_x87(s);
+	x87_twotox_tos();
+	sse2_from_x87(d);
+	return;
+    }
+
+    usereg(s);
+    ds=stackpos(s);
     emit_byte(0xd9);
-    emit_byte(0xf0);  /* f2xm1 */
-    x86_fadd_m((uintptr)&one);  /* Add '1' without using extra stack space */
+    emit_byte(0xc0+ds); /* duplicate source */
+    x87_twotox_tos();
+    tos_make(d); /* store to destination */
+}
+LENDFUNC(NONE,NONE,2,raw_ftwotox_rr,(FW d, FR s))
+
+LOWFUNC(NONE,NONE,2,raw_fetox_rr,(FW d, FR s))
+{
+    int ds;
+
+    if (use_sse2_fpu) {
+	sse2_to_x87(s);
+	x87_etox_tos();
+	sse2_from_x87(d);
+	return;
+    }
+
+    usereg(s);
+    ds=stackpos(s);
     emit_byte(0xd9);
-    emit_byte(0xfd);  /* and scale it */
-    emit_byte(0xdd);
-    emit_byte(0xd9);  /* take he rounded value off */
+    emit_byte(0xc0+ds); /* duplicate source */
+    x87_etox_tos();
     tos_make(d); /* store to destination */
 }
 LENDFUNC(NONE,NONE,2,raw_fetox_rr,(FW d, FR s))
@@ -4535,16 +4718,18 @@ LOWFUNC(NONE,NONE,2,raw_flog2_rr,(FW d, FR s))
 {
     int ds;
 
+    if (use_sse2_fpu) {
+	sse2_to_x87(s);
+	x87_log2_tos();
+	sse2_from_x87(d);
+	return;
+    }
+
     usereg(s);
     ds=stackpos(s);
     emit_byte(0xd9);
     emit_byte(0xc0+ds); /* duplicate source */
-    emit_byte(0xd9);
-    emit_byte(0xe8); /* push '1' */
-    emit_byte(0xd9);
-    emit_byte(0xc9); /* swap top two */
-    emit_byte(0xd9);
-    emit_byte(0xf1); /* take 1*log2(x) */
+    x87_log2_tos();
     tos_make(d); /* store to destination */
 }
 LENDFUNC(NONE,NONE,2,raw_flog2_rr,(FW d, FR s))
@@ -4554,6 +4739,14 @@ LOWFUNC(NONE,NONE,2,raw_fneg_rr,(FW d, FR s))
 {
     int ds;
 
+    if (use_sse2_fpu) {
+	MOVSDmr((uintptr)&sse2_sign_mask, X86_NOREG, X86_NOREG, 1, SSE2_SCRATCH);
+	if (d != s)
+		MOVAPDrr(SSE2_REG(s), SSE2_REG(d));
+	XORPDrr(SSE2_SCRATCH, SSE2_REG(d));
+	return;
+    }
+
     if (d!=s) {
 	usereg(s);
 	ds=stackpos(s);
@@ -4575,6 +4768,11 @@ LOWFUNC(NONE,NONE,2,raw_fadd_rr,(FRW d, FR s))
 {
     int ds;
 
+    if (use_sse2_fpu) {
+	ADDSDrr(SSE2_REG(s), SSE2_REG(d));
+	return;
+    }
+
     usereg(s);
     usereg(d);
     
@@ -4598,6 +4796,11 @@ LOWFUNC(NONE,NONE,2,raw_fsub_rr,(FRW d, FR s))
 {
     int ds;
 
+    if (use_sse2_fpu) {
+	SUBSDrr(SSE2_REG(s), SSE2_REG(d));
+	return;
+    }
+
     usereg(s);
     usereg(d);
     
@@ -4621,6 +4824,11 @@ LOWFUNC(NONE,NONE,2,raw_fcmp_rr,(FR d, FR s))
 {
     int ds;
 
+    if (use_sse2_fpu) {
+	UCOMISDrr(SSE2_REG(s), SSE2_REG(d));
+	return;
+    }
+
     usereg(s);
     usereg(d);
     
@@ -4636,6 +4844,11 @@ LOWFUNC(NONE,NONE,2,raw_fmul_rr,(FRW d, FR s))
 {
     int ds;
 
+    if (use_sse2_fpu) {
+	MULSDrr(SSE2_REG(s), SSE2_REG(d));
+	return;
+    }
+
     usereg(s);
     usereg(d);
     
@@ -4659,6 +4872,11 @@ LOWFUNC(NONE,NONE,2,raw_fdiv_rr,(FRW d, FR s))
 {
     int ds;
 
+    if (use_sse2_fpu) {
+	DIVSDrr(SSE2_REG(s), SSE2_REG(d));
+	return;
+    }
+
     usereg(s);
     usereg(d);
     
@@ -4682,6 +4900,17 @@ LOWFUNC(NONE,NONE,2,raw_frem_rr,(FRW d, FR s))
 {
     int ds;
 
+    if (use_sse2_fpu) {
+	sse2_to_x87(s);
+	sse2_to_x87(d);
+	emit_byte(0xd9);
+	emit_byte(0xf8); /* fprem */
+	sse2_from_x87(d);
+	emit_byte(0xdd);
+	emit_byte(0xd8); /* pop source */
+	return;
+    }
+
     usereg(s);
     usereg(d);
     
@@ -4701,6 +4930,17 @@ LOWFUNC(NONE,NONE,2,raw_frem1_rr,(FRW d, FR s))
 {
     int ds;
 
+    if (use_sse2_fpu) {
+	sse2_to_x87(s);
+	sse2_to_x87(d);
+	emit_byte(0xd9);
+	emit_byte(0xf5); /* fprem1 */
+	sse2_from_x87(d);
+	emit_byte(0xdd);
+	emit_byte(0xd8); /* pop source */
+	return;
+    }
+
     usereg(s);
     usereg(d);
     
@@ -4719,6 +4959,11 @@ LENDFUNC(NONE,NONE,2,raw_frem1_rr,(FRW d, FR s))
 
 LOWFUNC(NONE,NONE,1,raw_ftst_r,(FR r))
 {
+    if (use_sse2_fpu) {
+	XORPDrr(SSE2_SCRATCH, SSE2_SCRATCH);
+	UCOMISDrr(SSE2_SCRATCH, SSE2_REG(r));
+	return;
+    }
     make_tos(r);
     emit_byte(0xd9);  /* ftst */
     emit_byte(0xe4);
@@ -4733,6 +4978,12 @@ static __inline__ void raw_fflags_into_flags(int r)
 {
     int p;
 
+    if (use_sse2_fpu) {
+	XORPDrr(SSE2_SCRATCH, SSE2_SCRATCH);
+	UCOMISDrr(SSE2_SCRATCH, SSE2_REG(r)); /* same ZF/PF/CF as fucomi */
+	return;
+    }
+
     usereg(r);
     p=stackpos(r);
 
@@ -2336,6 +2336,13 @@ enum {
 #define MOVLPSmr(MD, MB, MI, MS, RD)	__SSELmr(      0x12, MD, MB, MI, MS, RD,_rX)
 #define MOVLPSrm(RS, MD, MB, MI, MS)	__SSELrm(      0x13, RS,_rX, MD, MB, MI, MS)
 
+#define MOVSDrr(RS, RD)			_SSESDrr(0x10, RS, RD)
+#define MOVSDmr(MD, MB, MI, MS, RD)	_SSESDmr(0x10, MD, MB, MI, MS, RD)
+#define MOVSDrm(RS, MD, MB, MI, MS)	_SSESDrm(0x11, RS, MD, MB, MI, MS)
+#define MOVSSrr(RS, RD)			_SSESSrr(0x10, RS, RD)
+#define MOVSSmr(MD, MB, MI, MS, RD)	_SSESSmr(0x10, MD, MB, MI, MS, RD)
+#define MOVSSrm(RS, MD, MB, MI, MS)	_SSESSrm(0x11, RS, MD, MB, MI, MS)
+
 
 /* --- Floating-Point instructions ----------------------------------------- */
 
@@ -41,6 +41,11 @@
 extern void compiler_dumpstate(void);
 #endif
 
+#if ENABLE_MON
+/* recompile blocks that cover break points added or removed in mon */
+extern void compiler_break_points_changed(void);
+#endif
+
 /* Now that we do block chaining, and also have linked lists on each tag,
    TAGMASK can be much smaller and still do its job. Saves several megs
    of memory! */
@@ -62,6 +62,7 @@
 #include "prefs.h"
 #include "user_strings.h"
 #include "vm_alloc.h"
+#include "jit_profile.h"
 
 #include "m68k.h"
 #include "memory.h"
@@ -77,6 +78,9 @@
 
 #ifdef ENABLE_MON
 #include "mon.h"
+#include <algorithm>
+#include <iterator>
+#include <vector>
 #endif
 
 #ifndef WIN32
@@ -159,6 +163,8 @@ static uae_u32	current_cache_size	= 0;		// Cache grows upwards: how much has bee
 static bool		lazy_flush			= true;		// Flag: lazy translation cache invalidation
 static bool		avoid_fpu			= true;		// Flag: compile FPU instructions ?
 static bool		have_cmov			= false;	// target has CMOV instructions ?
+static bool		have_sse2			= false;	// target has SSE2 instructions ?
+static bool		use_sse2_fpu		= false;	// Flag: compile FPU instructions to SSE2 scalar code ?
 static bool		have_lahf_lm		= true;		// target has LAHF supported in long mode ?
 static bool		have_rat_stall		= true;		// target has partial register stalls ?
 const bool		tune_alignment		= true;		// Tune code alignments for running CPU ?
@@ -268,6 +274,7 @@ extern struct cputbl op_smalltbl_5_nf[];
 static void flush_icache_hard(int n);
 static void flush_icache_lazy(int n);
 static void flush_icache_none(int n);
+static void flush_icache_profile(void);
 void (*flush_icache)(int n) = flush_icache_none;
 
 
@@ -611,7 +618,7 @@ LazyBlockAllocator<T>::~LazyBlockAllocator()
 	while (currentPool) {
 		Pool * deadPool = currentPool;
 		currentPool = currentPool->next;
-		free(deadPool);
+		vm_release(deadPool, sizeof(Pool));
 	}
 }
 
@@ -620,8 +627,13 @@ T * LazyBlockAllocator<T>::acquire()
 {
 	if (!mChunks) {
 		// There is no chunk left, allocate a new pool and link the
-		// chunks into the free list
-		Pool * newPool = (Pool *)malloc(sizeof(Pool));
+		// chunks into the free list. Generated code refers to blockinfos
+		// with 32-bit absolute addresses, so they can't come from malloc()
+		Pool * newPool = (Pool *)vm_acquire(sizeof(Pool), VM_MAP_DEFAULT | VM_MAP_32BIT);
+		if (newPool == VM_MAP_FAILED) {
+			write_log("<JIT compiler> : cannot allocate blockinfos in 32-bit memory\n");
+			abort();
+		}
 		for (T * chunk = &newPool->chunk[0]; chunk < &newPool->chunk[kPoolSize]; chunk++) {
 			chunk->next = mChunks;
 			mChunks = chunk;
@@ -1267,8 +1279,10 @@ static  void tomem(int r)
     int rr=live.state[r].realreg;
 
     if (isinreg(r)) {
+	/* The offset applies to all 32 bits, leave it pending if the
+	   register only holds the lower part of the value */
 	if (live.state[r].val && live.nat[rr].nholds==1
-		&& !live.nat[rr].locked) {
+		&& !live.nat[rr].locked && live.state[r].validsize==4) {
 	    // write_log("RemovingA offset %x from reg %d (%d) at %p\n",
 	    //   live.state[r].val,r,rr,target); 
 	    adjust_nreg(rr,live.state[r].val);
@@ -5032,6 +5046,10 @@ void compiler_init(void)
 	raw_init_cpu();
 	setzflg_uses_bsf = target_check_bsf();
 	write_log("<JIT compiler> : target processor has CMOV instructions : %s\n", have_cmov ? "yes" : "no");
+
+	// Keep FPU registers in SSE2 registers as doubles, instead of on the x87 stack ?
+	use_sse2_fpu = !avoid_fpu && have_sse2 && PrefsFindBool("jitfpusse");
+	write_log("<JIT compiler> : compile FPU instructions to SSE2 (double precision) : %s\n", use_sse2_fpu ? "yes" : "no");
 	write_log("<JIT compiler> : target processor can suffer from partial register stalls : %s\n", have_rat_stall ? "yes" : "no");
 	write_log("<JIT compiler> : alignment for loops, jumps are %d, %d\n", align_loops, align_jumps);
 	
@@ -5063,6 +5081,8 @@ void compiler_init(void)
 	write_log("<JIT compiler> : gather statistics on translation time\n");
 	emul_start_time = clock();
 #endif
+
+	jit_profile_init("m68k", true, ROMBaseMac, ROMSize, flush_icache_profile);
 }
 
 void compiler_exit(void)
@@ -5070,6 +5090,8 @@ void compiler_exit(void)
 #if PROFILE_COMPILE_TIME
 	emul_end_time = clock();
 #endif
+
+	jit_profile_exit();
 	
 	// Deallocate translation cache
 	if (compiled_code) {
@@ -5697,7 +5719,7 @@ static uint8 *do_alloc_code(uint32 size, int depth)
 			boundaries = page_size;
 		code_base = (uint8 *)sbrk(0);
 		for (int attempts = 0; attempts < CODE_ALLOC_MAX_ATTEMPTS; attempts++) {
-			if (vm_acquire_fixed(code_base, size) == 0) {
+			if (vm_acquire_fixed(code_base, size, VM_MAP_DEFAULT | VM_MAP_HUGE) == 0) {
 				uint8 *code = code_base;
 				code_base += size;
 				return code;
@@ -5707,7 +5729,7 @@ static uint8 *do_alloc_code(uint32 size, int depth)
 		return NULL;
 	}
 
-	if (vm_acquire_fixed(code_base, size) == 0) {
+	if (vm_acquire_fixed(code_base, size, VM_MAP_DEFAULT | VM_MAP_HUGE) == 0) {
 		uint8 *code = code_base;
 		code_base += size;
 		return code;
@@ -5718,7 +5740,7 @@ static uint8 *do_alloc_code(uint32 size, int depth)
 
 	return do_alloc_code(size, depth + 1);
 #else
-	uint8 *code = (uint8 *)vm_acquire(size);
+	uint8 *code = (uint8 *)vm_acquire(size, VM_MAP_DEFAULT | VM_MAP_HUGE);
 	return code == VM_MAP_FAILED ? NULL : code;
 #endif
 }
@@ -5752,6 +5774,7 @@ void alloc_cache(void)
 	
 	if (compiled_code) {
 		write_log("<JIT compiler> : actual translation cache size : %d KB at 0x%08X\n", cache_size, compiled_code);
+		vm_report_huge_pages("<JIT compiler> : translation cache", compiled_code, cache_size * 1024);
 		max_compile_start = compiled_code + cache_size*1024 - BYTES_PER_INST;
 		current_compile_p = compiled_code;
 		current_cache_size = 0;
@@ -6352,6 +6375,12 @@ static void flush_icache_none(int n)
 {
 	/* Nothing to do.  */
 }
+
+/* Called when block profiling is started or stopped */
+static void flush_icache_profile(void)
+{
+	flush_icache_hard(8);
+}
     
 static void flush_icache_hard(int n)
 {
@@ -6511,6 +6540,65 @@ static void mon_write_byte_jit(uintptr addr, uae_u32 b)
 	uae_u8 *m = (uae_u8 *)addr;
 	*m = b;
 }
+
+/* Break points the translated code was last checked against */
+static BREAK_POINT_SET jit_break_points;
+
+/* Address of the instruction before a break point, if known */
+static uae_u32 jit_break_point_last_pc;
+
+/* Called from translated code in front of an instruction at a break point */
+static void jit_break_point(void)
+{
+	m68k_break_point(m68k_getpc(), jit_break_point_last_pc);
+}
+
+/* Invalidate the blocks that cover addr, so that they get recompiled
+   with or without a call to jit_break_point() */
+static void invalidate_break_point_blocks(uaecptr addr)
+{
+	uae_u8 *pc_p = get_real_address(addr);
+	blockinfo *lists[2] = { active, dormant };
+	for (int i = 0; i < 2; i++) {
+		for (blockinfo *bi = lists[i]; bi; bi = bi->next) {
+			if (bi->status == BI_INVALID)
+				continue;
+#if USE_CHECKSUM_INFO
+			/* Traces in ROM don't keep their ranges */
+			bool covered = (bi->csi == NULL && isinrom((uintptr)pc_p));
+			for (checksum_info *csi = bi->csi; csi && !covered; csi = csi->next)
+				covered = (uintptr)(pc_p - csi->start_p) < csi->length;
+#else
+			bool covered = ((uintptr)pc_p - bi->min_pcp) < bi->len;
+#endif
+			if (covered) {
+				invalidate_block(bi);
+				raise_in_cl_list(bi);
+			}
+		}
+	}
+}
+
+void compiler_break_points_changed(void)
+{
+	if (!compiled_code) {
+		jit_break_points = active_break_points;
+		return;
+	}
+
+	std::vector<uintptr> changed;
+	std::set_symmetric_difference(jit_break_points.begin(), jit_break_points.end(),
+								  active_break_points.begin(), active_break_points.end(),
+								  std::back_inserter(changed));
+	for (size_t i = 0; i < changed.size(); i++)
+		invalidate_break_point_blocks(changed[i]);
+	jit_break_points = active_break_points;
+}
+
+static uae_u8 *mon_map_range_jit(uintptr addr, uintptr size)
+{
+	return (uae_u8 *)addr;
+}
 #endif
 
 void disasm_block(int target, uint8 * start, size_t length)
@@ -6529,15 +6617,18 @@ void disasm_block(int target, uint8 * start, size_t length)
 	
 	uae_u32 (*old_mon_read_byte)(uintptr) = mon_read_byte;
 	void (*old_mon_write_byte)(uintptr, uae_u32) = mon_write_byte;
+	uae_u8 *(*old_mon_map_range)(uintptr, uintptr) = mon_map_range;
 	
 	mon_read_byte = mon_read_byte_jit;
 	mon_write_byte = mon_write_byte_jit;
+	mon_map_range = mon_map_range_jit;
 	
 	const char *arg[5] = {"mon", "-m", "-r", disasm_str, NULL};
 	mon(4, arg);
 	
 	mon_read_byte = old_mon_read_byte;
 	mon_write_byte = old_mon_write_byte;
+	mon_map_range = old_mon_map_range;
 #endif
 }
 
@@ -6711,6 +6802,13 @@ static void compile_block(cpu_history* pc_hist, int blocklen)
 	
 	log_startblock();
 	
+	if (jit_profile_enabled) {
+	    uae_u64 *counter = jit_profile_counter(get_virtual_address((uae_u8 *)pc_hist[0].location));
+	    if (counter) {
+		raw_add_l_mi((uintptr)counter,1);
+		raw_adc_l_mi((uintptr)counter + 4,0);
+	    }
+	}
 	if (bi->count>=0) { /* Need to generate countdown code */
 	    raw_mov_l_mi((uintptr)&regs.pc_p,(uintptr)pc_hist[0].location);
 	    raw_sub_l_mi((uintptr)&(bi->count),1);
@@ -6775,8 +6873,17 @@ static void compile_block(cpu_history* pc_hist, int blocklen)
 		}
 #endif
 		
+#ifdef ENABLE_MON
+		/* Instructions at break points are not translated, they are
+		   preceded by a call into mon instead */
+		bool break_point = HAS_BREAK_POINTS() &&
+			IS_BREAK_POINT(get_virtual_address((uae_u8 *)pc_hist[i].location));
+#else
+		const bool break_point = false;
+#endif
+
 		failure = 1; // gb-- defaults to failure state
-		if (comptbl[opcode] && optlev>1) { 
+		if (comptbl[opcode] && optlev>1 && !break_point) { 
 		    failure=0;
 		    if (!was_comp) {
 			comp_pc_p=(uae_u8*)pc_hist[i].location;
@@ -6803,6 +6910,15 @@ static void compile_block(cpu_history* pc_hist, int blocklen)
 			flush(1);
 			was_comp=0;
 		    }
+#ifdef ENABLE_MON
+		    if (break_point) {
+			raw_mov_l_mi((uintptr)&regs.pc_p,
+				     (uintptr)pc_hist[i].location);
+			raw_mov_l_mi((uintptr)&jit_break_point_last_pc,
+				     i > 0 ? get_virtual_address((uae_u8 *)pc_hist[i-1].location) : 0);
+			raw_call((uintptr)jit_break_point);
+		    }
+#endif
 		    raw_mov_l_ri(REG_PAR1,(uae_u32)opcode);
 #if USE_NORMAL_CALLING_CONVENTION
 		    raw_push_l_r(REG_PAR1);
@@ -7038,6 +7154,10 @@ static void compile_block(cpu_history* pc_hist, int blocklen)
 	current_compile_p=get_target();
 	raise_in_cl_list(bi);
 	
+	if (jit_profile_enabled)
+		jit_profile_translated(get_virtual_address((uae_u8 *)pc_hist[0].location), blocklen,
+			(uae_u8 *)bi->direct_handler, current_compile_p - (uae_u8 *)bi->direct_handler);
+	
 	/* We will flush soon, anyway, so let's do it now */
 	if (current_compile_p>=max_compile_start)
 		flush_icache_hard(7);
@@ -7063,6 +7183,10 @@ void do_nothing(void)
 void exec_nostats(void)
 {
 	for (;;)  { 
+#ifdef ENABLE_MON
+		if (HAS_BREAK_POINTS() && IS_BREAK_POINT(m68k_getpc()))
+			m68k_break_point(m68k_getpc(), 0);
+#endif
 		uae_u32 opcode = GET_OPCODE;
 #if FLIGHT_RECORDER
 		m68k_record_step(m68k_getpc());
@@ -7088,6 +7212,10 @@ void execute_normal(void)
 		start_pc = regs.pc; 
 #endif
 		for (;;)  { /* Take note: This is the do-it-normal loop */
+#ifdef ENABLE_MON
+			if (HAS_BREAK_POINTS() && IS_BREAK_POINT(m68k_getpc()))
+				m68k_break_point(m68k_getpc(), blocklen > 0 ? get_virtual_address((uae_u8 *)pc_hist[blocklen-1].location) : 0);
+#endif
 			pc_hist[blocklen++].location = (uae_u16 *)regs.pc_p;
 			uae_u32 opcode = GET_OPCODE;
 #if FLIGHT_RECORDER
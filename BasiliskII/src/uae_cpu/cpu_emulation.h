@@ -22,6 +22,7 @@
 #define CPU_EMULATION_H
 
 #include <string.h>
+#include <vector>
 
 
 /*
@@ -103,4 +104,9 @@ extern "C" void Execute68kTrap(uint16 trap, M68kRegisters *r);	// Execute MacOS
 extern void TriggerInterrupt(void);								// Trigger interrupt level 1 (InterruptFlag must be set first)
 extern void TriggerNMI(void);									// Trigger interrupt level 7
 
+// State save/restore
+extern void Save680x0State(std::vector<uint32> &state);			// Save CPU/FPU state (must be called from Call680x0AtToplevel() callback)
+extern bool Restore680x0State(const std::vector<uint32> &state);	// Restore CPU/FPU state, takes effect at next Start680x0()
+extern void Call680x0AtToplevel(void (*func)(void));			// Call function from the outermost 680x0 execution loop
+
 #endif
@@ -242,6 +242,9 @@ static inline void set_fpiar(uae_u32 new_fpiar);
 extern void fpu_init(bool integral_68040);
 extern void fpu_exit(void);
 extern void fpu_reset(void);
+
+/* Reload host FPU control word from fpcr after restoring a saved context */
+extern void fpu_restore_control(void);
 	
 /* Floating-point arithmetic instructions */
 void fpuop_arithmetic(uae_u32 opcode, uae_u32 extra) REGPARAM;
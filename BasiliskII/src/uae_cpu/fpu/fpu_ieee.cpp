@@ -268,7 +268,7 @@ PRIVATE inline fpu_register FFPU make_extended(uae_u32 wrd1, uae_u32 wrd2, uae_u
 {
 	// is it zero?
 	if ((wrd1 & 0x7fff0000) == 0 && wrd2 == 0 && wrd3 == 0)
-		return 0.0;
+		return (wrd1 & 0x80000000) ? -0.0 : 0.0;
 
 	fpu_register result;
 #if USE_QUAD_DOUBLE
@@ -347,8 +347,11 @@ PRIVATE inline void FFPU make_extended_no_normalize(
 )
 {
 	// is it zero?
-	if ((wrd1 && 0x7fff0000) == 0 && wrd2 == 0 && wrd3 == 0) {
-		make_zero_positive(result);
+	if ((wrd1 & 0x7fff0000) == 0 && wrd2 == 0 && wrd3 == 0) {
+		if (wrd1 & 0x80000000)
+			make_zero_negative(result);
+		else
+			make_zero_positive(result);
 		return;
 	}
 	// is it NaN?
@@ -403,7 +406,8 @@ PRIVATE inline void FFPU extract_extended(fpu_register const & src,
 )
 {
 	if (src == 0.0) {
-		*wrd1 = *wrd2 = *wrd3 = 0;
+		*wrd1 = isneg(src) ? 0x80000000 : 0;
+		*wrd2 = *wrd3 = 0;
 		return;
 	}
 #if USE_QUAD_DOUBLE
@@ -2150,3 +2154,9 @@ PUBLIC void FFPU fpu_reset (void)
 	fpu_exit();
 	fpu_init(FPU is_integral);
 }
+
+PUBLIC void FFPU fpu_restore_control (void)
+{
+	fpu_debug(("fpu_restore_control\n"));
+	set_fpcr(get_fpcr());
+}
@@ -2367,3 +2367,9 @@ void FFPU fpu_reset (void)
 	fpu_exit();
 	fpu_init(FPU is_integral);
 }
+
+void FFPU fpu_restore_control (void)
+{
+	fpu_debug(("fpu_restore_control\n"));
+	set_fpcr(get_fpcr());
+}
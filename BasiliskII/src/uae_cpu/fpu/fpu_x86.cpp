@@ -6124,3 +6124,8 @@ PUBLIC void FFPU fpu_reset( void )
 	fpu_exit();
 	fpu_init(FPU is_integral);
 }
+
+PUBLIC void FFPU fpu_restore_control( void )
+{
+	set_fpcr(get_fpcr());
+}
@@ -1129,7 +1129,17 @@ DEFINE_ROUND_FUNC(nearest, 0x000)
 #endif
 
 #ifndef fp_round_to_nearest
-#define fp_round_to_nearest(x) ((int)((x) + 0.5))
+#define fp_round_to_nearest fp_do_round_to_nearest
+
+// Halfway cases are rounded to even, like the FPU does
+PRIVATE inline fpu_extended fp_do_round_to_nearest(fpu_extended x)
+{
+	fpu_extended value = fp_floor(x);
+	fpu_extended diff = x - value;
+	if (diff > 0.5 || (diff == 0.5 && value != 2 * fp_floor(value / 2)))
+		value += 1;
+	return value;
+}
 #endif
 
 #endif /* FPU_MATHLIB_H */
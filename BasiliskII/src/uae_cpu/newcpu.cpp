@@ -130,6 +130,25 @@ static void dump_regs(void)
 {
 	m68k_dumpstate(NULL);
 }
+
+// Stop in the monitor at a break point
+void m68k_break_point(uaecptr pc, uaecptr last_pc)
+{
+	if (last_pc)
+		printf("Stopped at break point address: %08x. Last PC: %08x\n", pc, last_pc);
+	else
+		printf("Stopped at break point address: %08x\n", pc);
+	m68k_dumpstate(NULL);
+	const char *arg[4] = {"mon", "-m", "-r", NULL};
+	mon(3, arg);
+}
+
+// Called by mon when break points were added or removed, the CPU
+// picks up the new set in m68k_do_specialties()
+static void break_points_changed(void)
+{
+	SPCFLAGS_SET( SPCFLAG_BREAK_POINTS );
+}
 #endif
 
 #define COUNT_INSTRS 0
@@ -1179,6 +1198,25 @@ static const char* ccnames[] =
 // execution only
 static int m68k_execute_depth = 0;
 
+// Function to be called from the outermost execution loop
+static void (*toplevel_callback)(void) = NULL;
+
+// Are we in the outermost execution loop (i.e. not inside an EmulOp)?
+static inline bool m68k_at_toplevel(void)
+{
+	// m68k_compile_execute() doesn't count as a level
+	return m68k_execute_depth == (UseJIT ? 0 : 1);
+}
+
+// Request a call of func from the outermost execution loop, at an
+// instruction boundary where all CPU state is in regs (may be called
+// from other threads)
+void m68k_call_at_toplevel(void (*func)(void))
+{
+	toplevel_callback = func;
+	SPCFLAGS_SET( SPCFLAG_TOPLEVEL_CALLBACK );
+}
+
 void m68k_reset (void)
 {
 	m68k_areg (regs, 7) = 0x2000;
@@ -1209,6 +1247,7 @@ void m68k_reset (void)
 	if (first_time) {
 		first_time = false;
 		mon_add_command("regs", dump_regs, "regs                    Dump m68k emulator registers\n");
+		mon_break_points_changed = break_points_changed;
 #if FLIGHT_RECORDER
 		// Install "log" command in mon
 		mon_add_command("log", dump_log, "log                      Dump m68k emulation log\n");
@@ -1359,6 +1398,22 @@ int m68k_do_specialties (void)
 		SPCFLAGS_CLEAR( SPCFLAG_INT );
 		SPCFLAGS_SET( SPCFLAG_DOINT );
 	}
+	if (SPCFLAGS_TEST( SPCFLAG_TOPLEVEL_CALLBACK ) && m68k_at_toplevel()) {
+		SPCFLAGS_CLEAR( SPCFLAG_TOPLEVEL_CALLBACK );
+		MakeSR();
+		toplevel_callback();
+	}
+#if ENABLE_MON
+	if (SPCFLAGS_TEST( SPCFLAG_BREAK_POINTS )) {
+		// Leave the execution loop so that the right one is chosen
+		// again, and recompile the blocks that cover changed break points
+		SPCFLAGS_CLEAR( SPCFLAG_BREAK_POINTS );
+#if USE_JIT
+		compiler_break_points_changed();
+#endif
+		return 1;
+	}
+#endif
 	if (SPCFLAGS_TEST( SPCFLAG_BRK )) {
 		SPCFLAGS_CLEAR( SPCFLAG_BRK );
 		return 1;
@@ -1366,8 +1421,170 @@ int m68k_do_specialties (void)
 	return 0;
 }
 
+#if ENABLE_MON
+// Execution loop that checks for break points before each instruction,
+// only used while there are any so that the normal loop has no overhead
+static void m68k_do_execute_break_points (void)
+{
+	uaecptr last_pc = 0;
+	for (;;) {
+		uaecptr pc = m68k_getpc();
+		if (IS_BREAK_POINT(pc))
+			m68k_break_point(pc, last_pc);
+		last_pc = pc;
+		uae_u32 opcode = GET_OPCODE;
+#if FLIGHT_RECORDER
+		m68k_record_step(pc);
+#endif
+		(*cpufunctbl[opcode])(opcode);
+		cpu_check_ticks();
+		if (SPCFLAGS_TEST(SPCFLAG_ALL_BUT_EXEC_RETURN)) {
+			if (m68k_do_specialties())
+				return;
+		}
+	}
+}
+#endif
+
+#if M68K_DECODE_CACHE
+bool m68k_use_decode_cache = false;
+
+/*
+ *  Decode cache for the interpreter
+ *
+ *  Straight-line runs of instructions are recorded the first time they
+ *  are interpreted, up to the next branch, jump or return, and later
+ *  replayed from a compact array of {location, opcode, handler} entries.
+ *  This avoids the lookup of every opcode in the 256 KB cpufunctbl[] and
+ *  the per-instruction tick accounting. The handlers still fetch their
+ *  own extension words, and the opcode word is compared with the cached
+ *  one before it is executed, so self-modifying code and code that is
+ *  loaded without a cache flush need no special treatment.
+ *
+ *  As the handlers are the same and the opcode is still fetched, this
+ *  only saves the table lookup, and cpu_bench shows it slower than the
+ *  plain interpreter on most kernels. It is therefore only compiled in
+ *  with M68K_DECODE_CACHE=1 and must then be enabled explicitly.
+ */
+
+static const int DECODE_CACHE_BLOCKS = 16384;	// Number of hash slots (power of two)
+static const int DECODE_CACHE_ENTRIES = 65536;	// Number of instructions in all blocks
+static const int DECODE_BLOCK_MAX = 32;			// Maximum number of instructions per block
+
+struct decode_entry {
+	uae_u8 *location;			// Host address of the instruction
+	cpuop_func *handler;
+	uae_u32 opcode;				// As returned by GET_OPCODE
+};
+
+struct decode_block {
+	uae_u8 *start;				// Host address of first instruction, NULL if free
+	decode_entry *entries;
+	int length;
+};
+
+static decode_block decode_blocks[DECODE_CACHE_BLOCKS];
+static decode_entry decode_pool[DECODE_CACHE_ENTRIES];
+static int decode_pool_used = 0;
+
+static inline decode_block *decode_cache_slot(uae_u8 *pc_p)
+{
+	uintptr a = (uintptr)pc_p;
+	return &decode_blocks[((a >> 1) ^ (a >> 15)) & (DECODE_CACHE_BLOCKS - 1)];
+}
+
+// Interpret instructions until the end of a block and record them
+static bool m68k_decode_block (decode_block *b)
+{
+	// Blocks are never freed individually, start over when the pool is full
+	if (decode_pool_used + DECODE_BLOCK_MAX > DECODE_CACHE_ENTRIES) {
+		memset(decode_blocks, 0, sizeof(decode_blocks));
+		decode_pool_used = 0;
+	}
+	decode_entry *e = decode_pool + decode_pool_used;
+	uae_u8 *start = regs.pc_p;
+	int n = 0;
+	for (;;) {
+		uae_u32 opcode = GET_OPCODE;
+		cpuop_func *handler = cpufunctbl[opcode];
+		e[n].location = regs.pc_p;
+		e[n].handler = handler;
+		e[n].opcode = opcode;
+		n++;
+#if FLIGHT_RECORDER
+		m68k_record_step(m68k_getpc());
+#endif
+		(*handler)(opcode);
+		cpu_check_ticks();
+		bool end = (table68k[cft_map(opcode)].cflow & fl_end_block) || n == DECODE_BLOCK_MAX;
+		if (end || SPCFLAGS_TEST(SPCFLAG_ALL_BUT_EXEC_RETURN)) {
+			// The block may be shorter when it was interrupted, but the
+			// location check in m68k_do_execute_cached() keeps it valid
+			b->start = start;
+			b->entries = e;
+			b->length = n;
+			decode_pool_used += n;
+			if (SPCFLAGS_TEST(SPCFLAG_ALL_BUT_EXEC_RETURN))
+				return m68k_do_specialties();
+			return false;
+		}
+	}
+}
+
+static void m68k_do_execute_cached (void)
+{
+	for (;;) {
+		decode_block *b = decode_cache_slot(regs.pc_p);
+		if (b->start != regs.pc_p) {
+			if (m68k_decode_block(b))
+				return;
+			continue;
+		}
+
+#ifdef USE_CPU_EMUL_SERVICES
+		emulated_ticks -= b->length;
+		if (emulated_ticks <= 0)
+			cpu_do_check_ticks();
+#endif
+		decode_entry *e = b->entries, *end = e + b->length;
+		do {
+			// Leave the block when the program took another path (e.g.
+			// an exception) or the instruction was modified. This also
+			// covers entries reused by a nested m68k_execute() that
+			// flushed the cache, a matching entry is always correct.
+			if (regs.pc_p != e->location || GET_OPCODE != e->opcode) {
+				if (e == b->entries)
+					b->start = NULL;	// Record the block again
+				break;
+			}
+#if FLIGHT_RECORDER
+			m68k_record_step(m68k_getpc());
+#endif
+			(*e->handler)(e->opcode);
+			if (SPCFLAGS_TEST(SPCFLAG_ALL_BUT_EXEC_RETURN)) {
+				if (m68k_do_specialties())
+					return;
+				break;
+			}
+		} while (++e < end);
+	}
+}
+#endif
+
 void m68k_do_execute (void)
 {
+#if ENABLE_MON
+	if (HAS_BREAK_POINTS()) {
+		m68k_do_execute_break_points();
+		return;
+	}
+#endif
+#if M68K_DECODE_CACHE
+	if (m68k_use_decode_cache) {
+		m68k_do_execute_cached();
+		return;
+	}
+#endif
 	for (;;) {
 		uae_u32 opcode = GET_OPCODE;
 #if FLIGHT_RECORDER
@@ -1384,17 +1601,13 @@ void m68k_do_execute (void)
 
 void m68k_execute (void)
 {
-#if USE_JIT
 	++m68k_execute_depth;
-#endif
 	for (;;) {
 		if (quit_program)
 			break;
 		m68k_do_execute();
 	}
-#if USE_JIT
 	--m68k_execute_depth;
-#endif
 }
 
 static void m68k_verify (uaecptr addr, uaecptr *nextpc)
@@ -81,6 +81,18 @@ struct comptbl {
 
 extern void REGPARAM2 op_illg (uae_u32) REGPARAM;
 extern void m68k_dumpstate(uaecptr *nextpc);
+#if ENABLE_MON
+extern void m68k_break_point(uaecptr pc, uaecptr last_pc);
+#endif
+
+// Replay decoded instruction runs in the interpreter (experimental, off by
+// default since it is not faster than the plain interpreter yet)
+#ifndef M68K_DECODE_CACHE
+#define M68K_DECODE_CACHE 0
+#endif
+#if M68K_DECODE_CACHE
+extern bool m68k_use_decode_cache;		// Set to replay instructions from the decode cache
+#endif
 
 typedef char flagtype;
 
@@ -191,42 +203,17 @@ static __inline__ uaecptr m68k_getpc (void)
 
 static __inline__ void m68k_setpc (uaecptr newpc)
 {
-#if ENABLE_MON
-	uae_u32 previous_pc = m68k_getpc();
-#endif
-
 #if REAL_ADDRESSING || DIRECT_ADDRESSING
 	regs.pc_p = get_real_address(newpc);
 #else
 	regs.pc_p = regs.pc_oldp = get_real_address(newpc);
 	regs.pc = newpc;
 #endif
-
-#if ENABLE_MON
-	if (IS_BREAK_POINT(newpc)) {
-		printf("Stopped at break point address: %08x. Last PC: %08x\n", newpc, previous_pc);
-		m68k_dumpstate(NULL);
-		const char *arg[4] = {"mon", "-m", "-r", NULL};
-		mon(3, arg);
-	}
-#endif // end of #if ENABLE_MON
 }
 
 static __inline__ void m68k_incpc (uae_s32 delta)
 {
-#if ENABLE_MON
-	uae_u32 previous_pc = m68k_getpc();
-#endif
 	regs.pc_p += (delta);
-#if ENABLE_MON
-	uaecptr next_pc = m68k_getpc();
-	if (IS_BREAK_POINT(next_pc)) {
-		printf("Stopped at break point address: %08x. Last PC: %08x\n", next_pc, previous_pc);
-		m68k_dumpstate(NULL);
-		const char *arg[4] = {"mon", "-m", "-r", NULL};
-		mon(3, arg);
-	}
-#endif // end of #if ENABLE_MON
 }
 
 /* These are only used by the 68020/68881 code, and therefore don't
@@ -335,6 +322,7 @@ extern void m68k_record_step(uaecptr) REGPARAM;
 #endif
 extern void m68k_do_execute(void);
 extern void m68k_execute(void);
+extern void m68k_call_at_toplevel(void (*func)(void));
 #if USE_JIT
 extern void m68k_compile_execute(void);
 #endif
@@ -39,6 +39,12 @@ enum {
 	SPCFLAG_JIT_END_COMPILE		= 0,
 	SPCFLAG_JIT_EXEC_RETURN		= 0,
 #endif
+	SPCFLAG_TOPLEVEL_CALLBACK	= 0x100,
+#if ENABLE_MON
+	SPCFLAG_BREAK_POINTS		= 0x200,
+#else
+	SPCFLAG_BREAK_POINTS		= 0,
+#endif
 	
 	SPCFLAG_ALL					= SPCFLAG_STOP
 								| SPCFLAG_INT
@@ -48,6 +54,8 @@ enum {
 								| SPCFLAG_DOINT
 								| SPCFLAG_JIT_END_COMPILE
 								| SPCFLAG_JIT_EXEC_RETURN
+								| SPCFLAG_TOPLEVEL_CALLBACK
+								| SPCFLAG_BREAK_POINTS
 								,
 	
 	SPCFLAG_ALL_BUT_EXEC_RETURN	= SPCFLAG_ALL & ~SPCFLAG_JIT_EXEC_RETURN
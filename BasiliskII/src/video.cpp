@@ -952,3 +952,81 @@ int16 VideoDriverStatus(uint32 pb, uint32 dce)
 	else
 		return nsDrvErr;
 }
+
+
+/*
+ *  Save/restore video driver state for snapshots
+ */
+
+const int VIDEO_STATE_WORDS = 10 + 256 * 3 / 4;	// Variables + palette
+
+void monitor_desc::save_state(vector<uint32> &state) const
+{
+	state.push_back(luminance_mapping);
+	state.push_back(interrupts_enabled);
+	state.push_back(dm_present);
+	state.push_back(gamma_table);
+	state.push_back(alloc_gamma_table_size);
+	state.push_back(current_apple_mode);
+	state.push_back(current_id);
+	state.push_back(preferred_apple_mode);
+	state.push_back(preferred_id);
+	state.push_back(slot_param);
+	size_t pos = state.size();
+	state.resize(pos + sizeof(palette) / 4);
+	memcpy(&state[pos], palette, sizeof(palette));
+}
+
+bool monitor_desc::restore_state(vector<uint32>::const_iterator &p, vector<uint32>::const_iterator end)
+{
+	if (end - p < VIDEO_STATE_WORDS)
+		return false;
+
+	// Switch to saved mode if it's not the current one
+	uint16 apple_mode = p[5];
+	uint32 id = p[6];
+	if (apple_mode != current_apple_mode || id != current_id) {
+		vector<video_mode>::const_iterator i = find_mode(apple_mode, id);
+		if (i == invalid_mode())
+			return false;
+		current_mode = i;
+		switch_to_current_mode();
+	}
+
+	luminance_mapping = p[0];
+	interrupts_enabled = p[1];
+	dm_present = p[2];
+	gamma_table = p[3];
+	alloc_gamma_table_size = p[4];
+	current_apple_mode = apple_mode;
+	current_id = id;
+	preferred_apple_mode = p[7];
+	preferred_id = p[8];
+	slot_param = p[9];
+	memcpy(palette, &p[10], sizeof(palette));
+	p += VIDEO_STATE_WORDS;
+
+	set_palette(palette, palette_size(current_mode->depth));
+	return true;
+}
+
+void VideoSaveState(vector<uint32> &state)
+{
+	state.clear();
+	state.push_back(VideoMonitors.size());
+	vector<monitor_desc *>::const_iterator i, end = VideoMonitors.end();
+	for (i = VideoMonitors.begin(); i != end; ++i)
+		(*i)->save_state(state);
+}
+
+bool VideoRestoreState(const vector<uint32> &state)
+{
+	if (state.empty() || state[0] != VideoMonitors.size())
+		return false;
+	vector<uint32>::const_iterator p = state.begin() + 1;
+	vector<monitor_desc *>::const_iterator i, end = VideoMonitors.end();
+	for (i = VideoMonitors.begin(); i != end; ++i)
+		if (!(*i)->restore_state(p, state.end()))
+			return false;
+	return p == state.end();
+}
@@ -0,0 +1 @@
+../../../BasiliskII/src/CrossPlatform/jit_profile.cpp
\ No newline at end of file
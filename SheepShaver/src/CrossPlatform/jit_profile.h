@@ -0,0 +1 @@
+../../../BasiliskII/src/CrossPlatform/jit_profile.h
\ No newline at end of file
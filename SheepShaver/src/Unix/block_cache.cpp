@@ -0,0 +1 @@
+../../../BasiliskII/src/Unix/block_cache.cpp
\ No newline at end of file
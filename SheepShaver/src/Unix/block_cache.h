@@ -0,0 +1 @@
+../../../BasiliskII/src/Unix/block_cache.h
\ No newline at end of file
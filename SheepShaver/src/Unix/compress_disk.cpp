@@ -0,0 +1 @@
+../../../BasiliskII/src/Unix/compress_disk.cpp
\ No newline at end of file
@@ -0,0 +1 @@
+../../../BasiliskII/src/Unix/disk_compressed.h
\ No newline at end of file
@@ -113,6 +113,13 @@
 #include "sigsegv.h"
 #include "sigregs.h"
 #include "rpc.h"
+#include "disk.h"
+#include "sony.h"
+#include "cdrom.h"
+#include "extfs.h"
+#include "thunks.h"
+#include "snapshot_unix.h"
+#include "mp_tasks.h"
 
 #define DEBUG 0
 #include "debug.h"
@@ -126,7 +133,7 @@
 #include <SDL.h>
 #endif
 
-#ifndef USE_SDL_VIDEO
+#if !defined(USE_SDL_VIDEO) && !defined(USE_HEADLESS_VIDEO)
 #include <X11/Xlib.h>
 #endif
 
@@ -193,7 +200,7 @@ uint8 *ROMBaseHost;		// Base address of Mac ROM (host address space)
 
 
 // Global variables
-#ifndef USE_SDL_VIDEO
+#if !defined(USE_SDL_VIDEO) && !defined(USE_HEADLESS_VIDEO)
 char *x_display_name = NULL;				// X11 display name
 Display *x_display = NULL;					// X11 display handle
 #ifdef X11_LOCK_TYPE
@@ -212,6 +219,10 @@ static EmulatorData *emulator_data;
 
 static uint8 last_xpram[XPRAM_SIZE];		// Buffer for monitoring XPRAM changes
 
+#if EMULATED_PPC
+static int32 snapshot_save_delay = 0;		// Seconds until snapshot is saved (0 = never)
+#endif
+
 static bool nvram_thread_active = false;	// Flag: NVRAM watchdog installed
 static volatile bool nvram_thread_cancel;	// Flag: Cancel NVRAM thread
 static pthread_t nvram_thread;				// NVRAM watchdog
@@ -253,6 +264,8 @@ static void *emul_func(void *arg);
 static void *nvram_func(void *arg);
 static void *tick_func(void *arg);
 #if EMULATED_PPC
+static void snapshot_restore(void);
+static void snapshot_save(void);
 extern void emul_ppc(uint32 start);
 extern void init_emul_ppc(void);
 extern void exit_emul_ppc(void);
@@ -339,14 +352,14 @@ int atomic_or(int *var, int v)
  *  Memory management helpers
  */
 
-static inline uint8 *vm_mac_acquire(uint32 size)
+static inline uint8 *vm_mac_acquire(uint32 size, int options = VM_MAP_DEFAULT)
 {
-	return (uint8 *)vm_acquire(size);
+	return (uint8 *)vm_acquire(size, options);
 }
 
-static inline int vm_mac_acquire_fixed(uint32 addr, uint32 size)
+static inline int vm_mac_acquire_fixed(uint32 addr, uint32 size, int options = VM_MAP_DEFAULT)
 {
-	return vm_acquire_fixed(Mac2HostAddr(addr), size);
+	return vm_acquire_fixed(Mac2HostAddr(addr), size, options);
 }
 
 static inline int vm_mac_release(uint32 addr, uint32 size)
@@ -708,6 +721,7 @@ int main(int argc, char **argv)
 	char str[256];
 	bool memory_mapped_from_zero, ram_rom_areas_contiguous;
 	const char *vmdir = NULL;
+	const char *huge_pages;
 
 	// Initialize variables
 	RAMBase = 0;
@@ -732,7 +746,7 @@ int main(int argc, char **argv)
 	for (int i=1; i<argc; i++) {
 		if (strcmp(argv[i], "--help") == 0) {
 			usage(argv[0]);
-#ifndef USE_SDL_VIDEO
+#if !defined(USE_SDL_VIDEO) && !defined(USE_HEADLESS_VIDEO)
 		} else if (strcmp(argv[i], "--display") == 0) {
 			i++;
 			if (i < argc)
@@ -803,7 +817,7 @@ int main(int argc, char **argv)
 		goto quit;
 #endif
 
-#ifndef USE_SDL_VIDEO
+#if !defined(USE_SDL_VIDEO) && !defined(USE_HEADLESS_VIDEO)
 	// Open display
 	x_display = XOpenDisplay(x_display_name);
 	if (x_display == NULL) {
@@ -831,6 +845,14 @@ int main(int argc, char **argv)
 	// Initialize VM system
 	vm_init();
 
+	// Back RAM, ROM and JIT caches with huge pages, if requested
+	huge_pages = PrefsFindString("hugepages");
+	if (huge_pages && strcmp(huge_pages, "none") != 0) {
+		int mode = strcmp(huge_pages, "explicit") == 0 ? VM_HUGE_PAGES_EXPLICIT : VM_HUGE_PAGES_TRANSPARENT;
+		if (vm_set_huge_pages(mode) < 0)
+			printf("WARNING: Huge pages are not supported on this platform\n");
+	}
+
 	// Get system info
 	get_system_info();
 
@@ -903,7 +925,7 @@ int main(int argc, char **argv)
 	memory_mapped_from_zero = false;
 	ram_rom_areas_contiguous = false;
 #if REAL_ADDRESSING && HAVE_LINKER_SCRIPT
-	if (vm_mac_acquire_fixed(0, RAMSize) == 0) {
+	if (vm_mac_acquire_fixed(0, RAMSize, VM_MAP_DEFAULT | VM_MAP_HUGE) == 0) {
 		D(bug("Could allocate RAM from 0x0000\n"));
 		RAMBase = 0;
 		RAMBaseHost = Mac2HostAddr(RAMBase);
@@ -934,7 +956,7 @@ int main(int argc, char **argv)
 		ROMBaseHost = Mac2HostAddr(ROMBase);
 		ram_rom_areas_contiguous = true;
 #else
-		if (vm_mac_acquire_fixed(RAM_BASE, RAMSize) < 0) {
+		if (vm_mac_acquire_fixed(RAM_BASE, RAMSize, VM_MAP_DEFAULT | VM_MAP_HUGE) < 0) {
 			sprintf(str, GetString(STR_RAM_MMAP_ERR), strerror(errno));
 			ErrorAlert(str);
 			goto quit;
@@ -952,6 +974,7 @@ int main(int argc, char **argv)
 #endif
 	ram_area_mapped = true;
 	D(bug("RAM area at %p (%08x)\n", RAMBaseHost, RAMBase));
+	vm_report_huge_pages("RAM", RAMBaseHost, RAMSize);
 
 	if (RAMBase > KernelDataAddr) {
 		ErrorAlert(GetString(STR_RAM_AREA_TOO_HIGH_ERR));
@@ -960,7 +983,7 @@ int main(int argc, char **argv)
 	
 	// Create area for Mac ROM
 	if (!ram_rom_areas_contiguous) {
-		if (vm_mac_acquire_fixed(ROM_BASE, ROM_AREA_SIZE) < 0) {
+		if (vm_mac_acquire_fixed(ROM_BASE, ROM_AREA_SIZE, VM_MAP_DEFAULT | VM_MAP_HUGE) < 0) {
 			sprintf(str, GetString(STR_ROM_MMAP_ERR), strerror(errno));
 			ErrorAlert(str);
 			goto quit;
@@ -977,6 +1000,7 @@ int main(int argc, char **argv)
 #endif
 	rom_area_mapped = true;
 	D(bug("ROM area at %p (%08x)\n", ROMBaseHost, ROMBase));
+	vm_report_huge_pages("ROM", ROMBaseHost, ROM_AREA_SIZE);
 
 	if (RAMBase > ROMBase) {
 		ErrorAlert(GetString(STR_RAM_HIGHER_THAN_ROM_ERR));
@@ -992,6 +1016,13 @@ int main(int argc, char **argv)
 		goto quit;
 	D(bug("Initialization complete\n"));
 
+#if EMULATED_PPC
+	// Resume from snapshot if there is one
+	snapshot_restore();
+	if (PrefsFindString("snapshot"))
+		snapshot_save_delay = PrefsFindInt32("snapshotsave");
+#endif
+
 	// Clear caches (as we loaded and patched code) and write protect ROM
 #if !EMULATED_PPC
 	flush_icache_range(ROMBase, ROMBase + ROM_AREA_SIZE);
@@ -1057,6 +1088,11 @@ quit:
 
 static void Quit(void)
 {
+#if USE_HOST_MP_TASKS
+	// Stop MP task threads, they run on PowerPC emulators of their own
+	MPTasksExit();
+#endif
+
 #if EMULATED_PPC
 	// Exit PowerPC emulation
 	exit_emul_ppc();
@@ -1137,7 +1173,7 @@ static void Quit(void)
 #endif
 
 	// Close X11 server connection
-#ifndef USE_SDL_VIDEO
+#if !defined(USE_SDL_VIDEO) && !defined(USE_HEADLESS_VIDEO)
 	if (x_display)
 		XCloseDisplay(x_display);
 #endif
@@ -1343,6 +1379,170 @@ static void *nvram_func(void *arg)
 }
 
 
+/*
+ *  Snapshot support
+ */
+
+#if EMULATED_PPC
+// Configuration a snapshot must have been taken with
+struct snapshot_config {
+	uint32 ram_base;
+	uint32 ram_size;
+	uint32 rom_base;
+	uint32 rom_checksum;
+	int32 rom_type;
+	uint32 pvr;
+	int32 video_mode;
+	uint32 lm_area_mapped;
+};
+
+static void get_snapshot_config(snapshot_config &c)
+{
+	memset(&c, 0, sizeof(c));
+	c.ram_base = RAMBase;
+	c.ram_size = RAMSize;
+	c.rom_base = ROMBase;
+	c.rom_checksum = *(uint32 *)ROMBaseHost;
+	c.rom_type = ROMType;
+	c.pvr = PVR;
+	c.video_mode = cur_mode;
+	c.lm_area_mapped = lm_area_mapped;
+}
+
+// Host-side state of drivers and managers
+static const struct {
+	uint32 tag;
+	void (*save)(std::vector<uint32> &state);
+	bool (*restore)(const std::vector<uint32> &state);
+} snapshot_modules[] = {
+	{SNAPSHOT_TAG_SHEEPMEM_PTRS, SheepMem::SaveState, SheepMem::RestoreState},
+	{SNAPSHOT_TAG_TIMER, TimerSaveState, TimerRestoreState},
+	{SNAPSHOT_TAG_SONY, SonySaveState, SonyRestoreState},
+	{SNAPSHOT_TAG_DISK, DiskSaveState, DiskRestoreState},
+	{SNAPSHOT_TAG_CDROM, CDROMSaveState, CDROMRestoreState},
+	{SNAPSHOT_TAG_EXTFS, ExtFSSaveState, ExtFSRestoreState},
+	{SNAPSHOT_TAG_VIDEO, VideoSaveState, VideoRestoreState}
+};
+
+// Memory areas outside of RAM and ROM; they are shared, aliased or
+// partly read-only, so they are copied instead of mapped
+static const struct {
+	uint32 tag;
+	uint32 base;
+	uint32 size;
+} snapshot_areas[] = {
+	{SNAPSHOT_TAG_KERNEL, KERNEL_DATA_BASE, KERNEL_AREA_SIZE},
+	{SNAPSHOT_TAG_DR_EMUL, DR_EMULATOR_BASE, DR_EMULATOR_SIZE},
+	{SNAPSHOT_TAG_DR_CACHE, DR_CACHE_BASE, DR_CACHE_SIZE},
+	{SNAPSHOT_TAG_SHEEPMEM, 0, 0},		// Filled in at run-time
+	{SNAPSHOT_TAG_LOWMEM, 0, 0x3000}	// Only if mapped separately from RAM
+};
+
+static bool snapshot_area(int i, uint32 &base, uint32 &size)
+{
+	base = snapshot_areas[i].base;
+	size = snapshot_areas[i].size;
+	switch (snapshot_areas[i].tag) {
+	case SNAPSHOT_TAG_SHEEPMEM:
+		base = SheepMem::Base();
+		size = SheepMem::Size();
+		break;
+	case SNAPSHOT_TAG_LOWMEM:
+		return lm_area_mapped;
+	}
+	return true;
+}
+
+// Save snapshot (called from the PowerPC execution loop)
+static void snapshot_save(void)
+{
+	const char *path = PrefsFindString("snapshot");
+	uint64 start = GetTicks_usec();
+
+	bool ok = false;
+	snapshot_file *s = snapshot_create(path);
+	if (s) {
+		snapshot_config config;
+		get_snapshot_config(config);
+		ok = snapshot_write_data(s, SNAPSHOT_TAG_CONFIG, &config, sizeof(config));
+
+		std::vector<uint32> state;
+		SavePPCState(state);
+		ok = ok && snapshot_write_data(s, SNAPSHOT_TAG_CPU, state);
+		ok = ok && snapshot_write_memory(s, SNAPSHOT_TAG_RAM, RAMBaseHost, RAMSize);
+		ok = ok && snapshot_write_memory(s, SNAPSHOT_TAG_ROM, ROMBaseHost, ROM_AREA_SIZE);
+		for (int i = 0; ok && i < (int)(sizeof(snapshot_areas) / sizeof(snapshot_areas[0])); i++) {
+			uint32 base, size;
+			if (snapshot_area(i, base, size))
+				ok = snapshot_write_memory(s, snapshot_areas[i].tag, Mac2HostAddr(base), size);
+		}
+		ok = ok && snapshot_write_data(s, SNAPSHOT_TAG_XPRAM, XPRAM, XPRAM_SIZE);
+		for (int i = 0; ok && i < (int)(sizeof(snapshot_modules) / sizeof(snapshot_modules[0])); i++) {
+			snapshot_modules[i].save(state);
+			ok = snapshot_write_data(s, snapshot_modules[i].tag, state);
+		}
+		ok = ok && snapshot_write_data(s, SNAPSHOT_TAG_FRAME, Mac2HostAddr(screen_base), VModes[cur_mode].viRowBytes * VModes[cur_mode].viYsize);
+
+		if (ok)
+			ok = snapshot_commit(s);
+		else
+			snapshot_close(s);
+	}
+
+	if (ok)
+		printf("Snapshot saved to %s in %d ms\n", path, int((GetTicks_usec() - start) / 1000));
+	else
+		printf("WARNING: Cannot save snapshot to %s (%s)\n", path, strerror(errno));
+
+	if (PrefsFindBool("snapshotquit"))
+		QuitEmulator();
+}
+
+// Restore snapshot before starting the PowerPC (RAM and ROM are mapped copy-on-write)
+static void snapshot_restore(void)
+{
+	const char *path = PrefsFindString("snapshot");
+	if (path == NULL || access(path, F_OK) < 0)
+		return;
+	uint64 start = GetTicks_usec();
+
+	snapshot_config config, saved_config;
+	get_snapshot_config(config);
+	snapshot_file *s = snapshot_open(path);
+	if (s == NULL
+	 || !snapshot_read_data(s, SNAPSHOT_TAG_CONFIG, &saved_config, sizeof(saved_config))
+	 || memcmp(&config, &saved_config, sizeof(config)) != 0) {
+		printf("WARNING: Snapshot %s is invalid or doesn't match the current configuration, ignored\n", path);
+		if (s)
+			snapshot_close(s);
+		return;
+	}
+
+	// From here on, there is no way back to a clean boot
+	std::vector<uint32> state;
+	bool ok = snapshot_read_data(s, SNAPSHOT_TAG_CPU, state) && RestorePPCState(state);
+	ok = ok && snapshot_map_memory(s, SNAPSHOT_TAG_RAM, RAMBaseHost, RAMSize);
+	ok = ok && snapshot_map_memory(s, SNAPSHOT_TAG_ROM, ROMBaseHost, ROM_AREA_SIZE);
+	for (int i = 0; ok && i < (int)(sizeof(snapshot_areas) / sizeof(snapshot_areas[0])); i++) {
+		uint32 base, size;
+		if (snapshot_area(i, base, size))
+			ok = snapshot_read_memory(s, snapshot_areas[i].tag, Mac2HostAddr(base), size);
+	}
+	ok = ok && snapshot_read_data(s, SNAPSHOT_TAG_XPRAM, XPRAM, XPRAM_SIZE);
+	for (int i = 0; ok && i < (int)(sizeof(snapshot_modules) / sizeof(snapshot_modules[0])); i++)
+		ok = snapshot_read_data(s, snapshot_modules[i].tag, state) && snapshot_modules[i].restore(state);
+	ok = ok && snapshot_read_data(s, SNAPSHOT_TAG_FRAME, Mac2HostAddr(screen_base), VModes[cur_mode].viRowBytes * VModes[cur_mode].viYsize);
+	snapshot_close(s);
+
+	if (!ok) {
+		ErrorAlert("Cannot restore snapshot, the file is damaged.");
+		QuitEmulator();
+	}
+	printf("Snapshot restored from %s in %d ms\n", path, int((GetTicks_usec() - start) / 1000));
+}
+#endif
+
+
 /*
  *  60Hz thread (really 60.15Hz)
  */
@@ -1413,6 +1613,12 @@ static void *tick_func(void *arg)
 		if (++tick_counter > 60) {
 			tick_counter = 0;
 			WriteMacInt32(0x20c, TimerDateTime());
+
+#if EMULATED_PPC
+			// Save snapshot when the requested time has passed
+			if (snapshot_save_delay > 0 && --snapshot_save_delay == 0)
+				CallPPCAtToplevel(snapshot_save);
+#endif
 		}
 
 		// Trigger 60Hz interrupt
@@ -2177,6 +2383,23 @@ bool SheepMem::Init(void)
 	return true;
 }
 
+void SheepMem::SaveState(std::vector<uint32> &state)
+{
+	state.clear();
+	state.push_back(proc);
+	state.push_back(data);
+}
+
+bool SheepMem::RestoreState(const std::vector<uint32> &state)
+{
+	// Procedures created after the snapshot must not overwrite older ones
+	if (state.size() != 2 || state[0] < base || state[1] > base + size || state[0] > state[1])
+		return false;
+	proc = state[0];
+	data = state[1];
+	return true;
+}
+
 void SheepMem::Exit(void)
 {
 	if (data) {
@@ -2245,7 +2468,7 @@ void ErrorAlert(const char *text)
 			rpc_method_wait_for_reply(gui_connection, RPC_TYPE_INVALID) == RPC_ERROR_NO_ERROR)
 			return;
 	}
-#if defined(ENABLE_GTK) && !defined(USE_SDL_VIDEO)
+#if defined(ENABLE_GTK) && !defined(USE_SDL_VIDEO) && !defined(USE_HEADLESS_VIDEO)
 	if (PrefsFindBool("nogui") || x_display == NULL) {
 		printf(GetString(STR_SHELL_ERROR_PREFIX), text);
 		return;
@@ -2269,7 +2492,7 @@ void WarningAlert(const char *text)
 			rpc_method_wait_for_reply(gui_connection, RPC_TYPE_INVALID) == RPC_ERROR_NO_ERROR)
 			return;
 	}
-#if defined(ENABLE_GTK) && !defined(USE_SDL_VIDEO)
+#if defined(ENABLE_GTK) && !defined(USE_SDL_VIDEO) && !defined(USE_HEADLESS_VIDEO)
 	if (PrefsFindBool("nogui") || x_display == NULL) {
 		printf(GetString(STR_SHELL_WARNING_PREFIX), text);
 		return;
@@ -0,0 +1,1173 @@
+/*
+ *  mp_tasks_unix.cpp - Multiprocessing Services tasks on host threads
+ *
+ *  SheepShaver (C) 1997-2008 Christian Bauer and Marc Hellwig
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+/*
+ *  The NanoKernel runs MP tasks on the single emulated processor. When
+ *  SheepShaver is configured with --enable-mp-tasks and the "mptasks"
+ *  pref is set, the exported MPLibrary entry points listed
+ *  below are redirected to this module instead: each task gets its own
+ *  host thread and PowerPC emulator, and queues, semaphores, critical
+ *  regions and events are built on host mutexes and condition variables.
+ *  The calling Mac OS process (the "blue task") keeps running on the
+ *  main emulator. Timers and notifications are redirected as well but
+ *  fail with kMPInsufficientResourcesErr, as the NanoKernel versions
+ *  can't reach the objects of this module.
+ */
+
+#include "sysdeps.h"
+#include "cpu_emulation.h"
+#include "main.h"
+#include "prefs.h"
+#include "macos_util.h"
+#include "thunks.h"
+#include "mp_tasks.h"
+
+#if USE_HOST_MP_TASKS
+
+#include <map>
+#include <deque>
+#include <errno.h>
+#include <sched.h>
+#include <unistd.h>
+#include <sys/time.h>
+
+#define DEBUG 0
+#include "debug.h"
+
+
+// Error codes
+enum {
+	kMPInvalidIDErr					= -29299,
+	kMPInsufficientResourcesErr		= -29298,
+	kMPTaskAbortedErr				= -29297,
+	kMPTimeoutErr					= -29296,
+	kMPDeletedErr					= -29295
+};
+
+// Durations
+const int32 kDurationImmediate = 0;
+const int32 kDurationForever = 0x7fffffff;
+
+// MPAllocateAligned() options
+const uint32 kMPAllocateClearMask = 0x0001;
+
+// Default task stack size
+const uint32 MP_DEFAULT_STACK_SIZE = 64 * 1024;
+
+// Size of system heap chunks the allocation pool grows by
+const uint32 MP_POOL_CHUNK_SIZE = 1024 * 1024;
+
+// Number of task storage indexes
+const uint32 MP_TASK_STORAGE_SIZE = 64;
+
+
+/*
+ *  Objects, the IDs handed out to MacOS are keys into mp_objects
+ */
+
+enum {
+	MP_TASK,
+	MP_QUEUE,
+	MP_SEMAPHORE,
+	MP_CRITICAL_REGION,
+	MP_EVENT
+};
+
+struct mp_object {
+	int type;
+	uint32 id;
+	int waiters;					// Threads blocked on the object
+	bool deleted;
+	pthread_cond_t cond;
+
+	mp_object(int t) : type(t), id(0), waiters(0), deleted(false)
+		{ pthread_cond_init(&cond, NULL); }
+	virtual ~mp_object()
+		{ pthread_cond_destroy(&cond); }
+};
+
+struct mp_task : public mp_object {
+	uint32 entry;					// TVECT of task entry point
+	uint32 param;
+	uint32 stack, stack_size;
+	uint32 notify_queue;
+	uint32 term1, term2;
+	int32 status;					// Termination status
+	bool terminated;				// Stopped by MPExit() or MPTerminateTask()
+	void *cpu;						// Emulator running the task (NULL for the blue task)
+	pthread_cond_t *blocked_on;		// Condition the task is waiting on
+	uint32 storage[MP_TASK_STORAGE_SIZE];	// Task storage values
+
+	mp_task() : mp_object(MP_TASK), entry(0), param(0), stack(0), stack_size(0),
+		notify_queue(0), term1(0), term2(0), status(0), terminated(false),
+		cpu(NULL), blocked_on(NULL)
+		{ memset(storage, 0, sizeof(storage)); }
+};
+
+struct mp_message {
+	uint32 p1, p2, p3;
+};
+
+struct mp_queue : public mp_object {
+	std::deque<mp_message> messages;
+	mp_queue() : mp_object(MP_QUEUE) { }
+};
+
+struct mp_semaphore : public mp_object {
+	uint32 value, max_value;
+	mp_semaphore() : mp_object(MP_SEMAPHORE) { }
+};
+
+struct mp_critical_region : public mp_object {
+	mp_task *owner;
+	uint32 count;
+	mp_critical_region() : mp_object(MP_CRITICAL_REGION), owner(NULL), count(0) { }
+};
+
+struct mp_event : public mp_object {
+	uint32 flags;
+	mp_event() : mp_object(MP_EVENT), flags(0) { }
+};
+
+// Global lock protecting all objects and the allocation pool
+static pthread_mutex_t mp_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static std::map<uint32, mp_object *> mp_objects;
+static uint32 mp_next_id = 0x4d500000;	// 'MP'
+
+// The MacOS process calling into MPLibrary
+static mp_task *blue_task = NULL;
+
+// Task of the calling thread, if not the blue task
+static pthread_key_t current_task_key;
+
+// Number of running task threads, task_exit_cond is signaled when it drops to 0
+static int task_count = 0;
+static pthread_cond_t task_exit_cond = PTHREAD_COND_INITIALIZER;
+
+// Allocated task storage indexes
+static bool storage_allocated[MP_TASK_STORAGE_SIZE];
+
+static inline mp_task *current_task(void)
+{
+	mp_task *task = (mp_task *)pthread_getspecific(current_task_key);
+	return task ? task : blue_task;
+}
+
+// Enter object into the ID table
+static uint32 new_object(mp_object *obj)
+{
+	do {
+		mp_next_id += 4;
+	} while (mp_next_id == 0 || mp_objects.find(mp_next_id) != mp_objects.end());
+	obj->id = mp_next_id;
+	mp_objects[obj->id] = obj;
+	return obj->id;
+}
+
+// Look up object of specified type, NULL if ID is invalid
+static mp_object *find_object(uint32 id, int type)
+{
+	std::map<uint32, mp_object *>::const_iterator it = mp_objects.find(id);
+	if (it == mp_objects.end() || it->second->type != type)
+		return NULL;
+	return it->second;
+}
+
+// Remove object from the ID table, it is freed once the last waiter left
+static void delete_object(mp_object *obj)
+{
+	mp_objects.erase(obj->id);
+	obj->deleted = true;
+	if (obj->waiters)
+		pthread_cond_broadcast(&obj->cond);
+	else
+		delete obj;
+}
+
+
+/*
+ *  Blocking with Duration timeouts, mp_lock must be held
+ */
+
+class mp_waiter {
+	mp_object *obj;
+	mp_task *task;
+	int32 duration;
+	struct timespec deadline;
+public:
+	mp_waiter(mp_object *o, int32 timeout);
+	~mp_waiter();
+	int32 wait(void);
+};
+
+mp_waiter::mp_waiter(mp_object *o, int32 timeout)
+	: obj(o), task(current_task()), duration(timeout)
+{
+	obj->waiters++;
+	if (duration != kDurationImmediate && duration != kDurationForever) {
+		// Positive durations are in milliseconds, negative ones in microseconds
+		uint64 nsec = duration > 0 ? (uint64)duration * 1000000 : (uint64)-(int64)duration * 1000;
+		struct timeval now;
+		gettimeofday(&now, NULL);
+		nsec += (uint64)now.tv_usec * 1000;
+		deadline.tv_sec = now.tv_sec + nsec / 1000000000;
+		deadline.tv_nsec = nsec % 1000000000;
+	}
+}
+
+mp_waiter::~mp_waiter()
+{
+	if (--obj->waiters == 0 && obj->deleted)
+		delete obj;
+}
+
+// Wait for the object to be signaled, returns noErr or why it can't be
+int32 mp_waiter::wait(void)
+{
+	if (obj->deleted)
+		return kMPDeletedErr;
+	if (task->terminated)
+		return kMPTaskAbortedErr;
+	if (duration == kDurationImmediate)
+		return kMPTimeoutErr;
+	task->blocked_on = &obj->cond;
+	int error = 0;
+	if (duration == kDurationForever)
+		pthread_cond_wait(&obj->cond, &mp_lock);
+	else
+		error = pthread_cond_timedwait(&obj->cond, &mp_lock, &deadline);
+	task->blocked_on = NULL;
+	if (obj->deleted)
+		return kMPDeletedErr;
+	if (task->terminated)
+		return kMPTaskAbortedErr;
+	return error == ETIMEDOUT ? (int32)kMPTimeoutErr : (int32)noErr;
+}
+
+
+/*
+ *  Allocation pool for MPAllocateAligned() and task stacks
+ *
+ *  Task threads can't call the Memory Manager, so blocks are carved
+ *  out of system heap chunks the blue task allocates on demand
+ */
+
+static std::map<uint32, uint32> pool_free;	// Address -> size
+static std::map<uint32, uint32> pool_used;
+
+static uint32 pool_alloc(uint32 size, uint32 align)
+{
+	size = (size + 15) & -16;
+	std::map<uint32, uint32>::iterator it;
+	for (it = pool_free.begin(); it != pool_free.end(); ++it) {
+		const uint32 start = it->first, end = it->first + it->second;
+		const uint32 addr = (start + align - 1) & -align;
+		if (addr < start || addr + size > end)
+			continue;
+		pool_free.erase(it);
+		if (addr > start)
+			pool_free[start] = addr - start;
+		if (addr + size < end)
+			pool_free[addr + size] = end - (addr + size);
+		pool_used[addr] = size;
+		return addr;
+	}
+	return 0;
+}
+
+static void pool_release(uint32 addr)
+{
+	std::map<uint32, uint32>::iterator it = pool_used.find(addr);
+	if (it == pool_used.end())
+		return;
+	uint32 size = it->second;
+	pool_used.erase(it);
+
+	// Coalesce with the following and preceding free blocks
+	it = pool_free.find(addr + size);
+	if (it != pool_free.end()) {
+		size += it->second;
+		pool_free.erase(it);
+	}
+	it = pool_free.lower_bound(addr);
+	if (it != pool_free.begin()) {
+		--it;
+		if (it->first + it->second == addr) {
+			it->second += size;
+			return;
+		}
+	}
+	pool_free[addr] = size;
+}
+
+// Add a system heap chunk with room for a block to the pool, must be
+// called by the blue task; mp_lock is dropped while the chunk is allocated
+static bool pool_grow(uint32 size, uint32 align)
+{
+	uint32 chunk_size = size + align > MP_POOL_CHUNK_SIZE ? size + align : MP_POOL_CHUNK_SIZE;
+	pthread_mutex_unlock(&mp_lock);
+	uint32 chunk = Mac_sysalloc(chunk_size);
+	pthread_mutex_lock(&mp_lock);
+	if (chunk == 0)
+		return false;
+	D(bug("MP pool grows by %d bytes at %08x\n", chunk_size, chunk));
+	pool_used[chunk] = chunk_size;
+	pool_release(chunk);
+	return true;
+}
+
+// Allocate block, growing the pool if called from the blue task
+static uint32 pool_alloc_grow(uint32 size, uint32 align)
+{
+	uint32 addr = pool_alloc(size, align);
+	if (addr == 0 && current_task() == blue_task && pool_grow(size, align))
+		addr = pool_alloc(size, align);
+	return addr;
+}
+
+
+/*
+ *  Tasks
+ */
+
+static void *task_func(void *arg)
+{
+	mp_task *task = (mp_task *)arg;
+	pthread_setspecific(current_task_key, task);
+	void *cpu = NewTaskCPU();
+
+	pthread_mutex_lock(&mp_lock);
+	task->cpu = cpu;
+	bool run = !task->terminated;
+	pthread_mutex_unlock(&mp_lock);
+
+	D(bug("MP task %08x starts at TVECT %08x\n", task->id, task->entry));
+	uint32 result = 0;
+	if (run)
+		result = ExecuteTaskCPU(cpu, task->entry, task->param, task->stack + task->stack_size);
+
+	pthread_mutex_lock(&mp_lock);
+	task->cpu = NULL;
+	pthread_mutex_unlock(&mp_lock);
+	DeleteTaskCPU(cpu);
+
+	pthread_mutex_lock(&mp_lock);
+	if (!task->terminated)
+		task->status = result;
+	D(bug("MP task %08x ends with status %d\n", task->id, task->status));
+	mp_queue *q = (mp_queue *)find_object(task->notify_queue, MP_QUEUE);
+	if (q) {
+		mp_message msg = { task->term1, task->term2, (uint32)task->status };
+		q->messages.push_back(msg);
+		pthread_cond_signal(&q->cond);
+	}
+	pool_release(task->stack);
+	if (--task_count == 0)
+		pthread_cond_broadcast(&task_exit_cond);
+	delete_object(task);
+	pthread_mutex_unlock(&mp_lock);
+	return NULL;
+}
+
+// Stop TASK, mp_lock must be held
+static void terminate_task(mp_task *task, int32 status)
+{
+	if (task->terminated)
+		return;
+	task->terminated = true;
+	task->status = status;
+	if (task->blocked_on)
+		pthread_cond_broadcast(task->blocked_on);
+	if (task->cpu)
+		StopTaskCPU(task->cpu);
+}
+
+static int32 mp_processors(void)
+{
+	long n = sysconf(_SC_NPROCESSORS_ONLN);
+	if (n < 1)
+		n = 1;
+	if (n > KPX_MAX_CPUS)
+		n = KPX_MAX_CPUS;
+	return n;
+}
+
+// ItemCount MPProcessors(void)
+static uint32 MPProcessors(const uint32 *)
+{
+	return mp_processors();
+}
+
+// ItemCount MPProcessorsScheduled(void)
+static uint32 MPProcessorsScheduled(const uint32 *)
+{
+	return mp_processors();
+}
+
+// OSStatus MPCreateTask(TaskProc entryPoint, void *parameter, ByteCount stackSize, MPQueueID notifyQueue,
+//                       void *terminationParameter1, void *terminationParameter2, MPTaskOptions options, MPTaskID *task)
+static uint32 MPCreateTask(const uint32 *args)
+{
+	if (args[0] == 0 || args[7] == 0)
+		return (uint32)paramErr;
+
+	const uint32 stack_size = args[2] ? (args[2] + 15) & -16 : MP_DEFAULT_STACK_SIZE;
+	uint32 stack;
+	pthread_mutex_lock(&mp_lock);
+	for (;;) {
+		if (args[3] && find_object(args[3], MP_QUEUE) == NULL) {
+			pthread_mutex_unlock(&mp_lock);
+			return (uint32)kMPInvalidIDErr;
+		}
+		if (task_count >= KPX_MAX_CPUS - 1) {
+			pthread_mutex_unlock(&mp_lock);
+			return (uint32)kMPInsufficientResourcesErr;
+		}
+
+		// Growing the pool drops mp_lock, so check again before
+		// taking the stack out of it
+		stack = pool_alloc(stack_size, 16);
+		if (stack || current_task() != blue_task || !pool_grow(stack_size, 16))
+			break;
+	}
+	if (stack == 0) {
+		pthread_mutex_unlock(&mp_lock);
+		return (uint32)kMPInsufficientResourcesErr;
+	}
+
+	mp_task *task = new mp_task;
+	task->entry = args[0];
+	task->param = args[1];
+	task->stack = stack;
+	task->stack_size = stack_size;
+	task->notify_queue = args[3];
+	task->term1 = args[4];
+	task->term2 = args[5];
+
+	pthread_attr_t attr;
+	pthread_attr_init(&attr);
+	pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+	pthread_t thread;
+	if (pthread_create(&thread, &attr, task_func, task) != 0) {
+		pthread_attr_destroy(&attr);
+		pool_release(task->stack);
+		delete task;
+		pthread_mutex_unlock(&mp_lock);
+		return (uint32)kMPInsufficientResourcesErr;
+	}
+	pthread_attr_destroy(&attr);
+	task_count++;
+	WriteMacInt32(args[7], new_object(task));
+	pthread_mutex_unlock(&mp_lock);
+	return noErr;
+}
+
+// OSStatus MPTerminateTask(MPTaskID task, OSStatus terminationStatus)
+static uint32 MPTerminateTask(const uint32 *args)
+{
+	pthread_mutex_lock(&mp_lock);
+	mp_task *task = (mp_task *)find_object(args[0], MP_TASK);
+	if (task == NULL || task == blue_task) {
+		pthread_mutex_unlock(&mp_lock);
+		return (uint32)kMPInvalidIDErr;
+	}
+	terminate_task(task, args[1]);
+	pthread_mutex_unlock(&mp_lock);
+	return noErr;
+}
+
+// void MPExit(OSStatus status)
+static uint32 MPExit(const uint32 *args)
+{
+	pthread_mutex_lock(&mp_lock);
+	mp_task *task = current_task();
+	if (task != blue_task)
+		terminate_task(task, args[0]);
+	pthread_mutex_unlock(&mp_lock);
+	return 0;
+}
+
+// void MPYield(void)
+static uint32 MPYield(const uint32 *)
+{
+	sched_yield();
+	return 0;
+}
+
+// MPTaskID MPCurrentTaskID(void)
+static uint32 MPCurrentTaskID(const uint32 *)
+{
+	return current_task()->id;
+}
+
+// Boolean MPTaskIsPreemptive(MPTaskID taskID)
+static uint32 MPTaskIsPreemptive(const uint32 *args)
+{
+	pthread_mutex_lock(&mp_lock);
+	mp_task *task = args[0] ? (mp_task *)find_object(args[0], MP_TASK) : current_task();
+	bool preemptive = task && task != blue_task;
+	pthread_mutex_unlock(&mp_lock);
+	return preemptive;
+}
+
+// OSStatus MPSetTaskWeight(MPTaskID task, MPTaskWeight weight)
+static uint32 MPSetTaskWeight(const uint32 *args)
+{
+	pthread_mutex_lock(&mp_lock);
+	bool valid = find_object(args[0], MP_TASK) != NULL;
+	pthread_mutex_unlock(&mp_lock);
+	return valid ? noErr : (uint32)kMPInvalidIDErr;
+}
+
+// OSStatus MPDelayUntil(AbsoluteTime *expirationTime)
+static uint32 MPDelayUntil(const uint32 *args)
+{
+	const uint64 expiration = ((uint64)ReadMacInt32(args[0]) << 32) | ReadMacInt32(args[0] + 4);
+	const uint64 target = (uint64)((double)expiration * 1.0e9 / (double)TimebaseSpeed);
+
+	// Wait on a private object so that MPTerminateTask() can abort the delay,
+	// nothing else signals it but the condition may still wake up spuriously
+	pthread_mutex_lock(&mp_lock);
+	mp_object *timer = new mp_object(MP_EVENT);
+	int32 err = noErr;
+	uint64 now;
+	while (err != kMPTaskAbortedErr && (now = GetTicks_nsec()) < target) {
+		uint64 usec = (target - now + 999) / 1000;
+		mp_waiter w(timer, usec > 0x7ffffffe ? -0x7ffffffe : -(int32)usec);
+		err = w.wait();
+	}
+	delete_object(timer);
+	pthread_mutex_unlock(&mp_lock);
+	return err == kMPTaskAbortedErr ? (uint32)kMPTaskAbortedErr : noErr;
+}
+
+
+/*
+ *  Message queues
+ */
+
+// OSStatus MPCreateQueue(MPQueueID *queue)
+static uint32 MPCreateQueue(const uint32 *args)
+{
+	if (args[0] == 0)
+		return (uint32)paramErr;
+	pthread_mutex_lock(&mp_lock);
+	WriteMacInt32(args[0], new_object(new mp_queue));
+	pthread_mutex_unlock(&mp_lock);
+	return noErr;
+}
+
+// OSStatus MPDeleteQueue(MPQueueID queue)
+static uint32 MPDeleteQueue(const uint32 *args)
+{
+	pthread_mutex_lock(&mp_lock);
+	mp_object *q = find_object(args[0], MP_QUEUE);
+	if (q)
+		delete_object(q);
+	pthread_mutex_unlock(&mp_lock);
+	return q ? noErr : (uint32)kMPInvalidIDErr;
+}
+
+// OSStatus MPNotifyQueue(MPQueueID queue, void *param1, void *param2, void *param3)
+static uint32 MPNotifyQueue(const uint32 *args)
+{
+	pthread_mutex_lock(&mp_lock);
+	mp_queue *q = (mp_queue *)find_object(args[0], MP_QUEUE);
+	if (q) {
+		mp_message msg = { args[1], args[2], args[3] };
+		q->messages.push_back(msg);
+		pthread_cond_signal(&q->cond);
+	}
+	pthread_mutex_unlock(&mp_lock);
+	return q ? noErr : (uint32)kMPInvalidIDErr;
+}
+
+// OSStatus MPWaitOnQueue(MPQueueID queue, void **param1, void **param2, void **param3, Duration timeout)
+static uint32 MPWaitOnQueue(const uint32 *args)
+{
+	pthread_mutex_lock(&mp_lock);
+	mp_queue *q = (mp_queue *)find_object(args[0], MP_QUEUE);
+	if (q == NULL) {
+		pthread_mutex_unlock(&mp_lock);
+		return (uint32)kMPInvalidIDErr;
+	}
+	int32 err = noErr;
+	{
+		mp_waiter w(q, args[4]);
+		while (q->messages.empty() && err == noErr)
+			err = w.wait();
+		if (err == noErr) {
+			const mp_message &msg = q->messages.front();
+			if (args[1])
+				WriteMacInt32(args[1], msg.p1);
+			if (args[2])
+				WriteMacInt32(args[2], msg.p2);
+			if (args[3])
+				WriteMacInt32(args[3], msg.p3);
+			q->messages.pop_front();
+		}
+	}
+	pthread_mutex_unlock(&mp_lock);
+	return err;
+}
+
+// OSStatus MPSetQueueReserve(MPQueueID queue, ItemCount count)
+static uint32 MPSetQueueReserve(const uint32 *args)
+{
+	pthread_mutex_lock(&mp_lock);
+	bool valid = find_object(args[0], MP_QUEUE) != NULL;
+	pthread_mutex_unlock(&mp_lock);
+	return valid ? noErr : (uint32)kMPInvalidIDErr;
+}
+
+
+/*
+ *  Semaphores
+ */
+
+// OSStatus MPCreateSemaphore(MPSemaphoreCount maximumValue, MPSemaphoreCount initialValue, MPSemaphoreID *semaphore)
+static uint32 MPCreateSemaphore(const uint32 *args)
+{
+	if (args[2] == 0 || args[1] > args[0])
+		return (uint32)paramErr;
+	pthread_mutex_lock(&mp_lock);
+	mp_semaphore *s = new mp_semaphore;
+	s->max_value = args[0];
+	s->value = args[1];
+	WriteMacInt32(args[2], new_object(s));
+	pthread_mutex_unlock(&mp_lock);
+	return noErr;
+}
+
+// OSStatus MPDeleteSemaphore(MPSemaphoreID semaphore)
+static uint32 MPDeleteSemaphore(const uint32 *args)
+{
+	pthread_mutex_lock(&mp_lock);
+	mp_object *s = find_object(args[0], MP_SEMAPHORE);
+	if (s)
+		delete_object(s);
+	pthread_mutex_unlock(&mp_lock);
+	return s ? noErr : (uint32)kMPInvalidIDErr;
+}
+
+// OSStatus MPSignalSemaphore(MPSemaphoreID semaphore)
+static uint32 MPSignalSemaphore(const uint32 *args)
+{
+	int32 err = noErr;
+	pthread_mutex_lock(&mp_lock);
+	mp_semaphore *s = (mp_semaphore *)find_object(args[0], MP_SEMAPHORE);
+	if (s == NULL)
+		err = kMPInvalidIDErr;
+	else if (s->value >= s->max_value)
+		err = kMPInsufficientResourcesErr;
+	else {
+		s->value++;
+		pthread_cond_signal(&s->cond);
+	}
+	pthread_mutex_unlock(&mp_lock);
+	return err;
+}
+
+// OSStatus MPWaitOnSemaphore(MPSemaphoreID semaphore, Duration timeout)
+static uint32 MPWaitOnSemaphore(const uint32 *args)
+{
+	pthread_mutex_lock(&mp_lock);
+	mp_semaphore *s = (mp_semaphore *)find_object(args[0], MP_SEMAPHORE);
+	if (s == NULL) {
+		pthread_mutex_unlock(&mp_lock);
+		return (uint32)kMPInvalidIDErr;
+	}
+	int32 err = noErr;
+	{
+		mp_waiter w(s, args[1]);
+		while (s->value == 0 && err == noErr)
+			err = w.wait();
+		if (err == noErr)
+			s->value--;
+	}
+	pthread_mutex_unlock(&mp_lock);
+	return err;
+}
+
+
+/*
+ *  Critical regions
+ */
+
+// OSStatus MPCreateCriticalRegion(MPCriticalRegionID *criticalRegion)
+static uint32 MPCreateCriticalRegion(const uint32 *args)
+{
+	if (args[0] == 0)
+		return (uint32)paramErr;
+	pthread_mutex_lock(&mp_lock);
+	WriteMacInt32(args[0], new_object(new mp_critical_region));
+	pthread_mutex_unlock(&mp_lock);
+	return noErr;
+}
+
+// OSStatus MPDeleteCriticalRegion(MPCriticalRegionID criticalRegion)
+static uint32 MPDeleteCriticalRegion(const uint32 *args)
+{
+	pthread_mutex_lock(&mp_lock);
+	mp_object *r = find_object(args[0], MP_CRITICAL_REGION);
+	if (r)
+		delete_object(r);
+	pthread_mutex_unlock(&mp_lock);
+	return r ? noErr : (uint32)kMPInvalidIDErr;
+}
+
+// OSStatus MPEnterCriticalRegion(MPCriticalRegionID criticalRegion, Duration timeout)
+static uint32 MPEnterCriticalRegion(const uint32 *args)
+{
+	pthread_mutex_lock(&mp_lock);
+	mp_critical_region *r = (mp_critical_region *)find_object(args[0], MP_CRITICAL_REGION);
+	if (r == NULL) {
+		pthread_mutex_unlock(&mp_lock);
+		return (uint32)kMPInvalidIDErr;
+	}
+	mp_task * const task = current_task();
+	int32 err = noErr;
+	{
+		mp_waiter w(r, args[1]);
+		while (r->owner && r->owner != task && err == noErr)
+			err = w.wait();
+		if (err == noErr) {
+			r->owner = task;
+			r->count++;
+		}
+	}
+	pthread_mutex_unlock(&mp_lock);
+	return err;
+}
+
+// OSStatus MPExitCriticalRegion(MPCriticalRegionID criticalRegion)
+static uint32 MPExitCriticalRegion(const uint32 *args)
+{
+	int32 err = noErr;
+	pthread_mutex_lock(&mp_lock);
+	mp_critical_region *r = (mp_critical_region *)find_object(args[0], MP_CRITICAL_REGION);
+	if (r == NULL)
+		err = kMPInvalidIDErr;
+	else if (r->owner != current_task())
+		err = kMPInsufficientResourcesErr;
+	else if (--r->count == 0) {
+		r->owner = NULL;
+		pthread_cond_signal(&r->cond);
+	}
+	pthread_mutex_unlock(&mp_lock);
+	return err;
+}
+
+
+/*
+ *  Event groups
+ */
+
+// OSStatus MPCreateEvent(MPEventID *event)
+static uint32 MPCreateEvent(const uint32 *args)
+{
+	if (args[0] == 0)
+		return (uint32)paramErr;
+	pthread_mutex_lock(&mp_lock);
+	WriteMacInt32(args[0], new_object(new mp_event));
+	pthread_mutex_unlock(&mp_lock);
+	return noErr;
+}
+
+// OSStatus MPDeleteEvent(MPEventID event)
+static uint32 MPDeleteEvent(const uint32 *args)
+{
+	pthread_mutex_lock(&mp_lock);
+	mp_object *e = find_object(args[0], MP_EVENT);
+	if (e)
+		delete_object(e);
+	pthread_mutex_unlock(&mp_lock);
+	return e ? noErr : (uint32)kMPInvalidIDErr;
+}
+
+// OSStatus MPSetEvent(MPEventID event, MPEventFlags flags)
+static uint32 MPSetEvent(const uint32 *args)
+{
+	pthread_mutex_lock(&mp_lock);
+	mp_event *e = (mp_event *)find_object(args[0], MP_EVENT);
+	if (e) {
+		e->flags |= args[1];
+		pthread_cond_broadcast(&e->cond);
+	}
+	pthread_mutex_unlock(&mp_lock);
+	return e ? noErr : (uint32)kMPInvalidIDErr;
+}
+
+// OSStatus MPWaitForEvent(MPEventID event, MPEventFlags *flags, Duration timeout)
+static uint32 MPWaitForEvent(const uint32 *args)
+{
+	pthread_mutex_lock(&mp_lock);
+	mp_event *e = (mp_event *)find_object(args[0], MP_EVENT);
+	if (e == NULL) {
+		pthread_mutex_unlock(&mp_lock);
+		return (uint32)kMPInvalidIDErr;
+	}
+	int32 err = noErr;
+	{
+		mp_waiter w(e, args[2]);
+		while (e->flags == 0 && err == noErr)
+			err = w.wait();
+		if (err == noErr) {
+			if (args[1])
+				WriteMacInt32(args[1], e->flags);
+			e->flags = 0;
+		}
+	}
+	pthread_mutex_unlock(&mp_lock);
+	return err;
+}
+
+
+/*
+ *  Memory allocation
+ */
+
+// LogicalAddress MPAllocateAligned(ByteCount size, UInt8 alignment, MPOpaqueID options)
+static uint32 MPAllocateAligned(const uint32 *args)
+{
+	const uint32 size = args[0];
+	const uint32 alignment = args[1] & 0xff;
+	if (size == 0 || alignment > 16)
+		return 0;
+	const uint32 align = alignment < 5 ? 32 : 1 << alignment;
+	pthread_mutex_lock(&mp_lock);
+	uint32 addr = pool_alloc_grow(size, align);
+	pthread_mutex_unlock(&mp_lock);
+	if (addr && (args[2] & kMPAllocateClearMask))
+		Mac_memset(addr, 0, size);
+	return addr;
+}
+
+// LogicalAddress MPAllocate(ByteCount size)
+static uint32 MPAllocate(const uint32 *args)
+{
+	const uint32 aligned_args[3] = { args[0], 5, 0 };
+	return MPAllocateAligned(aligned_args);
+}
+
+// void MPFree(LogicalAddress object)
+static uint32 MPFree(const uint32 *args)
+{
+	pthread_mutex_lock(&mp_lock);
+	pool_release(args[0]);
+	pthread_mutex_unlock(&mp_lock);
+	return 0;
+}
+
+// ByteCount MPGetAllocatedBlockSize(LogicalAddress object)
+static uint32 MPGetAllocatedBlockSize(const uint32 *args)
+{
+	pthread_mutex_lock(&mp_lock);
+	std::map<uint32, uint32>::const_iterator it = pool_used.find(args[0]);
+	uint32 size = it != pool_used.end() ? it->second : 0;
+	pthread_mutex_unlock(&mp_lock);
+	return size;
+}
+
+
+/*
+ *  Task storage
+ */
+
+// OSStatus MPAllocateTaskStorageIndex(TaskStorageIndex *index)
+static uint32 MPAllocateTaskStorageIndex(const uint32 *args)
+{
+	if (args[0] == 0)
+		return (uint32)paramErr;
+	pthread_mutex_lock(&mp_lock);
+	uint32 index;
+	for (index = 0; index < MP_TASK_STORAGE_SIZE; index++)
+		if (!storage_allocated[index])
+			break;
+	if (index == MP_TASK_STORAGE_SIZE) {
+		pthread_mutex_unlock(&mp_lock);
+		return (uint32)kMPInsufficientResourcesErr;
+	}
+	storage_allocated[index] = true;
+
+	// Values of a reused index start out as 0 again
+	std::map<uint32, mp_object *>::const_iterator it;
+	for (it = mp_objects.begin(); it != mp_objects.end(); ++it)
+		if (it->second->type == MP_TASK)
+			((mp_task *)it->second)->storage[index] = 0;
+	pthread_mutex_unlock(&mp_lock);
+	WriteMacInt32(args[0], index);
+	return noErr;
+}
+
+// OSStatus MPDeallocateTaskStorageIndex(TaskStorageIndex index)
+static uint32 MPDeallocateTaskStorageIndex(const uint32 *args)
+{
+	pthread_mutex_lock(&mp_lock);
+	bool valid = args[0] < MP_TASK_STORAGE_SIZE && storage_allocated[args[0]];
+	if (valid)
+		storage_allocated[args[0]] = false;
+	pthread_mutex_unlock(&mp_lock);
+	return valid ? noErr : (uint32)paramErr;
+}
+
+// OSStatus MPSetTaskStorageValue(TaskStorageIndex index, TaskStorageValue value)
+static uint32 MPSetTaskStorageValue(const uint32 *args)
+{
+	pthread_mutex_lock(&mp_lock);
+	bool valid = args[0] < MP_TASK_STORAGE_SIZE && storage_allocated[args[0]];
+	if (valid)
+		current_task()->storage[args[0]] = args[1];
+	pthread_mutex_unlock(&mp_lock);
+	return valid ? noErr : (uint32)paramErr;
+}
+
+// TaskStorageValue MPGetTaskStorageValue(TaskStorageIndex index)
+static uint32 MPGetTaskStorageValue(const uint32 *args)
+{
+	pthread_mutex_lock(&mp_lock);
+	uint32 value = 0;
+	if (args[0] < MP_TASK_STORAGE_SIZE && storage_allocated[args[0]])
+		value = current_task()->storage[args[0]];
+	pthread_mutex_unlock(&mp_lock);
+	return value;
+}
+
+
+/*
+ *  Miscellaneous
+ */
+
+// void MPBlockCopy(LogicalAddress source, LogicalAddress destination, ByteCount size)
+static uint32 MPBlockCopy(const uint32 *args)
+{
+	if (args[2])
+		memmove(Mac2HostAddr(args[1]), Mac2HostAddr(args[0]), args[2]);
+	return 0;
+}
+
+// void MPBlockClear(LogicalAddress address, ByteCount size)
+static uint32 MPBlockClear(const uint32 *args)
+{
+	if (args[1])
+		Mac_memset(args[0], 0, args[1]);
+	return 0;
+}
+
+// void *MPRemoteCall(MPRemoteProcedure remoteProc, void *parameter, MPRemoteContext context)
+static uint32 MPRemoteCall(const uint32 *args)
+{
+	// Only the blue task may run Toolbox code, there is no way to
+	// hand the call over to it from a task thread
+	if (current_task() != blue_task) {
+		D(bug("MPRemoteCall from task %08x not supported\n", current_task()->id));
+		return 0;
+	}
+	return call_macos1(args[0], args[1]);
+}
+
+// Timers and kernel notifications, which would have to signal queues,
+// semaphores and events of this module, are not available
+static uint32 MPUnsupported(const uint32 *)
+{
+	return (uint32)kMPInsufficientResourcesErr;
+}
+
+
+/*
+ *  MPLibrary entry points, the index into this table is passed in r0
+ */
+
+typedef uint32 (*mp_function)(const uint32 *args);
+
+struct mp_entry {
+	const char *name;
+	mp_function func;
+};
+
+#define MP_ENTRY(NAME) { #NAME, NAME }
+#define MP_UNSUPPORTED(NAME) { #NAME, MPUnsupported }
+static const mp_entry mp_entries[] = {
+	MP_ENTRY(MPProcessors),
+	MP_ENTRY(MPProcessorsScheduled),
+	MP_ENTRY(MPCreateTask),
+	MP_ENTRY(MPTerminateTask),
+	MP_ENTRY(MPExit),
+	MP_ENTRY(MPYield),
+	MP_ENTRY(MPCurrentTaskID),
+	MP_ENTRY(MPTaskIsPreemptive),
+	MP_ENTRY(MPSetTaskWeight),
+	MP_ENTRY(MPDelayUntil),
+	MP_ENTRY(MPCreateQueue),
+	MP_ENTRY(MPDeleteQueue),
+	MP_ENTRY(MPNotifyQueue),
+	MP_ENTRY(MPWaitOnQueue),
+	MP_ENTRY(MPSetQueueReserve),
+	MP_ENTRY(MPCreateSemaphore),
+	MP_ENTRY(MPDeleteSemaphore),
+	MP_ENTRY(MPSignalSemaphore),
+	MP_ENTRY(MPWaitOnSemaphore),
+	MP_ENTRY(MPCreateCriticalRegion),
+	MP_ENTRY(MPDeleteCriticalRegion),
+	MP_ENTRY(MPEnterCriticalRegion),
+	MP_ENTRY(MPExitCriticalRegion),
+	MP_ENTRY(MPCreateEvent),
+	MP_ENTRY(MPDeleteEvent),
+	MP_ENTRY(MPSetEvent),
+	MP_ENTRY(MPWaitForEvent),
+	MP_ENTRY(MPAllocateAligned),
+	MP_ENTRY(MPAllocate),
+	MP_ENTRY(MPFree),
+	MP_ENTRY(MPGetAllocatedBlockSize),
+	MP_ENTRY(MPAllocateTaskStorageIndex),
+	MP_ENTRY(MPDeallocateTaskStorageIndex),
+	MP_ENTRY(MPSetTaskStorageValue),
+	MP_ENTRY(MPGetTaskStorageValue),
+	MP_ENTRY(MPBlockCopy),
+	MP_ENTRY(MPBlockClear),
+	MP_ENTRY(MPRemoteCall),
+	MP_UNSUPPORTED(MPCreateTimer),
+	MP_UNSUPPORTED(MPDeleteTimer),
+	MP_UNSUPPORTED(MPArmTimer),
+	MP_UNSUPPORTED(MPCancelTimer),
+	MP_UNSUPPORTED(MPSetTimerNotify),
+	MP_UNSUPPORTED(MPCreateNotification),
+	MP_UNSUPPORTED(MPDeleteNotification),
+	MP_UNSUPPORTED(MPModifyNotification),
+	MP_UNSUPPORTED(MPModifyNotificationParameters),
+	MP_UNSUPPORTED(MPCauseNotification)
+};
+#undef MP_UNSUPPORTED
+#undef MP_ENTRY
+
+const int MP_ENTRY_COUNT = sizeof(mp_entries) / sizeof(mp_entries[0]);
+
+
+/*
+ *  Stop all task threads and forget the objects of the previous MacOS
+ *  session, returns false if some threads didn't finish in time
+ */
+
+static bool stop_tasks(void)
+{
+	pthread_mutex_lock(&mp_lock);
+	std::map<uint32, mp_object *>::const_iterator it;
+	for (it = mp_objects.begin(); it != mp_objects.end(); ++it)
+		if (it->second->type == MP_TASK && it->second != blue_task)
+			terminate_task((mp_task *)it->second, kMPTaskAbortedErr);
+
+	// Threads blocked in a host call can't be interrupted, don't wait for them forever
+	struct timeval now;
+	gettimeofday(&now, NULL);
+	struct timespec deadline;
+	deadline.tv_sec = now.tv_sec + 2;
+	deadline.tv_nsec = now.tv_usec * 1000;
+	while (task_count > 0)
+		if (pthread_cond_timedwait(&task_exit_cond, &mp_lock, &deadline) == ETIMEDOUT)
+			break;
+	const bool stopped = task_count == 0;
+	if (!stopped)
+		printf("WARNING: %d MP tasks didn't stop\n", task_count);
+
+	// Objects may still be referenced by the threads that are left, leak them then
+	if (stopped) {
+		for (it = mp_objects.begin(); it != mp_objects.end(); ++it)
+			delete it->second;
+	}
+	mp_objects.clear();
+	blue_task = NULL;
+
+	// Pool chunks and storage indexes belonged to the old system heap
+	pool_free.clear();
+	pool_used.clear();
+	memset(storage_allocated, 0, sizeof(storage_allocated));
+	pthread_mutex_unlock(&mp_lock);
+	return stopped;
+}
+
+
+/*
+ *  Patch MPLibrary (called at OP_INSTALL_DRIVERS)
+ */
+
+void MPTasksInstall(void)
+{
+	if (!PrefsFindBool("mptasks"))
+		return;
+
+	// Tasks of a MacOS session before a restart must not survive it
+	static bool initialized = false;
+	if (blue_task)
+		stop_tasks();
+	pthread_mutex_lock(&mp_lock);
+	blue_task = new mp_task;
+	new_object(blue_task);
+	pthread_mutex_unlock(&mp_lock);
+
+	// Stubs load the entry point index into r0 and call the NativeOp
+	static uint32 stubs[MP_ENTRY_COUNT];
+	if (!initialized) {
+		initialized = true;
+		pthread_key_create(&current_task_key, NULL);
+		for (int i = 0; i < MP_ENTRY_COUNT; i++) {
+			stubs[i] = SheepMem::ReserveProc(8);
+			WriteMacInt32(stubs[i], 0x38000000 | i);	// li r0,i
+			WriteMacInt32(stubs[i] + 4, NativeOpcode(NATIVE_MP_TASKS));
+		}
+	}
+
+	for (int i = 0; i < MP_ENTRY_COUNT; i++) {
+		char name[256];
+		name[0] = strlen(mp_entries[i].name);
+		memcpy(name + 1, mp_entries[i].name, name[0]);
+		uint32 tvect = FindLibSymbol("\011MPLibrary", name);
+		D(bug("%s TVECT at %08x\n", mp_entries[i].name, tvect));
+		if (tvect)
+			WriteMacInt32(tvect, stubs[i]);
+	}
+}
+
+
+/*
+ *  Stop task threads (called at QuitEmulator)
+ */
+
+void MPTasksExit(void)
+{
+	if (blue_task)
+		stop_tasks();
+}
+
+
+/*
+ *  Handle MPLibrary call
+ */
+
+uint32 MPTasksDispatch(uint32 index, const uint32 *args)
+{
+	if (index >= (uint32)MP_ENTRY_COUNT) {
+		printf("FATAL: MPLibrary stub called with bogus index %d\n", index);
+		QuitEmulator();
+	}
+	return mp_entries[index].func(args);
+}
+
+#endif
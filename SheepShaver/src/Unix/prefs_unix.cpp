@@ -41,6 +41,26 @@ prefs_desc platform_prefs_items[] = {
 	{"ignoresegv", TYPE_BOOLEAN, false,    "ignore illegal memory accesses"},
 #endif
 	{"idlewait", TYPE_BOOLEAN, false,      "sleep when idle"},
+	{"snapshot", TYPE_STRING, false,       "snapshot file to resume from (and to save to)"},
+	{"snapshotsave", TYPE_INT32, false,    "save snapshot this many seconds after startup (0 = never)"},
+	{"snapshotquit", TYPE_BOOLEAN, false,  "quit after saving snapshot"},
+	{"diskoverlay", TYPE_STRING, false,    "directory for copy-on-write overlays of disk images"},
+	{"diskoverlaymode", TYPE_STRING, false, "what to do with disk overlays on exit (keep, commit, discard)"},
+	{"diskmmap", TYPE_BOOLEAN, false,      "access disk image files through memory mappings"},
+	{"diskcachesize", TYPE_INT32, false,   "size of host disk block cache in MB"},
+	{"diskcachewriteback", TYPE_BOOLEAN, false, "delay disk writes in block cache"},
+	{"diskchunkcache", TYPE_INT32, false,  "size of decompressed chunk cache per compressed disk image in MB"},
+	{"diskchunkthreads", TYPE_INT32, false, "number of decompression threads per compressed disk image (0 = auto)"},
+	{"hugepages", TYPE_STRING, false,     "back RAM, ROM and JIT caches with huge pages (none, transparent, explicit)"},
+#ifdef USE_HEADLESS_VIDEO
+	{"screendump", TYPE_STRING, false,    "file the screen is dumped to on SIGUSR2 (headless video)"},
+#endif
+#ifdef USE_VNC_SERVER
+	{"vncport", TYPE_INT32, false,       "TCP port of the built-in VNC server (0 = none)"},
+	{"vnclisten", TYPE_STRING, false,    "address the VNC server listens on"},
+	{"vncsocket", TYPE_STRING, false,    "Unix domain socket the VNC server listens on instead"},
+	{"vncthreads", TYPE_INT32, false,    "number of VNC encoder threads (0 = one per CPU, up to 4)"},
+#endif
 	{NULL, TYPE_END, false, NULL} // End of list
 };
 
@@ -137,4 +157,18 @@ void AddPlatformPrefsDefaults(void)
 	PrefsAddBool("ignoresegv", false);
 #endif
 	PrefsAddBool("idlewait", true);
+	PrefsAddInt32("snapshotsave", 0);
+	PrefsAddBool("snapshotquit", false);
+	PrefsReplaceString("diskoverlaymode", "keep");
+	PrefsAddBool("diskmmap", false);
+	PrefsAddInt32("diskcachesize", 0);
+	PrefsAddBool("diskcachewriteback", false);
+	PrefsAddInt32("diskchunkcache", 8);
+	PrefsAddInt32("diskchunkthreads", 0);
+	PrefsReplaceString("hugepages", "none");
+#ifdef USE_VNC_SERVER
+	PrefsAddInt32("vncport", 5900);
+	PrefsReplaceString("vnclisten", "127.0.0.1");
+	PrefsAddInt32("vncthreads", 0);
+#endif
 }
@@ -0,0 +1 @@
+../../../BasiliskII/src/Unix/snapshot_unix.cpp
\ No newline at end of file
@@ -0,0 +1 @@
+../../../BasiliskII/src/Unix/snapshot_unix.h
\ No newline at end of file
@@ -114,7 +114,12 @@
 #define PPC_PROFILE_COMPILE_TIME 0
 #define PPC_PROFILE_GENERIC_CALLS 0
 #define PPC_PROFILE_REGS_USE 0
+// More than one CPU replaces the lwarx/stwcx. dyngen ops with slower generic code
+#if defined(HAVE_PTHREADS) && defined(ENABLE_MP_TASKS)
+#define KPX_MAX_CPUS 16
+#else
 #define KPX_MAX_CPUS 1
+#endif
 #if ENABLE_DYNGEN
 #define PPC_ENABLE_JIT 1
 #endif
@@ -429,6 +434,7 @@ typedef struct timeval tm_time_t;
 
 // Timing functions
 extern uint64 GetTicks_usec(void);
+extern uint64 GetTicks_nsec(void);
 extern void Delay_usec(uint32 usec);
 
 #ifdef HAVE_PTHREADS
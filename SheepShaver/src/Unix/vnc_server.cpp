@@ -0,0 +1 @@
+../../../BasiliskII/src/Unix/vnc_server.cpp
\ No newline at end of file
@@ -0,0 +1 @@
+../../../BasiliskII/src/Unix/vnc_server.h
\ No newline at end of file
@@ -356,6 +356,7 @@ typedef int64 tm_time_t;
 // Timing functions
 extern void timer_init(void);
 extern uint64 GetTicks_usec(void);
+extern uint64 GetTicks_nsec(void);
 extern void Delay_usec(uint32 usec);
 
 // Various definitions
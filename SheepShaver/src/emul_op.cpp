@@ -46,6 +46,7 @@
 #include "user_strings.h"
 #include "emul_op.h"
 #include "thunks.h"
+#include "mp_tasks.h"
 
 #define DEBUG 0
 #include "debug.h"
@@ -263,6 +264,11 @@ void EmulOp(M68kRegisters *r, uint32 pc, int selector)
 			WriteMacInt32(MakeExecutableTvec + 4, (uint32)TOC);
 #endif
 
+#if USE_HOST_MP_TASKS
+			// Run MP tasks on host threads
+			MPTasksInstall();
+#endif
+
 			// Patch DebugStr()
 			static const uint8 proc_template[] = {
 				M68K_EMUL_OP_DEBUG_STR >> 8, M68K_EMUL_OP_DEBUG_STR & 0xFF,
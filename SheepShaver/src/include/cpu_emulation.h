@@ -21,6 +21,7 @@
 #ifndef CPU_EMULATION_H
 #define CPU_EMULATION_H
 
+#include <vector>
 
 /*
  *  Memory system
@@ -117,6 +118,9 @@ extern void Execute68k(uint32, M68kRegisters *r);			// Execute 68k subroutine fr
 extern void Execute68kTrap(uint16 trap, M68kRegisters *r);	// Execute 68k A-Trap from EMUL_OP routine
 #if EMULATED_PPC
 extern void FlushCodeCache(uintptr start, uintptr end);		// Invalidate emulator caches
+extern void SavePPCState(std::vector<uint32> &state);		// Save CPU registers (call at top level)
+extern bool RestorePPCState(const std::vector<uint32> &state);	// Restore CPU registers when emulation starts
+extern void CallPPCAtToplevel(void (*func)(void));			// Call function from outermost emulation loop
 #endif
 extern void ExecuteNative(int selector);					// Execute native code from EMUL_OP routine (real mode switch)
 
@@ -0,0 +1,48 @@
+/*
+ *  mp_tasks.h - Multiprocessing Services tasks on host threads
+ *
+ *  SheepShaver (C) 1997-2008 Christian Bauer and Marc Hellwig
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#ifndef MP_TASKS_H
+#define MP_TASKS_H
+
+// Tasks need one CPU emulator per host thread
+#if EMULATED_PPC && defined(KPX_MAX_CPUS) && KPX_MAX_CPUS > 1
+#define USE_HOST_MP_TASKS 1
+#else
+#define USE_HOST_MP_TASKS 0
+#endif
+
+#if USE_HOST_MP_TASKS
+// Patch MPLibrary entry points, if enabled in the prefs
+extern void MPTasksInstall(void);
+
+// Stop task threads
+extern void MPTasksExit(void);
+
+// Handle call to MPLibrary entry point INDEX, ARGS are r3..r10
+extern uint32 MPTasksDispatch(uint32 index, const uint32 *args);
+
+// CPU emulators for task threads (from sheepshaver_glue.cpp)
+extern void *NewTaskCPU(void);
+extern void DeleteTaskCPU(void *cpu);
+extern uint32 ExecuteTaskCPU(void *cpu, uint32 tvect, uint32 param, uint32 stack_top);
+extern void StopTaskCPU(void *cpu);
+#endif
+
+#endif
@@ -67,6 +67,7 @@ enum {
   NATIVE_NAMED_CHECK_LOAD_INVOC,
   NATIVE_GET_NAMED_RESOURCE,
   NATIVE_GET_1_NAMED_RESOURCE,
+  NATIVE_MP_TASKS,
   NATIVE_OP_MAX
 };
 
@@ -128,6 +129,10 @@ public:
 	static uint32 Reserve(uint32 size);
 	static void Release(uint32 size);
 	static uint32 ReserveProc(uint32 size);
+	static uint32 Base();
+	static uint32 Size();
+	static void SaveState(std::vector<uint32> &state);
+	static bool RestoreState(const std::vector<uint32> &state);
 	friend class SheepVar;
 };
 
@@ -147,6 +152,16 @@ inline uint32 SheepMem::ZeroPage()
   return zero_page;
 }
 
+inline uint32 SheepMem::Base()
+{
+  return base;
+}
+
+inline uint32 SheepMem::Size()
+{
+  return size;
+}
+
 inline uint32 SheepMem::Reserve(uint32 size)
 {
 	data -= align(size);
@@ -21,6 +21,8 @@
 #ifndef VIDEO_H
 #define VIDEO_H
 
+#include <vector>
+
 extern bool VideoActivated(void);
 extern bool VideoSnapshot(int xsize, int ysize, uint8 *p);
 
@@ -139,6 +141,9 @@ extern void VideoVBL(void);
 extern void VideoInstallAccel(void);
 extern void VideoQuitFullScreen(void);
 
+extern void VideoSaveState(std::vector<uint32> &state);
+extern bool VideoRestoreState(const std::vector<uint32> &state);
+
 extern void video_set_palette(void);
 extern void video_set_cursor(void);
 extern bool video_can_change_cursor(void);
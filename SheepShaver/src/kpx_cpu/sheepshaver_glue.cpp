@@ -32,6 +32,7 @@
 #include "cpu/ppc/ppc-operations.hpp"
 #include "cpu/ppc/ppc-instructions.hpp"
 #include "thunks.h"
+#include "mp_tasks.h"
 
 // Used for NativeOp trampolines
 #include "video.h"
@@ -39,6 +40,7 @@
 #include "serial.h"
 #include "ether.h"
 #include "timer.h"
+#include "jit_profile.h"
 
 #include <stdio.h>
 #include <stdlib.h>
@@ -164,6 +166,12 @@ public:
 	// Execute MacOS/PPC code
 	uint32 execute_macos_code(uint32 tvect, int nargs, uint32 const *args);
 
+	// Run MP task entry point on its own stack, returning to RETURN_ADDR
+	uint32 execute_task(uint32 tvect, uint32 param, uint32 stack_top, uint32 return_addr);
+
+	// Make execute_task() return at the next spcflags check
+	void stop_task()			{ spcflags().set(SPCFLAG_CPU_EXEC_RETURN); }
+
 #if PPC_ENABLE_JIT
 	// Compile one instruction
 	virtual int compile1(codegen_context_t & cg_context);
@@ -174,6 +182,10 @@ public:
 	// Handle MacOS interrupt
 	void interrupt(uint32 entry);
 
+	// Save/restore registers for snapshots
+	void save_state(std::vector<uint32> &state);
+	void restore_state(const std::vector<uint32> &state);
+
 	// Make sure the SIGSEGV handler can access CPU registers
 	friend sigsegv_return_t sigsegv_handler(sigsegv_info_t *sip);
 };
@@ -182,6 +194,11 @@ sheepshaver_cpu::sheepshaver_cpu()
 {
 	init_decoder();
 
+#if PPC_DECODE_CACHE
+	int32 decode_cache_size = PrefsFindInt32("decodecachesize");
+	if (decode_cache_size > 0)
+		set_decode_cache_size(decode_cache_size * 1024);
+#endif
 #if PPC_ENABLE_JIT
 	if (PrefsFindBool("jit"))
 		enable_jit();
@@ -669,6 +686,17 @@ uint32 sheepshaver_cpu::execute_macos_code(uint32 tvect, int nargs, uint32 const
 	return retval;
 }
 
+// Call MP task entry point
+uint32 sheepshaver_cpu::execute_task(uint32 tvect, uint32 param, uint32 stack_top, uint32 return_addr)
+{
+	gpr(1) = (stack_top - 64) & -16;
+	gpr(2) = ReadMacInt32(tvect + 4);
+	gpr(3) = param;
+	lr() = return_addr;
+	execute(ReadMacInt32(tvect));
+	return gpr(3);
+}
+
 // Execute ppc routine
 inline void sheepshaver_cpu::execute_ppc(uint32 entry)
 {
@@ -714,12 +742,97 @@ inline void sheepshaver_cpu::get_resource(uint32 old_get_resource)
 // PowerPC CPU emulator
 static sheepshaver_cpu *ppc_cpu = NULL;
 
+#if USE_HOST_MP_TASKS
+// CPU emulators running Multiprocessing Services tasks
+static std::vector<sheepshaver_cpu *> task_cpus;
+static pthread_mutex_t task_cpus_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_key_t task_cpu_key;
+
+// EXEC_RETURN trampoline task entry points return to
+static uint32 task_return_trampoline = 0;
+#endif
+
+// Return the CPU emulator bound to the calling thread
+static inline sheepshaver_cpu *current_cpu(void)
+{
+#if USE_HOST_MP_TASKS
+	sheepshaver_cpu *cpu = (sheepshaver_cpu *)pthread_getspecific(task_cpu_key);
+	if (cpu)
+		return cpu;
+#endif
+	return ppc_cpu;
+}
+
 void FlushCodeCache(uintptr start, uintptr end)
 {
 	D(bug("FlushCodeCache(%08x, %08x)\n", start, end));
-	ppc_cpu->invalidate_cache_range(start, end);
+	sheepshaver_cpu * const cpu = current_cpu();
+	cpu->invalidate_cache_range(start, end);
+
+#if USE_HOST_MP_TASKS
+	// Other CPUs drop their translations at their next spcflags check
+	pthread_mutex_lock(&task_cpus_lock);
+	if (cpu != ppc_cpu)
+		ppc_cpu->post_invalidate_cache_range(start, end);
+	for (size_t i = 0; i < task_cpus.size(); i++) {
+		if (task_cpus[i] != cpu)
+			task_cpus[i]->post_invalidate_cache_range(start, end);
+	}
+	pthread_mutex_unlock(&task_cpus_lock);
+#endif
+}
+
+#if USE_HOST_MP_TASKS
+/*
+ *  Create CPU emulator for a Multiprocessing Services task, the
+ *  calling thread will run it
+ */
+
+void *NewTaskCPU(void)
+{
+	pthread_mutex_lock(&task_cpus_lock);
+	sheepshaver_cpu *cpu = new sheepshaver_cpu();
+	task_cpus.push_back(cpu);
+	pthread_mutex_unlock(&task_cpus_lock);
+	pthread_setspecific(task_cpu_key, cpu);
+	return cpu;
 }
 
+void DeleteTaskCPU(void *arg)
+{
+	sheepshaver_cpu *cpu = (sheepshaver_cpu *)arg;
+	pthread_setspecific(task_cpu_key, NULL);
+	pthread_mutex_lock(&task_cpus_lock);
+	for (size_t i = 0; i < task_cpus.size(); i++) {
+		if (task_cpus[i] == cpu) {
+			task_cpus.erase(task_cpus.begin() + i);
+			break;
+		}
+	}
+	delete cpu;
+	pthread_mutex_unlock(&task_cpus_lock);
+}
+
+/*
+ *  Run task entry point TVECT with PARAM on the stack below STACK_TOP,
+ *  returns the result of the entry point (undefined if the task was
+ *  stopped)
+ */
+
+uint32 ExecuteTaskCPU(void *arg, uint32 tvect, uint32 param, uint32 stack_top)
+{
+	sheepshaver_cpu *cpu = (sheepshaver_cpu *)arg;
+	return cpu->execute_task(tvect, param, stack_top, task_return_trampoline);
+}
+
+// Make the task leave ExecuteTaskCPU() at its next spcflags check
+void StopTaskCPU(void *arg)
+{
+	sheepshaver_cpu *cpu = (sheepshaver_cpu *)arg;
+	cpu->stop_task();
+}
+#endif
+
 // Dump PPC registers
 static void dump_registers(void)
 {
@@ -770,7 +883,7 @@ sigsegv_return_t sigsegv_handler(sigsegv_info_t *sip)
 		return SIGSEGV_RETURN_SKIP_INSTRUCTION;
 
 	// Get program counter of target CPU
-	sheepshaver_cpu * const cpu = ppc_cpu;
+	sheepshaver_cpu * const cpu = current_cpu();
 	const uint32 pc = cpu->pc();
 	
 	// Fault in Mac ROM or RAM?
@@ -826,6 +939,98 @@ sigsegv_return_t sigsegv_handler(sigsegv_info_t *sip)
 	return SIGSEGV_RETURN_FAILURE;
 }
 
+/*
+ *  Save/restore CPU state for snapshots
+ */
+
+struct ppc_state {
+	uint32 gpr[32];
+	powerpc_fpr fpr[32];
+	powerpc_vr vr[32];
+	uint32 cr, xer, vscr, vrsave, fpscr;
+	uint32 lr, ctr, pc;
+	uint32 run_mode;
+};
+
+static std::vector<uint32> restored_state;	// CPU state to install when emulation starts
+
+void sheepshaver_cpu::save_state(std::vector<uint32> &state)
+{
+	ppc_state s;
+	memset(&s, 0, sizeof(s));
+	for (int i = 0; i < 32; i++) {
+		s.gpr[i] = gpr(i);
+		s.fpr[i].j = fpr_dw(i);
+		s.vr[i] = vr(i);
+	}
+	s.cr = get_cr();
+	s.xer = get_xer();
+	s.vscr = vscr().get();
+	s.vrsave = vrsave();
+	s.fpscr = fpscr();
+	s.lr = lr();
+	s.ctr = ctr();
+	s.pc = pc();
+	s.run_mode = ReadMacInt32(XLM_RUN_MODE);
+	state.assign((uint32 *)&s, (uint32 *)(&s + 1));
+}
+
+void sheepshaver_cpu::restore_state(const std::vector<uint32> &state)
+{
+	const ppc_state &s = *(const ppc_state *)&state[0];
+	for (int i = 0; i < 32; i++) {
+		gpr(i) = s.gpr[i];
+		fpr_dw(i) = s.fpr[i].j;
+		vr(i) = s.vr[i];
+	}
+	set_cr(s.cr);
+	set_xer(s.xer);
+	vscr().set(s.vscr);
+	vrsave() = s.vrsave;
+	fpscr() = s.fpscr;
+	lr() = s.lr;
+	ctr() = s.ctr;
+	pc() = s.pc;
+	restore_fp_control();
+	WriteMacInt32(XLM_RUN_MODE, s.run_mode);
+}
+
+void SavePPCState(std::vector<uint32> &state)
+{
+	ppc_cpu->save_state(state);
+}
+
+bool RestorePPCState(const std::vector<uint32> &state)
+{
+	if (state.size() * sizeof(uint32) != sizeof(ppc_state))
+		return false;
+	restored_state = state;
+	return true;
+}
+
+void CallPPCAtToplevel(void (*func)(void))
+{
+	ppc_cpu->call_at_toplevel(func);
+}
+
+
+/*
+ *  Execution profile of translated blocks
+ */
+
+#if PPC_ENABLE_JIT
+static uint64 *jit_profile_block_counter(uint32 pc)
+{
+	return jit_profile_enabled ? jit_profile_counter(pc) : NULL;
+}
+
+static void jit_profile_flush(void)
+{
+	ppc_cpu->invalidate_cache();
+}
+#endif
+
+
 /*
  *  Initialize CPU emulation
  */
@@ -841,12 +1046,26 @@ void init_emul_ppc(void)
 	ppc_cpu->set_register(powerpc_registers::GPR(4), any_register(KernelDataAddr + 0x1000));
 	WriteMacInt32(XLM_RUN_MODE, MODE_68K);
 
+#if USE_HOST_MP_TASKS
+	// Initialize task CPUs support
+	pthread_key_create(&task_cpu_key, NULL);
+	task_return_trampoline = SheepMem::ReserveProc(4);
+	WriteMacInt32(task_return_trampoline, POWERPC_EXEC_RETURN);
+#endif
+
 #if ENABLE_MON
 	// Install "regs" command in cxmon
 	mon_add_command("regs", dump_registers, "regs                     Dump PowerPC registers\n");
 	mon_add_command("log", dump_log, "log                      Dump PowerPC emulation log\n");
 #endif
 
+#if PPC_ENABLE_JIT
+	if (PrefsFindBool("jit")) {
+		ppc_cpu->set_block_profiler(jit_profile_block_counter, jit_profile_translated);
+		jit_profile_init("ppc", false, ROMBase, ROM_SIZE, jit_profile_flush);
+	}
+#endif
+
 #if EMUL_TIME_STATS
 	emul_start_time = clock();
 #endif
@@ -884,6 +1103,10 @@ void exit_emul_ppc(void)
 	printf("\n");
 #endif
 
+#if PPC_ENABLE_JIT
+	jit_profile_exit();
+#endif
+
 	delete ppc_cpu;
 	ppc_cpu = NULL;
 }
@@ -923,6 +1146,13 @@ void emul_ppc(uint32 entry)
 #if 0
 	ppc_cpu->start_log();
 #endif
+	// Resume from snapshot instead of booting?
+	if (!restored_state.empty()) {
+		ppc_cpu->restore_state(restored_state);
+		restored_state.clear();
+		entry = ppc_cpu->get_register(powerpc_registers::PC).i;
+	}
+
 	// start emulation loop and enable code translation or caching
 	ppc_cpu->execute(entry);
 }
@@ -1149,6 +1379,15 @@ void sheepshaver_cpu::execute_native_op(uint32 selector)
 	case NATIVE_NAMED_CHECK_LOAD_INVOC:
 		named_check_load_invoc(gpr(3), gpr(4), gpr(5));
 		break;
+#if USE_HOST_MP_TASKS
+	case NATIVE_MP_TASKS: {
+		uint32 args[8];
+		for (int i = 0; i < 8; i++)
+			args[i] = gpr(3 + i);
+		gpr(3) = MPTasksDispatch(gpr(0), args);
+		break;
+	}
+#endif
 	default:
 		printf("FATAL: NATIVE_OP called with bogus selector %d\n", selector);
 		QuitEmulator();
@@ -60,6 +60,8 @@ public:
 	void initialize();
 	void clear();
 	void clear_range(uintptr start, uintptr end);
+	template< class Predicate >
+	int clear_if(Predicate pred);
 	block_info *fast_find(uintptr pc);
 	block_info *find(uintptr pc);
 
@@ -155,6 +157,26 @@ void block_cache< block_info, block_allocator >::clear_range(uintptr start, uint
 	}
 }
 
+template< class block_info, template<class T> class block_allocator >
+template< class Predicate >
+int block_cache< block_info, block_allocator >::clear_if(Predicate pred)
+{
+	int count = 0;
+	entry *p = active;
+	while (p) {
+		entry *q = p;
+		p = p->next;
+		if (pred(q)) {
+			q->invalidate();
+			remove_from_cl_list(q);
+			remove_from_list(q);
+			delete_blockinfo(q);
+			count++;
+		}
+	}
+	return count;
+}
+
 template< class block_info, template<class T> class block_allocator >
 inline block_info *block_cache< block_info, block_allocator >::new_blockinfo()
 {
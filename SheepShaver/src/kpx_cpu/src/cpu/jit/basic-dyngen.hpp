@@ -106,6 +106,7 @@ public:
 
 	// Return from compiled code
 	void gen_exec_return();
+	uint8 *exec_return_addr() const;
 
 	// Function calls
 	void gen_jmp(const uint8 *target);
@@ -274,10 +275,16 @@ basic_dyngen::execute(uint8 *entry_point)
 	func(entry_point, parent_cpu);
 }
 
+inline uint8 *
+basic_dyngen::exec_return_addr() const
+{
+	return execute_func + op_exec_return_offset;
+}
+
 inline void
 basic_dyngen::gen_exec_return()
 {
-	gen_jmp(execute_func + op_exec_return_offset);
+	gen_jmp(exec_return_addr());
 }
 
 inline bool
@@ -64,7 +64,7 @@ basic_jit_cache::init_translation_cache(uint32 size)
 	cache_size = (size + JIT_CACHE_SIZE_GUARD + roundup - 1) & -roundup;
 	assert(cache_size > 0);
 
-	tcode_start = (uint8 *)vm_acquire(cache_size, VM_MAP_PRIVATE | VM_MAP_32BIT);
+	tcode_start = (uint8 *)vm_acquire(cache_size, VM_MAP_PRIVATE | VM_MAP_32BIT | VM_MAP_HUGE);
 	if (tcode_start == VM_MAP_FAILED) {
 		tcode_start = NULL;
 		return false;
@@ -78,6 +78,7 @@ basic_jit_cache::init_translation_cache(uint32 size)
 	}
 	
 	D(bug("basic_jit_cache: Translation cache: %d KB at %p\n", cache_size / 1024, tcode_start));
+	vm_report_huge_pages("JIT translation cache", tcode_start, cache_size);
 	code_start = tcode_start;
 	code_p = code_start;
 	code_end = code_p + size;
@@ -88,6 +88,20 @@
 #endif
 
 
+/**
+ *	PPC_PREDICT_INDIRECT_BRANCHES
+ *
+ *		Define to 1 to give each translated blr/bctr an inline cache
+ *		of its last target block. Predicted branches then jump to the
+ *		translated code directly, and mispredictions look the target
+ *		up without returning to the dispatcher.
+ **/
+
+#ifndef PPC_PREDICT_INDIRECT_BRANCHES
+#define PPC_PREDICT_INDIRECT_BRANCHES PPC_ENABLE_JIT
+#endif
+
+
 /**
  *	PPC_EXECUTE_DUMP_STATE
  *
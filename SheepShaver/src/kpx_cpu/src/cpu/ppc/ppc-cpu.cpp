@@ -114,12 +114,6 @@ any_register powerpc_cpu::get_register(int id)
 	return value;
 }
 
-#if KPX_MAX_CPUS != 1
-uint32 powerpc_registers::reserve_valid = 0;
-uint32 powerpc_registers::reserve_addr = 0;
-uint32 powerpc_registers::reserve_data = 0;
-#endif
-
 void powerpc_cpu::init_registers()
 {
 	assert((((uintptr)&vr(0)) % 16) == 0);
@@ -242,6 +236,11 @@ static void mon_write_byte_ppc(uintptr addr, uint32 b)
 	uint8 *m = (uint8 *)addr;
 	*m = b;
 }
+
+static uint8 *mon_map_range_ppc(uintptr addr, uintptr size)
+{
+	return (uint8 *)addr;
+}
 #endif
 
 void powerpc_cpu::initialize()
@@ -262,7 +261,9 @@ void powerpc_cpu::initialize()
 	init_decoder();
 	init_registers();
 	init_decode_cache();
+	init_timebase();
 	execute_depth = 0;
+	toplevel_callback = NULL;
 
 	// Initialize block lookup table
 #if PPC_DECODE_CACHE || PPC_ENABLE_JIT
@@ -275,6 +276,15 @@ void powerpc_cpu::initialize()
 	// Init syscalls handler
 	execute_do_syscall = NULL;
 
+#if PPC_ENABLE_JIT
+	// No block profiler
+	block_counter = NULL;
+	block_translated = NULL;
+#endif
+#if PPC_PREDICT_INDIRECT_BRANCHES
+	predict_slots_used = 0;
+#endif
+
 	// Init field2mask
 	for (int i = 0; i < 256; i++) {
 		uint32 mask = 0;
@@ -293,6 +303,7 @@ void powerpc_cpu::initialize()
 	mon_init();
 	mon_read_byte = mon_read_byte_ppc;
 	mon_write_byte = mon_write_byte_ppc;
+	mon_map_range = mon_map_range_ppc;
 #endif
 
 #if PPC_PROFILE_COMPILE_TIME
@@ -309,6 +320,10 @@ void powerpc_cpu::enable_jit(uint32 cache_size)
 	if (cache_size)
 		codegen.set_cache_size(cache_size);
 	codegen.initialize();
+#if PPC_PREDICT_INDIRECT_BRANCHES
+	if (predict_slots == NULL)
+		predict_slots = new block_info[PREDICT_SLOTS];
+#endif
 }
 #endif
 
@@ -366,6 +381,19 @@ powerpc_cpu::powerpc_cpu(task_struct *parent_task)
 #if PPC_ENABLE_JIT
 	use_jit = false;
 #endif
+#if PPC_PREDICT_INDIRECT_BRANCHES
+	predict_slots = NULL;
+#endif
+#if PPC_DECODE_CACHE
+	decode_cache_segments = NULL;
+	decode_cache_max_segments = DECODE_CACHE_DEFAULT_SEGMENTS;
+#endif
+#if KPX_MAX_CPUS != 1
+	reserve_data = 0;
+	pending_invalidate_lock = SPIN_LOCK_UNLOCKED;
+	pending_invalidate_start = pending_invalidate_end = 0;
+#endif
+	use_block_cache = true;
 	++ppc_refcount;
 	initialize();
 }
@@ -436,6 +464,9 @@ powerpc_cpu::~powerpc_cpu()
 #endif
 
 	kill_decode_cache();
+#if PPC_PREDICT_INDIRECT_BRANCHES
+	delete[] predict_slots;
+#endif
 
 #if ENABLE_MON
 	mon_exit();
@@ -499,6 +530,12 @@ void powerpc_registers::interrupt_copy(powerpc_registers &oregs, powerpc_registe
 	}
 }
 
+void powerpc_cpu::call_at_toplevel(void (*func)(void))
+{
+	toplevel_callback = func;
+	spcflags().set(SPCFLAG_CPU_TOPLEVEL_CALLBACK);
+}
+
 bool powerpc_cpu::check_spcflags()
 {
 	if (spcflags().test(SPCFLAG_CPU_EXEC_RETURN)) {
@@ -523,6 +560,22 @@ bool powerpc_cpu::check_spcflags()
 		spcflags().set(SPCFLAG_CPU_HANDLE_INTERRUPT);
 	}
 #endif
+#if KPX_MAX_CPUS != 1
+	if (spcflags().test(SPCFLAG_CPU_INVALIDATE_CACHE)) {
+		spcflags().clear(SPCFLAG_CPU_INVALIDATE_CACHE);
+		spin_lock(&pending_invalidate_lock);
+		const uintptr start = pending_invalidate_start;
+		const uintptr end = pending_invalidate_end;
+		pending_invalidate_start = pending_invalidate_end = 0;
+		spin_unlock(&pending_invalidate_lock);
+		if (start != end)
+			invalidate_cache_range(start, end);
+	}
+#endif
+	if (spcflags().test(SPCFLAG_CPU_TOPLEVEL_CALLBACK) && execute_depth == 1) {
+		spcflags().clear(SPCFLAG_CPU_TOPLEVEL_CALLBACK);
+		toplevel_callback();
+	}
 	if (spcflags().test(SPCFLAG_CPU_ENTER_MON)) {
 		spcflags().clear(SPCFLAG_CPU_ENTER_MON);
 #if ENABLE_MON
@@ -560,6 +613,40 @@ void *powerpc_cpu::compile_chain_block(block_info *sbi)
 }
 #endif
 
+#if PPC_PREDICT_INDIRECT_BRANCHES
+powerpc_cpu::block_info *powerpc_cpu::alloc_predict_slot(uint32 pc)
+{
+	// Once the table is full, sites share slots and only mispredict more
+	if (predict_slots_used == PREDICT_SLOTS)
+		return &predict_slots[(pc >> 2) % PREDICT_SLOTS];
+
+	block_info *slot = &predict_slots[predict_slots_used++];
+	slot->pc = (uintptr)-1;
+	return slot;
+}
+
+void powerpc_cpu::invalidate_predict_slots()
+{
+	// Predicted entry points may belong to blocks that were removed
+	for (int i = 0; i < predict_slots_used; i++)
+		predict_slots[i].pc = (uintptr)-1;
+}
+
+void *powerpc_cpu::resolve_indirect_branch(block_info *slot)
+{
+	// The prediction and the fast lookup both missed, make this target
+	// the next prediction if it is translated already, else leave it
+	// to the dispatcher
+	block_info *tbi = my_block_cache.find(pc());
+	if (tbi == NULL)
+		return codegen.exec_return_addr();
+
+	slot->pc = tbi->pc;
+	slot->entry_point = tbi->entry_point;
+	return tbi->entry_point;
+}
+#endif
+
 void powerpc_cpu::execute(uint32 entry)
 {
 	bool invalidated_cache = false;
@@ -569,7 +656,7 @@ void powerpc_cpu::execute(uint32 entry)
 #endif
 	execute_depth++;
 #if PPC_DECODE_CACHE || PPC_ENABLE_JIT
-	if (execute_depth == 1 || (PPC_ENABLE_JIT && PPC_REENTRANT_JIT)) {
+	if (use_block_cache && (execute_depth == 1 || (PPC_ENABLE_JIT && PPC_REENTRANT_JIT))) {
 #if PPC_ENABLE_JIT
 		if (use_jit) {
 			block_info *bi = my_block_cache.find(pc());
@@ -614,10 +701,12 @@ void powerpc_cpu::execute(uint32 entry)
 			clock_t start_time;
 			start_time = clock();
 #endif
+			if (decode_cache_p >= decode_cache_end_p)
+				next_decode_cache_segment();
 			bi = my_block_cache.new_blockinfo();
 			bi->init(pc());
 
-			// Predecode a new block
+			// Predecode a new block, it ends early if the segment is full
 			block_info::decode_info *di;
 			const instr_info_t *ii;
 			uint32 dpc;
@@ -650,15 +739,7 @@ void powerpc_cpu::execute(uint32 entry)
 					di++;
 				}
 #endif
-				if (di >= decode_cache_end_p) {
-					// Invalidate cache and move current code to start
-					invalidate_cache();
-					const int blocklen = di - bi->di;
-					memmove(decode_cache_p, bi->di, blocklen * sizeof(*di));
-					bi->di = decode_cache_p;
-					di = bi->di + blocklen;
-				}
-			} while ((ii->cflow & CFLOW_END_BLOCK) == 0);
+			} while ((ii->cflow & CFLOW_END_BLOCK) == 0 && di < decode_cache_end_p);
 			bi->end_pc = dpc;
 			bi->min_pc = dpc;
 			bi->max_pc = entry;
@@ -666,6 +747,8 @@ void powerpc_cpu::execute(uint32 entry)
 			my_block_cache.add_to_cl_list(bi);
 			my_block_cache.add_to_active_list(bi);
 			decode_cache_p += bi->size;
+			decode_stats.blocks++;
+			decode_stats.insns += (dpc - pc()) / 4 + 1;
 #if PPC_PROFILE_COMPILE_TIME
 			compile_time += (clock() - start_time);
 #endif
@@ -743,32 +826,103 @@ void powerpc_cpu::execute()
 void powerpc_cpu::init_decode_cache()
 {
 #if PPC_DECODE_CACHE
-	decode_cache = (block_info::decode_info *)vm_acquire(DECODE_CACHE_SIZE);
-	if (decode_cache == VM_MAP_FAILED) {
-		fprintf(stderr, "powerpc_cpu: Could not allocate decode cache\n");
-		abort();
+	// Segments are allocated when first needed
+	decode_cache_segments = new block_info::decode_info *[decode_cache_max_segments];
+	for (int i = 0; i < decode_cache_max_segments; i++)
+		decode_cache_segments[i] = NULL;
+	decode_cache_segment = -1;
+	decode_cache_wrapped = false;
+	decode_cache = decode_cache_p = decode_cache_end_p = NULL;
+	memset(&decode_stats, 0, sizeof(decode_stats));
+#endif
+}
+
+void powerpc_cpu::kill_decode_cache()
+{
+#if PPC_DECODE_CACHE
+	if (decode_cache_segments == NULL)
+		return;
+	for (int i = 0; i < decode_cache_max_segments; i++) {
+		if (decode_cache_segments[i])
+			vm_release(decode_cache_segments[i], DECODE_CACHE_SEGMENT_SIZE);
+	}
+	delete[] decode_cache_segments;
+	decode_cache_segments = NULL;
+#endif
+}
+
+#if PPC_DECODE_CACHE
+void powerpc_cpu::set_decode_cache_size(uint32 size)
+{
+	// Drop the blocks predecoded into the current segments
+	if (decode_cache_segment >= 0)
+		invalidate_cache();
+	kill_decode_cache();
+	decode_cache_max_segments = DECODE_CACHE_DEFAULT_SEGMENTS;
+	if (size) {
+		decode_cache_max_segments = (size + DECODE_CACHE_SEGMENT_SIZE - 1) / DECODE_CACHE_SEGMENT_SIZE;
+		if (decode_cache_max_segments < 2)
+			decode_cache_max_segments = 2;
+	}
+	init_decode_cache();
+}
+
+// Predicate for blocks predecoded into a decode cache segment
+struct decode_info_in_segment {
+	const powerpc_block_info::decode_info *start, *end;
+	decode_info_in_segment(const powerpc_block_info::decode_info *s, const powerpc_block_info::decode_info *e)
+		: start(s), end(e) { }
+	bool operator()(const powerpc_block_info *bi) const
+		{ return bi->di >= start && bi->di < end; }
+};
+
+void powerpc_cpu::next_decode_cache_segment()
+{
+	int next = decode_cache_segment + 1;
+	if (next == decode_cache_max_segments) {
+		next = 0;
+		decode_cache_wrapped = true;
+	}
+	if (decode_cache_segments[next] == NULL) {
+		block_info::decode_info *segment = (block_info::decode_info *)vm_acquire(DECODE_CACHE_SEGMENT_SIZE);
+		if (segment == VM_MAP_FAILED) {
+			if (next == 0) {
+				fprintf(stderr, "powerpc_cpu: Could not allocate decode cache\n");
+				abort();
+			}
+			// Keep the segments we have
+			D(bug("powerpc_cpu: Decode cache limited to %d segments\n", next));
+			decode_cache_max_segments = next;
+			next = 0;
+			decode_cache_wrapped = true;
+		}
+		else {
+			D(bug("powerpc_cpu: Allocated decode cache segment %d: %d KB at %p\n", next, DECODE_CACHE_SEGMENT_SIZE / 1024, segment));
+			decode_cache_segments[next] = segment;
+		}
 	}
 
-	D(bug("powerpc_cpu: Allocated decode cache: %d KB at %p\n", DECODE_CACHE_SIZE / 1024, decode_cache));
+	decode_cache_segment = next;
+	decode_cache = decode_cache_segments[next];
 	decode_cache_p = decode_cache;
-	decode_cache_end_p = decode_cache + DECODE_CACHE_MAX_ENTRIES;
-#if FLIGHT_RECORDER
+	decode_cache_end_p = decode_cache + DECODE_CACHE_SEGMENT_ENTRIES;
+#if PPC_FLIGHT_RECORDER
 	// Leave enough room to last call to record_step()
-	decode_cache_end_p -= 2;
+	decode_cache_end_p -= 1;
 #endif
 #if PPC_EXECUTE_DUMP_STATE
 	// Leave enough room to last calls to dump state functions
 	decode_cache_end_p -= 2;
 #endif
-#endif
-}
 
-void powerpc_cpu::kill_decode_cache()
-{
-#if PPC_DECODE_CACHE
-	vm_release(decode_cache, DECODE_CACHE_SIZE);
-#endif
+	// Evict the blocks that were predecoded into the recycled segment
+	if (decode_cache_wrapped) {
+		D(bug("powerpc_cpu: Recycle decode cache segment %d\n", next));
+		decode_stats.segments++;
+		decode_stats.evicted_blocks += my_block_cache.clear_if(decode_info_in_segment(decode_cache, decode_cache + DECODE_CACHE_SEGMENT_ENTRIES));
+	}
 }
+#endif
 
 void powerpc_cpu::invalidate_cache()
 {
@@ -781,8 +935,16 @@ void powerpc_cpu::invalidate_cache()
 #if PPC_ENABLE_JIT
 	codegen.invalidate_cache();
 #endif
+#if PPC_PREDICT_INDIRECT_BRANCHES
+	// All indirect branch sites are gone with the translation cache
+	predict_slots_used = 0;
+#endif
 #if PPC_DECODE_CACHE
-	decode_cache_p = decode_cache;
+	// Restart from the first segment, that is now free
+	decode_cache_segment = -1;
+	decode_cache_wrapped = false;
+	decode_cache = decode_cache_p = decode_cache_end_p = NULL;
+	decode_stats.flushes++;
 #endif
 }
 
@@ -805,6 +967,24 @@ void powerpc_block_info::invalidate()
 #endif
 }
 
+#if KPX_MAX_CPUS != 1
+void powerpc_cpu::post_invalidate_cache_range(uintptr start, uintptr end)
+{
+	// Merge with the range not yet invalidated
+	spin_lock(&pending_invalidate_lock);
+	if (pending_invalidate_start != pending_invalidate_end) {
+		if (start > pending_invalidate_start)
+			start = pending_invalidate_start;
+		if (end < pending_invalidate_end)
+			end = pending_invalidate_end;
+	}
+	pending_invalidate_start = start;
+	pending_invalidate_end = end;
+	spin_unlock(&pending_invalidate_lock);
+	spcflags().set(SPCFLAG_CPU_INVALIDATE_CACHE);
+}
+#endif
+
 void powerpc_cpu::invalidate_cache_range(uintptr start, uintptr end)
 {
 	D(bug("Invalidate cache block [%08x - %08x]\n", start, end));
@@ -820,4 +1000,8 @@ void powerpc_cpu::invalidate_cache_range(uintptr start, uintptr end)
 	spcflags().set(SPCFLAG_JIT_EXEC_RETURN);
 	my_block_cache.clear_range(start, end);
 #endif
+#if PPC_PREDICT_INDIRECT_BRANCHES
+	if (use_jit)
+		invalidate_predict_slots();
+#endif
 }
@@ -288,6 +288,12 @@ public:
 
 	// Interrupts handling
 	void trigger_interrupt();
+
+	// Call FUNC from the outermost emulation loop, between two blocks
+	void call_at_toplevel(void (*func)(void));
+
+	// Set native FP rounding mode from FPSCR (after registers were restored)
+	void restore_fp_control();
 	
 	// Set VALUE to register ID
 	void set_register(int id, any_register const & value);
@@ -298,9 +304,32 @@ public:
 	// Set syscall callback
 	void set_syscall_callback(syscall_fn fn) { execute_do_syscall = fn; }
 
+	// Select between plain interpretation and cached execution
+	void enable_block_cache(bool enable) { use_block_cache = enable; }
+
+#if PPC_DECODE_CACHE
+	// Set the maximum size of the decode cache, in bytes (0 = default)
+	void set_decode_cache_size(uint32 size);
+
+	// Decode cache activity, to evaluate its size
+	struct decode_cache_stats {
+		uint64 blocks;			// Blocks predecoded
+		uint64 insns;			// Instructions predecoded
+		uint64 segments;		// Segments recycled
+		uint64 evicted_blocks;	// Blocks evicted with their segment
+		uint64 flushes;			// Full invalidations
+	};
+	const decode_cache_stats & get_decode_cache_stats() const { return decode_stats; }
+#endif
+
 	// Caches invalidation
 	void invalidate_cache();
 	void invalidate_cache_range(uintptr start, uintptr end);
+#if KPX_MAX_CPUS != 1
+	// Caches invalidation requested by another thread, the range is
+	// invalidated by this CPU at its next check of special flags
+	void post_invalidate_cache_range(uintptr start, uintptr end);
+#endif
 private:
 	struct { uintptr start, end; } cache_range;
 
@@ -333,8 +362,15 @@ protected:
 	virtual int compile1(codegen_context_t & cg_context) { return COMPILE_FAILURE; }
 
 	bool use_jit;
+
+	// Optional execution counters of translated blocks, "counter" returns
+	// NULL if the block at "pc" is not to be counted
+	typedef uint64 *(*block_counter_fn)(uint32 pc);
+	typedef void (*block_translated_fn)(uint32 pc, uint32 num_insns, uint8 *code, uint32 code_size);
 public:
 	void enable_jit(uint32 cache_size = 0);
+	void set_block_profiler(block_counter_fn counter, block_translated_fn translated)
+		{ block_counter = counter; block_translated = translated; }
 #endif
 
 private:
@@ -356,12 +392,14 @@ private:
 	block_cache< block_info, lazy_allocator > my_block_cache;
 
 #if PPC_DECODE_CACHE
-	// Decode Cache
-	static const uint32 DECODE_CACHE_MAX_ENTRIES = 32768;
-	static const uint32 DECODE_CACHE_SIZE = DECODE_CACHE_MAX_ENTRIES * sizeof(block_info::decode_info);
+	// Decode Cache, current segment
+	static const uint32 DECODE_CACHE_SEGMENT_ENTRIES = 16384;
+	static const uint32 DECODE_CACHE_SEGMENT_SIZE = DECODE_CACHE_SEGMENT_ENTRIES * sizeof(block_info::decode_info);
+	static const int DECODE_CACHE_DEFAULT_SEGMENTS = 16;
 	block_info::decode_info * decode_cache;
 	block_info::decode_info * decode_cache_p;
 	block_info::decode_info * decode_cache_end_p;
+	void next_decode_cache_segment();
 #endif
 
 #if PPC_ENABLE_JIT
@@ -374,8 +412,54 @@ private:
 #if DYNGEN_DIRECT_BLOCK_CHAINING
 	void *compile_chain_block(block_info *sbi);
 #endif
+#if PPC_PREDICT_INDIRECT_BRANCHES
+	block_info *alloc_predict_slot(uint32 pc);
+	void invalidate_predict_slots();
+	void *resolve_indirect_branch(block_info *slot);
+#endif
 #endif
 
+	// Members below are not accessed by the precompiled dyngen ops, those
+	// embed the offsets of the members above and must be kept in sync
+#if PPC_ENABLE_JIT
+	block_counter_fn block_counter;
+	block_translated_fn block_translated;
+#endif
+#if PPC_PREDICT_INDIRECT_BRANCHES
+	// Last targets of indirect branches, one per translated blr/bctr
+	// until the table is full. Only pc and entry_point are used, the
+	// generated code checks them like for a block_info
+	static const int PREDICT_SLOTS = 4096;
+	block_info *predict_slots;
+	int predict_slots_used;
+#endif
+#if PPC_DECODE_CACHE
+	// Decode cache segments, allocated on demand up to the maximum
+	// size then recycled in FIFO order. Recycling a segment evicts the
+	// blocks predecoded into it, instead of invalidating all blocks
+	block_info::decode_info ** decode_cache_segments;
+	int decode_cache_max_segments;
+	int decode_cache_segment;
+	bool decode_cache_wrapped;
+	decode_cache_stats decode_stats;
+#endif
+#if KPX_MAX_CPUS != 1
+	// Value loaded by the last lwarx, for stwcx to detect stores from
+	// other processors
+	uint32 reserve_data;
+
+	// Range posted by post_invalidate_cache_range()
+	spinlock_t pending_invalidate_lock;
+	uintptr pending_invalidate_start;
+	uintptr pending_invalidate_end;
+#endif
+
+	// Clear to always interpret, bypassing the decode cache and JIT
+	bool use_block_cache;
+
+	// Function to call once no nested execute() is active
+	void (*toplevel_callback)(void);
+
 	// Semantic action templates
 	template< bool SB, bool OE >
 	uint32 do_execute_divide(uint32, uint32);
@@ -434,6 +518,9 @@ private:
 	void execute_mfspr(uint32 opcode);
 	template< class TBR >
 	void execute_mftbr(uint32 opcode);
+	static void init_timebase(void);
+	static uint32 get_tbl(uint32);
+	static uint32 get_tbu(uint32);
 	template< class SPR >
 	void execute_mtspr(uint32 opcode);
 	template< class SH, class MA, class Rc >
@@ -92,6 +92,11 @@ static inline int ppc_to_native_rounding_mode(int round)
 	}
 }
 
+void powerpc_cpu::restore_fp_control()
+{
+	fesetround(ppc_to_native_rounding_mode(FPSCR_RN_field::extract(fpscr())));
+}
+
 /**
  *	Helper class to compute the overflow/carry condition
  *
@@ -743,13 +748,13 @@ template< class RA >
 void powerpc_cpu::execute_lwarx(uint32 opcode)
 {
 	const uint32 ea = RA::get(this, opcode) + operand_RB::get(this, opcode);
-	uint32 reserve_data = vm_read_memory_4(ea);
+	const uint32 value = vm_read_memory_4(ea);
 	regs().reserve_valid = 1;
 	regs().reserve_addr = ea;
 #if KPX_MAX_CPUS != 1
-	regs().reserve_data = reserve_data;
+	reserve_data = value;
 #endif
-	operand_RD::set(this, opcode, reserve_data);
+	operand_RD::set(this, opcode, value);
 	increment_pc(4);
 }
 
@@ -759,15 +764,24 @@ void powerpc_cpu::execute_stwcx(uint32 opcode)
 	const uint32 ea = RA::get(this, opcode) + operand_RB::get(this, opcode);
 	cr().clear(0);
 	if (regs().reserve_valid) {
-		if (regs().reserve_addr == ea /* physical_addr(EA) */
-#if KPX_MAX_CPUS != 1
-			/* HACK: if another processor wrote to the reserved block,
-			   nothing happens, i.e. we should operate as if reserve == 0 */
-			&& regs().reserve_data == vm_read_memory_4(ea)
-#endif
-			) {
+		if (regs().reserve_addr == ea /* physical_addr(EA) */) {
+#if KPX_MAX_CPUS == 1
 			vm_write_memory_4(ea, operand_RS::get(this, opcode));
 			cr().set(0, standalone_CR_EQ_field::mask());
+#else
+			// The reservation is lost if another processor changed the
+			// word since lwarx, a compare-and-swap makes the check and
+			// the store atomic
+#if HAVE_VM_COMPARE_AND_SWAP
+			if (vm_compare_and_swap_memory_4(ea, reserve_data, operand_RS::get(this, opcode)))
+				cr().set(0, standalone_CR_EQ_field::mask());
+#else
+			if (reserve_data == vm_read_memory_4(ea)) {
+				vm_write_memory_4(ea, operand_RS::get(this, opcode));
+				cr().set(0, standalone_CR_EQ_field::mask());
+			}
+#endif
+#endif
 		}
 		regs().reserve_valid = 0;
 	}
@@ -1206,12 +1220,27 @@ static uint64 muldiv64(uint64 a, uint32 b, uint32 c)
 	return res.ll;
 }
 
+#ifdef SHEEPSHAVER
+// Host nanoseconds to timebase ticks, as a 32.32 fixed-point factor
+static uint64 tb_scale = 0;
+#endif
+
+// Called by the first CPU before any other one is created, task CPUs
+// only ever read tb_scale afterwards
+void powerpc_cpu::init_timebase(void)
+{
+#ifdef SHEEPSHAVER
+	if (tb_scale == 0)
+		tb_scale = ((uint64)TimebaseSpeed << 32) / 1000000000;
+#endif
+}
+
 static inline uint64 get_tb_ticks(void)
 {
 	uint64 ticks;
 #ifdef SHEEPSHAVER
-	const uint32 TBFreq = TimebaseSpeed;
-	ticks = muldiv64(GetTicks_usec(), TBFreq, 1000000);
+	const uint64 ns = GetTicks_nsec();
+	ticks = (ns >> 32) * tb_scale + (((ns & 0xffffffff) * tb_scale) >> 32);
 #else
 	const uint32 TBFreq = 25 * 1000 * 1000; // 25 MHz
 	ticks = muldiv64((uint64)clock(), TBFreq, CLOCKS_PER_SEC);
@@ -1219,14 +1248,24 @@ static inline uint64 get_tb_ticks(void)
 	return ticks;
 }
 
+uint32 powerpc_cpu::get_tbl(uint32)
+{
+	return (uint32)get_tb_ticks();
+}
+
+uint32 powerpc_cpu::get_tbu(uint32)
+{
+	return get_tb_ticks() >> 32;
+}
+
 template< class TBR >
 void powerpc_cpu::execute_mftbr(uint32 opcode)
 {
 	uint32 tbr = TBR::get(this, opcode);
 	uint32 d = 0;
 	switch (tbr) {
-	case 268: d = (uint32)get_tb_ticks(); break;
-	case 269: d = (get_tb_ticks() >> 32); break;
+	case 268: d = get_tbl(0); break;
+	case 269: d = get_tbu(0); break;
 	default: execute_illegal(opcode);
 	}
 	operand_RD::set(this, opcode, d);
@@ -1619,7 +1658,7 @@ void powerpc_cpu::execute_vector_shift_octet(uint32 opcode)
 {
 	typename VA::type const & vA = VA::const_ref(this, opcode);
 	typename VB::type const & vB = VB::const_ref(this, opcode);
-	typename VD::type & vD = VD::ref(this, opcode);
+	typename VD::type vD;
 
 	const int sh = SH::get(this, opcode);
 	if (SD < 0) {
@@ -1639,6 +1678,8 @@ void powerpc_cpu::execute_vector_shift_octet(uint32 opcode)
 		}
 	}
 
+	// vD may be the same register as vA or vB
+	VD::ref(this, opcode) = vD;
 	increment_pc(4);
 }
 
@@ -1740,7 +1781,7 @@ void powerpc_cpu::execute_vector_permute(uint32 opcode)
 	powerpc_vr const & vA = vr(vA_field::extract(opcode));
 	powerpc_vr const & vB = vr(vB_field::extract(opcode));
 	powerpc_vr const & vC = vr(vC_field::extract(opcode));
-	powerpc_vr & vD = vr(vD_field::extract(opcode));
+	powerpc_vr vD;
 
 	for (int i = 0; i < 16; i++) {
 		const int ei = ev_mixed::byte_element(i);
@@ -1749,6 +1790,8 @@ void powerpc_cpu::execute_vector_permute(uint32 opcode)
 		vD.b[ei] = (n & 0x10) ? vB.b[en] : vA.b[en];
 	}
 
+	// vD may be the same register as vA, vB or vC
+	vr(vD_field::extract(opcode)) = vD;
 	increment_pc(4);
 }
 
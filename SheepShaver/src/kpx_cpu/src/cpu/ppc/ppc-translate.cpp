@@ -147,8 +147,23 @@ powerpc_cpu::compile_block(uint32 entry_point)
 	bi->init(entry_point);
 	bi->entry_point = dg.gen_start(entry_point);
 
+	// Count executions of the block. There is no 64-bit increment in the
+	// precompiled ops, so only the low half of the counter is used.
+	if (block_counter) {
+		uintptr counter = (uintptr)block_counter(entry_point);
+#ifdef WORDS_BIGENDIAN
+		if (counter)
+			counter += 4;
+#endif
+		if (counter && counter <= 0xffffffff)
+			dg.gen_inc_32_mem(counter);
+	}
+
 	// Direct block chaining support variables
 	bool use_direct_block_chaining = false;
+#if PPC_PREDICT_INDIRECT_BRANCHES
+	bool predict_indirect_branch = false;
+#endif
 
 	int compile_status;
 	uint32 dpc = entry_point - 4;
@@ -541,6 +556,9 @@ powerpc_cpu::compile_block(uint32 entry_point)
 				dg.gen_store_im_LR(npc);
 
 			dg.gen_bc(bo, bi, (uint32)-1, npc, use_direct_block_chaining);
+#if PPC_PREDICT_INDIRECT_BRANCHES
+			predict_indirect_branch = true;
+#endif
 			break;
 		}
 		case PPC_I(B):			// Branch
@@ -795,6 +813,23 @@ powerpc_cpu::compile_block(uint32 entry_point)
 			dg.gen_store_T0_GPR(rD_field::extract(opcode));
 			break;
 		}
+		case PPC_I(MFTB):		// Move from Time Base
+		{
+			// Direct call, the timebase does not depend on the PC
+			const int tbr = operand_TBR::get(this, opcode);
+			switch (tbr) {
+			case 268:
+				dg.gen_invoke_T0_ret_T0(&powerpc_cpu::get_tbl);
+				break;
+			case 269:
+				dg.gen_invoke_T0_ret_T0(&powerpc_cpu::get_tbu);
+				break;
+			default:
+				goto do_generic;
+			}
+			dg.gen_store_T0_GPR(rD_field::extract(opcode));
+			break;
+		}
 		case PPC_I(MTSPR):		// Move to Special-Purpose Register
 		{
 			dg.gen_load_T0_GPR(rS_field::extract(opcode));
@@ -1536,9 +1571,27 @@ powerpc_cpu::compile_block(uint32 entry_point)
 		// In direct block chaining mode, this code is reached only if
 		// there are pending spcflags, i.e. get out of this block
 		if (!use_direct_block_chaining) {
-			// TODO: optimize this to a direct jump to pregenerated code?
-			dg.gen_mov_ad_A0_im((uintptr)bi);
-			dg.gen_jump_next_A0();
+#if PPC_PREDICT_INDIRECT_BRANCHES
+			if (predict_indirect_branch) {
+				// Jump to the last target of this blr/bctr or to the fast
+				// lookup result, else resolve the misprediction without
+				// going back to the dispatcher
+				typedef void *(*func_t)(dyngen_cpu_base);
+				func_t func = (func_t)nv_mem_fun(&powerpc_cpu::resolve_indirect_branch).ptr();
+				block_info *slot = alloc_predict_slot(bi->pc);
+				dg.gen_mov_ad_A0_im((uintptr)slot);
+				dg.gen_jump_next_A0();
+				dg.gen_mov_ad_A0_im((uintptr)slot);
+				dg.gen_invoke_CPU_A0_ret_A0(func);
+				dg.gen_jmp_A0();
+			}
+			else
+#endif
+			{
+				// TODO: optimize this to a direct jump to pregenerated code?
+				dg.gen_mov_ad_A0_im((uintptr)bi);
+				dg.gen_jump_next_A0();
+			}
 		}
 		dg.gen_exec_return();
 	}
@@ -1573,6 +1626,8 @@ powerpc_cpu::compile_block(uint32 entry_point)
 	bi->size = dg.code_ptr() - bi->entry_point;
 	if (disasm)
 		disasm_translation(entry_point, dpc - entry_point + 4, bi->entry_point, bi->size);
+	if (block_translated)
+		block_translated(entry_point, (dpc - entry_point) / 4 + 1, bi->entry_point, bi->size);
 
 	dg.gen_end();
 	my_block_cache.add_to_cl_list(bi);
@@ -31,6 +31,8 @@ enum {
 	SPCFLAG_CPU_HANDLE_INTERRUPT	= 1 << 2,	// Call user interrupt handler
 	SPCFLAG_CPU_ENTER_MON			= 1 << 3,	// Enter cxmon
 	SPCFLAG_JIT_EXEC_RETURN			= 1 << 4,	// Return from compiled code
+	SPCFLAG_CPU_TOPLEVEL_CALLBACK	= 1 << 5,	// Call function from outermost loop
+	SPCFLAG_CPU_INVALIDATE_CACHE	= 1 << 6,	// Invalidate range posted by another thread
 };
 
 class basic_spcflags
@@ -273,6 +273,18 @@ static inline void vm_write_memory_4_reversed(vm_addr_t addr, uint32 value)
 	uint32 * const m = (uint32 *)vm_do_get_real_address(addr);
 	vm_do_write_memory_4_reversed(m, value);
 }
+#ifdef __GNUC__
+// Store NEW_VALUE at ADDR if it still holds OLD_VALUE, atomically
+#define HAVE_VM_COMPARE_AND_SWAP 1
+static inline bool vm_compare_and_swap_memory_4(vm_addr_t addr, uint32 old_value, uint32 new_value)
+{
+	uint32 * const m = (uint32 *)vm_do_get_real_address(addr);
+	uint32 old_word, new_word;
+	vm_do_write_memory_4(&old_word, old_value);
+	vm_do_write_memory_4(&new_word, new_value);
+	return __sync_bool_compare_and_swap(m, old_word, new_word);
+}
+#endif
 static inline void *vm_memset(vm_addr_t addr, int c, size_t n)
 {
 	uint8 * const m = (uint8 *)vm_do_get_real_address(addr);
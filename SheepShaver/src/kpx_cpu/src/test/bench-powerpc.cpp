@@ -0,0 +1,605 @@
+/*
+ *  bench-powerpc.cpp - PowerPC emulation benchmark
+ *
+ *  Kheperix (C) 2003-2005 Gwenole Beauchesne
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+/*
+ *  Small PowerPC kernels are run out of a bare memory area, without ROM
+ *  or Mac OS, through each execution mode of powerpc_cpu:
+ *
+ *    interp     plain interpreter (enable_block_cache(false))
+ *    predecode  decode cache (PPC_DECODE_CACHE)
+ *    jit        dyngen translator (PPC_ENABLE_JIT)
+ *
+ *  Each kernel is a loop with its iteration count in r3 that ends with
+ *  the "return" instruction (opcode 6), like in test-powerpc.cpp. The
+ *  number of executed instructions is known from the loop structure.
+ *  A raw big-endian code file (e.g. saved with the "s" command of mon)
+ *  can be run as kernel "file" with -f, its instructions are counted
+ *  with the JIT block profiler.
+ *
+ *  The first run of each mode is reported as warm-up time (it includes
+ *  decoding or translation), the best of the following runs gives the
+ *  MIPS figure. Results are printed to stdout as one JSON object per
+ *  line, all other output goes to stderr. The predecode mode also
+ *  reports its decode cache activity, whose maximum size in KB can be
+ *  set with -c.
+ *
+ *  Usage: bench-powerpc [-m modes] [-k kernels] [-n runs] [-s scale] [-f file] [-c size]
+ */
+
+#include <map>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/time.h>
+
+#include "sysdeps.h"
+#include "vm_alloc.h"
+#include "cpu/ppc/ppc-cpu.hpp"
+#include "cpu/ppc/ppc-instructions.hpp"
+
+// Memory layout
+static const uint32 BENCH_MEM_SIZE = 0x400000;
+static const uint32 CODE_OFFSET = 0;					// Kernel code
+static const uint32 DATA_OFFSET = 0x80000;				// Kernel constants and results
+static const uint32 SRC_OFFSET = 0x100000;				// Source of memory copy
+static const uint32 DST_OFFSET = 0x200000;				// Destination of memory copy
+static const uint32 COUNTERS_OFFSET = 0x300000;			// JIT block counters
+static const uint32 COPY_WORDS = 0x4000;				// 64 KB per memory copy
+static const uint32 MAX_CODE_SIZE = DATA_OFFSET - CODE_OFFSET;
+static const int MAX_COUNTERS = (BENCH_MEM_SIZE - COUNTERS_OFFSET) / sizeof(uint64);
+
+// Execution modes
+enum {
+	MODE_INTERP,
+	MODE_PREDECODE,
+	MODE_JIT,
+	NUM_MODES
+};
+
+static const char *mode_names[] = {"interp", "predecode", "jit"};
+
+// Kernels
+struct kernel {
+	const char *name;
+	const uint32 *code;		// NULL for the code file
+	int code_words;
+	uint32 count;			// Iterations (r3) at scale 1
+	uint32 fixed_insns;		// Instructions outside of the loop
+	uint32 loop_insns;		// Instructions per iteration
+	uint32 r4;				// Initial value of r4
+};
+
+// ALU: add/xor/rotate chain
+static const uint32 alu_code[] = {
+	0x7c6903a6,				//       mtctr   r3
+	0x7ca52214,				// loop: add     r5,r5,r4
+	0x7cc62a78,				//       xor     r6,r6,r5
+	0x54c6183e,				//       rotlwi  r6,r6,3
+	0x38840001,				//       addi    r4,r4,1
+	0x4200fff0,				//       bdnz    loop
+	0x18000000				//       return
+};
+
+// Memory copy of COPY_WORDS words from r7 to r8
+static const uint32 memcpy_code[] = {
+	0x3927fffc,				// loop: addi    r9,r7,-4
+	0x3948fffc,				//       addi    r10,r8,-4
+	0x7d6903a6,				//       mtctr   r11
+	0x85890004,				// copy: lwzu    r12,4(r9)
+	0x958a0004,				//       stwu    r12,4(r10)
+	0x4200fff8,				//       bdnz    copy
+	0x3463ffff,				//       addic.  r3,r3,-1
+	0x4082ffe4,				//       bne     loop
+	0x18000000				//       return
+};
+
+// FPU: multiply, divide and multiply-add on constants from r7
+static const uint32 fpu_code[] = {
+	0x7c6903a6,				//       mtctr   r3
+	0xc8270000,				//       lfd     f1,0(r7)
+	0xc8470008,				//       lfd     f2,8(r7)
+	0xc8670010,				//       lfd     f3,16(r7)
+	0xc8870018,				//       lfd     f4,24(r7)
+	0xfca02090,				//       fmr     f5,f4
+	0xfcc02090,				//       fmr     f6,f4
+	0xfca5082a,				// loop: fadd    f5,f5,f1
+	0xfce500b2,				//       fmul    f7,f5,f2
+	0xfd071824,				//       fdiv    f8,f7,f3
+	0xfc84402a,				//       fadd    f4,f4,f8
+	0xfcc8323a,				//       fmadd   f6,f8,f8,f6
+	0x4200ffec,				//       bdnz    loop
+	0xd8870020,				//       stfd    f4,32(r7)
+	0xd8c70028,				//       stfd    f6,40(r7)
+	0x18000000				//       return
+};
+
+// AltiVec: float multiply-add and integer vectors on constants from r7
+static const uint32 altivec_code[] = {
+	0x7c6903a6,				//       mtctr   r3
+	0x39200000,				//       li      r9,0
+	0x39400010,				//       li      r10,16
+	0x39600020,				//       li      r11,32
+	0x39800030,				//       li      r12,48
+	0x7c2748ce,				//       lvx     v1,r7,r9
+	0x7c4750ce,				//       lvx     v2,r7,r10
+	0x7c6758ce,				//       lvx     v3,r7,r11
+	0x7c8760ce,				//       lvx     v4,r7,r12
+	0x10c004c4,				//       vxor    v6,v0,v0
+	0x110004c4,				//       vxor    v8,v0,v0
+	0x106308ae,				// loop: vmaddfp v3,v3,v2,v1
+	0x10c6180a,				//       vaddfp  v6,v6,v3
+	0x10840cc4,				//       vxor    v4,v4,v1
+	0x11082080,				//       vadduwm v8,v8,v4
+	0x4200fff0,				//       bdnz    loop
+	0x39200040,				//       li      r9,64
+	0x39400050,				//       li      r10,80
+	0x7cc749ce,				//       stvx    v6,r7,r9
+	0x7d0751ce,				//       stvx    v8,r7,r10
+	0x18000000				//       return
+};
+
+// Branches: xorshift32 random numbers, with data dependent branches
+// (both sides of each if/else execute the same number of instructions)
+static const uint32 branchy_code[] = {
+	0x7c6903a6,				//       mtctr   r3
+	0x54896824,				// loop: slwi    r9,r4,13
+	0x7c844a78,				//       xor     r4,r4,r9
+	0x54897c7e,				//       srwi    r9,r4,17
+	0x7c844a78,				//       xor     r4,r4,r9
+	0x54892834,				//       slwi    r9,r4,5
+	0x7c844a78,				//       xor     r4,r4,r9
+	0x70890001,				//       andi.   r9,r4,1
+	0x4182000c,				//       beq     1f
+	0x38a50001,				//       addi    r5,r5,1
+	0x4800000c,				//       b       2f
+	0x38c60001,				// 1:    addi    r6,r6,1
+	0x60000000,				//       nop
+	0x70890008,				// 2:    andi.   r9,r4,8
+	0x4182000c,				//       beq     3f
+	0x7ca52214,				//       add     r5,r5,r4
+	0x4800000c,				//       b       4f
+	0x7cc43050,				// 3:    subf    r6,r4,r6
+	0x60000000,				//       nop
+	0x4200ffb8,				// 4:    bdnz    loop
+	0x18000000				//       return
+};
+
+// Calls: direct call and indirect call (through CTR) to leaf functions
+static const uint32 calls_code[] = {
+	0x48000005,				//       bl      1f
+	0x7d4802a6,				// 1:    mflr    r10
+	0x396a0028,				//       addi    r11,r10,leaf2-1b
+	0x7d6903a6,				//       mtctr   r11
+	0x48000015,				// loop: bl      leaf1
+	0x4e800421,				//       bctrl
+	0x3463ffff,				//       addic.  r3,r3,-1
+	0x4082fff4,				//       bne     loop
+	0x18000000,				//       return
+	0x38a50001,				// leaf1: addi   r5,r5,1
+	0x4e800020,				//       blr
+	0x7cc62a14,				// leaf2: add    r6,r6,r5
+	0x4e800020				//       blr
+};
+
+#define CODE(x) x, sizeof(x) / sizeof(x[0])
+
+static kernel kernels[] = {
+	{"alu", CODE(alu_code), 2000000, 2, 5, 1},
+	{"memcpy", CODE(memcpy_code), 200, 1, 5 + 3 * COPY_WORDS, 0},
+	{"fpu", CODE(fpu_code), 500000, 10, 6, 0},
+	{"altivec", CODE(altivec_code), 1000000, 16, 5, 0},
+	{"branchy", CODE(branchy_code), 500000, 2, 15, 0x2545f491},
+	{"calls", CODE(calls_code), 1000000, 5, 8, 0},
+	{"file", NULL, 0, 1, 0, 0, 0}
+};
+
+static const int NUM_KERNELS = sizeof(kernels) / sizeof(kernels[0]);
+
+static uint8 *mem_host;					// Benchmark memory
+static uint32 mem_base;					// ... in emulated address space
+static uint32 *file_code;
+static int file_words;
+static FILE *results;					// JSON results, the original stdout
+
+
+/*
+ *  Glue to the rest of SheepShaver, see test-powerpc.cpp
+ */
+
+uint32 ROMBase = 0x40800000;
+int64 TimebaseSpeed = 25000000;	// Default:  25 MHz
+uint32 PVR = 0x000c0000;		// Default: 7400 (with AltiVec)
+
+bool PrefsFindBool(const char *name)
+{
+	return false;
+}
+
+uint64 GetTicks_usec(void)
+{
+	return clock();
+}
+
+uint64 GetTicks_nsec(void)
+{
+	return (uint64)clock() * 1000;
+}
+
+void HandleInterrupt(powerpc_registers *)
+{
+}
+
+#if PPC_ENABLE_JIT && PPC_REENTRANT_JIT
+void init_emul_op_trampolines(basic_dyngen & dg)
+{
+}
+#endif
+
+
+/*
+ *  CPU with the "return" instruction
+ */
+
+struct powerpc_bench_cpu
+	: public powerpc_cpu
+{
+	powerpc_bench_cpu();
+	void execute_return(uint32 opcode);
+};
+
+powerpc_bench_cpu::powerpc_bench_cpu()
+{
+	static const instr_info_t return_ii = {
+		"return",
+		(execute_pmf)&powerpc_bench_cpu::execute_return,
+		PPC_I(MAX),
+		D_form, 6, 0, CFLOW_JUMP
+	};
+	init_decoder_entry(&return_ii);
+}
+
+void powerpc_bench_cpu::execute_return(uint32 opcode)
+{
+	spcflags().set(SPCFLAG_CPU_EXEC_RETURN);
+}
+
+
+/*
+ *  Statistics of translated blocks, and execution counters of the
+ *  blocks when counting the instructions of the code file
+ */
+
+struct block_stat {
+	uint32 num_insns;
+	uint64 *counter;
+};
+
+static std::map<uint32, block_stat> block_stats;
+static uint32 translated_blocks, translated_bytes;
+static bool count_blocks;
+static int num_counters;
+
+static uint64 *bench_block_counter(uint32 pc)
+{
+	if (!count_blocks || num_counters >= MAX_COUNTERS)
+		return NULL;
+	uint64 *counter = (uint64 *)(mem_host + COUNTERS_OFFSET) + num_counters++;
+	*counter = 0;
+	block_stats[pc].counter = counter;
+	return counter;
+}
+
+static void bench_block_translated(uint32 pc, uint32 num_insns, uint8 *code, uint32 code_size)
+{
+	block_stats[pc].num_insns = num_insns;
+	translated_blocks++;
+	translated_bytes += code_size;
+}
+
+
+/*
+ *  Time in microseconds
+ */
+
+static uint64 now_usec(void)
+{
+	struct timeval tv;
+	gettimeofday(&tv, NULL);
+	return (uint64)tv.tv_sec * 1000000 + tv.tv_usec;
+}
+
+
+/*
+ *  Load kernel and its data
+ */
+
+static void write_double(uint32 addr, double d)
+{
+	union { double d; uint64 i; } u;
+	u.d = d;
+	vm_write_memory_4(addr, u.i >> 32);
+	vm_write_memory_4(addr + 4, u.i);
+}
+
+static void write_float(uint32 addr, float f)
+{
+	union { float f; uint32 i; } u;
+	u.f = f;
+	vm_write_memory_4(addr, u.i);
+}
+
+static void load(const kernel &k)
+{
+	const uint32 *code = k.code ? k.code : file_code;
+	const int code_words = k.code ? k.code_words : file_words;
+	for (int i = 0; i < code_words; i++)
+		vm_write_memory_4(mem_base + CODE_OFFSET + i * 4, code[i]);
+
+	// FPU constants
+	const uint32 data = mem_base + DATA_OFFSET;
+	memset(mem_host + DATA_OFFSET, 0, 0x100);
+	if (strcmp(k.name, "fpu") == 0) {
+		write_double(data + 0, 1.0);
+		write_double(data + 8, 3.0);
+		write_double(data + 16, 7.0);
+	}
+
+	// AltiVec constants
+	if (strcmp(k.name, "altivec") == 0) {
+		for (int i = 0; i < 4; i++) {
+			write_float(data + i * 4, 1.0f + i);
+			write_float(data + 16 + i * 4, 0.5f);
+			vm_write_memory_4(data + 48 + i * 4, 0x01234567 * (i + 1));
+		}
+	}
+
+	for (uint32 i = 0; i < COPY_WORDS; i++)
+		vm_write_memory_4(mem_base + SRC_OFFSET + i * 4, i * 0x9e3779b9);
+	memset(mem_host + DST_OFFSET, 0, COPY_WORDS * 4);
+}
+
+static void setup(powerpc_bench_cpu *cpu, const kernel &k, uint32 count)
+{
+	for (int i = 0; i < 32; i++)
+		cpu->gpr(i) = 0;
+	cpu->gpr(3) = count;
+	cpu->gpr(4) = k.r4;
+	cpu->gpr(7) = mem_base + (strcmp(k.name, "memcpy") == 0 ? SRC_OFFSET : DATA_OFFSET);
+	cpu->gpr(8) = mem_base + DST_OFFSET;
+	cpu->gpr(11) = COPY_WORDS;
+	memset(mem_host + DATA_OFFSET + 32, 0, 0x100 - 32);
+}
+
+// Checksum of registers, results and copied memory, to compare the execution modes
+static uint32 checksum(powerpc_bench_cpu *cpu)
+{
+	uint32 sum = 0;
+	for (int i = 3; i < 13; i++)
+		sum = (sum << 5 | sum >> 27) ^ cpu->gpr(i);
+	for (uint32 i = 32; i < 96; i += 4)
+		sum = (sum << 5 | sum >> 27) ^ vm_read_memory_4(mem_base + DATA_OFFSET + i);
+	for (uint32 i = 0; i < COPY_WORDS; i++)
+		sum += vm_read_memory_4(mem_base + DST_OFFSET + i * 4);
+	return sum;
+}
+
+
+/*
+ *  Run kernel once, returns time in microseconds
+ */
+
+static uint64 run_once(powerpc_bench_cpu *cpu, const kernel &k, uint32 count)
+{
+	setup(cpu, k, count);
+	uint64 start = now_usec();
+	cpu->execute(mem_base + CODE_OFFSET);
+	return now_usec() - start;
+}
+
+static bool bench(powerpc_bench_cpu *cpu, const kernel &k, uint32 count, int mode, int runs, uint64 insns, uint32 ref_sum)
+{
+	translated_blocks = translated_bytes = 0;
+#if PPC_DECODE_CACHE
+	const powerpc_cpu::decode_cache_stats decode_stats = cpu->get_decode_cache_stats();
+#endif
+	uint64 warmup = run_once(cpu, k, count);
+	bool ok = checksum(cpu) == ref_sum;
+	uint32 blocks = translated_blocks, code_size = translated_bytes;
+
+	uint64 best = warmup;
+	for (int i = 0; i < runs; i++) {
+		uint64 t = run_once(cpu, k, count);
+		if (t < best)
+			best = t;
+		ok &= checksum(cpu) == ref_sum;
+	}
+	if (best == 0)
+		best = 1;
+
+	fprintf(results, "{\"core\":\"kpx_cpu\",\"kernel\":\"%s\",\"mode\":\"%s\",\"insns\":%llu,\"seconds\":%.6f,\"mips\":%.2f,\"warmup_seconds\":%.6f",
+		k.name, mode_names[mode], (unsigned long long)insns, best / 1e6, double(insns) / best, warmup / 1e6);
+	if (mode == MODE_JIT)
+		fprintf(results, ",\"blocks\":%u,\"code_bytes\":%u", blocks, code_size);
+#if PPC_DECODE_CACHE
+	if (mode == MODE_PREDECODE) {
+		const powerpc_cpu::decode_cache_stats &stats = cpu->get_decode_cache_stats();
+		fprintf(results, ",\"decoded_blocks\":%llu,\"evicted_blocks\":%llu,\"flushes\":%llu",
+			(unsigned long long)(stats.blocks - decode_stats.blocks),
+			(unsigned long long)(stats.evicted_blocks - decode_stats.evicted_blocks),
+			(unsigned long long)(stats.flushes - decode_stats.flushes));
+	}
+#endif
+	fprintf(results, ",\"checksum\":\"%08x\",\"ok\":%s}\n", ref_sum, ok ? "true" : "false");
+	fflush(results);
+	return ok;
+}
+
+// Count instructions of the code file with the JIT block profiler
+static uint64 count_insns(powerpc_bench_cpu *cpu, const kernel &k, uint32 count)
+{
+	uint64 insns = 0;
+#if PPC_ENABLE_JIT
+	block_stats.clear();
+	num_counters = 0;
+	count_blocks = true;
+	cpu->invalidate_cache();
+	run_once(cpu, k, count);
+	count_blocks = false;
+	cpu->invalidate_cache();
+
+	std::map<uint32, block_stat>::const_iterator it;
+	for (it = block_stats.begin(); it != block_stats.end(); ++it) {
+		if (it->second.counter)
+			insns += (uint32)*it->second.counter * it->second.num_insns;
+	}
+#endif
+	return insns;
+}
+
+
+/*
+ *  Main program
+ */
+
+static bool selected(const char *list, const char *name)
+{
+	if (list == NULL)
+		return true;
+	size_t len = strlen(name);
+	for (const char *p = list; (p = strstr(p, name)) != NULL; p += len)
+		if ((p == list || p[-1] == ',') && (p[len] == 0 || p[len] == ','))
+			return true;
+	return false;
+}
+
+static void usage(const char *prg)
+{
+	fprintf(stderr, "Usage: %s [-m interp,predecode,jit] [-k alu,memcpy,fpu,altivec,branchy,calls,file] [-n runs] [-s scale] [-f file] [-c size]\n", prg);
+	exit(1);
+}
+
+int main(int argc, char *argv[])
+{
+	const char *modes = NULL, *kernel_list = NULL, *file_name = NULL;
+	int runs = 3;
+	double scale = 1.0;
+	int decode_cache_size = 0;
+	int opt;
+	while ((opt = getopt(argc, argv, "m:k:n:s:f:c:")) != -1) {
+		switch (opt) {
+			case 'm': modes = optarg; break;
+			case 'k': kernel_list = optarg; break;
+			case 'n': runs = atoi(optarg); break;
+			case 's': scale = atof(optarg); break;
+			case 'f': file_name = optarg; break;
+			case 'c': decode_cache_size = atoi(optarg); break;
+			default: usage(argv[0]);
+		}
+	}
+	if (runs < 1 || scale <= 0)
+		usage(argv[0]);
+
+	// The CPU emulator prints its banner and logs to stdout, so keep
+	// stdout for the results and send everything else to stderr
+	int results_fd = dup(STDOUT_FILENO);
+	if (results_fd >= 0 && (results = fdopen(results_fd, "w")) != NULL)
+		dup2(STDERR_FILENO, STDOUT_FILENO);
+	else
+		results = stdout;
+
+	// Code file
+	if (file_name) {
+		FILE *f = fopen(file_name, "rb");
+		if (f == NULL) {
+			perror(file_name);
+			return 1;
+		}
+		static uint8 buf[MAX_CODE_SIZE];
+		file_words = fread(buf, 1, sizeof(buf), f) / 4;
+		fclose(f);
+		file_code = new uint32[file_words];
+		for (int i = 0; i < file_words; i++)
+			file_code[i] = (buf[i * 4] << 24) | (buf[i * 4 + 1] << 16) | (buf[i * 4 + 2] << 8) | buf[i * 4 + 3];
+	}
+
+	// Initialize VM system (predecode cache uses vm_acquire())
+	vm_init();
+	mem_host = (uint8 *)vm_acquire(BENCH_MEM_SIZE, VM_MAP_DEFAULT | VM_MAP_32BIT);
+	if (mem_host == VM_MAP_FAILED) {
+		fprintf(stderr, "Cannot allocate memory\n");
+		return 1;
+	}
+	mem_base = vm_do_get_virtual_address(mem_host);
+
+	// One CPU per execution mode
+	powerpc_bench_cpu *cpus[NUM_MODES];
+	for (int mode = 0; mode < NUM_MODES; mode++)
+		cpus[mode] = new powerpc_bench_cpu;
+	cpus[MODE_INTERP]->enable_block_cache(false);
+#if PPC_DECODE_CACHE
+	if (decode_cache_size > 0)
+		cpus[MODE_PREDECODE]->set_decode_cache_size(decode_cache_size * 1024);
+#endif
+#if PPC_ENABLE_JIT
+	cpus[MODE_JIT]->enable_jit();
+	cpus[MODE_JIT]->set_block_profiler(bench_block_counter, bench_block_translated);
+#endif
+
+	bool ok = true;
+	for (int i = 0; i < NUM_KERNELS; i++) {
+		kernel &k = kernels[i];
+		if (k.code == NULL && file_code == NULL)
+			continue;
+		if (!selected(kernel_list, k.name))
+			continue;
+		uint32 count = uint32(k.count * scale);
+		if (count == 0)
+			count = 1;
+
+		load(k);
+		for (int mode = 0; mode < NUM_MODES; mode++)
+			cpus[mode]->invalidate_cache();
+
+		uint64 insns = k.fixed_insns + (uint64)count * k.loop_insns;
+		if (k.code == NULL)
+			insns = count_insns(cpus[MODE_JIT], k, count);
+
+		// The plain interpreter provides the reference checksum
+		run_once(cpus[MODE_INTERP], k, count);
+		uint32 ref_sum = checksum(cpus[MODE_INTERP]);
+
+		for (int mode = 0; mode < NUM_MODES; mode++) {
+			if (!selected(modes, mode_names[mode]))
+				continue;
+#if !PPC_ENABLE_JIT
+			if (mode == MODE_JIT)
+				continue;
+#endif
+			ok &= bench(cpus[mode], k, count, mode, runs, insns, ref_sum);
+		}
+	}
+
+	for (int mode = 0; mode < NUM_MODES; mode++)
+		delete cpus[mode];
+	vm_release(mem_host, BENCH_MEM_SIZE);
+	vm_exit();
+	return ok ? 0 : 1;
+}
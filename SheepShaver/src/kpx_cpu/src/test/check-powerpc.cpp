@@ -0,0 +1,1046 @@
+/*
+ *  check-powerpc.cpp - Differential testing of the PowerPC JIT compiler
+ *
+ *  Kheperix (C) 2003-2005 Gwenole Beauchesne
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+/*
+ *  Random basic blocks are run from the same initial registers and
+ *  memory through the predecoding interpreter and the dyngen translator.
+ *  Both must leave the same registers and memory behind, the first
+ *  block that does not is reduced to the smallest instruction sequence
+ *  that still diverges, and printed with a disassembly and the
+ *  differences.
+ *
+ *  Blocks are built from templates of each instruction format, like
+ *  the ones of test-powerpc.cpp, with random operands. r29-r31 are
+ *  reserved for memory accesses: r29 points to a scratch area, r30 is
+ *  a small index and every load or store is preceded by an "addi" that
+ *  sets its base register r31. Blocks end with the "return" instruction
+ *  (opcode 6). A raw big-endian code file can be checked as a whole
+ *  with -f, it must also end with "return".
+ *
+ *  Known differences are ignored unless -S (strict) is given: NaNs
+ *  only have to match as NaNs, since the host FPU does not propagate
+ *  NaN payloads the way the PowerPC does, FPSCR[FPRF] is not compared,
+ *  generated code does not compute the result class, and estimate
+ *  instructions are not generated.
+ *
+ *  Usage: check-powerpc [-n blocks] [-l insns] [-s seed] [-u units] [-e errors] [-f file] [-S] [-v]
+ */
+
+#include <vector>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+
+#include "sysdeps.h"
+#include "vm_alloc.h"
+#include "cpu/ppc/ppc-cpu.hpp"
+#include "cpu/ppc/ppc-instructions.hpp"
+
+#if ENABLE_MON
+#include "mon.h"
+#include "mon_disass.h"
+#endif
+
+// Memory layout
+static const uint32 CHECK_MEM_SIZE = 0x100000;
+static const uint32 CODE_OFFSET = 0;					// Block code
+static const uint32 SCRATCH_OFFSET = 0x80000;			// Memory accessed by the block
+static const uint32 SCRATCH_SIZE = 0x2000;
+static const uint32 MAX_CODE_SIZE = SCRATCH_OFFSET - CODE_OFFSET;
+
+// Registers reserved for memory accesses
+static const int SCRATCH_REG = 29;						// Base of scratch memory
+static const int INDEX_REG = 30;						// Index of X-form accesses
+static const int ADDR_REG = 31;							// Base of the access
+static const int NUM_FREE_GPRS = 29;
+
+static const uint32 POWERPC_RETURN = 0x18000000;
+
+static uint8 *mem_host;					// Test memory
+static uint32 mem_base;					// ... in emulated address space
+static bool strict = false;
+
+
+/*
+ *  Glue to the rest of SheepShaver, see test-powerpc.cpp
+ */
+
+uint32 ROMBase = 0x40800000;
+int64 TimebaseSpeed = 25000000;	// Default:  25 MHz
+uint32 PVR = 0x000c0000;		// Default: 7400 (with AltiVec)
+
+bool PrefsFindBool(const char *name)
+{
+	return false;
+}
+
+uint64 GetTicks_usec(void)
+{
+	return clock();
+}
+
+uint64 GetTicks_nsec(void)
+{
+	return (uint64)clock() * 1000;
+}
+
+void HandleInterrupt(powerpc_registers *)
+{
+}
+
+#if PPC_ENABLE_JIT && PPC_REENTRANT_JIT
+void init_emul_op_trampolines(basic_dyngen & dg)
+{
+}
+#endif
+
+
+/*
+ *  Instruction templates, operand fields are listed as
+ *  <kind><bit position>[:<width>]:
+ *
+ *    r  GPR, other than r29-r31	f  FPR	v  vector register
+ *    c  CR field (3 bits)			b  CR bit
+ *    i  immediate value
+ *    A  base register of a memory access (always r31)
+ *    X  index register of a memory access (always r30)
+ */
+
+struct insn_template {
+	const char *name;
+	uint32 opcode;
+	const char *fields;
+};
+
+#define OP(P)		((uint32)(P) << 26)
+#define XO(P, X)	(OP(P) | ((uint32)(X) << 1))
+#define VX(X)		(OP(4) | (uint32)(X))
+#define SPR(N)		((((N) & 0x1f) << 16) | (((N) >> 5) << 11))
+
+static const insn_template alu_insns[] = {
+	{"add", XO(31, 266), "r21 r16 r11 i10:1 i0:1"},
+	{"addc", XO(31, 10), "r21 r16 r11 i10:1 i0:1"},
+	{"adde", XO(31, 138), "r21 r16 r11 i10:1 i0:1"},
+	{"addi", OP(14), "r21 r16 i0:16"},
+	{"addic", OP(12), "r21 r16 i0:16"},
+	{"addic.", OP(13), "r21 r16 i0:16"},
+	{"addis", OP(15), "r21 r16 i0:16"},
+	{"addme", XO(31, 234), "r21 r16 i10:1 i0:1"},
+	{"addze", XO(31, 202), "r21 r16 i10:1 i0:1"},
+	{"and", XO(31, 28), "r21 r16 r11 i0:1"},
+	{"andc", XO(31, 60), "r21 r16 r11 i0:1"},
+	{"andi.", OP(28), "r21 r16 i0:16"},
+	{"andis.", OP(29), "r21 r16 i0:16"},
+	{"cmp", XO(31, 0), "c23 r16 r11"},
+	{"cmpi", OP(11), "c23 r16 i0:16"},
+	{"cmpl", XO(31, 32), "c23 r16 r11"},
+	{"cmpli", OP(10), "c23 r16 i0:16"},
+	{"cntlzw", XO(31, 26), "r21 r16 i0:1"},
+	{"crand", XO(19, 257), "b21 b16 b11"},
+	{"crandc", XO(19, 129), "b21 b16 b11"},
+	{"creqv", XO(19, 289), "b21 b16 b11"},
+	{"crnand", XO(19, 225), "b21 b16 b11"},
+	{"crnor", XO(19, 33), "b21 b16 b11"},
+	{"cror", XO(19, 449), "b21 b16 b11"},
+	{"crorc", XO(19, 417), "b21 b16 b11"},
+	{"crxor", XO(19, 193), "b21 b16 b11"},
+	{"divw", XO(31, 491), "r21 r16 r11 i10:1 i0:1"},
+	{"divwu", XO(31, 459), "r21 r16 r11 i10:1 i0:1"},
+	{"eieio", XO(31, 854), ""},
+	{"eqv", XO(31, 284), "r21 r16 r11 i0:1"},
+	{"extsb", XO(31, 954), "r21 r16 i0:1"},
+	{"extsh", XO(31, 922), "r21 r16 i0:1"},
+	{"isync", XO(19, 150), ""},
+	{"mcrf", XO(19, 0), "c23 c18"},
+	{"mcrxr", XO(31, 512), "c23"},
+	{"mfcr", XO(31, 19), "r21"},
+	{"mtcrf", XO(31, 144), "r21 i12:8"},
+	{"mulhw", XO(31, 75), "r21 r16 r11 i0:1"},
+	{"mulhwu", XO(31, 11), "r21 r16 r11 i0:1"},
+	{"mulli", OP(7), "r21 r16 i0:16"},
+	{"mullw", XO(31, 235), "r21 r16 r11 i10:1 i0:1"},
+	{"nand", XO(31, 476), "r21 r16 r11 i0:1"},
+	{"neg", XO(31, 104), "r21 r16 i10:1 i0:1"},
+	{"nor", XO(31, 124), "r21 r16 r11 i0:1"},
+	{"or", XO(31, 444), "r21 r16 r11 i0:1"},
+	{"orc", XO(31, 412), "r21 r16 r11 i0:1"},
+	{"ori", OP(24), "r21 r16 i0:16"},
+	{"oris", OP(25), "r21 r16 i0:16"},
+	{"rlwimi", OP(20), "r21 r16 i11:5 i6:5 i1:5 i0:1"},
+	{"rlwinm", OP(21), "r21 r16 i11:5 i6:5 i1:5 i0:1"},
+	{"rlwnm", OP(23), "r21 r16 r11 i6:5 i1:5 i0:1"},
+	{"slw", XO(31, 24), "r21 r16 r11 i0:1"},
+	{"sraw", XO(31, 792), "r21 r16 r11 i0:1"},
+	{"srawi", XO(31, 824), "r21 r16 i11:5 i0:1"},
+	{"srw", XO(31, 536), "r21 r16 r11 i0:1"},
+	{"subf", XO(31, 40), "r21 r16 r11 i10:1 i0:1"},
+	{"subfc", XO(31, 8), "r21 r16 r11 i10:1 i0:1"},
+	{"subfe", XO(31, 136), "r21 r16 r11 i10:1 i0:1"},
+	{"subfic", OP(8), "r21 r16 i0:16"},
+	{"subfme", XO(31, 232), "r21 r16 i10:1 i0:1"},
+	{"subfze", XO(31, 200), "r21 r16 i10:1 i0:1"},
+	{"sync", XO(31, 598), ""},
+	{"xor", XO(31, 316), "r21 r16 r11 i0:1"},
+	{"xori", OP(26), "r21 r16 i0:16"},
+	{"xoris", OP(27), "r21 r16 i0:16"},
+	{"mflr", XO(31, 339) | SPR(8), "r21"},
+	{"mfctr", XO(31, 339) | SPR(9), "r21"},
+	{"mfxer", XO(31, 339) | SPR(1), "r21"},
+	{"mtlr", XO(31, 467) | SPR(8), "r21"},
+	{"mtctr", XO(31, 467) | SPR(9), "r21"},
+	{"mtxer", XO(31, 467) | SPR(1), "r21"},
+};
+
+static const insn_template mem_insns[] = {
+	{"dcba", XO(31, 758), "A16 X11"},
+	{"dcbf", XO(31, 86), "A16 X11"},
+	{"dcbst", XO(31, 54), "A16 X11"},
+	{"dcbt", XO(31, 278), "A16 X11"},
+	{"dcbtst", XO(31, 246), "A16 X11"},
+	{"dcbz", XO(31, 1014), "A16 X11"},
+	{"lbz", OP(34), "r21 A16 i0:9"},
+	{"lbzu", OP(35), "r21 A16 i0:9"},
+	{"lbzux", XO(31, 119), "r21 A16 X11"},
+	{"lbzx", XO(31, 87), "r21 A16 X11"},
+	{"lfd", OP(50), "f21 A16 i0:9"},
+	{"lfdu", OP(51), "f21 A16 i0:9"},
+	{"lfdux", XO(31, 631), "f21 A16 X11"},
+	{"lfdx", XO(31, 599), "f21 A16 X11"},
+	{"lfs", OP(48), "f21 A16 i0:9"},
+	{"lfsu", OP(49), "f21 A16 i0:9"},
+	{"lfsux", XO(31, 567), "f21 A16 X11"},
+	{"lfsx", XO(31, 535), "f21 A16 X11"},
+	{"lha", OP(42), "r21 A16 i0:9"},
+	{"lhau", OP(43), "r21 A16 i0:9"},
+	{"lhaux", XO(31, 375), "r21 A16 X11"},
+	{"lhax", XO(31, 343), "r21 A16 X11"},
+	{"lhbrx", XO(31, 790), "r21 A16 X11"},
+	{"lhz", OP(40), "r21 A16 i0:9"},
+	{"lhzu", OP(41), "r21 A16 i0:9"},
+	{"lhzux", XO(31, 311), "r21 A16 X11"},
+	{"lhzx", XO(31, 279), "r21 A16 X11"},
+	{"lvebx", XO(31, 7), "v21 A16 X11"},
+	{"lvehx", XO(31, 39), "v21 A16 X11"},
+	{"lvewx", XO(31, 71), "v21 A16 X11"},
+	{"lvsl", XO(31, 6), "v21 A16 X11"},
+	{"lvsr", XO(31, 38), "v21 A16 X11"},
+	{"lvx", XO(31, 103), "v21 A16 X11"},
+	{"lvxl", XO(31, 359), "v21 A16 X11"},
+	{"lwarx", XO(31, 20), "r21 A16 X11"},
+	{"lwbrx", XO(31, 534), "r21 A16 X11"},
+	{"lwz", OP(32), "r21 A16 i0:9"},
+	{"lwzu", OP(33), "r21 A16 i0:9"},
+	{"lwzux", XO(31, 55), "r21 A16 X11"},
+	{"lwzx", XO(31, 23), "r21 A16 X11"},
+	{"stb", OP(38), "r21 A16 i0:9"},
+	{"stbu", OP(39), "r21 A16 i0:9"},
+	{"stbux", XO(31, 247), "r21 A16 X11"},
+	{"stbx", XO(31, 215), "r21 A16 X11"},
+	{"stfd", OP(54), "f21 A16 i0:9"},
+	{"stfdu", OP(55), "f21 A16 i0:9"},
+	{"stfdux", XO(31, 759), "f21 A16 X11"},
+	{"stfdx", XO(31, 727), "f21 A16 X11"},
+	{"stfs", OP(52), "f21 A16 i0:9"},
+	{"stfsu", OP(53), "f21 A16 i0:9"},
+	{"stfsux", XO(31, 695), "f21 A16 X11"},
+	{"stfsx", XO(31, 663), "f21 A16 X11"},
+	{"sth", OP(44), "r21 A16 i0:9"},
+	{"sthbrx", XO(31, 918), "r21 A16 X11"},
+	{"sthu", OP(45), "r21 A16 i0:9"},
+	{"sthux", XO(31, 439), "r21 A16 X11"},
+	{"sthx", XO(31, 407), "r21 A16 X11"},
+	{"stvebx", XO(31, 135), "v21 A16 X11"},
+	{"stvehx", XO(31, 167), "v21 A16 X11"},
+	{"stvewx", XO(31, 199), "v21 A16 X11"},
+	{"stvx", XO(31, 231), "v21 A16 X11"},
+	{"stvxl", XO(31, 487), "v21 A16 X11"},
+	{"stw", OP(36), "r21 A16 i0:9"},
+	{"stwbrx", XO(31, 662), "r21 A16 X11"},
+	{"stwcx.", XO(31, 150), "r21 A16 X11"},
+	{"stwu", OP(37), "r21 A16 i0:9"},
+	{"stwux", XO(31, 183), "r21 A16 X11"},
+	{"stwx", XO(31, 151), "r21 A16 X11"},
+};
+
+static const insn_template fpu_insns[] = {
+	{"fabs", XO(63, 264), "f21 f11 i0:1"},
+	{"fadd", XO(63, 21), "f21 f16 f11 i0:1"},
+	{"fadds", XO(59, 21), "f21 f16 f11 i0:1"},
+	{"fcmpo", XO(63, 32), "c23 f16 f11"},
+	{"fcmpu", XO(63, 0), "c23 f16 f11"},
+	{"fctiw", XO(63, 14), "f21 f11 i0:1"},
+	{"fctiwz", XO(63, 15), "f21 f11 i0:1"},
+	{"fdiv", XO(63, 18), "f21 f16 f11 i0:1"},
+	{"fdivs", XO(59, 18), "f21 f16 f11 i0:1"},
+	{"fmadd", XO(63, 29), "f21 f16 f11 f6 i0:1"},
+	{"fmadds", XO(59, 29), "f21 f16 f11 f6 i0:1"},
+	{"fmr", XO(63, 72), "f21 f11 i0:1"},
+	{"fmsub", XO(63, 28), "f21 f16 f11 f6 i0:1"},
+	{"fmsubs", XO(59, 28), "f21 f16 f11 f6 i0:1"},
+	{"fmul", XO(63, 25), "f21 f16 f6 i0:1"},
+	{"fmuls", XO(59, 25), "f21 f16 f6 i0:1"},
+	{"fnabs", XO(63, 136), "f21 f11 i0:1"},
+	{"fneg", XO(63, 40), "f21 f11 i0:1"},
+	{"fnmadd", XO(63, 31), "f21 f16 f11 f6 i0:1"},
+	{"fnmadds", XO(59, 31), "f21 f16 f11 f6 i0:1"},
+	{"fnmsub", XO(63, 30), "f21 f16 f11 f6 i0:1"},
+	{"fnmsubs", XO(59, 30), "f21 f16 f11 f6 i0:1"},
+	{"frsp", XO(63, 12), "f21 f11 i0:1"},
+	{"fsel", XO(63, 23), "f21 f16 f11 f6 i0:1"},
+	{"fsub", XO(63, 20), "f21 f16 f11 i0:1"},
+	{"fsubs", XO(59, 20), "f21 f16 f11 i0:1"},
+	{"mcrfs", XO(63, 64), "c23 c18"},
+	{"mffs", XO(63, 583), "f21 i0:1"},
+	{"mtfsb0", XO(63, 70), "b21 i0:1"},
+	{"mtfsb1", XO(63, 38), "b21 i0:1"},
+	{"mtfsf", XO(63, 711), "i17:8 f11 i0:1"},
+	{"mtfsfi", XO(63, 134), "c23 i12:4 i0:1"},
+};
+
+static const insn_template vmx_insns[] = {
+	{"mfvscr", VX(1540), "v21"},
+	{"mtvscr", VX(1604), "v11"},
+	{"vaddcuw", VX(384), "v21 v16 v11"},
+	{"vaddfp", VX(10), "v21 v16 v11"},
+	{"vaddsbs", VX(768), "v21 v16 v11"},
+	{"vaddshs", VX(832), "v21 v16 v11"},
+	{"vaddsws", VX(896), "v21 v16 v11"},
+	{"vaddubm", VX(0), "v21 v16 v11"},
+	{"vaddubs", VX(512), "v21 v16 v11"},
+	{"vadduhm", VX(64), "v21 v16 v11"},
+	{"vadduhs", VX(576), "v21 v16 v11"},
+	{"vadduwm", VX(128), "v21 v16 v11"},
+	{"vadduws", VX(640), "v21 v16 v11"},
+	{"vand", VX(1028), "v21 v16 v11"},
+	{"vandc", VX(1092), "v21 v16 v11"},
+	{"vavgsb", VX(1282), "v21 v16 v11"},
+	{"vavgsh", VX(1346), "v21 v16 v11"},
+	{"vavgsw", VX(1410), "v21 v16 v11"},
+	{"vavgub", VX(1026), "v21 v16 v11"},
+	{"vavguh", VX(1090), "v21 v16 v11"},
+	{"vavguw", VX(1154), "v21 v16 v11"},
+	{"vcfsx", VX(842), "v21 i16:5 v11"},
+	{"vcfux", VX(778), "v21 i16:5 v11"},
+	{"vcmpbfp", VX(966), "v21 v16 v11 i10:1"},
+	{"vcmpeqfp", VX(198), "v21 v16 v11 i10:1"},
+	{"vcmpequb", VX(6), "v21 v16 v11 i10:1"},
+	{"vcmpequh", VX(70), "v21 v16 v11 i10:1"},
+	{"vcmpequw", VX(134), "v21 v16 v11 i10:1"},
+	{"vcmpgefp", VX(454), "v21 v16 v11 i10:1"},
+	{"vcmpgtfp", VX(710), "v21 v16 v11 i10:1"},
+	{"vcmpgtsb", VX(774), "v21 v16 v11 i10:1"},
+	{"vcmpgtsh", VX(838), "v21 v16 v11 i10:1"},
+	{"vcmpgtsw", VX(902), "v21 v16 v11 i10:1"},
+	{"vcmpgtub", VX(518), "v21 v16 v11 i10:1"},
+	{"vcmpgtuh", VX(582), "v21 v16 v11 i10:1"},
+	{"vcmpgtuw", VX(646), "v21 v16 v11 i10:1"},
+	{"vctsxs", VX(970), "v21 i16:5 v11"},
+	{"vctuxs", VX(906), "v21 i16:5 v11"},
+	{"vexptefp", VX(394), "v21 v11"},
+	{"vlogefp", VX(458), "v21 v11"},
+	{"vmaddfp", VX(46), "v21 v16 v11 v6"},
+	{"vmaxfp", VX(1034), "v21 v16 v11"},
+	{"vmaxsb", VX(258), "v21 v16 v11"},
+	{"vmaxsh", VX(322), "v21 v16 v11"},
+	{"vmaxsw", VX(386), "v21 v16 v11"},
+	{"vmaxub", VX(2), "v21 v16 v11"},
+	{"vmaxuh", VX(66), "v21 v16 v11"},
+	{"vmaxuw", VX(130), "v21 v16 v11"},
+	{"vmhaddshs", VX(32), "v21 v16 v11 v6"},
+	{"vmhraddshs", VX(33), "v21 v16 v11 v6"},
+	{"vminfp", VX(1098), "v21 v16 v11"},
+	{"vminsb", VX(770), "v21 v16 v11"},
+	{"vminsh", VX(834), "v21 v16 v11"},
+	{"vminsw", VX(898), "v21 v16 v11"},
+	{"vminub", VX(514), "v21 v16 v11"},
+	{"vminuh", VX(578), "v21 v16 v11"},
+	{"vminuw", VX(642), "v21 v16 v11"},
+	{"vmladduhm", VX(34), "v21 v16 v11 v6"},
+	{"vmrghb", VX(12), "v21 v16 v11"},
+	{"vmrghh", VX(76), "v21 v16 v11"},
+	{"vmrghw", VX(140), "v21 v16 v11"},
+	{"vmrglb", VX(268), "v21 v16 v11"},
+	{"vmrglh", VX(332), "v21 v16 v11"},
+	{"vmrglw", VX(396), "v21 v16 v11"},
+	{"vmsummbm", VX(37), "v21 v16 v11 v6"},
+	{"vmsumshm", VX(40), "v21 v16 v11 v6"},
+	{"vmsumshs", VX(41), "v21 v16 v11 v6"},
+	{"vmsumubm", VX(36), "v21 v16 v11 v6"},
+	{"vmsumuhm", VX(38), "v21 v16 v11 v6"},
+	{"vmsumuhs", VX(39), "v21 v16 v11 v6"},
+	{"vmulesb", VX(776), "v21 v16 v11"},
+	{"vmulesh", VX(840), "v21 v16 v11"},
+	{"vmuleub", VX(520), "v21 v16 v11"},
+	{"vmuleuh", VX(584), "v21 v16 v11"},
+	{"vmulosb", VX(264), "v21 v16 v11"},
+	{"vmulosh", VX(328), "v21 v16 v11"},
+	{"vmuloub", VX(8), "v21 v16 v11"},
+	{"vmulouh", VX(72), "v21 v16 v11"},
+	{"vnmsubfp", VX(47), "v21 v16 v11 v6"},
+	{"vnor", VX(1284), "v21 v16 v11"},
+	{"vor", VX(1156), "v21 v16 v11"},
+	{"vperm", VX(43), "v21 v16 v11 v6"},
+	{"vpkpx", VX(782), "v21 v16 v11"},
+	{"vpkshss", VX(398), "v21 v16 v11"},
+	{"vpkshus", VX(270), "v21 v16 v11"},
+	{"vpkswss", VX(462), "v21 v16 v11"},
+	{"vpkswus", VX(334), "v21 v16 v11"},
+	{"vpkuhum", VX(14), "v21 v16 v11"},
+	{"vpkuhus", VX(142), "v21 v16 v11"},
+	{"vpkuwum", VX(78), "v21 v16 v11"},
+	{"vpkuwus", VX(206), "v21 v16 v11"},
+	{"vrefp", VX(266), "v21 v11"},
+	{"vrfim", VX(714), "v21 v11"},
+	{"vrfin", VX(522), "v21 v11"},
+	{"vrfip", VX(650), "v21 v11"},
+	{"vrfiz", VX(586), "v21 v11"},
+	{"vrlb", VX(4), "v21 v16 v11"},
+	{"vrlh", VX(68), "v21 v16 v11"},
+	{"vrlw", VX(132), "v21 v16 v11"},
+	{"vrsqrtefp", VX(330), "v21 v11"},
+	{"vsel", VX(42), "v21 v16 v11 v6"},
+	{"vsl", VX(452), "v21 v16 v11"},
+	{"vslb", VX(260), "v21 v16 v11"},
+	{"vsldoi", VX(44), "v21 v16 v11 i6:4"},
+	{"vslh", VX(324), "v21 v16 v11"},
+	{"vslo", VX(1036), "v21 v16 v11"},
+	{"vslw", VX(388), "v21 v16 v11"},
+	{"vspltb", VX(524), "v21 i16:4 v11"},
+	{"vsplth", VX(588), "v21 i16:3 v11"},
+	{"vspltisb", VX(780), "v21 i16:5"},
+	{"vspltish", VX(844), "v21 i16:5"},
+	{"vspltisw", VX(908), "v21 i16:5"},
+	{"vspltw", VX(652), "v21 i16:2 v11"},
+	{"vsr", VX(708), "v21 v16 v11"},
+	{"vsrab", VX(772), "v21 v16 v11"},
+	{"vsrah", VX(836), "v21 v16 v11"},
+	{"vsraw", VX(900), "v21 v16 v11"},
+	{"vsrb", VX(516), "v21 v16 v11"},
+	{"vsrh", VX(580), "v21 v16 v11"},
+	{"vsro", VX(1100), "v21 v16 v11"},
+	{"vsrw", VX(644), "v21 v16 v11"},
+	{"vsubcuw", VX(1408), "v21 v16 v11"},
+	{"vsubfp", VX(74), "v21 v16 v11"},
+	{"vsubsbs", VX(1792), "v21 v16 v11"},
+	{"vsubshs", VX(1856), "v21 v16 v11"},
+	{"vsubsws", VX(1920), "v21 v16 v11"},
+	{"vsububm", VX(1024), "v21 v16 v11"},
+	{"vsububs", VX(1536), "v21 v16 v11"},
+	{"vsubuhm", VX(1088), "v21 v16 v11"},
+	{"vsubuhs", VX(1600), "v21 v16 v11"},
+	{"vsubuwm", VX(1152), "v21 v16 v11"},
+	{"vsubuws", VX(1664), "v21 v16 v11"},
+	{"vsumsws", VX(1928), "v21 v16 v11"},
+	{"vsum2sws", VX(1672), "v21 v16 v11"},
+	{"vsum4sbs", VX(1800), "v21 v16 v11"},
+	{"vsum4shs", VX(1608), "v21 v16 v11"},
+	{"vsum4ubs", VX(1544), "v21 v16 v11"},
+	{"vupkhpx", VX(846), "v21 v11"},
+	{"vupkhsb", VX(526), "v21 v11"},
+	{"vupkhsh", VX(590), "v21 v11"},
+	{"vupklpx", VX(974), "v21 v11"},
+	{"vupklsb", VX(654), "v21 v11"},
+	{"vupklsh", VX(718), "v21 v11"},
+	{"vxor", VX(1220), "v21 v16 v11"},
+};
+
+#define TEMPLATES(x) x, sizeof(x) / sizeof(x[0])
+
+static const struct {
+	const char *name;
+	const insn_template *insns;
+	int count;
+	int weight;
+} units[] = {
+	{"alu", TEMPLATES(alu_insns), 4},
+	{"mem", TEMPLATES(mem_insns), 2},
+	{"fpu", TEMPLATES(fpu_insns), 2},
+	{"vmx", TEMPLATES(vmx_insns), 2}
+};
+
+static const int NUM_UNITS = sizeof(units) / sizeof(units[0]);
+
+
+/*
+ *  Pseudo-random numbers (xorshift32), so that a seed gives the same
+ *  blocks everywhere
+ */
+
+static uint32 random_state;
+
+static void seed_random(uint32 seed)
+{
+	random_state = seed * 0x9e3779b9 + 0x7f4a7c15;
+	if (random_state == 0)
+		random_state = 1;
+}
+
+static uint32 random32(void)
+{
+	random_state ^= random_state << 13;
+	random_state ^= random_state >> 17;
+	random_state ^= random_state << 5;
+	return random_state;
+}
+
+static uint32 random_below(uint32 n)
+{
+	return random32() % n;
+}
+
+
+/*
+ *  Block generation
+ */
+
+// One instruction of a block, with the "addi" setting up r31 for memory accesses
+struct block_insn {
+	uint32 setup;					// 0 if none
+	uint32 opcode;
+	const insn_template *t;
+};
+
+typedef std::vector<block_insn> block;
+
+static block_insn make_insn(const insn_template *t)
+{
+	block_insn bi;
+	bi.setup = 0;
+	bi.opcode = t->opcode;
+	bi.t = t;
+	for (const char *p = t->fields; *p; ) {
+		char kind = *p++;
+		char *end;
+		int pos = strtol(p, &end, 10);
+		int width = kind == 'c' ? 3 : 5;
+		if (*end == ':')
+			width = strtol(end + 1, &end, 10);
+		p = end;
+		while (*p == ' ')
+			p++;
+
+		uint32 v;
+		switch (kind) {
+		case 'r':
+			v = random_below(NUM_FREE_GPRS);
+			break;
+		case 'A':
+			v = ADDR_REG;
+			bi.setup = (14 << 26) | (ADDR_REG << 21) | (SCRATCH_REG << 16) | random_below(SCRATCH_SIZE / 2);
+			break;
+		case 'X':
+			v = INDEX_REG;
+			break;
+		default:
+			v = random32();
+			break;
+		}
+		bi.opcode |= (v & ((1 << width) - 1)) << pos;
+	}
+	return bi;
+}
+
+static bool unit_selected(const char *list, const char *name);
+
+// Instructions with results that may legitimately differ: estimates
+// only have a defined precision, and moves from the FPSCR would make
+// the difference in FPSCR[FPRF] visible
+static bool is_inexact(const insn_template *t)
+{
+	static const char *names[] = {
+		"fres", "frsqrte", "vexptefp", "vlogefp", "vrefp", "vrsqrtefp",
+		"mffs", "mcrfs"
+	};
+	for (size_t i = 0; i < sizeof(names) / sizeof(names[0]); i++)
+		if (strcmp(t->name, names[i]) == 0)
+			return true;
+	return false;
+}
+
+static void make_block(block &b, int max_insns, const char *unit_list)
+{
+	int total_weight = 0;
+	for (int i = 0; i < NUM_UNITS; i++)
+		if (unit_selected(unit_list, units[i].name))
+			total_weight += units[i].weight;
+
+	b.clear();
+	int n = 1 + random_below(max_insns);
+	for (int i = 0; i < n; i++) {
+		int w = random_below(total_weight);
+		int u = 0;
+		for (;; u++) {
+			if (!unit_selected(unit_list, units[u].name))
+				continue;
+			if ((w -= units[u].weight) < 0)
+				break;
+		}
+		const insn_template *t = &units[u].insns[random_below(units[u].count)];
+		if (!strict && is_inexact(t)) {
+			i--;
+			continue;
+		}
+		b.push_back(make_insn(t));
+	}
+}
+
+static int load_block(const block &b)
+{
+	int n = 0;
+	for (size_t i = 0; i < b.size(); i++) {
+		if (b[i].setup)
+			vm_write_memory_4(mem_base + CODE_OFFSET + 4 * n++, b[i].setup);
+		vm_write_memory_4(mem_base + CODE_OFFSET + 4 * n++, b[i].opcode);
+	}
+	vm_write_memory_4(mem_base + CODE_OFFSET + 4 * n++, POWERPC_RETURN);
+	return n;
+}
+
+static void print_code(int num_words, const block *b)
+{
+	int k = 0;
+	for (int i = 0; i < num_words; i++) {
+		uint32 pc = mem_base + CODE_OFFSET + i * 4;
+		uint32 opcode = vm_read_memory_4(pc);
+		printf("  %08x: %08x  ", pc, opcode);
+#if ENABLE_MON
+		disass_ppc(stdout, pc, opcode);
+#else
+		const char *name = "return";
+		if (b && k < (int)b->size()) {
+			if ((*b)[k].setup && (*b)[k].setup == opcode)
+				name = "addi";
+			else
+				name = (*b)[k++].t->name;
+		}
+		printf("%s\n", name);
+#endif
+	}
+}
+
+
+/*
+ *  Register state
+ */
+
+struct check_state {
+	uint32 gpr[32];
+	uint64 fpr[32];
+	powerpc_vr vr[32];
+	uint32 cr, xer, fpscr, vscr, lr, ctr, pc;
+};
+
+static void random_state_values(check_state &s)
+{
+	static const uint32 gpr_values[] = {
+		0, 1, 2, 0x7f, 0x80, 0xff, 0x7fff, 0x8000, 0xffff,
+		0x7fffffff, 0x80000000, 0x80000001, 0xfffffffe, 0xffffffff
+	};
+	static const uint64 fpr_values[] = {
+		UVAL64(0x0000000000000000), UVAL64(0x8000000000000000),	// +/-0
+		UVAL64(0x3ff0000000000000), UVAL64(0xbff0000000000000),	// +/-1
+		UVAL64(0x7ff0000000000000), UVAL64(0xfff0000000000000),	// +/-Inf
+		UVAL64(0x7ff8000000000000), UVAL64(0x7ff4000000000000),	// QNaN, SNaN
+		UVAL64(0x0000000000000001), UVAL64(0x800fffffffffffff),	// Denormals
+		UVAL64(0x7fefffffffffffff), UVAL64(0x3fe0000000000000),	// Max, 0.5
+		UVAL64(0x41e0000000000000), UVAL64(0xc1e0000000200000),	// 2^31, -(2^31+1)
+		UVAL64(0x3810000000000000), UVAL64(0x47efffffe0000000)	// Single min and max
+	};
+	static const int NUM_GPR_VALUES = sizeof(gpr_values) / sizeof(gpr_values[0]);
+	static const int NUM_FPR_VALUES = sizeof(fpr_values) / sizeof(fpr_values[0]);
+
+	for (int i = 0; i < 32; i++) {
+		switch (random_below(4)) {
+		case 0: s.gpr[i] = gpr_values[random_below(NUM_GPR_VALUES)]; break;
+		case 1: s.gpr[i] = (int8)random32(); break;
+		default: s.gpr[i] = random32(); break;
+		}
+	}
+	s.gpr[SCRATCH_REG] = mem_base + SCRATCH_OFFSET;
+	s.gpr[INDEX_REG] = random_below(0x100);
+
+	for (int i = 0; i < 32; i++) {
+		if (random_below(3) == 0)
+			s.fpr[i] = fpr_values[random_below(NUM_FPR_VALUES)];
+		else {
+			// Random sign and mantissa, exponent around 1.0
+			uint64 m = ((uint64)random32() << 32) | random32();
+			uint64 e = 1023 - 40 + random_below(80);
+			s.fpr[i] = (m & UVAL64(0x800fffffffffffff)) | (e << 52);
+		}
+	}
+
+	for (int i = 0; i < 32; i++) {
+		for (int j = 0; j < 4; j++) {
+			if (random_below(2) == 0)
+				s.vr[i].w[j] = random32();
+			else {
+				// Floats around 1.0 for the vector FP instructions
+				union { float f; uint32 i; } u;
+				u.f = (float)(int32)random32() / (float)(1 << (8 + random_below(16)));
+				s.vr[i].w[j] = u.i;
+			}
+		}
+	}
+
+	s.cr = random32();
+	s.xer = random32() & 0xe000007f;
+	s.fpscr = random32() & 3;		// Rounding mode only, exceptions disabled
+	s.vscr = random32() & 0x00010000;	// NJ
+	s.lr = random32();
+	s.ctr = random32();
+	s.pc = mem_base + CODE_OFFSET;
+}
+
+
+/*
+ *  CPU with the "return" instruction and access to the register state
+ */
+
+struct powerpc_check_cpu
+	: public powerpc_cpu
+{
+	powerpc_check_cpu();
+	void execute_return(uint32 opcode);
+	void set_state(const check_state &s);
+	void get_state(check_state &s);
+};
+
+powerpc_check_cpu::powerpc_check_cpu()
+{
+	static const instr_info_t return_ii = {
+		"return",
+		(execute_pmf)&powerpc_check_cpu::execute_return,
+		PPC_I(MAX),
+		D_form, 6, 0, CFLOW_JUMP
+	};
+	init_decoder_entry(&return_ii);
+}
+
+void powerpc_check_cpu::execute_return(uint32 opcode)
+{
+	spcflags().set(SPCFLAG_CPU_EXEC_RETURN);
+}
+
+void powerpc_check_cpu::set_state(const check_state &s)
+{
+	for (int i = 0; i < 32; i++) {
+		gpr(i) = s.gpr[i];
+		fpr_dw(i) = s.fpr[i];
+		vr(i) = s.vr[i];
+	}
+	cr().set(s.cr);
+	xer().set(s.xer);
+	fpscr() = s.fpscr;
+	vscr().set(s.vscr);
+	lr() = s.lr;
+	ctr() = s.ctr;
+	pc() = s.pc;
+	restore_fp_control();
+}
+
+void powerpc_check_cpu::get_state(check_state &s)
+{
+	for (int i = 0; i < 32; i++) {
+		s.gpr[i] = gpr(i);
+		s.fpr[i] = fpr_dw(i);
+		s.vr[i] = vr(i);
+	}
+	s.cr = cr().get();
+	s.xer = xer().get();
+	s.fpscr = fpscr();
+	s.vscr = vscr().get();
+	s.lr = lr();
+	s.ctr = ctr();
+	s.pc = pc();
+}
+
+
+/*
+ *  Run code from a state through the interpreter and the JIT compiler
+ */
+
+struct check_result {
+	check_state regs;
+	uint8 mem[SCRATCH_SIZE];
+};
+
+static uint8 scratch_init[SCRATCH_SIZE];
+static check_result interp_result, jit_result;
+
+static void run(powerpc_check_cpu *cpu, const check_state &init, check_result &r)
+{
+	memcpy(mem_host + SCRATCH_OFFSET, scratch_init, SCRATCH_SIZE);
+	cpu->invalidate_cache();
+	cpu->set_state(init);
+	cpu->execute(init.pc);
+	cpu->get_state(r.regs);
+	memcpy(r.mem, mem_host + SCRATCH_OFFSET, SCRATCH_SIZE);
+}
+
+static inline uint32 get_be32(const uint8 *p)
+{
+	return (p[0] << 24) | (p[1] << 16) | (p[2] << 8) | p[3];
+}
+
+static inline bool is_nan(uint64 v)
+{
+	return (v & UVAL64(0x7ff0000000000000)) == UVAL64(0x7ff0000000000000) && (v & UVAL64(0x000fffffffffffff)) != 0;
+}
+
+static inline bool is_nan(uint32 v)
+{
+	return (v & 0x7f800000) == 0x7f800000 && (v & 0x007fffff) != 0;
+}
+
+// Compare results, print differences if "verbose", returns the number of differences
+static int compare(const check_state &init, const check_result &a, const check_result &b, bool verbose)
+{
+	int diffs = 0;
+#define DIFF(NAME, FMT, INIT, A, B) do {									\
+		diffs++;															\
+		if (verbose)														\
+			printf("  %-6s initial " FMT "  interp " FMT "  jit " FMT "\n",	\
+				   NAME, INIT, A, B);										\
+	} while (0)
+
+	char name[8];
+	for (int i = 0; i < 32; i++) {
+		if (a.regs.gpr[i] != b.regs.gpr[i]) {
+			sprintf(name, "r%d", i);
+			DIFF(name, "%08x", init.gpr[i], a.regs.gpr[i], b.regs.gpr[i]);
+		}
+	}
+	for (int i = 0; i < 32; i++) {
+		uint64 x = a.regs.fpr[i], y = b.regs.fpr[i];
+		if (x != y && (strict || !is_nan(x) || !is_nan(y))) {
+			sprintf(name, "f%d", i);
+			DIFF(name, "%016llx", (unsigned long long)init.fpr[i], (unsigned long long)x, (unsigned long long)y);
+		}
+	}
+	for (int i = 0; i < 32; i++) {
+		for (int j = 0; j < 4; j++) {
+			uint32 x = a.regs.vr[i].w[j], y = b.regs.vr[i].w[j];
+			if (x != y && (strict || !is_nan(x) || !is_nan(y))) {
+				sprintf(name, "v%d.%d", i, j);
+				DIFF(name, "%08x", init.vr[i].w[j], x, y);
+			}
+		}
+	}
+	if (a.regs.cr != b.regs.cr)
+		DIFF("cr", "%08x", init.cr, a.regs.cr, b.regs.cr);
+	if (a.regs.xer != b.regs.xer)
+		DIFF("xer", "%08x", init.xer, a.regs.xer, b.regs.xer);
+	uint32 fpscr_mask = strict ? 0xffffffff : ~FPSCR_FPRF_field::mask();
+	if ((a.regs.fpscr ^ b.regs.fpscr) & fpscr_mask)
+		DIFF("fpscr", "%08x", init.fpscr, a.regs.fpscr, b.regs.fpscr);
+	if (a.regs.vscr != b.regs.vscr)
+		DIFF("vscr", "%08x", init.vscr, a.regs.vscr, b.regs.vscr);
+	if (a.regs.lr != b.regs.lr)
+		DIFF("lr", "%08x", init.lr, a.regs.lr, b.regs.lr);
+	if (a.regs.ctr != b.regs.ctr)
+		DIFF("ctr", "%08x", init.ctr, a.regs.ctr, b.regs.ctr);
+	if (a.regs.pc != b.regs.pc)
+		DIFF("pc", "%08x", init.pc, a.regs.pc, b.regs.pc);
+
+	// Memory, by words
+	for (uint32 i = 0; i < SCRATCH_SIZE; i += 4) {
+		if (memcmp(a.mem + i, b.mem + i, 4) != 0) {
+			sprintf(name, "+%04x", i);
+			DIFF(name, "%08x", get_be32(scratch_init + i), get_be32(a.mem + i), get_be32(b.mem + i));
+		}
+	}
+#undef DIFF
+	return diffs;
+}
+
+static powerpc_check_cpu *interp_cpu, *jit_cpu;
+
+static int check_code(const check_state &init, bool verbose)
+{
+	run(interp_cpu, init, interp_result);
+	run(jit_cpu, init, jit_result);
+	return compare(init, interp_result, jit_result, verbose);
+}
+
+// Remove instructions as long as the block keeps diverging
+static void reduce_block(block &b, const check_state &init)
+{
+	bool reduced;
+	do {
+		reduced = false;
+		for (size_t i = 0; i < b.size() && b.size() > 1; i++) {
+			block_insn bi = b[i];
+			b.erase(b.begin() + i);
+			load_block(b);
+			if (check_code(init, false) != 0) {
+				reduced = true;
+				i--;
+			} else
+				b.insert(b.begin() + i, bi);
+		}
+	} while (reduced);
+}
+
+
+/*
+ *  Main program
+ */
+
+static bool unit_selected(const char *list, const char *name)
+{
+	if (list == NULL)
+		return true;
+	size_t len = strlen(name);
+	for (const char *p = list; (p = strstr(p, name)) != NULL; p += len)
+		if ((p == list || p[-1] == ',') && (p[len] == 0 || p[len] == ','))
+			return true;
+	return false;
+}
+
+static void usage(const char *prg)
+{
+	fprintf(stderr, "Usage: %s [-n blocks] [-l insns] [-s seed] [-u alu,mem,fpu,vmx] [-e errors] [-f file] [-S] [-v]\n", prg);
+	exit(1);
+}
+
+int main(int argc, char *argv[])
+{
+	const char *unit_list = NULL, *file_name = NULL;
+	int num_blocks = 10000, max_insns = 16, max_errors = 10;
+	uint32 seed = time(NULL);
+	bool verbose = false;
+	int opt;
+	while ((opt = getopt(argc, argv, "n:l:s:u:e:f:Sv")) != -1) {
+		switch (opt) {
+			case 'n': num_blocks = atoi(optarg); break;
+			case 'l': max_insns = atoi(optarg); break;
+			case 's': seed = strtoul(optarg, NULL, 0); break;
+			case 'u': unit_list = optarg; break;
+			case 'e': max_errors = atoi(optarg); break;
+			case 'f': file_name = optarg; break;
+			case 'S': strict = true; break;
+			case 'v': verbose = true; break;
+			default: usage(argv[0]);
+		}
+	}
+	if (num_blocks < 1 || max_insns < 1 || max_insns > 1000)
+		usage(argv[0]);
+	bool have_unit = false;
+	for (int i = 0; i < NUM_UNITS; i++)
+		have_unit |= unit_selected(unit_list, units[i].name);
+	if (!have_unit)
+		usage(argv[0]);
+
+	// Initialize VM system (predecode cache uses vm_acquire())
+	vm_init();
+	mem_host = (uint8 *)vm_acquire(CHECK_MEM_SIZE, VM_MAP_DEFAULT | VM_MAP_32BIT);
+	if (mem_host == VM_MAP_FAILED) {
+		fprintf(stderr, "Cannot allocate memory\n");
+		return 1;
+	}
+	mem_base = vm_do_get_virtual_address(mem_host);
+
+#if ENABLE_MON
+	mon_init();
+#endif
+#if !PPC_ENABLE_JIT
+	fprintf(stderr, "The JIT compiler is not available in this build\n");
+	return 1;
+#endif
+
+	interp_cpu = new powerpc_check_cpu;
+	jit_cpu = new powerpc_check_cpu;
+#if PPC_ENABLE_JIT
+	jit_cpu->enable_jit();
+#endif
+
+	int errors = 0;
+	check_state init;
+
+	// Code file, run as a whole from random registers
+	if (file_name) {
+		FILE *f = fopen(file_name, "rb");
+		if (f == NULL) {
+			perror(file_name);
+			return 1;
+		}
+		static uint8 buf[MAX_CODE_SIZE];
+		int num_words = fread(buf, 1, sizeof(buf), f) / 4;
+		fclose(f);
+		memcpy(mem_host + CODE_OFFSET, buf, num_words * 4);
+
+		seed_random(seed);
+		random_state_values(init);
+		for (uint32 i = 0; i < SCRATCH_SIZE; i++)
+			scratch_init[i] = random32();
+		if (check_code(init, false) != 0) {
+			printf("%s diverges (seed %u):\n", file_name, seed);
+			check_code(init, true);
+			errors++;
+		}
+		printf("%s: %s\n", file_name, errors ? "FAILED" : "ok");
+	}
+
+	// Random blocks
+	uint64 num_insns = 0;
+	int n;
+	for (n = 0; !file_name && n < num_blocks && errors < max_errors; n++) {
+		uint32 block_seed = seed + n;
+		seed_random(block_seed);
+		block b;
+		make_block(b, max_insns, unit_list);
+		random_state_values(init);
+		for (uint32 i = 0; i < SCRATCH_SIZE; i++)
+			scratch_init[i] = random32();
+
+		int num_words = load_block(b);
+		num_insns += num_words;
+		if (verbose) {
+			printf("Block %d (seed %u):\n", n, block_seed);
+			print_code(num_words, &b);
+		}
+		if (check_code(init, false) == 0)
+			continue;
+
+		errors++;
+		printf("Block %d (seed %u, reproduce with -s %u -n 1) diverges:\n", n, block_seed, block_seed);
+		print_code(num_words, &b);
+		check_code(init, true);
+
+		reduce_block(b, init);
+		num_words = load_block(b);
+		printf("Reduced to:\n");
+		print_code(num_words, &b);
+		check_code(init, true);
+		printf("\n");
+		fflush(stdout);
+	}
+	if (!file_name)
+		printf("%d blocks, %llu instructions, %d diverging\n", n, (unsigned long long)num_insns, errors);
+
+	delete jit_cpu;
+	delete interp_cpu;
+	vm_release(mem_host, CHECK_MEM_SIZE);
+	vm_exit();
+	return errors ? 1 : 0;
+}
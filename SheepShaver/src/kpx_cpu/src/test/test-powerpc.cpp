@@ -210,6 +210,11 @@ uint64 GetTicks_usec(void)
 	return clock();
 }
 
+uint64 GetTicks_nsec(void)
+{
+	return (uint64)clock() * 1000;
+}
+
 void HandleInterrupt(powerpc_registers *)
 {
 }
@@ -63,6 +63,16 @@ static void sheepshaver_write_byte(uintptr adr, uint32 b)
 {
 	WriteMacInt8(adr, b);
 }
+
+static uint8 *sheepshaver_map_range(uintptr adr, uintptr size)
+{
+	// RAM and ROM are contiguous in host memory, anything else goes through sheepshaver_read_byte()
+	if (adr >= RAMBase && size <= RAMSize && adr - RAMBase <= RAMSize - size)
+		return Mac2HostAddr(adr);
+	if (adr >= ROMBase && size <= ROM_AREA_SIZE && adr - ROMBase <= ROM_AREA_SIZE - size)
+		return Mac2HostAddr(adr);
+	return NULL;
+}
 #endif
 
 
@@ -260,6 +270,7 @@ bool InitAll(const char *vmdir)
 	mon_init();
 	mon_read_byte = sheepshaver_read_byte;
 	mon_write_byte = sheepshaver_write_byte;
+	mon_map_range = sheepshaver_map_range;
 #endif
 
 	return true;
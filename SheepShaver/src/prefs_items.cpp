@@ -57,6 +57,9 @@ prefs_desc common_prefs_items[] = {
 	{"ignoreillegal", TYPE_BOOLEAN, false, "ignore illegal instructions"},
 	{"jit", TYPE_BOOLEAN, false,        "enable JIT compiler"},
 	{"jit68k", TYPE_BOOLEAN, false,     "enable 68k DR emulator"},
+	{"jitprofile", TYPE_STRING, false,  "count executions of translated blocks, write profile to file"},
+	{"decodecachesize", TYPE_INT32, false, "maximum size of the interpreter decode cache in KB (0 = default)"},
+	{"mptasks", TYPE_BOOLEAN, false,    "run Multiprocessing Services tasks on host threads"},
 	{"keyboardtype", TYPE_INT32, false, "hardware keyboard type"},
 	{NULL, TYPE_END, false, NULL} // End of list
 };
@@ -90,6 +93,8 @@ void AddPrefsDefaults(void)
 	PrefsAddBool("jit", false);
 #endif
 	PrefsAddBool("jit68k", false);
+	PrefsAddInt32("decodecachesize", 0);
+	PrefsAddBool("mptasks", false);
 
 	PrefsAddInt32("keyboardtype", 5);
 }
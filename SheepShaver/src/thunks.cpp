@@ -96,6 +96,7 @@ uint32 NativeOpcode(int selector)
 	case NATIVE_GET_NAMED_RESOURCE:
 	case NATIVE_GET_1_NAMED_RESOURCE:
   	case NATIVE_MAKE_EXECUTABLE:
+	case NATIVE_MP_TASKS:
 		opcode = POWERPC_NATIVE_OP(1, selector);
 		break;
 	default:
@@ -330,6 +330,84 @@ void TimerReset(void)
 }
 
 
+/*
+ *  Save/restore active timer tasks for snapshots (wakeup times are
+ *  stored relative to the current time)
+ */
+
+static uint32 wakeup_to_delay(tm_time_t wakeup, tm_time_t now)
+{
+	tm_time_t delay;
+	if (timer_cmp_time(wakeup, now) > 0)
+		timer_sub_time(delay, wakeup, now);
+	else
+		timer_mac2host_time(delay, 0);
+	return timer_host2mac_time(delay);
+}
+
+static tm_time_t delay_to_wakeup(uint32 mac_delay, tm_time_t now)
+{
+	tm_time_t delay, wakeup;
+	timer_mac2host_time(delay, mac_delay);
+	timer_add_time(wakeup, now, delay);
+	return wakeup;
+}
+
+void TimerSaveState(std::vector<uint32> &state)
+{
+	tm_time_t now;
+	timer_current_time(now);
+	state.clear();
+	for (TMDesc *d = tmDescList; d; d = d->next) {
+		state.push_back(d->task);
+		state.push_back(wakeup_to_delay(d->wakeup, now));
+	}
+}
+
+bool TimerRestoreState(const std::vector<uint32> &state)
+{
+	if (state.size() % 2)
+		return false;
+	TimerReset();
+	tm_time_t now;
+	timer_current_time(now);
+	for (size_t i=state.size(); i>0; i-=2) {
+		TMDesc *desc = new TMDesc;
+		desc->task = state[i - 2];
+		desc->wakeup = delay_to_wakeup(state[i - 1], now);
+		desc->next = tmDescList;
+		tmDescList = desc;
+	}
+
+#if PRECISE_TIMING
+	// Look for next task to be called and set wakeup_time
+#ifdef PRECISE_TIMING_MACH
+	semaphore_wait(wakeup_time_sem);
+	thread_suspend(timer_thread);
+#endif
+#if PRECISE_TIMING_POSIX
+	timer_thread_suspend();
+	pthread_mutex_lock(&wakeup_time_lock);
+#endif
+	wakeup_time = wakeup_time_max;
+	for (TMDesc *d = tmDescList; d; d = d->next)
+		if ((ReadMacInt16(d->task + qType) & 0x8000))
+			if (timer_cmp_time(d->wakeup, wakeup_time) < 0)
+				wakeup_time = d->wakeup;
+#ifdef PRECISE_TIMING_MACH
+	semaphore_signal(wakeup_time_sem);
+	thread_abort(timer_thread);
+	thread_resume(timer_thread);
+#endif
+#ifdef PRECISE_TIMING_POSIX
+	pthread_mutex_unlock(&wakeup_time_lock);
+	timer_thread_resume();
+#endif
+#endif
+	return true;
+}
+
+
 /*
  *  Insert timer task
  */
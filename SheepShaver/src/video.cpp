@@ -1095,3 +1095,66 @@ int16 VideoDoDriverIO(uint32 spaceID, uint32 commandID, uint32 commandContents,
 	else
 		return IOCommandIsComplete(commandID, err);
 }
+
+
+/*
+ *  Save/restore video driver state for snapshots (the video mode
+ *  itself is part of the snapshot configuration and not switched here)
+ */
+
+template <class T>
+static void save_bytes(std::vector<uint32> &state, const T &data)
+{
+	size_t pos = state.size();
+	state.resize(pos + (sizeof(data) + 3) / 4);
+	memcpy(&state[pos], &data, sizeof(data));
+}
+
+template <class T>
+static void restore_bytes(std::vector<uint32>::const_iterator &p, T &data)
+{
+	memcpy(&data, &p[0], sizeof(data));
+	p += (sizeof(data) + 3) / 4;
+}
+
+const size_t VIDEO_STATE_WORDS = 4 + (sizeof(VidLocals) + 3) / 4 + (sizeof(mac_pal) + 3) / 4 + (sizeof(MacCursor) + 3) / 4;
+
+void VideoSaveState(std::vector<uint32> &state)
+{
+	state.clear();
+	state.push_back(video_activated);
+	state.push_back(save_conf_id);
+	state.push_back(save_conf_mode);
+	state.push_back(private_data != NULL);
+	VidLocals locals;
+	memset(&locals, 0, sizeof(locals));
+	if (private_data)
+		locals = *private_data;
+	save_bytes(state, locals);
+	save_bytes(state, mac_pal);
+	save_bytes(state, MacCursor);
+}
+
+bool VideoRestoreState(const std::vector<uint32> &state)
+{
+	if (state.size() != VIDEO_STATE_WORDS)
+		return false;
+	std::vector<uint32>::const_iterator p = state.begin();
+	video_activated = p[0];
+	save_conf_id = p[1];
+	save_conf_mode = p[2];
+	bool driver_open = p[3];
+	p += 4;
+	VidLocals locals;
+	restore_bytes(p, locals);
+	if (driver_open) {
+		if (private_data == NULL)
+			private_data = new VidLocals;
+		*private_data = locals;
+	}
+	restore_bytes(p, mac_pal);
+	restore_bytes(p, MacCursor);
+
+	video_set_palette();
+	return true;
+}
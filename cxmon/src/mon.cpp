@@ -59,6 +59,8 @@ extern "C" {
 // Break points
 BREAK_POINT_SET active_break_points;
 BREAK_POINT_SET disabled_break_points;
+uint32 break_point_filter[(1 << BREAK_POINT_FILTER_BITS) / 32];
+void (*mon_break_points_changed)(void) = NULL;
 
 // Buffer we're operating on
 bool mon_use_real_mem = false;
@@ -230,28 +232,73 @@ void mon_write_byte_real(uintptr adr, uint32 b)
 	*(uint8 *)adr = b;
 }
 
+uint8 *(*mon_map_range)(uintptr adr, uintptr size);
+
+uint8 *mon_map_range_buffer(uintptr adr, uintptr size)
+{
+	uintptr ofs = adr % mon_mem_size;
+	if (size > mon_mem_size - ofs)
+		return NULL;	// Range wraps around the end of the buffer
+	return mem + ofs;
+}
+
+uint8 *mon_map_range_real(uintptr adr, uintptr size)
+{
+	return (uint8 *)adr;
+}
+
+void mon_read_block(uintptr adr, uint8 *dst, uintptr size)
+{
+	const uint8 *p = mon_map_range ? mon_map_range(adr, size) : NULL;
+	if (p)
+		memcpy(dst, p, size);
+	else {
+		while (size--)
+			*dst++ = mon_read_byte(adr++);
+	}
+}
+
+void mon_write_block(uintptr adr, const uint8 *src, uintptr size)
+{
+	uint8 *p = mon_map_range ? mon_map_range(adr, size) : NULL;
+	if (p)
+		memcpy(p, src, size);
+	else {
+		while (size--)
+			mon_write_byte(adr++, *src++);
+	}
+}
+
 uint32 mon_read_half(uintptr adr)
 {
-	return (mon_read_byte(adr) << 8) | mon_read_byte(adr+1);
+	uint8 b[2];
+	mon_read_block(adr, b, 2);
+	return (b[0] << 8) | b[1];
 }
 
 void mon_write_half(uintptr adr, uint32 w)
 {
-	mon_write_byte(adr, w >> 8);
-	mon_write_byte(adr+1, w);
+	uint8 b[2];
+	b[0] = w >> 8;
+	b[1] = w;
+	mon_write_block(adr, b, 2);
 }
 
 uint32 mon_read_word(uintptr adr)
 {
-	return (mon_read_byte(adr) << 24) | (mon_read_byte(adr+1) << 16) | (mon_read_byte(adr+2) << 8) | mon_read_byte(adr+3);
+	uint8 b[4];
+	mon_read_block(adr, b, 4);
+	return (b[0] << 24) | (b[1] << 16) | (b[2] << 8) | b[3];
 }
 
 void mon_write_word(uintptr adr, uint32 l)
 {
-	mon_write_byte(adr, l >> 24);
-	mon_write_byte(adr+1, l >> 16);
-	mon_write_byte(adr+2, l >> 8);
-	mon_write_byte(adr+3, l);
+	uint8 b[4];
+	b[0] = l >> 24;
+	b[1] = l >> 16;
+	b[2] = l >> 8;
+	b[3] = l;
+	mon_write_block(adr, b, 4);
 }
 
 
@@ -1044,6 +1091,7 @@ void mon_add_break_point(uintptr addr)
 		disabled_break_points.erase(it);
 		active_break_points.insert(addr);
 	}
+	mon_update_break_points();
 }
 
 
@@ -1084,6 +1132,23 @@ void mon_load_break_point(const char* file_path)
 	}
 
 	fclose(file);
+	mon_update_break_points();
+}
+
+
+/*
+ * Rebuild break point filter and notify the emulator
+ */
+
+void mon_update_break_points(void)
+{
+	memset(break_point_filter, 0, sizeof(break_point_filter));
+	for (BREAK_POINT_SET::iterator it = active_break_points.begin(); it != active_break_points.end(); it++) {
+		uintptr page = (*it >> BREAK_POINT_PAGE_BITS) & ((1 << BREAK_POINT_FILTER_BITS) - 1);
+		break_point_filter[page >> 5] |= 1 << (page & 31);
+	}
+	if (mon_break_points_changed)
+		mon_break_points_changed();
 }
 
 
@@ -1141,6 +1206,7 @@ void mon_init()
 
 	mon_read_byte = NULL;
 	mon_write_byte = NULL;
+	mon_map_range = NULL;
 
 	input = NULL;
 	mon_string = NULL;
@@ -1213,10 +1279,13 @@ void mon(int argc, const char **argv)
 
 	// Set up memory access functions if not supplied by the user
 	if (mon_read_byte == NULL) {
-		if (mon_use_real_mem)
+		if (mon_use_real_mem) {
 			mon_read_byte = mon_read_byte_real;
-		else
+			mon_map_range = mon_map_range_real;
+		} else {
 			mon_read_byte = mon_read_byte_buffer;
+			mon_map_range = mon_map_range_buffer;
+		}
 	}
 	if (mon_write_byte == NULL) {
 		if (mon_use_real_mem)
@@ -100,15 +100,36 @@ extern bool mon_aborted();                    // Check if Ctrl-C was pressed
 // Memory access
 extern uint32 (*mon_read_byte)(uintptr adr);
 extern void (*mon_write_byte)(uintptr adr, uint32 b);
+extern uint8 *(*mon_map_range)(uintptr adr, uintptr size);	// Optional, returns host pointer to "size" contiguous bytes at "adr" or NULL
+extern void mon_read_block(uintptr adr, uint8 *dst, uintptr size);
+extern void mon_write_block(uintptr adr, const uint8 *src, uintptr size);
 extern uint32 mon_read_half(uintptr adr);
 extern void mon_write_half(uintptr adr, uint32 w);
 extern uint32 mon_read_word(uintptr adr);
 extern void mon_write_word(uintptr adr, uint32 l);
 
+// Filter in front of active_break_points, with one bit per (hashed) page
+// that contains a break point, so most addresses are rejected by a bit test
+const int BREAK_POINT_PAGE_BITS = 12;
+const int BREAK_POINT_FILTER_BITS = 16;
+extern uint32 break_point_filter[(1 << BREAK_POINT_FILTER_BITS) / 32];
+
+static inline bool break_point_filter_test(uintptr address)
+{
+	uintptr page = (address >> BREAK_POINT_PAGE_BITS) & ((1 << BREAK_POINT_FILTER_BITS) - 1);
+	return (break_point_filter[page >> 5] >> (page & 31)) & 1;
+}
+
 // Check if break point is set
-#define IS_BREAK_POINT(address) (active_break_points.find(address) != active_break_points.end())
+#define IS_BREAK_POINT(address) (break_point_filter_test(address) && active_break_points.find(address) != active_break_points.end())
+// Check if any break point is set
+#define HAS_BREAK_POINTS() (!active_break_points.empty())
 // Add break point
 extern void mon_add_break_point(uintptr addr);
 extern void mon_load_break_point(const char* file_path);
+// Rebuild filter after changing active_break_points
+extern void mon_update_break_points(void);
+// Optional, called when the set of active break points changed
+extern void (*mon_break_points_changed)(void);
 
 #endif
@@ -112,6 +112,45 @@ start:
 }
 
 
+/*
+ *  Get pointer to "size" bytes of memory at "adr", either mapped directly
+ *  or copied to "buf"
+ */
+
+#define BLOCK_SIZE 0x10000  // Bytes per bulk memory access
+
+static const uint8 *get_block(uintptr adr, uintptr size, uint8 *buf)
+{
+	const uint8 *p = mon_map_range ? mon_map_range(adr, size) : NULL;
+	if (p)
+		return p;
+	mon_read_block(adr, buf, size);
+	return buf;
+}
+
+
+/*
+ *  Find byte string in memory block, returns NULL if not found
+ *  (memchr() and memcmp() are vectorized by the C library)
+ */
+
+static const uint8 *find_bytes(const uint8 *p, uintptr size, const uint8 *str, uintptr len)
+{
+	if (len > size)
+		return NULL;
+	const uint8 *end = p + size - len + 1;
+	while (p < end) {
+		p = (const uint8 *)memchr(p, str[0], end - p);
+		if (p == NULL)
+			return NULL;
+		if (memcmp(p + 1, str + 1, len - 1) == 0)
+			return p;
+		p++;
+	}
+	return NULL;
+}
+
+
 /*
  *  Convert character to printable character
  */
@@ -225,6 +264,7 @@ void shell_command(void)
 void memory_dump(void)
 {
 	uintptr adr, end_adr;
+	uint8 buf[MEMDUMP_BPL + 3];
 	uint8 mem[MEMDUMP_BPL + 1];
 
 	mem[MEMDUMP_BPL] = 0;
@@ -234,12 +274,14 @@ void memory_dump(void)
 
 	while (adr <= end_adr && !mon_aborted()) {
 		fprintf(monout, "%0*lx:", int(2 * sizeof(adr)), mon_use_real_mem ? adr: adr % mon_mem_size);
-		for (int i=0; i<MEMDUMP_BPL; i++, adr++) {
+		const uint8 *p = get_block(adr, MEMDUMP_BPL, buf);
+		for (int i=0; i<MEMDUMP_BPL; i++) {
 			if (i % 4 == 0)
-				fprintf(monout, " %08x", mon_read_word(adr));
-			mem[i] = char2print(mon_read_byte(adr));
+				fprintf(monout, " %08x", (p[i] << 24) | (p[i+1] << 16) | (p[i+2] << 8) | p[i+3]);
+			mem[i] = char2print(p[i]);
 		}
 		fprintf(monout, "  '%s'\n", mem);
+		adr += MEMDUMP_BPL;
 	}
 
 	mon_dot_address = adr;
@@ -256,6 +298,7 @@ void memory_dump(void)
 void ascii_dump(void)
 {
 	uintptr adr, end_adr;
+	uint8 buf[ASCIIDUMP_BPL];
 	uint8 str[ASCIIDUMP_BPL + 1];
 
 	str[ASCIIDUMP_BPL] = 0;
@@ -265,9 +308,11 @@ void ascii_dump(void)
 
 	while (adr <= end_adr && !mon_aborted()) {
 		fprintf(monout, "%0*lx:", int(2 * sizeof(adr)), mon_use_real_mem ? adr : adr % mon_mem_size);
-		for (int i=0; i<ASCIIDUMP_BPL; i++, adr++)
-			str[i] = char2print(mon_read_byte(adr));
+		const uint8 *p = get_block(adr, ASCIIDUMP_BPL, buf);
+		for (int i=0; i<ASCIIDUMP_BPL; i++)
+			str[i] = char2print(p[i]);
 		fprintf(monout, " '%s'\n", str);
+		adr += ASCIIDUMP_BPL;
 	}
 
 	mon_dot_address = adr;
@@ -356,6 +401,7 @@ void break_point_remove(void)
 
 	if (0 == index) {
 		active_break_points.clear();
+		mon_update_break_points();
 		printf("Removed all break points!\n");
 		return;
 	}
@@ -365,6 +411,7 @@ void break_point_remove(void)
 	// Remove break point
 	printf("Removed break point %4x at address %08lx\n", index, *it);
 	active_break_points.erase(it);
+	mon_update_break_points();
 }
 
 
@@ -382,6 +429,7 @@ void break_point_disable(void)
 		for (BREAK_POINT_SET::iterator it = active_break_points.begin(); it != active_break_points.end(); it++)
 			disabled_break_points.insert(*it);
 		active_break_points.clear();
+		mon_update_break_points();
 		printf("Disabled all break points!\n");
 		return;
 	}
@@ -393,6 +441,7 @@ void break_point_disable(void)
 	disabled_break_points.insert(*it);
 	// Remove break point
 	active_break_points.erase(it);
+	mon_update_break_points();
 }
 
 
@@ -409,6 +458,7 @@ void break_point_enable(void)
 	if (0 == index) {
 		active_break_points.insert(disabled_break_points.begin(), disabled_break_points.end());
 		disabled_break_points.clear();
+		mon_update_break_points();
 		printf("Enabled all break points!\n");
 		return;
 	}
@@ -420,6 +470,7 @@ void break_point_enable(void)
 	active_break_points.insert(*it);
 	// Remove break point
 	disabled_break_points.erase(it);
+	mon_update_break_points();
 }
 
 
@@ -666,7 +717,7 @@ void modify(void)
 
 void fill(void)
 {
-	uintptr adr, end_adr, len, src_adr = 0;
+	uintptr adr, end_adr, len;
 	uint8 *str;
 
 	if (!mon_expression(&adr))
@@ -675,10 +726,27 @@ void fill(void)
 		return;
 	if (!byte_string(str, len))
 		return;
+	if (len == 0 || adr > end_adr) {
+		free(str);
+		return;
+	}
 
-	while (adr <= end_adr)
-		mon_write_byte(adr++, str[src_adr++ % len]);
+	// Replicate pattern into a buffer holding a whole number of copies
+	uintptr buf_size = len > BLOCK_SIZE ? len : BLOCK_SIZE - BLOCK_SIZE % len;
+	uint8 *buf = (uint8 *)malloc(buf_size);
+	assert(buf != NULL);
+	for (uintptr i=0; i<buf_size; i++)
+		buf[i] = str[i % len];
+
+	uintptr num = end_adr - adr + 1;
+	while (num) {
+		uintptr n = num < buf_size ? num : buf_size;
+		mon_write_block(adr, buf, n);
+		adr += n;
+		num -= n;
+	}
 
+	free(buf);
 	free(str);
 }
 
@@ -691,7 +759,6 @@ void fill(void)
 void transfer(void)
 {
 	uintptr adr, end_adr, dest;
-	int num;
 
 	if (!mon_expression(&adr))
 		return;
@@ -703,17 +770,33 @@ void transfer(void)
 		mon_error("Too many arguments");
 		return;
 	}
+	if (adr > end_adr)
+		return;
 
-	num = end_adr - adr + 1;
+	// Each block is read completely before it is written, so copying
+	// in the right direction handles overlapping ranges
+	uint8 *buf = (uint8 *)malloc(BLOCK_SIZE);
+	assert(buf != NULL);
+	uintptr num = end_adr - adr + 1;
 
-	if (dest < adr)
-		for (int i=0; i<num; i++)
-			mon_write_byte(dest++, mon_read_byte(adr++));
-	else {
-		dest += end_adr - adr;
-		for (int i=0; i<num; i++)
-			mon_write_byte(dest--, mon_read_byte(end_adr--));
+	if (dest < adr) {
+		while (num) {
+			uintptr n = num < BLOCK_SIZE ? num : BLOCK_SIZE;
+			mon_read_block(adr, buf, n);
+			mon_write_block(dest, buf, n);
+			adr += n; dest += n;
+			num -= n;
+		}
+	} else {
+		while (num) {
+			uintptr n = num < BLOCK_SIZE ? num : BLOCK_SIZE;
+			num -= n;
+			mon_read_block(adr + num, buf, n);
+			mon_write_block(dest + num, buf, n);
+		}
 	}
+
+	free(buf);
 }
 
 
@@ -738,16 +821,36 @@ void compare(void)
 		return;
 	}
 
+	uint8 *buf1 = (uint8 *)malloc(BLOCK_SIZE);
+	uint8 *buf2 = (uint8 *)malloc(BLOCK_SIZE);
+	assert(buf1 != NULL && buf2 != NULL);
+
 	while (adr <= end_adr && !mon_aborted()) {
-		if (mon_read_byte(adr) != mon_read_byte(dest)) {
-			fprintf(monout, "%0*lx ", int(2 * sizeof(adr)), mon_use_real_mem ? adr : adr % mon_mem_size);
-			num++;
-			if (!(num & 7))
-				fputc('\n', monout);
+		uintptr n = end_adr - adr + 1;
+		if (n > BLOCK_SIZE)
+			n = BLOCK_SIZE;
+		const uint8 *p1 = get_block(adr, n, buf1);
+		const uint8 *p2 = get_block(dest, n, buf2);
+
+		// Only look at individual bytes if the blocks differ
+		if (memcmp(p1, p2, n) != 0) {
+			for (uintptr i=0; i<n; i++) {
+				if (p1[i] != p2[i]) {
+					fprintf(monout, "%0*lx ", int(2 * sizeof(adr)), mon_use_real_mem ? adr + i : (adr + i) % mon_mem_size);
+					num++;
+					if (!(num & 7))
+						fputc('\n', monout);
+				}
+			}
 		}
-		adr++; dest++;
+		adr += n; dest += n;
+		if (adr == 0)
+			break;	// Wrapped around
 	}
 
+	free(buf1);
+	free(buf2);
+
 	if (num & 7)
 		fputc('\n', monout);
 	fprintf(monout, "%d byte(s) different\n", num);
@@ -771,25 +874,39 @@ void hunt(void)
 		return;
 	if (!byte_string(str, len))
 		return;
+	if (len == 0) {
+		free(str);
+		mon_error("Empty search string");
+		return;
+	}
 
-	while ((adr+len-1) <= end_adr && !mon_aborted()) {
-		uint32 i;
-
-		for (i=0; i<len; i++)
-			if (mon_read_byte(adr + i) != str[i])
-				break;
+	// Scan in blocks that overlap by len-1 bytes so that no match is missed
+	uint8 *buf = (uint8 *)malloc(BLOCK_SIZE + len - 1);
+	assert(buf != NULL);
 
-		if (i == len) {
-			fprintf(monout, "%0*lx ", int(2 * sizeof(adr)), mon_use_real_mem ? adr : adr % mon_mem_size);
+	while ((adr+len-1) <= end_adr && !mon_aborted()) {
+		uintptr n = end_adr - adr + 1;
+		if (n > BLOCK_SIZE + len - 1)
+			n = BLOCK_SIZE + len - 1;
+		const uint8 *p = get_block(adr, n, buf);
+
+		const uint8 *q = p;
+		while ((q = find_bytes(q, p + n - q, str, len)) != NULL) {
+			uintptr found = adr + (q - p);
+			fprintf(monout, "%0*lx ", int(2 * sizeof(adr)), mon_use_real_mem ? found : found % mon_mem_size);
 			num++;
 			if (num == 1)
-				mon_dot_address = adr;
+				mon_dot_address = found;
 			if (!(num & 7))
 				fputc('\n', monout);
+			q++;
 		}
-		adr++;
+		adr += n - len + 1;
+		if (adr == 0)
+			break;	// Wrapped around
 	}
 
+	free(buf);
 	free(str);
 
 	if (num & 7)
@@ -807,7 +924,6 @@ void load_data(void)
 {
 	uintptr start_adr;
 	FILE *file;
-	int fc;
 
 	if (!mon_expression(&start_adr))
 		return;
@@ -829,9 +945,15 @@ void load_data(void)
 		mon_error("Unable to open file");
 	else {
 		uintptr adr = start_adr;
+		uint8 *buf = (uint8 *)malloc(BLOCK_SIZE);
+		assert(buf != NULL);
+		size_t n;
 
-		while ((fc = fgetc(file)) != EOF)
-			mon_write_byte(adr++, fc);
+		while ((n = fread(buf, 1, BLOCK_SIZE, file)) > 0) {
+			mon_write_block(adr, buf, n);
+			adr += n;
+		}
+		free(buf);
 		fclose(file);
 
 		fprintf(monerr, "%08x bytes read from %0*lx to %0*lx\n", adr - start_adr, int(2 * sizeof(adr)), mon_use_real_mem ? start_adr : start_adr % mon_mem_size, int(2 * sizeof(adr)), mon_use_real_mem ? adr-1 : (adr-1) % mon_mem_size);
@@ -872,9 +994,16 @@ void save_data(void)
 		mon_error("Unable to create file");
 	else {
 		uintptr adr = start_adr, end_adr = start_adr + size - 1;
-
-		while (adr <= end_adr)
-			fputc(mon_read_byte(adr++), file);
+		uint8 *buf = (uint8 *)malloc(BLOCK_SIZE);
+		assert(buf != NULL);
+
+		for (uintptr num = size; num; ) {
+			uintptr n = num < BLOCK_SIZE ? num : BLOCK_SIZE;
+			fwrite(get_block(adr, n, buf), 1, n, file);
+			adr += n;
+			num -= n;
+		}
+		free(buf);
 		fclose(file);
 
 		fprintf(monerr, "%08x bytes written from %0*lx to %0*lx\n", size, int(2 * sizeof(adr)), mon_use_real_mem ? start_adr : start_adr % mon_mem_size, int(2 * sizeof(adr)), mon_use_real_mem ? end_adr : end_adr % mon_mem_size);